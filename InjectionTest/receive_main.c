@@ -68,7 +68,7 @@ int main(int argc, char *argv[]) {
     printf("DroneBridge example receiver: Waiting for data\n");
     while (keep_going) {
         uint16_t radiotap_length = 0;
-        ssize_t received_bytes = recv(raw_interfaces[0].db_socket, buffer, BUFFER_SIZE, 0);
+        ssize_t received_bytes = db_recv(raw_interfaces[0].db_socket, buffer, BUFFER_SIZE);
         uint16_t payload_length = get_db_payload(buffer, received_bytes, payload_buff, &seq_num, &radiotap_length);
         int8_t rssi = get_rssi(buffer, radiotap_length);
         printf("Received raw frame with %zi bytes & %i bytes of payload (%i dBm)\n", received_bytes,
@@ -0,0 +1,105 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#include <string.h>
+#include "db_aggregator.h"
+
+/**
+ * @param agg Aggregator to init
+ * @param mtu Max. payload bytes per packet. Limited to DATA_UNI_LENGTH
+ */
+void db_agg_init(db_aggregator_t *agg, uint16_t mtu) {
+    memset(agg, 0, sizeof(db_aggregator_t));
+    agg->mtu = (mtu == 0 || mtu > DATA_UNI_LENGTH) ? DATA_UNI_LENGTH : mtu;
+}
+
+/**
+ * Append a message to the pending packet
+ *
+ * @param agg The aggregator
+ * @param data The message. Copied
+ * @param length Length of the message
+ * @param max_delay_us Deadline of the message class. The packet is due max_delay_us after now_us at the latest
+ * @param now_us db_clock_us()
+ * @return false if the message does not fit into the pending packet - send it with db_agg_take() and add again
+ */
+bool db_agg_add(db_aggregator_t *agg, const uint8_t *data, uint16_t length, uint32_t max_delay_us, uint64_t now_us) {
+    if (agg->length + length > agg->mtu && agg->length > 0) return false;
+    if (length > agg->mtu) length = agg->mtu;   // only possible for a single message larger than the MTU
+    if (agg->length == 0) {
+        agg->oldest_us = now_us;
+        agg->due_us = now_us + max_delay_us;
+    } else if (now_us + max_delay_us < agg->due_us) {
+        agg->due_us = now_us + max_delay_us;
+    }
+    memcpy(agg->data + agg->length, data, length);
+    agg->length += length;
+    return true;
+}
+
+/**
+ * @return true if the pending packet is full or its deadline expired
+ */
+bool db_agg_due(const db_aggregator_t *agg, uint64_t now_us) {
+    return agg->length > 0 && (agg->length >= agg->mtu || now_us >= agg->due_us);
+}
+
+/**
+ * Take the pending packet for sending. Its data stays valid in agg->data until the next db_agg_add()
+ *
+ * @param agg The aggregator
+ * @param now_us db_clock_us()
+ * @return Length of the packet. 0 if there is nothing pending
+ */
+uint16_t db_agg_take(db_aggregator_t *agg, uint64_t now_us) {
+    uint16_t length = agg->length;
+    if (length == 0) return 0;
+    db_agg_record(&agg->stats, length, agg->mtu, now_us - agg->oldest_us);
+    agg->length = 0;
+    return length;
+}
+
+/**
+ * @return Microseconds until the pending packet is due. -1 if nothing is pending
+ */
+long db_agg_timeout_us(const db_aggregator_t *agg, uint64_t now_us) {
+    if (agg->length == 0) return -1;
+    return agg->due_us > now_us ? (long) (agg->due_us - now_us) : 0;
+}
+
+/**
+ * Count a sent packet in the fill ratio and delay histograms
+ *
+ * @param stats Stats to update
+ * @param length Payload length of the packet
+ * @param mtu Max. payload length
+ * @param delay_us Time the oldest data inside the packet waited
+ */
+void db_agg_record(db_agg_stats_t *stats, uint16_t length, uint16_t mtu, uint64_t delay_us) {
+    static const uint32_t delay_limits_ms[DB_AGG_HIST_BINS - 1] = {1, 2, 5, 10, 20, 50, 100};
+    int fill_bin = (int) ((uint32_t) length * DB_AGG_HIST_BINS / (mtu + 1u));
+    int delay_bin = 0;
+    while (delay_bin < DB_AGG_HIST_BINS - 1 && delay_us >= delay_limits_ms[delay_bin] * 1000ull)
+        delay_bin++;
+    stats->packets++;
+    stats->bytes += length;
+    stats->fill[fill_bin < DB_AGG_HIST_BINS ? fill_bin : DB_AGG_HIST_BINS - 1]++;
+    stats->delay[delay_bin]++;
+}
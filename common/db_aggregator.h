@@ -0,0 +1,50 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#ifndef DRONEBRIDGE_DB_AGGREGATOR_H
+#define DRONEBRIDGE_DB_AGGREGATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "db_protocol.h"
+#include "shared_memory.h"
+
+/**
+ * Collects small telemetry messages into one DroneBridge packet. Every packet pays the radiotap, 802.11 and DroneBridge
+ * headers and a channel access, so tiny packets waste airtime. A packet is sent once it is full (MTU) or the deadline
+ * of the oldest message in it expired - whichever comes first. Messages are never split.
+ */
+typedef struct {
+    uint16_t mtu;
+    uint16_t length;
+    uint64_t oldest_us;     // time the first message of the pending packet was added
+    uint64_t due_us;        // pending packet has to be sent at this time at the latest
+    uint8_t data[DATA_UNI_LENGTH];
+    db_agg_stats_t stats;
+} db_aggregator_t;
+
+void db_agg_init(db_aggregator_t *agg, uint16_t mtu);
+bool db_agg_add(db_aggregator_t *agg, const uint8_t *data, uint16_t length, uint32_t max_delay_us, uint64_t now_us);
+bool db_agg_due(const db_aggregator_t *agg, uint64_t now_us);
+uint16_t db_agg_take(db_aggregator_t *agg, uint64_t now_us);
+long db_agg_timeout_us(const db_aggregator_t *agg, uint64_t now_us);
+void db_agg_record(db_agg_stats_t *stats, uint16_t length, uint16_t mtu, uint64_t delay_us);
+
+#endif //DRONEBRIDGE_DB_AGGREGATOR_H
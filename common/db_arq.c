@@ -0,0 +1,286 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#include <string.h>
+#include "db_arq.h"
+
+#define SLOT(seq) ((seq) & (DB_ARQ_WINDOW - 1))
+
+void db_arq_sender_init(db_arq_sender_t *sender) {
+    memset(sender, 0, sizeof(db_arq_sender_t));
+    sender->rto_us = DB_ARQ_INITIAL_RTO_US;
+}
+
+/**
+ * @param sender The sender
+ * @param data Payload of the frame. Copied
+ * @param length Length of the payload. Max. DB_ARQ_MAX_PAYLOAD
+ * @return false if the window is full. Try again after the next ack
+ */
+bool db_arq_queue(db_arq_sender_t *sender, const uint8_t *data, uint16_t length) {
+    if (db_arq_window_full(sender)) return false;
+    if (length > DB_ARQ_MAX_PAYLOAD) length = DB_ARQ_MAX_PAYLOAD;
+    db_arq_slot_t *slot = &sender->slots[SLOT(sender->next_seq)];
+    db_arq_data_header_t *header = (db_arq_data_header_t *) slot->frame;
+    header->magic = DB_ARQ_MAGIC;
+    header->type = DB_ARQ_TYPE_DATA;
+    header->seq = sender->next_seq;
+    memcpy(slot->frame + sizeof(db_arq_data_header_t), data, length);
+    slot->length = (uint16_t) (length + sizeof(db_arq_data_header_t));
+    slot->acked = false;
+    slot->fast = false;
+    slot->retries = 0;
+    slot->sent_us = 0;
+    sender->next_seq++;
+    sender->stats.frames++;
+    return true;
+}
+
+/**
+ * @return true if no more frames can be queued until the next ack arrives
+ */
+bool db_arq_window_full(const db_arq_sender_t *sender) {
+    return (uint16_t) (sender->next_seq - sender->base) >= DB_ARQ_WINDOW;
+}
+
+static void advance_base(db_arq_sender_t *sender) {
+    while (sender->base != sender->next_seq && sender->slots[SLOT(sender->base)].acked)
+        sender->base++;
+}
+
+/**
+ * Get the next frame to send: new frames, frames with a sent later one acknowledged and timed out frames
+ *
+ * @param sender The sender
+ * @param now_us db_clock_us()
+ * @param frame Set to the frame incl. header. Valid until the next db_arq_queue()
+ * @param length Set to the length of the frame
+ * @return false if there is nothing to send right now
+ */
+bool db_arq_next_frame(db_arq_sender_t *sender, uint64_t now_us, const uint8_t **frame, uint16_t *length) {
+    for (uint16_t seq = sender->base; seq != sender->next_seq; seq++) {
+        db_arq_slot_t *slot = &sender->slots[SLOT(seq)];
+        if (slot->acked) continue;
+        if (slot->sent_us > 0 && slot->fast) {
+            sender->stats.fast_retransmissions++;
+            slot->retries++;
+        } else if (slot->sent_us > 0) {
+            if (now_us < slot->due_us) continue;
+            if (slot->retries >= DB_ARQ_MAX_RETRIES) {
+                slot->acked = true;
+                sender->stats.given_up++;
+                advance_base(sender);
+                continue;
+            }
+            sender->stats.retransmissions++;
+            slot->retries++;
+            if (seq == sender->base)    // back off once per window - the link might be gone for a while
+                sender->rto_us = sender->rto_us * 2 > DB_ARQ_MAX_RTO_US ? DB_ARQ_MAX_RTO_US : sender->rto_us * 2;
+        }
+        slot->fast = false;
+        slot->sent_us = now_us;
+        slot->due_us = now_us + sender->rto_us;
+        ((db_arq_data_header_t *) slot->frame)->base = sender->base;
+        *frame = slot->frame;
+        *length = slot->length;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @return Microseconds until the next frame has to be sent. -1 if all frames are acknowledged
+ */
+long db_arq_timeout_us(const db_arq_sender_t *sender, uint64_t now_us) {
+    long timeout = -1;
+    for (uint16_t seq = sender->base; seq != sender->next_seq; seq++) {
+        const db_arq_slot_t *slot = &sender->slots[SLOT(seq)];
+        if (slot->acked) continue;
+        if (slot->sent_us == 0 || slot->fast || slot->due_us <= now_us) return 0;
+        if (timeout < 0 || (long) (slot->due_us - now_us) < timeout)
+            timeout = (long) (slot->due_us - now_us);
+    }
+    return timeout;
+}
+
+/**
+ * @param sender The sender
+ * @param data Received data starting with a db_arq_ack_header_t
+ * @param length Length of the received data
+ * @param now_us db_clock_us()
+ * @return 1 if the ack was processed, 0 if it was outdated, -1 if it is no valid ack
+ */
+int db_arq_process_ack(db_arq_sender_t *sender, const uint8_t *data, uint16_t length, uint64_t now_us) {
+    db_arq_ack_header_t ack;
+    if (length < sizeof(db_arq_ack_header_t)) return -1;
+    memcpy(&ack, data, sizeof(db_arq_ack_header_t));
+    if (ack.magic != DB_ARQ_MAGIC || ack.type != DB_ARQ_TYPE_ACK) return -1;
+    uint16_t in_flight = (uint16_t) (sender->next_seq - sender->base);
+    if ((uint16_t) (ack.next - sender->base) > in_flight) return 0;
+    sender->stats.acks++;
+
+    uint64_t newest_sent_us = 0, rtt_us = 0;
+    uint16_t cumulative = (uint16_t) (ack.next - sender->base);
+    for (uint16_t n = 0; n < in_flight; n++) {
+        uint16_t seq = (uint16_t) (sender->base + n);
+        uint16_t ahead = (uint16_t) (seq - ack.next);
+        bool acked = n < cumulative || (ahead >= 1 && ahead <= 32 && ((ack.bitmap >> (ahead - 1)) & 1u));
+        db_arq_slot_t *slot = &sender->slots[SLOT(seq)];
+        if (!acked || slot->acked) continue;
+        slot->acked = true;
+        if (slot->sent_us > newest_sent_us) newest_sent_us = slot->sent_us;
+        if (slot->retries == 0 && slot->sent_us > 0) rtt_us = now_us - slot->sent_us;  // only unambiguous samples
+    }
+    // frames sent before an acknowledged one are lost
+    for (uint16_t seq = sender->base; seq != sender->next_seq; seq++) {
+        db_arq_slot_t *slot = &sender->slots[SLOT(seq)];
+        if (!slot->acked && slot->sent_us > 0 && slot->sent_us < newest_sent_us)
+            slot->fast = true;
+    }
+    if (rtt_us > 0) {
+        if (sender->srtt_us == 0) {
+            sender->srtt_us = (uint32_t) rtt_us;
+            sender->rttvar_us = (uint32_t) (rtt_us / 2);
+        } else {
+            uint32_t delta = rtt_us > sender->srtt_us ? (uint32_t) (rtt_us - sender->srtt_us) :
+                             (uint32_t) (sender->srtt_us - rtt_us);
+            sender->rttvar_us = (3 * sender->rttvar_us + delta) / 4;
+            sender->srtt_us = (uint32_t) ((7 * (uint64_t) sender->srtt_us + rtt_us) / 8);
+        }
+        uint32_t rto = sender->srtt_us + 4 * sender->rttvar_us;
+        sender->rto_us = rto < DB_ARQ_MIN_RTO_US ? DB_ARQ_MIN_RTO_US : (rto > DB_ARQ_MAX_RTO_US ? DB_ARQ_MAX_RTO_US : rto);
+        sender->stats.srtt_us = sender->srtt_us;
+    }
+    advance_base(sender);
+    return 1;
+}
+
+void db_arq_receiver_init(db_arq_receiver_t *receiver) {
+    memset(receiver, 0, sizeof(db_arq_receiver_t));
+}
+
+/**
+ * @return true if the data starts with an ARQ data header
+ */
+bool db_arq_is_data(const uint8_t *data, uint16_t length) {
+    return length >= sizeof(db_arq_data_header_t) && data[0] == DB_ARQ_MAGIC && data[1] == DB_ARQ_TYPE_DATA;
+}
+
+/**
+ * Store a received frame. Get the frames that can be passed on with db_arq_deliver()
+ *
+ * @param receiver The receiver
+ * @param data Received data starting with a db_arq_data_header_t
+ * @param length Length of the received data
+ * @param now_us db_clock_us()
+ * @return 1 if the frame is new, 0 if it is a duplicate or outside the window, -1 if it is invalid
+ */
+int db_arq_receive(db_arq_receiver_t *receiver, const uint8_t *data, uint16_t length, uint64_t now_us) {
+    db_arq_data_header_t header;
+    if (!db_arq_is_data(data, length) || length - sizeof(db_arq_data_header_t) > DB_ARQ_MAX_PAYLOAD) return -1;
+    memcpy(&header, data, sizeof(db_arq_data_header_t));
+    int16_t base_ahead = (int16_t) (header.base - receiver->next);
+    if (!receiver->started || base_ahead < -DB_ARQ_WINDOW) {
+        // first frame or the sender restarted
+        memset(receiver->slots, 0, sizeof(receiver->slots));
+        receiver->started = true;
+        receiver->next = header.base;
+        receiver->skip_to = header.base;
+    } else if (base_ahead > 0 && (int16_t) (header.base - receiver->skip_to) > 0) {
+        receiver->skip_to = header.base;
+    }
+
+    int16_t ahead = (int16_t) (header.seq - receiver->next);
+    if (ahead >= DB_ARQ_WINDOW) return 0;
+    bool ack_was_pending = receiver->ack_pending;
+    receiver->ack_pending = true;
+    db_arq_rx_slot_t *slot = &receiver->slots[SLOT(header.seq)];
+    if (ahead < 0 || slot->received) {
+        receiver->stats.duplicates++;
+        receiver->ack_due_us = now_us;  // our ack got lost
+        return 0;
+    }
+    slot->received = true;
+    slot->length = (uint16_t) (length - sizeof(db_arq_data_header_t));
+    memcpy(slot->data, data + sizeof(db_arq_data_header_t), slot->length);
+    if (ahead > 0)
+        receiver->ack_due_us = now_us;  // gap: let the sender retransmit right away
+    else if (!ack_was_pending)
+        receiver->ack_due_us = now_us + DB_ARQ_ACK_DELAY_US;
+    return 1;
+}
+
+/**
+ * Get the next frame in order. Call until it returns false
+ *
+ * @param receiver The receiver
+ * @param data Set to the payload of the frame. Valid until the next db_arq_receive()
+ * @param length Set to the length of the payload
+ * @return false if the next frame has not been received yet
+ */
+bool db_arq_deliver(db_arq_receiver_t *receiver, const uint8_t **data, uint16_t *length) {
+    while (receiver->started) {
+        db_arq_rx_slot_t *slot = &receiver->slots[SLOT(receiver->next)];
+        if (slot->received) {
+            slot->received = false;
+            receiver->next++;
+            receiver->stats.frames++;
+            *data = slot->data;
+            *length = slot->length;
+            return true;
+        }
+        if ((int16_t) (receiver->skip_to - receiver->next) <= 0) break;
+        receiver->next++;   // the sender gave up on this frame
+        receiver->stats.given_up++;
+    }
+    return false;
+}
+
+/**
+ * @return true if an ack has to be sent now. Send it with the next downlink packet if there is one
+ */
+bool db_arq_ack_due(const db_arq_receiver_t *receiver, uint64_t now_us) {
+    return receiver->ack_pending && now_us >= receiver->ack_due_us;
+}
+
+/**
+ * @return Microseconds until an ack has to be sent. -1 if no ack is pending
+ */
+long db_arq_ack_timeout_us(const db_arq_receiver_t *receiver, uint64_t now_us) {
+    if (!receiver->ack_pending) return -1;
+    return receiver->ack_due_us > now_us ? (long) (receiver->ack_due_us - now_us) : 0;
+}
+
+/**
+ * @param receiver The receiver
+ * @param ack Filled with the current receive state
+ */
+void db_arq_build_ack(db_arq_receiver_t *receiver, db_arq_ack_header_t *ack) {
+    ack->magic = DB_ARQ_MAGIC;
+    ack->type = DB_ARQ_TYPE_ACK;
+    ack->next = receiver->next;
+    ack->bitmap = 0;
+    for (uint16_t n = 0; n < DB_ARQ_WINDOW - 1; n++) {
+        if (receiver->slots[SLOT(receiver->next + 1 + n)].received)
+            ack->bitmap |= 1u << n;
+    }
+    if (receiver->ack_pending) receiver->stats.acks++;
+    receiver->ack_pending = false;
+}
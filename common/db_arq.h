@@ -0,0 +1,113 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#ifndef DRONEBRIDGE_DB_ARQ_H
+#define DRONEBRIDGE_DB_ARQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "shared_memory.h"
+
+#define DB_ARQ_MAGIC            0xDA    // first byte of every ARQ header. Neither MSP ('$') nor MAVLink (0xFD, 0xFE)
+#define DB_ARQ_TYPE_DATA        0x01
+#define DB_ARQ_TYPE_ACK         0x02
+#define DB_ARQ_WINDOW           16      // max. frames in flight. Power of two, max. 32
+#define DB_ARQ_MAX_PAYLOAD      384     // max. bytes per frame. Must fit the receive buffer of the UAV control module
+#define DB_ARQ_MAX_RETRIES      8       // a frame is given up after this many retransmissions
+#define DB_ARQ_MIN_RTO_US       10000
+#define DB_ARQ_MAX_RTO_US       1000000
+#define DB_ARQ_INITIAL_RTO_US   100000
+#define DB_ARQ_ACK_DELAY_US     2000    // max. time an ack waits for a downlink packet to piggyback on
+#define DB_ARQ_MAX_BUFFERED     (DB_ARQ_WINDOW * DB_ARQ_MAX_PAYLOAD)    // max. bytes a receiver passes on at once
+
+typedef struct {
+    uint8_t magic;
+    uint8_t type;       // DB_ARQ_TYPE_DATA
+    uint16_t seq;
+    uint16_t base;      // oldest frame the sender still retransmits. The receiver skips all frames before it
+} __attribute__((packed)) db_arq_data_header_t;
+
+typedef struct {
+    uint8_t magic;
+    uint8_t type;       // DB_ARQ_TYPE_ACK
+    uint16_t next;      // all frames before this one were received
+    uint32_t bitmap;    // bit n set: frame next + 1 + n was received
+} __attribute__((packed)) db_arq_ack_header_t;
+
+typedef struct {
+    bool acked;
+    bool fast;              // retransmit right away: a frame sent later was already acknowledged
+    uint8_t retries;
+    uint16_t length;        // incl. header
+    uint64_t sent_us;       // 0 if not sent yet
+    uint64_t due_us;        // retransmission time
+    uint8_t frame[sizeof(db_arq_data_header_t) + DB_ARQ_MAX_PAYLOAD];
+} db_arq_slot_t;
+
+/**
+ * Sending side of the selective repeat ARQ. Frames are retransmitted if their ack did not arrive within the
+ * retransmission timeout (derived from the measured round trip time) or right away if a frame sent after them was
+ * acknowledged.
+ */
+typedef struct {
+    uint16_t base;          // oldest frame not acknowledged
+    uint16_t next_seq;
+    uint32_t srtt_us;       // smoothed round trip time. 0 until the first measurement
+    uint32_t rttvar_us;
+    uint32_t rto_us;
+    db_arq_slot_t slots[DB_ARQ_WINDOW];
+    db_arq_stats_t stats;
+} db_arq_sender_t;
+
+typedef struct {
+    bool received;
+    uint16_t length;
+    uint8_t data[DB_ARQ_MAX_PAYLOAD];
+} db_arq_rx_slot_t;
+
+/**
+ * Receiving side of the selective repeat ARQ. Frames are passed on in order. Frames the sender gave up on are skipped.
+ */
+typedef struct {
+    bool started;
+    uint16_t next;          // next frame to pass on
+    uint16_t skip_to;       // sender does not retransmit frames before this one anymore
+    bool ack_pending;
+    uint64_t ack_due_us;
+    db_arq_rx_slot_t slots[DB_ARQ_WINDOW];
+    db_arq_stats_t stats;
+} db_arq_receiver_t;
+
+void db_arq_sender_init(db_arq_sender_t *sender);
+bool db_arq_window_full(const db_arq_sender_t *sender);
+bool db_arq_queue(db_arq_sender_t *sender, const uint8_t *data, uint16_t length);
+bool db_arq_next_frame(db_arq_sender_t *sender, uint64_t now_us, const uint8_t **frame, uint16_t *length);
+long db_arq_timeout_us(const db_arq_sender_t *sender, uint64_t now_us);
+int db_arq_process_ack(db_arq_sender_t *sender, const uint8_t *data, uint16_t length, uint64_t now_us);
+
+void db_arq_receiver_init(db_arq_receiver_t *receiver);
+bool db_arq_is_data(const uint8_t *data, uint16_t length);
+int db_arq_receive(db_arq_receiver_t *receiver, const uint8_t *data, uint16_t length, uint64_t now_us);
+bool db_arq_deliver(db_arq_receiver_t *receiver, const uint8_t **data, uint16_t *length);
+bool db_arq_ack_due(const db_arq_receiver_t *receiver, uint64_t now_us);
+long db_arq_ack_timeout_us(const db_arq_receiver_t *receiver, uint64_t now_us);
+void db_arq_build_ack(db_arq_receiver_t *receiver, db_arq_ack_header_t *ack);
+
+#endif //DRONEBRIDGE_DB_ARQ_H
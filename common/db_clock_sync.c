@@ -0,0 +1,141 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * NTP like two-way clock offset measurement between ground station and UAV over the DroneBridge status port. The ground
+ * station sends a request carrying its send time t1. The UAV notes the receive time t2 and replies with t1, t2 and its
+ * send time t3. With the receive time t4 of the response the ground station calculates:
+ *
+ *     offset = ((t2 - t1) + (t3 - t4)) / 2     rtt = (t4 - t1) - (t3 - t2)
+ *
+ * The error of a sample is at most rtt/2, so only the sample with the lowest RTT inside a sliding window is used.
+ * All timestamps are CLOCK_MONOTONIC. On the UAV all modules therefore share the same time base.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "db_clock_sync.h"
+
+/**
+ * @return CLOCK_MONOTONIC in microseconds
+ */
+uint64_t db_clock_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/**
+ * @param payload Payload of a received DroneBridge raw frame
+ * @param payload_length Length of the payload
+ * @param message_id DB_CLOCK_SYNC_REQUEST_ID or DB_CLOCK_SYNC_RESPONSE_ID
+ * @return true if the payload is a clock sync message of the given type
+ */
+bool db_clock_sync_is_msg(const uint8_t *payload, uint16_t payload_length, uint8_t message_id) {
+    return payload_length >= sizeof(db_clock_sync_msg_t) && payload[0] == '$' && payload[1] == 'D' &&
+           payload[2] == message_id;
+}
+
+void db_clock_sync_init(db_clock_sync_t *sync) {
+    memset(sync, 0, sizeof(db_clock_sync_t));
+}
+
+/**
+ * @param sync Clock sync state
+ * @param now_us Current time (db_clock_us())
+ * @return true if a new request should be sent. Requests are sent faster until the sample window is filled
+ */
+bool db_clock_sync_request_due(db_clock_sync_t *sync, uint64_t now_us) {
+    uint64_t interval = (sync->sample_cnt < DB_CLOCK_SYNC_WINDOW) ? DB_CLOCK_SYNC_FAST_INTERVAL_MS :
+                        DB_CLOCK_SYNC_INTERVAL_MS;
+    return (now_us - sync->last_request_us) >= interval * 1000;
+}
+
+/**
+ * Write a new request into the buffer. Send it right after this call.
+ *
+ * @param sync Clock sync state
+ * @param buffer Buffer of at least sizeof(db_clock_sync_msg_t) bytes (e.g. the raw payload buffer)
+ * @return Length of the request
+ */
+uint16_t db_clock_sync_build_request(db_clock_sync_t *sync, uint8_t *buffer) {
+    db_clock_sync_msg_t *request = (db_clock_sync_msg_t *) buffer;
+    memset(request, 0, sizeof(db_clock_sync_msg_t));
+    request->ident[0] = '$';
+    request->ident[1] = 'D';
+    request->message_id = DB_CLOCK_SYNC_REQUEST_ID;
+    request->sync_id = ++sync->sync_id;
+    sync->last_request_us = db_clock_us();
+    request->t1 = sync->last_request_us;
+    return sizeof(db_clock_sync_msg_t);
+}
+
+/**
+ * Answer a request. Send the response right after this call.
+ *
+ * @param request Received request. May point into buffer
+ * @param t2 Receive time of the request (db_clock_us())
+ * @param buffer Buffer for the response of at least sizeof(db_clock_sync_msg_t) bytes
+ * @return Length of the response
+ */
+uint16_t db_clock_sync_build_response(const db_clock_sync_msg_t *request, uint64_t t2, uint8_t *buffer) {
+    db_clock_sync_msg_t response;
+    response.ident[0] = '$';
+    response.ident[1] = 'D';
+    response.message_id = DB_CLOCK_SYNC_RESPONSE_ID;
+    response.sync_id = request->sync_id;
+    response.t1 = request->t1;
+    response.t2 = t2;
+    response.t3 = db_clock_us();
+    memcpy(buffer, &response, sizeof(db_clock_sync_msg_t));
+    return sizeof(db_clock_sync_msg_t);
+}
+
+/**
+ * Process a response of the UAV. Responses to old requests or duplicates (received via multiple adapters) are ignored.
+ *
+ * @param sync Clock sync state
+ * @param response Received response
+ * @param t4 Receive time of the response (db_clock_us())
+ * @return true if the response was used as a new sample
+ */
+bool db_clock_sync_process_response(db_clock_sync_t *sync, const db_clock_sync_msg_t *response, uint64_t t4) {
+    if (response->sync_id != sync->sync_id || response->t1 != sync->last_request_us)
+        return false;
+    sync->sync_id++; // a second response to the same request must not be used
+    int64_t processing = (int64_t) (response->t3 - response->t2);
+    int64_t rtt = (int64_t) (t4 - response->t1) - processing;
+    if (rtt < 0 || processing < 0)
+        return false;
+    db_clock_sync_sample_t *sample = &sync->samples[sync->next_sample];
+    sample->offset_us = ((int64_t) (response->t2 - response->t1) + (int64_t) (response->t3 - t4)) / 2;
+    sample->rtt_us = (uint32_t) rtt;
+    sync->next_sample = (sync->next_sample + 1) % DB_CLOCK_SYNC_WINDOW;
+    if (sync->sample_cnt < DB_CLOCK_SYNC_WINDOW) sync->sample_cnt++;
+
+    db_clock_sync_sample_t *best = &sync->samples[0];
+    for (int i = 1; i < sync->sample_cnt; i++) {
+        if (sync->samples[i].rtt_us < best->rtt_us)
+            best = &sync->samples[i];
+    }
+    sync->offset_us = best->offset_us;
+    sync->rtt_us = best->rtt_us;
+    sync->synced = true;
+    return true;
+}
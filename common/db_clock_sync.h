@@ -0,0 +1,60 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#ifndef DRONEBRIDGE_DB_CLOCK_SYNC_H
+#define DRONEBRIDGE_DB_CLOCK_SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "db_protocol.h"
+
+#define DB_CLOCK_SYNC_REQUEST_ID    4
+#define DB_CLOCK_SYNC_RESPONSE_ID   5
+#define DB_CLOCK_SYNC_WINDOW        16      // offset is taken from the sample with the lowest RTT of the last n samples
+#define DB_CLOCK_SYNC_INTERVAL_MS   1000    // interval between requests once synced
+#define DB_CLOCK_SYNC_FAST_INTERVAL_MS 100  // interval between requests until the window is filled
+
+typedef struct {
+    int64_t offset_us;  // remote clock - local clock
+    uint32_t rtt_us;    // round trip time minus processing time on the remote side
+} db_clock_sync_sample_t;
+
+/**
+ * State of the requesting side (ground station)
+ */
+typedef struct {
+    db_clock_sync_sample_t samples[DB_CLOCK_SYNC_WINDOW];
+    int sample_cnt;     // valid samples in the window
+    int next_sample;
+    uint8_t sync_id;    // id of the last request
+    uint64_t last_request_us;
+    bool synced;        // offset_us is valid
+    int64_t offset_us;  // remote clock - local clock
+    uint32_t rtt_us;    // RTT of the sample the offset was taken from
+} db_clock_sync_t;
+
+uint64_t db_clock_us();
+bool db_clock_sync_is_msg(const uint8_t *payload, uint16_t payload_length, uint8_t message_id);
+void db_clock_sync_init(db_clock_sync_t *sync);
+bool db_clock_sync_request_due(db_clock_sync_t *sync, uint64_t now_us);
+uint16_t db_clock_sync_build_request(db_clock_sync_t *sync, uint8_t *buffer);
+uint16_t db_clock_sync_build_response(const db_clock_sync_msg_t *request, uint64_t t2, uint8_t *buffer);
+bool db_clock_sync_process_response(db_clock_sync_t *sync, const db_clock_sync_msg_t *response, uint64_t t4);
+
+#endif //DRONEBRIDGE_DB_CLOCK_SYNC_H
@@ -0,0 +1,280 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include "db_event.h"
+#include "db_clock_sync.h"
+#include "db_common.h"
+
+/**
+ * @param loop Loop to init
+ * @return 0 on success, -1 if epoll is not available
+ */
+int db_event_loop_init(db_event_loop_t *loop) {
+    memset(loop, 0, sizeof(db_event_loop_t));
+    for (int i = 0; i < DB_EVENT_MAX_HANDLERS; i++)
+        loop->handlers[i].fd = -1;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_EVENT: Could not create epoll instance: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static db_event_handler_t *add_handler(db_event_loop_t *loop, int type, int fd, uint32_t events, db_event_cb callback,
+                                       void *arg) {
+    for (int i = 0; i < DB_EVENT_MAX_HANDLERS; i++) {
+        db_event_handler_t *handler = &loop->handlers[i];
+        if (handler->type != DB_EVENT_FREE) continue;
+        struct epoll_event event = {.events = events, .data.ptr = handler};
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            LOG_SYS_STD(LOG_ERR, "DB_EVENT: Could not add fd %i: %s\n", fd, strerror(errno));
+            return NULL;
+        }
+        memset(handler, 0, sizeof(db_event_handler_t));
+        handler->type = type;
+        handler->fd = fd;
+        handler->events = events;
+        handler->callback = callback;
+        handler->arg = arg;
+        return handler;
+    }
+    LOG_SYS_STD(LOG_ERR, "DB_EVENT: Too many handlers (max. %i)\n", DB_EVENT_MAX_HANDLERS);
+    return NULL;
+}
+
+/**
+ * Watch a file descriptor. Add EPOLLET for edge triggered notification - the callback then has to read/write until
+ * EAGAIN.
+ *
+ * @param loop The loop
+ * @param fd File descriptor. Stays owned by the caller - remove the handler before closing it
+ * @param events EPOLLIN, EPOLLOUT, EPOLLET, ...
+ * @param callback Called with the occurred events
+ * @param arg Stored in handler->arg
+ * @return The handler or NULL on error
+ */
+db_event_handler_t *db_event_add_io(db_event_loop_t *loop, int fd, uint32_t events, db_event_cb callback, void *arg) {
+    return add_handler(loop, DB_EVENT_IO, fd, events, callback, arg);
+}
+
+/**
+ * Change the events of an I/O handler. 0 pauses the handler without removing it
+ *
+ * @return 0 on success
+ */
+int db_event_modify_io(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    if (handler->events == events) return 0;
+    struct epoll_event event = {.events = events, .data.ptr = handler};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, handler->fd, &event) < 0)
+        return -1;
+    handler->events = events;
+    return 0;
+}
+
+/**
+ * Create a timer. It is disarmed until db_event_timer_arm() is called
+ *
+ * @return The handler or NULL on error
+ */
+db_event_handler_t *db_event_add_timer(db_event_loop_t *loop, db_event_cb callback, void *arg) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_EVENT: Could not create timer: %s\n", strerror(errno));
+        return NULL;
+    }
+    db_event_handler_t *handler = add_handler(loop, DB_EVENT_TIMER, fd, EPOLLIN, callback, arg);
+    if (handler == NULL) close(fd);
+    return handler;
+}
+
+/**
+ * (Re)arm a timer. Replaces the previous setting
+ *
+ * @param handler A timer handler
+ * @param delay_us Time until the first expiration. 0 together with interval_us = 0 disarms the timer
+ * @param interval_us Period of the following expirations. 0 = one shot
+ * @return 0 on success
+ */
+int db_event_timer_arm(db_event_handler_t *handler, uint64_t delay_us, uint64_t interval_us) {
+    if (delay_us == 0 && interval_us > 0) delay_us = interval_us;
+    struct itimerspec spec = {
+            .it_value = {.tv_sec = (time_t) (delay_us / 1000000), .tv_nsec = (long) (delay_us % 1000000) * 1000},
+            .it_interval = {.tv_sec = (time_t) (interval_us / 1000000), .tv_nsec = (long) (interval_us % 1000000) * 1000}
+    };
+    if (timerfd_settime(handler->fd, 0, &spec, NULL) < 0)
+        return -1;
+    handler->due_us = delay_us > 0 ? db_clock_us() + delay_us : 0;
+    handler->interval_us = interval_us;
+    return 0;
+}
+
+/**
+ * Receive signals via the loop instead of an asynchronous signal handler. The signals get blocked for the process
+ *
+ * @param loop The loop
+ * @param signals Signal numbers (SIGINT, SIGTERM, ...)
+ * @param count Number of signals
+ * @param callback Called with the signal number
+ * @param arg Stored in handler->arg
+ * @return The handler or NULL on error
+ */
+db_event_handler_t *db_event_add_signals(db_event_loop_t *loop, const int *signals, int count, db_event_cb callback,
+                                         void *arg) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int i = 0; i < count; i++)
+        sigaddset(&mask, signals[i]);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        return NULL;
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_EVENT: Could not create signalfd: %s\n", strerror(errno));
+        return NULL;
+    }
+    db_event_handler_t *handler = add_handler(loop, DB_EVENT_SIGNAL, fd, EPOLLIN, callback, arg);
+    if (handler == NULL) close(fd);
+    return handler;
+}
+
+/**
+ * Run a function once all events of the current iteration were dispatched. Used to batch work that several events
+ * trigger (e.g. flushing a send queue once after reading all sockets)
+ *
+ * @return 0 on success, -1 if too much work is deferred already
+ */
+int db_event_defer(db_event_loop_t *loop, db_event_defer_cb callback, void *arg) {
+    for (uint32_t i = loop->deferred_head; i != loop->deferred_tail; i++) {
+        db_event_deferred_t *pending = &loop->deferred[i % DB_EVENT_MAX_DEFERRED];
+        if (pending->callback == callback && pending->arg == arg) return 0;     // already scheduled
+    }
+    if (loop->deferred_tail - loop->deferred_head >= DB_EVENT_MAX_DEFERRED) return -1;
+    loop->deferred[loop->deferred_tail % DB_EVENT_MAX_DEFERRED] = (db_event_deferred_t) {callback, arg};
+    loop->deferred_tail++;
+    return 0;
+}
+
+/**
+ * Stop watching. Timers & signal handlers close their file descriptor, I/O file descriptors stay open
+ */
+void db_event_remove(db_event_loop_t *loop, db_event_handler_t *handler) {
+    if (handler == NULL || handler->type == DB_EVENT_FREE || handler->type == DB_EVENT_REMOVED) return;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, handler->fd, NULL);
+    if (handler->type != DB_EVENT_IO) close(handler->fd);
+    handler->fd = -1;
+    handler->type = DB_EVENT_REMOVED;
+}
+
+static void dispatch(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events, uint64_t now_us) {
+    if (handler->type == DB_EVENT_IO) {
+        handler->callback(loop, handler, events);
+    } else if (handler->type == DB_EVENT_TIMER) {
+        uint64_t expirations;
+        if (read(handler->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+        if (handler->due_us > 0 && now_us > handler->due_us) {
+            uint32_t latency = (uint32_t) (now_us - handler->due_us);
+            loop->stats.timer_latency_avg_us = (loop->stats.timer_latency_avg_us * 7 + latency) / 8;
+            if (latency > loop->stats.timer_latency_max_us) loop->stats.timer_latency_max_us = latency;
+        }
+        handler->due_us = handler->interval_us > 0 ? handler->due_us + expirations * handler->interval_us : 0;
+        handler->callback(loop, handler, (uint32_t) expirations);
+    } else if (handler->type == DB_EVENT_SIGNAL) {
+        struct signalfd_siginfo info;
+        while (handler->type == DB_EVENT_SIGNAL && read(handler->fd, &info, sizeof(info)) == sizeof(info))
+            handler->callback(loop, handler, info.ssi_signo);
+    } else {
+        return;
+    }
+    loop->stats.callbacks++;
+}
+
+/**
+ * Dispatch events until db_event_stop() gets called
+ *
+ * @return 0 if stopped, -1 on error
+ */
+int db_event_run(db_event_loop_t *loop) {
+    struct epoll_event events[DB_EVENT_BATCH];
+    loop->running = true;
+    loop->stats.started_us = db_clock_us();
+    while (loop->running) {
+        int n = epoll_wait(loop->epoll_fd, events, DB_EVENT_BATCH,
+                           loop->deferred_head != loop->deferred_tail ? 0 : -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_SYS_STD(LOG_ERR, "DB_EVENT: epoll_wait failed: %s\n", strerror(errno));
+            return -1;
+        }
+        uint64_t woke_us = db_clock_us();
+        loop->stats.iterations++;
+        for (int i = 0; i < n && loop->running; i++)
+            dispatch(loop, (db_event_handler_t *) events[i].data.ptr, events[i].events, woke_us);
+        // deferred work scheduled by the deferred work itself runs in the next iteration
+        for (uint32_t end = loop->deferred_tail; loop->deferred_head != end && loop->running;) {
+            db_event_deferred_t deferred = loop->deferred[loop->deferred_head % DB_EVENT_MAX_DEFERRED];
+            loop->deferred_head++;
+            deferred.callback(loop, deferred.arg);
+            loop->stats.callbacks++;
+        }
+        for (int i = 0; i < DB_EVENT_MAX_HANDLERS; i++)
+            if (loop->handlers[i].type == DB_EVENT_REMOVED) loop->handlers[i].type = DB_EVENT_FREE;
+        uint32_t busy_us = (uint32_t) (db_clock_us() - woke_us);
+        loop->stats.busy_us += busy_us;
+        if (busy_us > loop->stats.iteration_max_us) loop->stats.iteration_max_us = busy_us;
+    }
+    return 0;
+}
+
+/**
+ * Let db_event_run() return after the current callback
+ */
+void db_event_stop(db_event_loop_t *loop) {
+    loop->running = false;
+}
+
+/**
+ * Log how busy the loop was and how precise its timers fired
+ */
+void db_event_report(const db_event_loop_t *loop, const char *module_tag) {
+    uint64_t runtime_us = db_clock_us() - loop->stats.started_us;
+    if (loop->stats.iterations == 0 || runtime_us == 0) return;
+    LOG_SYS_STD(LOG_NOTICE, "%s: Event loop: %llu wake ups, %llu callbacks, %.2f %% busy, max. %u us per wake up, "
+                            "timer latency avg. %u us max. %u us\n", module_tag,
+                (unsigned long long) loop->stats.iterations, (unsigned long long) loop->stats.callbacks,
+                100.0 * (double) loop->stats.busy_us / (double) runtime_us, loop->stats.iteration_max_us,
+                loop->stats.timer_latency_avg_us, loop->stats.timer_latency_max_us);
+}
+
+/**
+ * Remove all handlers and close the epoll instance. I/O file descriptors stay open
+ */
+void db_event_loop_close(db_event_loop_t *loop) {
+    for (int i = 0; i < DB_EVENT_MAX_HANDLERS; i++)
+        db_event_remove(loop, &loop->handlers[i]);
+    close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+}
@@ -0,0 +1,105 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#ifndef DRONEBRIDGE_DB_EVENT_H
+#define DRONEBRIDGE_DB_EVENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/epoll.h>
+
+#define DB_EVENT_MAX_HANDLERS   64
+#define DB_EVENT_MAX_DEFERRED   32
+#define DB_EVENT_BATCH          16      // events taken from the kernel per epoll_wait()
+
+typedef struct db_event_loop db_event_loop_t;
+typedef struct db_event_handler db_event_handler_t;
+
+/**
+ * @param loop The loop the handler belongs to
+ * @param handler The handler. handler->arg is the pointer passed on registration
+ * @param events I/O: epoll events (EPOLLIN, EPOLLOUT, EPOLLHUP, ...). Timer: number of expirations since the last
+ * call. Signal: signal number
+ */
+typedef void (*db_event_cb)(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events);
+typedef void (*db_event_defer_cb)(db_event_loop_t *loop, void *arg);
+
+enum {
+    DB_EVENT_FREE,
+    DB_EVENT_REMOVED,   // removed during the current batch. Pending events of it are ignored
+    DB_EVENT_IO,
+    DB_EVENT_TIMER,
+    DB_EVENT_SIGNAL
+};
+
+struct db_event_handler {
+    int type;
+    int fd;                 // I/O: owned by the caller. Timer & signal: timerfd/signalfd owned by the loop
+    uint32_t events;
+    db_event_cb callback;
+    void *arg;
+    uint64_t due_us;        // timer: next expiration (db_clock_us()). 0 = disarmed
+    uint64_t interval_us;   // timer: period. 0 = one shot
+};
+
+typedef struct {
+    db_event_defer_cb callback;
+    void *arg;
+} db_event_deferred_t;
+
+typedef struct {
+    uint64_t started_us;
+    uint64_t iterations;            // wake ups
+    uint64_t callbacks;             // I/O, timer, signal & deferred callbacks run
+    uint64_t busy_us;               // time spent between wake up and the next wait
+    uint32_t iteration_max_us;
+    uint32_t timer_latency_avg_us;  // expiration -> callback. Exponential moving average
+    uint32_t timer_latency_max_us;
+} db_event_stats_t;
+
+/**
+ * Event loop based on epoll. Timers are timerfds (CLOCK_MONOTONIC), signals are delivered via a signalfd, so every
+ * source is a file descriptor and the loop sleeps in exactly one epoll_wait(). Handlers are registered once - nothing
+ * gets rebuilt per iteration. Deferred work runs after all events of an iteration were dispatched.
+ */
+struct db_event_loop {
+    int epoll_fd;
+    bool running;
+    db_event_handler_t handlers[DB_EVENT_MAX_HANDLERS];
+    db_event_deferred_t deferred[DB_EVENT_MAX_DEFERRED];
+    uint32_t deferred_head, deferred_tail;
+    db_event_stats_t stats;
+};
+
+int db_event_loop_init(db_event_loop_t *loop);
+db_event_handler_t *db_event_add_io(db_event_loop_t *loop, int fd, uint32_t events, db_event_cb callback, void *arg);
+int db_event_modify_io(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events);
+db_event_handler_t *db_event_add_timer(db_event_loop_t *loop, db_event_cb callback, void *arg);
+int db_event_timer_arm(db_event_handler_t *handler, uint64_t delay_us, uint64_t interval_us);
+db_event_handler_t *db_event_add_signals(db_event_loop_t *loop, const int *signals, int count, db_event_cb callback,
+                                         void *arg);
+int db_event_defer(db_event_loop_t *loop, db_event_defer_cb callback, void *arg);
+void db_event_remove(db_event_loop_t *loop, db_event_handler_t *handler);
+int db_event_run(db_event_loop_t *loop);
+void db_event_stop(db_event_loop_t *loop);
+void db_event_report(const db_event_loop_t *loop, const char *module_tag);
+void db_event_loop_close(db_event_loop_t *loop);
+
+#endif //DRONEBRIDGE_DB_EVENT_H
@@ -0,0 +1,231 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * Client side of the link daemon (see link/link_main.c) and the ring shared with it.
+ *
+ * Without the daemon every module opens one AF_PACKET socket per port and adapter. The kernel clones each received
+ * frame into every one of these sockets and runs every BPF filter on it. With the daemon there is only one receiving
+ * socket per adapter. The daemon sorts the frames by port and puts them into one shared memory ring per registered
+ * client socket. An eventfd per client signals new frames, so it can be watched with epoll like a socket.
+ * Frames in the ring are complete raw frames (radiotap header + DB raw header + payload) just as returned by recv().
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "db_link.h"
+#include "db_common.h"
+
+typedef struct {
+    int event_fd;
+    int control_fd;
+    db_link_ring_t *ring;
+} db_link_client_t;
+
+static db_link_client_t link_clients[DB_LINK_MAX_CLIENTS];
+static int num_link_clients = 0;
+
+/**
+ * @param if_name Interface served by the daemon
+ * @param path Filled with the path of the control socket of the daemon for that interface
+ * @param path_length Size of path
+ */
+void db_link_socket_path(const char *if_name, char *path, size_t path_length) {
+    snprintf(path, path_length, "%s/%s", DB_LINK_DIR, if_name);
+}
+
+/**
+ * Daemon side: Put a received frame into the ring of a client
+ *
+ * @return 0 on success, -1 if the ring is full or the frame too long (frame is dropped)
+ */
+int db_link_ring_push(db_link_ring_t *ring, const uint8_t *frame, uint16_t length, uint64_t rx_time_us) {
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= DB_LINK_RING_SLOTS || length > DB_LINK_MAX_FRAME) {
+        ring->dropped++;
+        return -1;
+    }
+    db_link_slot_t *slot = &ring->slots[head & (DB_LINK_RING_SLOTS - 1)];
+    memcpy(slot->frame, frame, length);
+    slot->length = length;
+    slot->rx_time_us = rx_time_us;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static db_link_client_t *get_client(int event_fd) {
+    for (int i = 0; i < num_link_clients; i++) {
+        if (link_clients[i].event_fd == event_fd)
+            return &link_clients[i];
+    }
+    return NULL;
+}
+
+/**
+ * Register a socket with the link daemon of an interface. Replaces the receiving part of an AF_PACKET socket.
+ *
+ * @param if_name Interface the daemon was started on (same string as passed to the daemon)
+ * @param comm_id The communication ID
+ * @param recv_direction Direction of frames the client wants to receive
+ * @param port DroneBridge port the client wants to receive frames for
+ * @return An eventfd that becomes readable when frames can be read using db_link_recv() or -1 on failure
+ */
+int db_link_open(const char *if_name, uint8_t comm_id, uint8_t recv_direction, uint8_t port) {
+    if (num_link_clients >= DB_LINK_MAX_CLIENTS) {
+        LOG_SYS_STD(LOG_ERR, "DB_LINK: Too many link sockets in this process\n");
+        return -1;
+    }
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    db_link_socket_path(if_name, addr.sun_path, sizeof(addr.sun_path));
+    int control_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (control_fd < 0 || connect(control_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_LINK: Could not connect to link daemon at %s: %s\n", addr.sun_path,
+                    strerror(errno));
+        goto error;
+    }
+    db_link_register_t reg = {.comm_id = comm_id, .recv_direction = recv_direction, .port = port};
+    if (send(control_fd, &reg, sizeof(reg), 0) != sizeof(reg))
+        goto error;
+
+    // reply: status byte + memfd of the ring + eventfd
+    int8_t status = -1;
+    int fds[2];
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {.iov_base = &status, .iov_len = sizeof(status)};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+    if (recvmsg(control_fd, &msg, 0) <= 0 || status != 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_LINK: Link daemon at %s refused registration\n", addr.sun_path);
+        goto error;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+        goto error;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    db_link_ring_t *ring = mmap(NULL, sizeof(db_link_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (ring == MAP_FAILED) {
+        LOG_SYS_STD(LOG_ERR, "DB_LINK: Could not map ring: %s\n", strerror(errno));
+        close(fds[1]);
+        goto error;
+    }
+    link_clients[num_link_clients].event_fd = fds[1];
+    link_clients[num_link_clients].control_fd = control_fd;   // kept open. Daemon frees the ring once it is closed
+    link_clients[num_link_clients].ring = ring;
+    num_link_clients++;
+    LOG_SYS_STD(LOG_INFO, "DB_LINK: Receiving port %i via link daemon of %s\n", port, if_name);
+    return fds[1];
+
+    error:
+    if (control_fd >= 0) close(control_fd);
+    return -1;
+}
+
+/**
+ * Unregister a socket from the link daemon. The daemon frees the ring once the control socket is closed.
+ *
+ * @param event_fd File descriptor returned by db_link_open()
+ * @return 0 on success, -1 if the file descriptor was not returned by db_link_open()
+ */
+int db_link_close(int event_fd) {
+    db_link_client_t *client = get_client(event_fd);
+    if (client == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    munmap(client->ring, sizeof(db_link_ring_t));
+    close(client->control_fd);
+    close(client->event_fd);
+    *client = link_clients[--num_link_clients];
+    return 0;
+}
+
+/**
+ * @return 1 if the file descriptor was returned by db_link_open()
+ */
+int db_link_is_client(int event_fd) {
+    return get_client(event_fd) != NULL;
+}
+
+/**
+ * Read the next frame from the ring. Never blocks: an empty ring returns -1 with errno EAGAIN like a non-blocking
+ * socket does. That happens after a spurious wake up - the daemon signals the eventfd after pushing a batch, so the
+ * frame that raised the event may already be taken. The eventfd stays readable as long as there are frames left in
+ * the ring.
+ *
+ * @param event_fd File descriptor returned by db_link_open()
+ * @param buffer Buffer for the frame. Frames longer than the buffer get truncated
+ * @param buffer_length Size of buffer
+ * @return Length of the frame or -1 on error (EAGAIN: no frame available)
+ */
+ssize_t db_link_recv(int event_fd, uint8_t *buffer, size_t buffer_length) {
+    return db_link_recv_ts(event_fd, buffer, buffer_length, NULL);
+}
+
+/**
+ * Same as db_link_recv() but also returns the time the daemon received the frame
+ *
+ * @param rx_time_us Filled with the arrival time of the frame at the daemon (db_clock_us() time base). May be NULL
+ */
+ssize_t db_link_recv_ts(int event_fd, uint8_t *buffer, size_t buffer_length, uint64_t *rx_time_us) {
+    db_link_client_t *client = get_client(event_fd);
+    if (client == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    db_link_ring_t *ring = client->ring;
+    uint64_t event_cnt;
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        // clear the stale event so that the caller is only woken again once the daemon pushed something new
+        if (read(event_fd, &event_cnt, sizeof(event_cnt)) < 0 && errno != EAGAIN)
+            return -1;
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    db_link_slot_t *slot = &ring->slots[tail & (DB_LINK_RING_SLOTS - 1)];
+    size_t length = slot->length < buffer_length ? slot->length : buffer_length;
+    memcpy(buffer, slot->frame, length);
+    if (rx_time_us != NULL)
+        *rx_time_us = slot->rx_time_us;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    if (tail + 1 == head) {
+        // ring drained: clear the eventfd. Re-arm it if the daemon pushed a frame in the meantime
+        if (read(event_fd, &event_cnt, sizeof(event_cnt)) > 0 &&
+            __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != tail + 1) {
+            event_cnt = 1;
+            if (write(event_fd, &event_cnt, sizeof(event_cnt)) < 0)
+                LOG_SYS_STD(LOG_ERR, "DB_LINK: Could not re-arm the event of a link socket: %s\n", strerror(errno));
+        }
+    }
+    return (ssize_t) length;
+}
@@ -0,0 +1,70 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#ifndef DRONEBRIDGE_DB_LINK_H
+#define DRONEBRIDGE_DB_LINK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "db_protocol.h"
+
+#define DB_LINK_PREFIX          "link:"         // link:<interface> receives via the link daemon (db_link)
+#define DB_LINK_DIR             "/tmp/db_link"  // one unix control socket per interface served by the daemon
+#define DB_LINK_MAX_CLIENTS     16              // per interface (daemon) and per process (client)
+#define DB_LINK_RING_SLOTS      256             // must be a power of two
+#define DB_LINK_MAX_FRAME       (MAX_DB_DATA_LENGTH + 64) // received radiotap headers are longer than the sent ones
+
+typedef struct {
+    uint16_t length;
+    uint64_t rx_time_us;    // arrival time at the daemon (db_clock_us() time base, kernel timestamp if available)
+    uint8_t frame[DB_LINK_MAX_FRAME];
+} db_link_slot_t;
+
+/**
+ * Single producer (daemon) single consumer (module) ring of received frames. Shared via memfd. Head and tail are free
+ * running counters and live on separate cache lines.
+ */
+typedef struct {
+    uint32_t head;          // written by the daemon
+    uint8_t pad_head[60];
+    uint32_t tail;          // written by the client
+    uint8_t pad_tail[60];
+    uint32_t dropped;       // frames the daemon dropped because the ring was full
+    db_link_slot_t slots[DB_LINK_RING_SLOTS];
+} db_link_ring_t;
+
+/**
+ * First and only message a client sends on the control socket. The daemon replies with the ring (memfd) and the
+ * eventfd that gets signaled when new frames are in the ring.
+ */
+typedef struct {
+    uint8_t comm_id;
+    uint8_t recv_direction;
+    uint8_t port;
+} __attribute__((packed)) db_link_register_t;
+
+void db_link_socket_path(const char *if_name, char *path, size_t path_length);
+int db_link_ring_push(db_link_ring_t *ring, const uint8_t *frame, uint16_t length, uint64_t rx_time_us);
+int db_link_open(const char *if_name, uint8_t comm_id, uint8_t recv_direction, uint8_t port);
+int db_link_close(int event_fd);
+int db_link_is_client(int event_fd);
+ssize_t db_link_recv(int event_fd, uint8_t *buffer, size_t buffer_length);
+ssize_t db_link_recv_ts(int event_fd, uint8_t *buffer, size_t buffer_length, uint64_t *rx_time_us);
+
+#endif //DRONEBRIDGE_DB_LINK_H
@@ -0,0 +1,520 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+/**
+ * MAVLink router of the air side. The control module owns the flight controller port and the raw link, additional
+ * serial ports and local UDP/unix sockets are opened here. Every frame is split off the byte stream once (see
+ * db_serial_stream.c) and written to the destination endpoints as is - no extra router process, no extra copies.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include "db_mav_router.h"
+#include "db_mav_sched.h"
+#include "db_common.h"
+#include "db_clock_sync.h"
+#include "mavlink/c_library_v2/common/mavlink.h"
+
+#define MAVLINK_V1_MAGIC            0xFE
+#define MAVLINK_V2_MAGIC            0xFD
+#define MAVLINK_V1_HEADER_LENGTH    6
+#define MAVLINK_V2_HEADER_LENGTH    10
+#define SERIAL_REOPEN_INTERVAL_US   2000000
+#define UDP_READ_BUF_SIZE           2048
+
+/**
+ * @param router Router to init. No endpoints
+ * @param deliver Called with every frame for an external endpoint
+ * @param arg Passed on to deliver
+ */
+void db_mav_router_init(db_mav_router_t *router, db_mav_router_cb deliver, void *arg) {
+    memset(router, 0, sizeof(db_mav_router_t));
+    router->deliver = deliver;
+    router->deliver_arg = arg;
+}
+
+static db_mav_endpoint_t *new_endpoint(db_mav_router_t *router, int type, const char *name) {
+    if (router->endpoint_cnt >= DB_MAV_ROUTER_MAX_ENDPOINTS) {
+        LOG_SYS_STD(LOG_ERR, "DB_MAV_ROUTER: Max. %i endpoints supported\n", DB_MAV_ROUTER_MAX_ENDPOINTS);
+        return NULL;
+    }
+    db_mav_endpoint_t *ep = &router->endpoints[router->endpoint_cnt];
+    memset(ep, 0, sizeof(db_mav_endpoint_t));
+    ep->type = type;
+    ep->fd = -1;
+    strncpy(ep->name, name, sizeof(ep->name) - 1);
+    db_serial_stream_init(&ep->stream, DB_SERIAL_STREAM_MAVLINK);
+    db_serial_writer_init(&ep->writer, -1, 115200);
+    return ep;
+}
+
+/**
+ * Endpoint that is served by the module itself, e.g. the flight controller port or the downlink to the ground station.
+ * Frames from it are passed to db_mav_router_route(), frames for it arrive at the deliver callback.
+ *
+ * @return Index of the endpoint or -1 if there are too many
+ */
+int db_mav_router_add_external(db_mav_router_t *router, const char *name) {
+    if (new_endpoint(router, DB_MAV_EP_EXTERNAL, name) == NULL) return -1;
+    return router->endpoint_cnt++;
+}
+
+static speed_t baud_to_speed(int baud_rate) {
+    switch (baud_rate) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 500000: return B500000;
+        case 921600: return B921600;
+        case 1500000: return B1500000;
+        default: return B115200;
+    }
+}
+
+static int open_serial(db_mav_endpoint_t *ep) {
+    const char *device = ep->name + strlen(DB_MAV_ROUTER_SERIAL_PREFIX);
+    int fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        LOG_SYS_STD(LOG_WARNING, "DB_MAV_ROUTER: Could not open %s: %s\n", device, strerror(errno));
+        return -1;
+    }
+    struct termios options;
+    tcgetattr(fd, &options);
+    options.c_iflag &= ~(IGNBRK | BRKINT | ICRNL | INLCR | PARMRK | INPCK | ISTRIP | IXON);
+    options.c_oflag &= ~(OCRNL | ONLCR | ONLRET | ONOCR | OFILL | OPOST);
+    options.c_lflag &= ~(ECHO | ECHONL | ICANON | IEXTEN | ISIG);
+    options.c_cflag &= ~(CSIZE | PARENB);
+    options.c_cflag |= CS8;
+    cfsetispeed(&options, baud_to_speed(ep->baud_rate));
+    cfsetospeed(&options, baud_to_speed(ep->baud_rate));
+    tcflush(fd, TCIFLUSH);
+    tcsetattr(fd, TCSANOW, &options);
+    ep->fd = fd;
+    db_serial_writer_init(&ep->writer, fd, ep->baud_rate);
+    LOG_SYS_STD(LOG_INFO, "DB_MAV_ROUTER: Opened %s with %i baud\n", device, ep->baud_rate);
+    return fd;
+}
+
+static int open_udp(db_mav_endpoint_t *ep, const char *address) {
+    struct sockaddr_in bind_addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY)};
+    if (ep->type == DB_MAV_EP_UDP) {
+        char ip[INET_ADDRSTRLEN] = "";
+        const char *colon = strrchr(address, ':');
+        struct sockaddr_in *peer = (struct sockaddr_in *) &ep->peer;
+        if (colon == NULL || colon - address >= INET_ADDRSTRLEN) return -1;
+        strncpy(ip, address, (size_t) (colon - address));
+        peer->sin_family = AF_INET;
+        peer->sin_port = htons((uint16_t) strtol(colon + 1, NULL, 10));
+        if (inet_pton(AF_INET, ip, &peer->sin_addr) != 1 || peer->sin_port == 0) return -1;
+        ep->peer_length = sizeof(struct sockaddr_in);
+    } else {
+        bind_addr.sin_port = htons((uint16_t) strtol(address, NULL, 10));
+        if (bind_addr.sin_port == 0) return -1;
+    }
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    const int y = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &y, sizeof(y));
+    if (bind(fd, (struct sockaddr *) &bind_addr, sizeof(bind_addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    ep->fd = fd;
+    return fd;
+}
+
+static int open_unix(db_mav_endpoint_t *ep, const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) == 0 || strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    ep->fd = fd;
+    return fd;
+}
+
+/**
+ * @param value <message ID>+<message ID>+...
+ * @return Number of IDs or -1 if the list is malformed
+ */
+static int parse_id_list(const char *value, uint32_t *ids) {
+    int cnt = 0;
+    const char *p = value;
+    while (*p != '\0' && *p != ',') {
+        char *end;
+        long msg_id = strtol(p, &end, 10);
+        if (end == p || msg_id < 0 || cnt >= DB_MAV_ROUTER_MAX_FILTER) return -1;
+        ids[cnt++] = (uint32_t) msg_id;
+        p = end;
+        if (*p == '+') p++;
+        else if (*p != '\0' && *p != ',') return -1;
+    }
+    return cnt;
+}
+
+static int parse_options(db_mav_endpoint_t *ep, const char *options) {
+    const char *p = options;
+    while (*p != '\0') {
+        const char *value = strchr(p, '=');
+        if (value == NULL) return -1;
+        value++;
+        if (strncmp(p, "baud=", 5) == 0 && ep->type == DB_MAV_EP_SERIAL) {
+            ep->baud_rate = (int) strtol(value, NULL, 10);
+        } else if (strncmp(p, "kbit=", 5) == 0) {
+            ep->budget_bytes_per_us = strtod(value, NULL) * 1000 / 8 / 1e6;
+        } else if (strncmp(p, "allow=", 6) == 0) {
+            if ((ep->allow_cnt = parse_id_list(value, ep->allow)) < 0) return -1;
+        } else if (strncmp(p, "deny=", 5) == 0) {
+            if ((ep->deny_cnt = parse_id_list(value, ep->deny)) < 0) return -1;
+        } else {
+            return -1;
+        }
+        p = strchr(p, ',');
+        if (p == NULL) break;
+        p++;
+    }
+    return 0;
+}
+
+/**
+ * Open an endpoint
+ *
+ * @param router The router
+ * @param spec <type>:<address>[@<option>=<value>,...] with the types serial:<device>, udp:<IP>:<port>, udpin:<port>,
+ * unix:<path> and the options baud=<baud rate> (serial only, default 115200), kbit=<max. data rate to the endpoint>,
+ * allow=<message ID>+... (pass on only these messages) and deny=<message ID>+.... Commands, acks & parameters are
+ * never rate limited. e.g. serial:/dev/ttyUSB0@baud=921600 or udp:127.0.0.1:14550@kbit=64,deny=30+31
+ * @return Index of the endpoint or -1 on error
+ */
+int db_mav_router_add_endpoint(db_mav_router_t *router, const char *spec) {
+    char address[64];
+    int type, opened;
+    if (strncmp(spec, DB_MAV_ROUTER_SERIAL_PREFIX, strlen(DB_MAV_ROUTER_SERIAL_PREFIX)) == 0)
+        type = DB_MAV_EP_SERIAL;
+    else if (strncmp(spec, DB_MAV_ROUTER_UDP_PREFIX, strlen(DB_MAV_ROUTER_UDP_PREFIX)) == 0)
+        type = DB_MAV_EP_UDP;
+    else if (strncmp(spec, DB_MAV_ROUTER_UDP_SERVER_PREFIX, strlen(DB_MAV_ROUTER_UDP_SERVER_PREFIX)) == 0)
+        type = DB_MAV_EP_UDP_SERVER;
+    else if (strncmp(spec, DB_MAV_ROUTER_UNIX_PREFIX, strlen(DB_MAV_ROUTER_UNIX_PREFIX)) == 0)
+        type = DB_MAV_EP_UNIX;
+    else {
+        LOG_SYS_STD(LOG_ERR, "DB_MAV_ROUTER: Unknown endpoint type \"%s\" - use serial:, udp:, udpin: or unix:\n", spec);
+        return -1;
+    }
+    const char *options = strchr(spec, '@');
+    size_t name_length = options != NULL ? (size_t) (options - spec) : strlen(spec);
+    if (name_length >= sizeof(address)) name_length = sizeof(address) - 1;
+    memcpy(address, spec, name_length);
+    address[name_length] = '\0';
+    db_mav_endpoint_t *ep = new_endpoint(router, type, address);
+    if (ep == NULL) return -1;
+    ep->baud_rate = 115200;
+    if (options != NULL && parse_options(ep, options + 1) < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_MAV_ROUTER: Invalid options \"%s\" - use baud=<n>,kbit=<n>,allow=<id>+<id>,"
+                             "deny=<id>+<id>\n", options + 1);
+        return -1;
+    }
+    ep->tokens = ep->budget_bytes_per_us * DB_MAV_ROUTER_BURST_MS * 1000;
+    ep->tokens_updated_us = db_clock_us();
+    const char *target = strchr(address, ':') + 1;
+    switch (type) {
+        case DB_MAV_EP_SERIAL:
+            ep->open_try_us = db_clock_us();
+            opened = open_serial(ep);   // re-opened later if the device is not there yet
+            break;
+        case DB_MAV_EP_UNIX:
+            opened = open_unix(ep, target);
+            break;
+        default:
+            opened = open_udp(ep, target);
+            break;
+    }
+    if (opened < 0 && type != DB_MAV_EP_SERIAL) {
+        LOG_SYS_STD(LOG_ERR, "DB_MAV_ROUTER: Could not open %s: %s\n", address, strerror(errno));
+        return -1;
+    }
+    LOG_SYS_STD(LOG_INFO, "DB_MAV_ROUTER: Endpoint %i: %s\n", router->endpoint_cnt, address);
+    return router->endpoint_cnt++;
+}
+
+/**
+ * @return true if the frame was parsed. System & component ID of the sender, message ID and the target system &
+ * component (0 if the message has none)
+ */
+static bool parse_frame(const uint8_t *frame, uint16_t length, uint8_t *system_id, uint8_t *component_id,
+                        uint32_t *msg_id, uint8_t *target_system, uint8_t *target_component) {
+    const uint8_t *payload;
+    uint8_t payload_length;
+    if (frame[0] == MAVLINK_V2_MAGIC && length >= MAVLINK_V2_HEADER_LENGTH + 2) {
+        *system_id = frame[5];
+        *component_id = frame[6];
+        *msg_id = frame[7] | (frame[8] << 8) | ((uint32_t) frame[9] << 16);
+        payload = frame + MAVLINK_V2_HEADER_LENGTH;
+    } else if (frame[0] == MAVLINK_V1_MAGIC && length >= MAVLINK_V1_HEADER_LENGTH + 2) {
+        *system_id = frame[3];
+        *component_id = frame[4];
+        *msg_id = frame[5];
+        payload = frame + MAVLINK_V1_HEADER_LENGTH;
+    } else {
+        return false;
+    }
+    payload_length = frame[1];
+    *target_system = 0;
+    *target_component = 0;
+    const mavlink_msg_entry_t *msg_entry = mavlink_get_msg_entry(*msg_id);
+    if (msg_entry == NULL) return true;
+    // MAVLink v2 cuts trailing zero bytes of the payload: a target that is not part of the frame is 0
+    if ((msg_entry->flags & MAV_MSG_ENTRY_FLAG_HAVE_TARGET_SYSTEM) && msg_entry->target_system_ofs < payload_length)
+        *target_system = payload[msg_entry->target_system_ofs];
+    if ((msg_entry->flags & MAV_MSG_ENTRY_FLAG_HAVE_TARGET_COMPONENT)
+        && msg_entry->target_component_ofs < payload_length)
+        *target_component = payload[msg_entry->target_component_ofs];
+    return true;
+}
+
+static void learn_route(db_mav_router_t *router, int source, uint8_t system_id, uint8_t component_id) {
+    for (int i = 0; i < router->route_cnt; i++) {
+        db_mav_route_t *route = &router->routes[i];
+        if (route->system_id != system_id || route->component_id != component_id) continue;
+        if (route->endpoint != source) {
+            LOG_SYS_STD(LOG_NOTICE, "DB_MAV_ROUTER: System %u component %u moved from %s to %s\n", system_id,
+                        component_id, router->endpoints[route->endpoint].name, router->endpoints[source].name);
+            router->endpoints[route->endpoint].stats.systems--;
+            router->endpoints[source].stats.systems++;
+            route->endpoint = (uint8_t) source;
+        }
+        return;
+    }
+    if (router->route_cnt >= DB_MAV_ROUTER_MAX_ROUTES) return;
+    router->routes[router->route_cnt++] = (db_mav_route_t) {system_id, component_id, (uint8_t) source};
+    router->endpoints[source].stats.systems++;
+    LOG_SYS_STD(LOG_INFO, "DB_MAV_ROUTER: System %u component %u is behind %s\n", system_id, component_id,
+                router->endpoints[source].name);
+}
+
+/**
+ * @return Bit mask of the endpoints the target was seen on. 0 if it is unknown
+ */
+static uint32_t find_target(const db_mav_router_t *router, uint8_t target_system, uint8_t target_component) {
+    uint32_t component_mask = 0, system_mask = 0;
+    for (int i = 0; i < router->route_cnt; i++) {
+        const db_mav_route_t *route = &router->routes[i];
+        if (route->system_id != target_system) continue;
+        system_mask |= 1u << route->endpoint;
+        if (route->component_id == target_component) component_mask |= 1u << route->endpoint;
+    }
+    return (target_component != 0 && component_mask != 0) ? component_mask : system_mask;
+}
+
+static bool is_filtered(const db_mav_endpoint_t *ep, uint32_t msg_id) {
+    for (int i = 0; i < ep->deny_cnt; i++)
+        if (ep->deny[i] == msg_id) return true;
+    if (ep->allow_cnt == 0) return false;
+    for (int i = 0; i < ep->allow_cnt; i++)
+        if (ep->allow[i] == msg_id) return false;
+    return true;
+}
+
+static void send_frame(db_mav_router_t *router, int index, const uint8_t *frame, uint16_t length, uint32_t msg_id,
+                       uint64_t now_us) {
+    db_mav_endpoint_t *ep = &router->endpoints[index];
+    if (is_filtered(ep, msg_id)) {
+        ep->stats.filtered++;
+        return;
+    }
+    bool command = db_mav_sched_classify(msg_id) == DB_MAV_CLASS_COMMAND;
+    if (ep->budget_bytes_per_us > 0) {
+        double max_tokens = ep->budget_bytes_per_us * DB_MAV_ROUTER_BURST_MS * 1000;
+        ep->tokens += (double) (now_us - ep->tokens_updated_us) * ep->budget_bytes_per_us;
+        ep->tokens_updated_us = now_us;
+        if (ep->tokens > max_tokens) ep->tokens = max_tokens;
+        if (!command && ep->tokens < length) {
+            ep->stats.rate_limited++;
+            return;
+        }
+        ep->tokens -= length;   // commands may go into debt
+    }
+    switch (ep->type) {
+        case DB_MAV_EP_EXTERNAL:
+            router->deliver(index, frame, length, router->deliver_arg);
+            break;
+        case DB_MAV_EP_SERIAL:
+            if (db_serial_writer_queue(&ep->writer, command ? DB_SERIAL_CLASS_CMD : DB_SERIAL_CLASS_BULK, frame,
+                                       length) < 0) {
+                ep->stats.errors++;
+                return;
+            }
+            break;
+        default:
+            if (ep->peer_length == 0) return;   // server that did not hear from anybody yet
+            if (sendto(ep->fd, frame, length, MSG_DONTWAIT, (struct sockaddr *) &ep->peer, ep->peer_length) != length) {
+                ep->stats.errors++;
+                return;
+            }
+            break;
+    }
+    ep->stats.frames_out++;
+    ep->stats.bytes_out += length;
+}
+
+/**
+ * Pass a frame on. The sender gets learned, the frame goes to all endpoints its target was seen on. Broadcasts and
+ * frames for an unknown target go to all endpoints but the source.
+ *
+ * @param router The router
+ * @param source Index of the endpoint the frame came from
+ * @param frame Complete MAVLink v1/v2 frame (see db_serial_stream_next())
+ * @param length Length of the frame
+ * @param now_us db_clock_us()
+ */
+void db_mav_router_route(db_mav_router_t *router, int source, const uint8_t *frame, uint16_t length,
+                         uint64_t now_us) {
+    uint8_t system_id, component_id, target_system, target_component;
+    uint32_t msg_id, destinations = 0;
+    if (!parse_frame(frame, length, &system_id, &component_id, &msg_id, &target_system, &target_component)) return;
+    router->endpoints[source].stats.frames_in++;
+    learn_route(router, source, system_id, component_id);
+    if (target_system != 0)
+        destinations = find_target(router, target_system, target_component);
+    if (destinations == 0)
+        destinations = ~0u;
+    for (int i = 0; i < router->endpoint_cnt; i++) {
+        if (i != source && (destinations & (1u << i)))
+            send_frame(router, i, frame, length, msg_id, now_us);
+    }
+}
+
+static void close_serial(db_mav_endpoint_t *ep, const char *reason, uint64_t now_us) {
+    LOG_SYS_STD(LOG_ERR, "DB_MAV_ROUTER: %s closed: %s\n", ep->name, reason);
+    close(ep->fd);
+    ep->fd = -1;
+    ep->open_try_us = now_us;
+    db_serial_writer_init(&ep->writer, -1, ep->baud_rate);
+    db_serial_stream_init(&ep->stream, DB_SERIAL_STREAM_MAVLINK);
+}
+
+/**
+ * Read & route everything that arrived on an endpoint. Call when its fd became readable. A serial endpoint that got
+ * closed has fd -1 afterwards
+ *
+ * @param router The router
+ * @param index Index of the endpoint
+ * @param now_us db_clock_us()
+ */
+void db_mav_router_read(db_mav_router_t *router, int index, uint64_t now_us) {
+    db_mav_endpoint_t *ep = &router->endpoints[index];
+    if (ep->type == DB_MAV_EP_EXTERNAL || ep->fd < 0) return;
+    const uint8_t *frame;
+    uint16_t frame_length;
+    if (ep->type == DB_MAV_EP_SERIAL) {
+        ssize_t read_bytes = db_serial_stream_fill(&ep->stream, ep->fd);
+        if (read_bytes == 0 || (read_bytes < 0 && errno != EAGAIN && errno != EINTR)) {
+            close_serial(ep, read_bytes == 0 ? "EOF" : strerror(errno), now_us);
+            return;
+        }
+    } else {
+        uint8_t buf[UDP_READ_BUF_SIZE];
+        struct sockaddr_storage sender;
+        socklen_t sender_length = sizeof(sender);
+        ssize_t recv_bytes;
+        while ((recv_bytes = recvfrom(ep->fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *) &sender,
+                                      &sender_length)) > 0) {
+            if (ep->type != DB_MAV_EP_UDP) {
+                memcpy(&ep->peer, &sender, sender_length);  // reply to whoever sent last
+                ep->peer_length = sender_length;
+            }
+            db_serial_stream_feed(&ep->stream, buf, (uint32_t) recv_bytes);
+            sender_length = sizeof(sender);
+        }
+    }
+    while (db_serial_stream_next(&ep->stream, &frame, &frame_length))
+        db_mav_router_route(router, index, frame, frame_length, now_us);
+}
+
+/**
+ * Continue writing to serial endpoints and re-open serial ports that were closed. Call after every wake up of the
+ * module. File descriptors of endpoints may change
+ */
+void db_mav_router_service(db_mav_router_t *router, uint64_t now_us) {
+    for (int i = 0; i < router->endpoint_cnt; i++) {
+        db_mav_endpoint_t *ep = &router->endpoints[i];
+        if (ep->type == DB_MAV_EP_SERIAL && ep->fd < 0 && now_us - ep->open_try_us >= SERIAL_REOPEN_INTERVAL_US) {
+            ep->open_try_us = now_us;
+            open_serial(ep);
+        }
+    }
+    for (int i = 0; i < router->endpoint_cnt; i++) {
+        db_mav_endpoint_t *ep = &router->endpoints[i];
+        if (ep->type != DB_MAV_EP_SERIAL || ep->fd < 0 || !db_serial_writer_pending(&ep->writer)) continue;
+        if (db_serial_writer_flush(&ep->writer) < 0)
+            close_serial(ep, strerror(errno), now_us);
+    }
+}
+
+/**
+ * @return Max. time the module may wait before the serial endpoints need to be written again. -1 if
+ * there is nothing to wait for
+ */
+long db_mav_router_timeout_us(const db_mav_router_t *router) {
+    long timeout = -1;
+    for (int i = 0; i < router->endpoint_cnt; i++) {
+        const db_mav_endpoint_t *ep = &router->endpoints[i];
+        if (ep->type == DB_MAV_EP_SERIAL && ep->fd >= 0 && ep->writer.throttle_us > 0
+            && (timeout < 0 || ep->writer.throttle_us < timeout))
+            timeout = ep->writer.throttle_us;
+    }
+    return timeout;
+}
+
+void db_mav_router_report(const db_mav_router_t *router, const char *module_tag) {
+    for (int i = 0; i < router->endpoint_cnt; i++) {
+        const db_mav_route_stats_t *stats = &router->endpoints[i].stats;
+        LOG_SYS_STD(LOG_INFO, "%s: MAVLink router %s: %u frames in, %u frames out (%u bytes), %u filtered, %u rate "
+                              "limited, %u errors, %u systems\n", module_tag, router->endpoints[i].name,
+                    stats->frames_in, stats->frames_out, stats->bytes_out, stats->filtered, stats->rate_limited,
+                    stats->errors, stats->systems);
+    }
+}
+
+void db_mav_router_close(db_mav_router_t *router) {
+    for (int i = 0; i < router->endpoint_cnt; i++) {
+        db_mav_endpoint_t *ep = &router->endpoints[i];
+        if (ep->fd >= 0) close(ep->fd);
+        ep->fd = -1;
+        if (ep->type == DB_MAV_EP_UNIX)
+            unlink(ep->name + strlen(DB_MAV_ROUTER_UNIX_PREFIX));
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#ifndef DRONEBRIDGE_DB_MAV_ROUTER_H
+#define DRONEBRIDGE_DB_MAV_ROUTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include "db_serial_stream.h"
+#include "db_serial_writer.h"
+#include "shared_memory.h"
+
+#define DB_MAV_ROUTER_SERIAL_PREFIX     "serial:"   // serial:<device>[@baud=<baud rate>]
+#define DB_MAV_ROUTER_UDP_PREFIX        "udp:"      // udp:<IP>:<port> sends to the address, replies are accepted
+#define DB_MAV_ROUTER_UDP_SERVER_PREFIX "udpin:"    // udpin:<port> listens on the port, sends to the last sender
+#define DB_MAV_ROUTER_UNIX_PREFIX       "unix:"     // unix:<path> datagram socket, sends to the last sender
+#define DB_MAV_ROUTER_MAX_ROUTES        32          // system/component IDs learned from the traffic
+#define DB_MAV_ROUTER_MAX_FILTER        32          // message IDs per allow/deny list
+#define DB_MAV_ROUTER_BURST_MS          100         // a rate limited endpoint may send this much of its rate at once
+
+enum {
+    DB_MAV_EP_EXTERNAL,     // owned by the module (e.g. raw link downlink). Frames are handed to the deliver callback
+    DB_MAV_EP_SERIAL,
+    DB_MAV_EP_UDP,
+    DB_MAV_EP_UDP_SERVER,
+    DB_MAV_EP_UNIX
+};
+
+typedef struct {
+    int type;
+    int fd;
+    char name[64];
+    int baud_rate;                  // serial only
+    uint64_t open_try_us;           // serial only: last attempt to open the device
+    struct sockaddr_storage peer;   // UDP & unix: destination of the frames. Servers: last sender
+    socklen_t peer_length;          // 0 = nobody to send to yet
+    db_serial_stream_t stream;      // splits the received data into MAVLink frames
+    db_serial_writer_t writer;      // serial only
+    double budget_bytes_per_us;     // 0 = unlimited
+    double tokens;
+    uint64_t tokens_updated_us;
+    uint32_t allow[DB_MAV_ROUTER_MAX_FILTER];   // only these message IDs are passed on. Empty = all
+    int allow_cnt;
+    uint32_t deny[DB_MAV_ROUTER_MAX_FILTER];    // these message IDs are never passed on
+    int deny_cnt;
+    db_mav_route_stats_t stats;
+} db_mav_endpoint_t;
+
+typedef struct {
+    uint8_t system_id;
+    uint8_t component_id;
+    uint8_t endpoint;
+} db_mav_route_t;
+
+/**
+ * @param endpoint Index of the external endpoint the frame is for
+ * @param frame Complete MAVLink frame. Only valid during the call
+ * @param length Length of the frame
+ * @param arg Pointer passed to db_mav_router_init()
+ */
+typedef void (*db_mav_router_cb)(int endpoint, const uint8_t *frame, uint16_t length, void *arg);
+
+/**
+ * Passes MAVLink frames between endpoints (flight controller, raw link to the ground station, companion computers,
+ * gimbals, local apps). The system/component IDs behind every endpoint are learned from the frames it sends. Frames
+ * with a target system only go to the endpoints the target was seen on, all others go to every endpoint but the one
+ * they came from. Frames are never decoded or re-encoded.
+ */
+typedef struct {
+    db_mav_endpoint_t endpoints[DB_MAV_ROUTER_MAX_ENDPOINTS];
+    int endpoint_cnt;
+    db_mav_route_t routes[DB_MAV_ROUTER_MAX_ROUTES];
+    int route_cnt;
+    db_mav_router_cb deliver;
+    void *deliver_arg;
+} db_mav_router_t;
+
+void db_mav_router_init(db_mav_router_t *router, db_mav_router_cb deliver, void *arg);
+int db_mav_router_add_external(db_mav_router_t *router, const char *name);
+int db_mav_router_add_endpoint(db_mav_router_t *router, const char *spec);
+void db_mav_router_route(db_mav_router_t *router, int source, const uint8_t *frame, uint16_t length,
+                         uint64_t now_us);
+void db_mav_router_read(db_mav_router_t *router, int index, uint64_t now_us);
+void db_mav_router_service(db_mav_router_t *router, uint64_t now_us);
+long db_mav_router_timeout_us(const db_mav_router_t *router);
+void db_mav_router_report(const db_mav_router_t *router, const char *module_tag);
+void db_mav_router_close(db_mav_router_t *router);
+
+#endif //DRONEBRIDGE_DB_MAV_ROUTER_H
@@ -0,0 +1,354 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+/**
+ * MAVLink downlink scheduler. The flight controller streams high rate state messages (ATTITUDE, positions, ...) next
+ * to rare but important ones (COMMAND_ACK, STATUSTEXT, mission & parameter protocol). Sending everything in arrival
+ * order lets the state messages crowd out the important ones as soon as the link gets congested. Instead:
+ *  - command class messages are queued first in first out and trigger a packet right away
+ *  - state messages only keep the newest version per system/component/message ID. An older one that was not sent
+ *    yet is worthless and gets replaced
+ *  - rate caps per message ID limit how often a message may be sent
+ *  - all packets have to fit into an airtime budget (token bucket). Packets are filled in class order. Only command
+ *    messages may use the last COMMAND_RESERVE bytes of the budget, so they never wait behind a large packet of state
+ *    or bulk messages
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "db_mav_sched.h"
+#include "db_aggregator.h"
+#include "db_common.h"
+#include "mavlink/c_library_v2/common/mavlink.h"
+
+#define MAVLINK_V1_MAGIC    0xFE
+#define MAVLINK_V2_MAGIC    0xFD
+#define COMMAND_RESERVE     (DB_MAV_SCHED_MAX_FRAME + DB_MAV_SCHED_PACKET_COST) // budget only commands may use
+#define MAX_TOKENS(sched)   ((sched)->mtu + DB_MAV_SCHED_PACKET_COST + COMMAND_RESERVE)
+
+/**
+ * @param sched Scheduler to init
+ * @param mtu Max. MAVLink bytes per DroneBridge packet
+ * @param budget_kbit Airtime budget of the MAVLink downlink in kbit/s including DB_MAV_SCHED_PACKET_COST per
+ * packet. 0 = unlimited
+ * @param deadline_ms Max. time a state message waits for more data to fill the packet. Bulk messages wait twice as
+ * long. 0 = DB_MAV_SCHED_DEADLINE_MS
+ */
+void db_mav_sched_init(db_mav_sched_t *sched, uint16_t mtu, uint32_t budget_kbit, uint32_t deadline_ms) {
+    memset(sched, 0, sizeof(db_mav_sched_t));
+    sched->mtu = mtu < DB_MAV_SCHED_MAX_FRAME ? DB_MAV_SCHED_MAX_FRAME : (mtu > DATA_UNI_LENGTH ? DATA_UNI_LENGTH : mtu);
+    if (deadline_ms == 0) deadline_ms = DB_MAV_SCHED_DEADLINE_MS;
+    sched->deadline_us[DB_MAV_CLASS_COMMAND] = 0;
+    sched->deadline_us[DB_MAV_CLASS_STATE] = deadline_ms * 1000;
+    sched->deadline_us[DB_MAV_CLASS_BULK] = 2 * deadline_ms * 1000;
+    sched->budget_bytes_per_us = budget_kbit / 8000.0;
+    sched->tokens = MAX_TOKENS(sched);
+}
+
+/**
+ * Parse rate caps like "30:10,33:5" (ATTITUDE at max. 10 Hz, GLOBAL_POSITION_INT at max. 5 Hz). Call before the
+ * first message is added. Caps do not apply to command class messages.
+ *
+ * @param sched The scheduler
+ * @param spec <message ID>:<max. rate in Hz>,...
+ * @return 0 on success, -1 on a malformed spec
+ */
+int db_mav_sched_parse_rates(db_mav_sched_t *sched, const char *spec) {
+    const char *p = spec;
+    while (*p != '\0') {
+        char *end;
+        long msg_id = strtol(p, &end, 10);
+        if (end == p || *end != ':') break;
+        p = end + 1;
+        double rate = strtod(p, &end);
+        if (end == p || rate <= 0 || sched->rate_cnt >= DB_MAV_SCHED_MAX_RATES) break;
+        sched->rates[sched->rate_cnt].msg_id = (uint32_t) msg_id;
+        sched->rates[sched->rate_cnt].min_interval_us = (uint32_t) (1000000 / rate);
+        sched->rate_cnt++;
+        p = end;
+        if (*p == ',') p++;
+        else if (*p != '\0') break;
+    }
+    if (*p != '\0') {
+        LOG_SYS_STD(LOG_ERR, "DB_MAV_SCHED: Invalid rate cap at \"%s\" - use <message ID>:<Hz>,...\n", p);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @param msg_id MAVLink message ID
+ * @return DB_MAV_CLASS_COMMAND, DB_MAV_CLASS_STATE or DB_MAV_CLASS_BULK
+ */
+int db_mav_sched_classify(uint32_t msg_id) {
+    switch (msg_id) {
+        case MAVLINK_MSG_ID_COMMAND_ACK:
+        case MAVLINK_MSG_ID_COMMAND_LONG:
+        case MAVLINK_MSG_ID_COMMAND_INT:
+        case MAVLINK_MSG_ID_STATUSTEXT:
+        case MAVLINK_MSG_ID_PARAM_VALUE:
+        case MAVLINK_MSG_ID_MISSION_ITEM:
+        case MAVLINK_MSG_ID_MISSION_ITEM_INT:
+        case MAVLINK_MSG_ID_MISSION_REQUEST:
+        case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+        case MAVLINK_MSG_ID_MISSION_COUNT:
+        case MAVLINK_MSG_ID_MISSION_ACK:
+        case MAVLINK_MSG_ID_MISSION_ITEM_REACHED:
+        case MAVLINK_MSG_ID_AUTOPILOT_VERSION:
+        case MAVLINK_MSG_ID_TIMESYNC:
+            return DB_MAV_CLASS_COMMAND;
+        case MAVLINK_MSG_ID_HEARTBEAT:
+        case MAVLINK_MSG_ID_SYS_STATUS:
+        case MAVLINK_MSG_ID_SYSTEM_TIME:
+        case MAVLINK_MSG_ID_GPS_RAW_INT:
+        case MAVLINK_MSG_ID_SCALED_IMU:
+        case MAVLINK_MSG_ID_RAW_IMU:
+        case MAVLINK_MSG_ID_SCALED_PRESSURE:
+        case MAVLINK_MSG_ID_ATTITUDE:
+        case MAVLINK_MSG_ID_ATTITUDE_QUATERNION:
+        case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
+        case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+        case MAVLINK_MSG_ID_RC_CHANNELS_RAW:
+        case MAVLINK_MSG_ID_RC_CHANNELS:
+        case MAVLINK_MSG_ID_SERVO_OUTPUT_RAW:
+        case MAVLINK_MSG_ID_MISSION_CURRENT:
+        case MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT:
+        case MAVLINK_MSG_ID_VFR_HUD:
+        case MAVLINK_MSG_ID_ATTITUDE_TARGET:
+        case MAVLINK_MSG_ID_POSITION_TARGET_GLOBAL_INT:
+        case MAVLINK_MSG_ID_HIGHRES_IMU:
+        case MAVLINK_MSG_ID_ALTITUDE:
+        case MAVLINK_MSG_ID_BATTERY_STATUS:
+        case MAVLINK_MSG_ID_VIBRATION:
+        case MAVLINK_MSG_ID_HOME_POSITION:
+        case MAVLINK_MSG_ID_EXTENDED_SYS_STATE:
+            return DB_MAV_CLASS_STATE;
+        default:
+            return DB_MAV_CLASS_BULK;
+    }
+}
+
+static db_mav_rate_t *find_rate(db_mav_sched_t *sched, uint32_t msg_id) {
+    for (int i = 0; i < sched->rate_cnt; i++)
+        if (sched->rates[i].msg_id == msg_id) return &sched->rates[i];
+    return NULL;
+}
+
+static void queue_frame(db_mav_sched_t *sched, db_mav_queue_t *queue, const uint8_t *frame, uint16_t length,
+                        uint64_t now_us) {
+    if (queue->tail - queue->head >= DB_MAV_SCHED_QUEUE_LENGTH) {
+        sched->stats.dropped++;
+        return;
+    }
+    db_mav_frame_t *queued = &queue->frames[queue->tail++ % DB_MAV_SCHED_QUEUE_LENGTH];
+    memcpy(queued->frame, frame, length);
+    queued->length = length;
+    queued->queued_us = now_us;
+    sched->pending_bytes += length;
+}
+
+/**
+ * Hand a complete MAVLink v1/v2 frame (e.g. from db_serial_stream_next()) to the scheduler
+ *
+ * @param sched The scheduler
+ * @param frame The frame. Copied
+ * @param length Length of the frame
+ * @param now_us db_clock_us()
+ */
+void db_mav_sched_add(db_mav_sched_t *sched, const uint8_t *frame, uint16_t length, uint64_t now_us) {
+    uint32_t msg_id, key;
+    if (length > DB_MAV_SCHED_MAX_FRAME) return;
+    if (frame[0] == MAVLINK_V2_MAGIC && length >= 12) {
+        msg_id = frame[7] | (frame[8] << 8) | ((uint32_t) frame[9] << 16);
+        key = (msg_id << 16) | (frame[5] << 8) | frame[6];
+    } else if (frame[0] == MAVLINK_V1_MAGIC && length >= 8) {
+        msg_id = frame[5];
+        key = (msg_id << 16) | (frame[3] << 8) | frame[4];
+    } else {
+        return;
+    }
+    int msg_class = db_mav_sched_classify(msg_id);
+    if (msg_class == DB_MAV_CLASS_COMMAND) {
+        queue_frame(sched, &sched->command, frame, length, now_us);
+        return;
+    }
+    db_mav_rate_t *rate = find_rate(sched, msg_id);
+    if (msg_class == DB_MAV_CLASS_STATE) {
+        db_mav_state_slot_t *slot = NULL;
+        for (int i = 0; i < sched->state_cnt && slot == NULL; i++)
+            if (sched->state[i].key == key) slot = &sched->state[i];
+        if (slot == NULL && sched->state_cnt < DB_MAV_SCHED_STATE_SLOTS) {
+            slot = &sched->state[sched->state_cnt++];
+            slot->key = key;
+            slot->min_interval_us = rate != NULL ? rate->min_interval_us : 0;
+        }
+        if (slot != NULL) {
+            if (slot->pending) {
+                sched->stats.superseded++;
+                sched->pending_bytes -= slot->message.length;
+            } else {
+                slot->pending_since_us = now_us;
+            }
+            memcpy(slot->message.frame, frame, length);
+            slot->message.length = length;
+            slot->message.queued_us = now_us;
+            slot->pending = true;
+            sched->pending_bytes += length;
+            return;
+        }
+        // out of slots: handle like any other message
+    }
+    if (rate != NULL) {
+        if (rate->last_accepted_us != 0 && now_us - rate->last_accepted_us < rate->min_interval_us) {
+            sched->stats.rate_limited++;
+            return;
+        }
+        rate->last_accepted_us = now_us;
+    }
+    queue_frame(sched, &sched->bulk, frame, length, now_us);
+}
+
+static void refill_tokens(db_mav_sched_t *sched, uint64_t now_us) {
+    if (sched->budget_bytes_per_us <= 0) return;
+    sched->tokens += (double) (now_us - sched->tokens_updated_us) * sched->budget_bytes_per_us;
+    sched->tokens_updated_us = now_us;
+    if (sched->tokens > MAX_TOKENS(sched))
+        sched->tokens = MAX_TOKENS(sched);
+}
+
+/**
+ * @return Tokens required before a packet may be sent. Packets without command messages must leave the reserve
+ */
+static double required_tokens(bool urgent) {
+    return urgent ? 0 : COMMAND_RESERVE + DB_MAV_SCHED_PACKET_COST + DB_MAV_SCHED_MAX_FRAME;
+}
+
+static uint16_t take_queue(db_mav_sched_t *sched, db_mav_queue_t *queue, int msg_class, uint8_t *packet,
+                           uint16_t length, uint16_t limit, uint64_t *oldest_us, uint64_t now_us) {
+    while (queue->tail != queue->head) {
+        db_mav_frame_t *queued = &queue->frames[queue->head % DB_MAV_SCHED_QUEUE_LENGTH];
+        if (length + queued->length > limit) break;
+        memcpy(packet + length, queued->frame, queued->length);
+        length += queued->length;
+        sched->pending_bytes -= queued->length;
+        sched->stats.sent[msg_class]++;
+        if (queued->queued_us < *oldest_us) *oldest_us = queued->queued_us;
+        if (msg_class == DB_MAV_CLASS_COMMAND && now_us - queued->queued_us > sched->stats.command_latency_max_us)
+            sched->stats.command_latency_max_us = (uint32_t) (now_us - queued->queued_us);
+        queue->head++;
+    }
+    return length;
+}
+
+/**
+ * @param sched The scheduler
+ * @param full true if the pending messages fill a packet - nobody has to wait for their deadline then
+ * @return Earliest time one of the pending messages may be sent. UINT64_MAX if nothing is pending
+ */
+static uint64_t next_due(const db_mav_sched_t *sched, bool full) {
+    uint64_t due = UINT64_MAX;
+    if (sched->command.tail != sched->command.head)
+        due = sched->command.frames[sched->command.head % DB_MAV_SCHED_QUEUE_LENGTH].queued_us;
+    if (sched->bulk.tail != sched->bulk.head) {
+        uint64_t bulk_due = sched->bulk.frames[sched->bulk.head % DB_MAV_SCHED_QUEUE_LENGTH].queued_us;
+        if (!full) bulk_due += sched->deadline_us[DB_MAV_CLASS_BULK];
+        if (bulk_due < due) due = bulk_due;
+    }
+    for (int i = 0; i < sched->state_cnt; i++) {
+        const db_mav_state_slot_t *slot = &sched->state[i];
+        if (!slot->pending) continue;
+        uint64_t slot_due = full ? 0 : slot->pending_since_us + sched->deadline_us[DB_MAV_CLASS_STATE];
+        if (slot->sent_us + slot->min_interval_us > slot_due) slot_due = slot->sent_us + slot->min_interval_us;
+        if (slot_due < due) due = slot_due;
+    }
+    return due;
+}
+
+/**
+ * Assemble the next DroneBridge packet if one may be sent now. Call whenever a message was added and after
+ * db_mav_sched_timeout_us() elapsed.
+ *
+ * @param sched The scheduler
+ * @param packet Buffer of at least mtu bytes that receives the MAVLink frames
+ * @param now_us db_clock_us()
+ * @return Length of the packet. 0 if nothing is to be sent right now
+ */
+uint16_t db_mav_sched_next_packet(db_mav_sched_t *sched, uint8_t *packet, uint64_t now_us) {
+    if (sched->pending_bytes == 0 || next_due(sched, sched->pending_bytes >= sched->mtu) > now_us) return 0;
+    bool urgent = sched->command.tail != sched->command.head;
+    refill_tokens(sched, now_us);
+    if (sched->budget_bytes_per_us > 0 && sched->tokens < required_tokens(urgent)) {
+        sched->stats.budget_waits++;
+        return 0;
+    }
+    uint64_t oldest_us = now_us;
+    uint16_t length = take_queue(sched, &sched->command, DB_MAV_CLASS_COMMAND, packet, 0, sched->mtu, &oldest_us,
+                                 now_us);
+    // state & bulk messages only fill what the budget allows without touching the command reserve
+    uint16_t limit = sched->mtu;
+    if (sched->budget_bytes_per_us > 0) {
+        double allowed = sched->tokens - COMMAND_RESERVE - DB_MAV_SCHED_PACKET_COST;
+        limit = allowed < length ? length : (allowed < sched->mtu ? (uint16_t) allowed : sched->mtu);
+    }
+    // state streams that were not sent for the longest time first, so a high rate stream can not starve the others
+    while (true) {
+        db_mav_state_slot_t *next = NULL;
+        for (int i = 0; i < sched->state_cnt; i++) {
+            db_mav_state_slot_t *slot = &sched->state[i];
+            if (slot->pending && length + slot->message.length <= limit
+                && now_us - slot->sent_us >= slot->min_interval_us && (next == NULL || slot->sent_us < next->sent_us))
+                next = slot;
+        }
+        if (next == NULL) break;
+        memcpy(packet + length, next->message.frame, next->message.length);
+        length += next->message.length;
+        sched->pending_bytes -= next->message.length;
+        next->pending = false;
+        next->sent_us = now_us;
+        if (next->message.queued_us < oldest_us) oldest_us = next->message.queued_us;
+        sched->stats.sent[DB_MAV_CLASS_STATE]++;
+    }
+    length = take_queue(sched, &sched->bulk, DB_MAV_CLASS_BULK, packet, length, limit, &oldest_us, now_us);
+    if (length == 0) return 0;  // only rate capped state messages are waiting
+    sched->tokens -= length + DB_MAV_SCHED_PACKET_COST;
+    sched->stats.packets++;
+    sched->stats.bytes += length;
+    db_agg_record(&sched->agg_stats, length, sched->mtu, now_us - oldest_us);
+    return length;
+}
+
+/**
+ * @param sched The scheduler
+ * @param now_us db_clock_us()
+ * @return Microseconds until db_mav_sched_next_packet() should be called again. -1 if nothing is waiting
+ */
+long db_mav_sched_timeout_us(const db_mav_sched_t *sched, uint64_t now_us) {
+    if (sched->pending_bytes == 0) return -1;
+    uint64_t due = next_due(sched, sched->pending_bytes >= sched->mtu);
+    long timeout = due > now_us ? (long) (due - now_us) : 0;
+    if (sched->budget_bytes_per_us > 0) {
+        double missing = required_tokens(sched->command.tail != sched->command.head) - sched->tokens
+                         - (double) (now_us - sched->tokens_updated_us) * sched->budget_bytes_per_us;
+        if (missing > 0 && (long) (missing / sched->budget_bytes_per_us) + 1 > timeout)
+            timeout = (long) (missing / sched->budget_bytes_per_us) + 1;
+    }
+    return timeout;
+}
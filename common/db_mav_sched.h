@@ -0,0 +1,95 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#ifndef DRONEBRIDGE_DB_MAV_SCHED_H
+#define DRONEBRIDGE_DB_MAV_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "shared_memory.h"
+
+#define DB_MAV_SCHED_MAX_FRAME      280     // MAVLink v2 signed frame with 255 bytes payload
+#define DB_MAV_SCHED_STATE_SLOTS    64      // distinct (system, component, message) state streams
+#define DB_MAV_SCHED_QUEUE_LENGTH   32      // frames in the command and in the bulk queue
+#define DB_MAV_SCHED_MAX_RATES      32      // per message ID rate caps
+#define DB_MAV_SCHED_DEADLINE_MS    20      // default max. time state messages wait for more data to fill a packet
+#define DB_MAV_SCHED_PACKET_COST    64      // airtime of the radiotap/802.11/DroneBridge headers in bytes
+
+#define DB_MAV_CLASS_COMMAND    0   // acks, commands, text, mission & parameter protocol. Sent first, never dropped
+#define DB_MAV_CLASS_STATE      1   // periodic state. A newer message replaces a not yet sent one
+#define DB_MAV_CLASS_BULK       2   // everything else. First in, first out
+#define DB_MAV_CLASS_CNT        3
+
+typedef struct {
+    uint16_t length;
+    uint64_t queued_us;
+    uint8_t frame[DB_MAV_SCHED_MAX_FRAME];
+} db_mav_frame_t;
+
+typedef struct {
+    uint32_t key;               // message ID << 16 | system ID << 8 | component ID
+    bool pending;               // holds a message that was not sent yet
+    uint64_t pending_since_us;  // arrival of the oldest message that was replaced by the pending one
+    uint64_t sent_us;           // last time a message of this stream was sent
+    uint32_t min_interval_us;   // rate cap. 0 = no cap
+    db_mav_frame_t message;
+} db_mav_state_slot_t;
+
+typedef struct {
+    db_mav_frame_t frames[DB_MAV_SCHED_QUEUE_LENGTH];
+    uint32_t head, tail;
+} db_mav_queue_t;
+
+typedef struct {
+    uint32_t msg_id;
+    uint32_t min_interval_us;
+    uint64_t last_accepted_us;  // for messages that are not coalesced
+} db_mav_rate_t;
+
+/**
+ * Decides which MAVLink messages of the flight controller are sent to the ground station and when. Messages are
+ * classified by their ID (see db_mav_sched_classify()), packed into DroneBridge packets of up to mtu bytes and only
+ * sent while the airtime budget allows it. A packet goes out once it is full or the deadline of the class of one of
+ * the waiting messages expired. Command messages have no deadline, they are sent right away.
+ */
+typedef struct {
+    uint16_t mtu;
+    double budget_bytes_per_us;     // 0 = unlimited
+    double tokens;                  // bytes that may be sent right now. Token bucket of the airtime budget
+    uint64_t tokens_updated_us;
+    uint32_t deadline_us[DB_MAV_CLASS_CNT];
+    uint32_t pending_bytes;
+    db_mav_queue_t command, bulk;
+    db_mav_state_slot_t state[DB_MAV_SCHED_STATE_SLOTS];
+    int state_cnt;
+    db_mav_rate_t rates[DB_MAV_SCHED_MAX_RATES];
+    int rate_cnt;
+    db_mav_sched_stats_t stats;
+    db_agg_stats_t agg_stats;
+} db_mav_sched_t;
+
+void db_mav_sched_init(db_mav_sched_t *sched, uint16_t mtu, uint32_t budget_kbit, uint32_t deadline_ms);
+int db_mav_sched_parse_rates(db_mav_sched_t *sched, const char *spec);
+int db_mav_sched_classify(uint32_t msg_id);
+void db_mav_sched_add(db_mav_sched_t *sched, const uint8_t *frame, uint16_t length, uint64_t now_us);
+uint16_t db_mav_sched_next_packet(db_mav_sched_t *sched, uint8_t *packet, uint64_t now_us);
+long db_mav_sched_timeout_us(const db_mav_sched_t *sched, uint64_t now_us);
+
+#endif //DRONEBRIDGE_DB_MAV_SCHED_H
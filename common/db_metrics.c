@@ -0,0 +1,133 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "db_metrics.h"
+#include "db_clock_sync.h"
+#include "db_common.h"
+
+#define VCIO_IOCTL_PROPERTY     _IOWR(100, 0, char *)
+#define VCIO_TAG_GET_THROTTLED  0x00030046
+
+/**
+ * @param sampler Sampler to init. Opens all available sources
+ * @param interval_ms Time between two samples
+ */
+void db_metrics_open(db_metrics_t *sampler, uint32_t interval_ms) {
+    memset(sampler, 0, sizeof(db_metrics_t));
+    sampler->interval_us = interval_ms * 1000;
+    sampler->stat_fd = open(DB_METRICS_PROC_STAT, O_RDONLY | O_CLOEXEC);
+    sampler->thermal_fd = open(DB_METRICS_THERMAL, O_RDONLY | O_CLOEXEC);
+    sampler->throttled_fd = open(DB_METRICS_THROTTLED, O_RDONLY | O_CLOEXEC);
+    sampler->vcio_fd = sampler->throttled_fd < 0 ? open(DB_METRICS_VCIO, O_RDWR | O_CLOEXEC) : -1;
+    if (sampler->stat_fd < 0)
+        LOG_SYS_STD(LOG_ERR, "DB_METRICS: Could not open %s - no CPU load\n", DB_METRICS_PROC_STAT);
+    if (sampler->throttled_fd < 0 && sampler->vcio_fd < 0)
+        LOG_SYS_STD(LOG_NOTICE, "DB_METRICS: No firmware interface found - no under-voltage detection\n");
+}
+
+/**
+ * Read a small file from the start. Keeps the file open
+ *
+ * @return Number of bytes read. 0 on error
+ */
+static ssize_t read_file(int fd, char *buf, size_t size) {
+    if (fd < 0) return 0;
+    ssize_t length = pread(fd, buf, size - 1, 0);
+    if (length <= 0) return 0;
+    buf[length] = '\0';
+    return length;
+}
+
+/**
+ * @return CPU load since the previous call in %. Aggregated "cpu" line of /proc/stat
+ */
+static uint8_t sample_cpu_load(db_metrics_t *sampler) {
+    char buf[256];
+    if (read_file(sampler->stat_fd, buf, sizeof(buf)) == 0 || strncmp(buf, "cpu ", 4) != 0) return 0;
+    uint64_t values[8] = {0};   // user nice system idle iowait irq softirq steal
+    char *pos = buf + 4;
+    for (int i = 0; i < 8; i++)
+        values[i] = strtoull(pos, &pos, 10);
+    uint64_t idle = values[3] + values[4];
+    uint64_t busy = values[0] + values[1] + values[2] + values[5] + values[6] + values[7];
+    uint64_t d_busy = busy - sampler->cpu_busy, d_total = busy + idle - sampler->cpu_total;
+    bool first = sampler->cpu_total == 0;
+    sampler->cpu_busy = busy;
+    sampler->cpu_total = busy + idle;
+    if (first || d_total == 0) return 0;
+    return (uint8_t) (d_busy * 100 / d_total);
+}
+
+/**
+ * @return Firmware throttled flags of the Raspberry Pi. 0 if unavailable
+ */
+static uint32_t sample_throttled(db_metrics_t *sampler) {
+    char buf[32];
+    if (read_file(sampler->throttled_fd, buf, sizeof(buf)) > 0)
+        return (uint32_t) strtoul(buf, NULL, 16);
+    if (sampler->vcio_fd >= 0) {
+        // property message: buffer size, request code, tag, value buffer size, tag request code, value, end tag
+        uint32_t msg[7] = {sizeof(msg), 0, VCIO_TAG_GET_THROTTLED, 4, 0, 0, 0};
+        if (ioctl(sampler->vcio_fd, VCIO_IOCTL_PROPERTY, msg) == 0)
+            return msg[5];
+    }
+    return 0;
+}
+
+/**
+ * Take a new sample if the interval expired
+ *
+ * @param sampler The sampler
+ * @param now_us db_clock_us()
+ * @return true if sampler->metrics was updated
+ */
+bool db_metrics_sample(db_metrics_t *sampler, uint64_t now_us) {
+    if (now_us < sampler->next_sample_us) return false;
+    sampler->next_sample_us = now_us + sampler->interval_us;
+    char buf[32];
+    sampler->metrics.cpu_load = sample_cpu_load(sampler);
+    if (read_file(sampler->thermal_fd, buf, sizeof(buf)) > 0)
+        sampler->metrics.temp = (uint8_t) (strtol(buf, NULL, 10) / 1000);
+    sampler->metrics.throttled = sample_throttled(sampler);
+    sampler->metrics.undervolt = (uint8_t) (sampler->metrics.throttled & DB_METRICS_UNDERVOLT_NOW ? 1 : 0);
+    sampler->metrics.sample_time_us = (uint32_t) (db_clock_us() - now_us);
+    return true;
+}
+
+/**
+ * @return Microseconds until the next sample is due
+ */
+long db_metrics_timeout_us(const db_metrics_t *sampler, uint64_t now_us) {
+    return sampler->next_sample_us > now_us ? (long) (sampler->next_sample_us - now_us) : 0;
+}
+
+void db_metrics_close(db_metrics_t *sampler) {
+    int *fds[] = {&sampler->stat_fd, &sampler->thermal_fd, &sampler->throttled_fd, &sampler->vcio_fd};
+    for (int i = 0; i < 4; i++) {
+        if (*fds[i] >= 0) close(*fds[i]);
+        *fds[i] = -1;
+    }
+}
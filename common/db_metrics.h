@@ -0,0 +1,56 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#ifndef DRONEBRIDGE_DB_METRICS_H
+#define DRONEBRIDGE_DB_METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "shared_memory.h"
+
+#define DB_METRICS_INTERVAL_MS      1000
+#define DB_METRICS_PROC_STAT        "/proc/stat"
+#define DB_METRICS_THERMAL          "/sys/class/thermal/thermal_zone0/temp"
+#define DB_METRICS_THROTTLED        "/sys/devices/platform/soc/soc:firmware/get_throttled"  // RPi firmware driver
+#define DB_METRICS_VCIO             "/dev/vcio"     // RPi VideoCore mailbox. Used if the sysfs file is missing
+#define DB_METRICS_UNDERVOLT_NOW    0x1             // bit of the firmware throttled flags
+
+/**
+ * System metrics sampler. All files stay open and are read with pread(). Nothing gets forked, so sampling does not
+ * disturb the RC/telemetry loop of the module using it. -1 for every source that is not available on this system.
+ */
+typedef struct {
+    int stat_fd;
+    int thermal_fd;
+    int throttled_fd;
+    int vcio_fd;
+    uint64_t cpu_busy;          // jiffies of the previous sample
+    uint64_t cpu_total;
+    uint32_t interval_us;
+    uint64_t next_sample_us;
+    db_sys_metrics_t metrics;   // result of the last sample
+} db_metrics_t;
+
+void db_metrics_open(db_metrics_t *sampler, uint32_t interval_ms);
+bool db_metrics_sample(db_metrics_t *sampler, uint64_t now_us);
+long db_metrics_timeout_us(const db_metrics_t *sampler, uint64_t now_us);
+void db_metrics_close(db_metrics_t *sampler);
+
+#endif //DRONEBRIDGE_DB_METRICS_H
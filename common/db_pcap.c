@@ -0,0 +1,341 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * pcap backend for DroneBridge raw sockets. Modules keep using a plain socket file descriptor (select(), recv(),
+ * get_db_payload(), get_rssi()). Instead of a monitor mode interface a worker thread feeds that descriptor via an
+ * AF_UNIX datagram socket pair:
+ *  - Replay: Frames of a pcap file (LINKTYPE_IEEE802_11_RADIOTAP) are fed at original, scaled or max. speed. The
+ *    regular DroneBridge BPF filter is attached to the socket, so only frames for the module pass. Sent frames get
+ *    discarded. Once the file is replayed the process receives SIGINT so that modules shut down as usual.
+ *  - Capture: Frames received on the live interface are recorded to a pcap file and forwarded. Sent frames are
+ *    injected via the live interface.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include "db_pcap.h"
+#include "db_protocol.h"
+#include "db_raw_receive.h"
+#include "db_common.h"
+
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAP_SNAPLEN            65535
+#define PCAP_FLUSH_INTERVAL_S   1
+
+typedef struct {
+    FILE *file;
+    int peer;                       // our end of the socket pair
+    double speed;                   // 1 = original speed, DB_PCAP_SPEED_MAX = max. speed
+    int swapped;                    // file has different byte order
+    int nsec;                       // timestamps in nanoseconds
+    char filepath[256];
+} pcap_replay_t;
+
+typedef struct {
+    FILE *file;
+    int peer;
+    int raw_socket;
+    struct sockaddr_ll raw_socket_addr;
+    char filepath[256];
+} pcap_capture_t;
+
+static int active_replays = 0;
+
+static uint32_t swap32(uint32_t v) {
+    return ((v & 0xff) << 24) | ((v & 0xff00) << 8) | ((v & 0xff0000) >> 8) | ((v & 0xff000000) >> 24);
+}
+
+static long long monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Create a new pcap file with radiotap link type
+ *
+ * @param filepath Path of the file. Gets overwritten
+ * @return The opened file or NULL on error
+ */
+FILE *db_pcap_create_file(const char *filepath) {
+    FILE *file = fopen(filepath, "wb");
+    if (file == NULL) {
+        LOG_SYS_STD(LOG_ERR, "DB_PCAP: Could not create %s: %s\n", filepath, strerror(errno));
+        return NULL;
+    }
+    pcap_file_header_t hdr = {.magic_number = PCAP_MAGIC_USEC, .version_major = 2, .version_minor = 4,
+            .thiszone = 0, .sigfigs = 0, .snaplen = PCAP_SNAPLEN, .network = LINKTYPE_IEEE802_11_RADIOTAP};
+    if (fwrite(&hdr, sizeof(hdr), 1, file) != 1) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * Append a frame (including radiotap header) to a pcap file. Uses the current system time as timestamp.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int db_pcap_write_record(FILE *file, const uint8_t *frame, uint32_t length) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    pcap_record_header_t rec = {.ts_sec = (uint32_t) ts.tv_sec, .ts_usec = (uint32_t) (ts.tv_nsec / 1000),
+            .incl_len = length, .orig_len = length};
+    if (fwrite(&rec, sizeof(rec), 1, file) != 1 || fwrite(frame, 1, length, file) != length)
+        return -1;
+    return 0;
+}
+
+/**
+ * Receive and discard everything the module sent via the replay socket
+ */
+static void drain_peer(int peer, uint8_t *buf) {
+    while (recv(peer, buf, MAX_DB_DATA_LENGTH, MSG_DONTWAIT) > 0) {}
+}
+
+static void *replay_thread(void *arg) {
+    pcap_replay_t *replay = arg;
+    sigset_t all_signals;  // signals are for the main thread
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, NULL);
+    uint8_t tx_buf[MAX_DB_DATA_LENGTH];
+    uint8_t *frame = malloc(PCAP_SNAPLEN);
+    pcap_record_header_t rec;
+    long long start_us = monotonic_us(), first_ts_us = -1;
+    uint32_t replayed = 0, skipped = 0;
+
+    while (frame != NULL && fread(&rec, sizeof(rec), 1, replay->file) == 1) {
+        if (replay->swapped) {
+            rec.ts_sec = swap32(rec.ts_sec);
+            rec.ts_usec = swap32(rec.ts_usec);
+            rec.incl_len = swap32(rec.incl_len);
+        }
+        if (rec.incl_len > PCAP_SNAPLEN) {
+            LOG_SYS_STD(LOG_ERR, "DB_PCAP: Corrupt record in %s. Stopping replay\n", replay->filepath);
+            break;
+        }
+        if (fread(frame, 1, rec.incl_len, replay->file) != rec.incl_len)
+            break;
+        if (rec.incl_len < 4 || (uint32_t) (frame[2] | (frame[3] << 8)) >= rec.incl_len) {
+            skipped++;  // no valid radiotap header
+            continue;
+        }
+        long long ts_us = rec.ts_sec * 1000000LL + (replay->nsec ? rec.ts_usec / 1000 : rec.ts_usec);
+        if (first_ts_us < 0) first_ts_us = ts_us;
+
+        long long due_us = start_us;
+        if (replay->speed > DB_PCAP_SPEED_MAX)
+            due_us += (long long) ((ts_us - first_ts_us) / replay->speed);
+        struct pollfd pfd = {.fd = replay->peer, .events = POLLIN | POLLOUT};
+        for (;;) {
+            long long wait_us = due_us - monotonic_us();
+            pfd.events = (short) (wait_us > 0 ? POLLIN : POLLIN | POLLOUT);
+            int timeout_ms = wait_us > 0 ? (int) ((wait_us + 999) / 1000) : -1;
+            if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR)
+                break;
+            if (pfd.revents & POLLIN)
+                drain_peer(replay->peer, tx_buf);
+            if (pfd.revents & (POLLERR | POLLHUP))
+                goto end;
+            if (wait_us <= 0 && (pfd.revents & POLLOUT))
+                break;
+        }
+        if (send(replay->peer, frame, rec.incl_len, MSG_DONTWAIT) < 0 && errno != EAGAIN)
+            break;
+        replayed++;
+    }
+    end:
+    LOG_SYS_STD(LOG_NOTICE, "DB_PCAP: Finished replay of %s (%u frames, %u skipped)\n", replay->filepath, replayed,
+                skipped);
+    fclose(replay->file);
+    free(frame);
+    // give the module the chance to read all queued frames before terminating it
+    int unread = 0;
+    for (int i = 0; i < 500 && ioctl(replay->peer, SIOCOUTQ, &unread) == 0 && unread > 0; i++)
+        usleep(10000);
+    if (__sync_sub_and_fetch(&active_replays, 1) == 0)
+        kill(getpid(), SIGINT); // all replays done. Terminate the module like on user request
+    return NULL;
+}
+
+/**
+ * Open a replay of a pcap file as a DroneBridge raw socket
+ *
+ * @param spec <file>[@<speed>] where speed is a replay speed factor (1 = original timing) or "max"
+ * @param comm_id The communication ID that we filter for
+ * @param recv_direction Direction of frames that pass the filter
+ * @param port DroneBridge port that passes the filter
+ * @return File descriptor to read the frames from or -1 on error
+ */
+int db_pcap_open_replay(const char *spec, uint8_t comm_id, uint8_t recv_direction, uint8_t port) {
+    pcap_replay_t *replay = calloc(1, sizeof(pcap_replay_t));
+    if (replay == NULL) return -1;
+    strncpy(replay->filepath, spec, sizeof(replay->filepath) - 1);
+    replay->speed = 1;
+    char *speed_str = strrchr(replay->filepath, DB_PCAP_CAPTURE_SEPARATOR);
+    if (speed_str != NULL) {
+        *speed_str++ = '\0';
+        replay->speed = (strcmp(speed_str, "max") == 0) ? DB_PCAP_SPEED_MAX : strtod(speed_str, NULL);
+    }
+    replay->file = fopen(replay->filepath, "rb");
+    pcap_file_header_t hdr;
+    if (replay->file == NULL || fread(&hdr, sizeof(hdr), 1, replay->file) != 1) {
+        LOG_SYS_STD(LOG_ERR, "DB_PCAP: Could not read pcap file %s\n", replay->filepath);
+        goto error;
+    }
+    if (hdr.magic_number == PCAP_MAGIC_USEC || hdr.magic_number == PCAP_MAGIC_NSEC) {
+        replay->nsec = hdr.magic_number == PCAP_MAGIC_NSEC;
+    } else if (hdr.magic_number == swap32(PCAP_MAGIC_USEC) || hdr.magic_number == swap32(PCAP_MAGIC_NSEC)) {
+        replay->swapped = 1;
+        replay->nsec = hdr.magic_number == swap32(PCAP_MAGIC_NSEC);
+        hdr.network = swap32(hdr.network);
+    } else {
+        LOG_SYS_STD(LOG_ERR, "DB_PCAP: %s is not a pcap file\n", replay->filepath);
+        goto error;
+    }
+    if (hdr.network != LINKTYPE_IEEE802_11_RADIOTAP) {
+        LOG_SYS_STD(LOG_ERR, "DB_PCAP: %s has link type %u. Only radiotap (%i) is supported\n", replay->filepath,
+                    hdr.network, LINKTYPE_IEEE802_11_RADIOTAP);
+        goto error;
+    }
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_PCAP: Could not create socket pair: %s\n", strerror(errno));
+        goto error;
+    }
+    replay->peer = sv[1];
+    // the kernel also runs socket filters on AF_UNIX datagrams. Filter before any frame gets replayed
+    if (setBPF(sv[0], comm_id, recv_direction, port) < 0) {
+        close(sv[1]);
+        goto error;
+    }
+    __sync_add_and_fetch(&active_replays, 1);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, replay_thread, replay) != 0) {
+        __sync_sub_and_fetch(&active_replays, 1);
+        close(sv[0]);
+        close(sv[1]);
+        goto error;
+    }
+    pthread_detach(thread);
+    LOG_SYS_STD(LOG_NOTICE, "DB_PCAP: Replaying %s at %s speed\n", replay->filepath,
+                replay->speed > DB_PCAP_SPEED_MAX ? speed_str ? speed_str : "original" : "max.");
+    return sv[0];
+
+    error:
+    if (replay->file) fclose(replay->file);
+    free(replay);
+    return -1;
+}
+
+static void *capture_thread(void *arg) {
+    pcap_capture_t *capture = arg;
+    sigset_t all_signals;  // signals are for the main thread
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, NULL);
+    uint8_t buf[PCAP_SNAPLEN];
+    uint32_t captured = 0;
+    time_t last_flush = time(NULL);
+    struct pollfd pfds[2] = {{.fd = capture->raw_socket, .events = POLLIN},
+                             {.fd = capture->peer, .events = POLLIN}};
+    for (;;) {
+        if (poll(pfds, 2, PCAP_FLUSH_INTERVAL_S * 1000) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfds[0].revents & POLLIN) {
+            ssize_t l = recv(capture->raw_socket, buf, sizeof(buf), 0);
+            if (l > 0) {
+                if (db_pcap_write_record(capture->file, buf, (uint32_t) l) == 0)
+                    captured++;
+                // behave like a raw socket with a full receive buffer if the module does not keep up
+                send(capture->peer, buf, (size_t) l, MSG_DONTWAIT);
+            }
+        }
+        if (pfds[1].revents & POLLIN) {
+            ssize_t l = recv(capture->peer, buf, sizeof(buf), 0);
+            if (l > 0 && sendto(capture->raw_socket, buf, (size_t) l, 0,
+                                (struct sockaddr *) &capture->raw_socket_addr, sizeof(struct sockaddr_ll)) <= 0)
+                LOG_SYS_STD(LOG_ERR, "DB_PCAP: Send failed (monitor): %s\n", strerror(errno));
+        }
+        if ((pfds[1].revents & (POLLERR | POLLHUP)))
+            break;
+        if (time(NULL) - last_flush >= PCAP_FLUSH_INTERVAL_S) {
+            fflush(capture->file);
+            last_flush = time(NULL);
+        }
+    }
+    LOG_SYS_STD(LOG_NOTICE, "DB_PCAP: Captured %u frames to %s\n", captured, capture->filepath);
+    fclose(capture->file);
+    free(capture);
+    return NULL;
+}
+
+/**
+ * Record all frames received on a live DroneBridge raw socket. The returned descriptor replaces the raw socket
+ * for the module: frames received on it and frames sent through it are forwarded to/from the raw socket.
+ *
+ * @param raw_socket Configured raw socket (incl. BPF filter)
+ * @param raw_socket_addr Address used to send via the raw socket
+ * @param filepath pcap file to write
+ * @return File descriptor to use instead of raw_socket or -1 on error
+ */
+int db_pcap_open_capture(int raw_socket, struct sockaddr_ll *raw_socket_addr, const char *filepath) {
+    pcap_capture_t *capture = calloc(1, sizeof(pcap_capture_t));
+    if (capture == NULL) return -1;
+    strncpy(capture->filepath, filepath, sizeof(capture->filepath) - 1);
+    capture->raw_socket = raw_socket;
+    capture->raw_socket_addr = *raw_socket_addr;
+    if ((capture->file = db_pcap_create_file(filepath)) == NULL) {
+        free(capture);
+        return -1;
+    }
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_PCAP: Could not create socket pair: %s\n", strerror(errno));
+        fclose(capture->file);
+        free(capture);
+        return -1;
+    }
+    capture->peer = sv[1];
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, capture_thread, capture) != 0) {
+        close(sv[0]);
+        close(sv[1]);
+        fclose(capture->file);
+        free(capture);
+        return -1;
+    }
+    pthread_detach(thread);
+    LOG_SYS_STD(LOG_NOTICE, "DB_PCAP: Capturing received frames to %s\n", filepath);
+    return sv[0];
+}
@@ -0,0 +1,55 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#ifndef DRONEBRIDGE_DB_PCAP_H
+#define DRONEBRIDGE_DB_PCAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <linux/if_packet.h>
+
+#define DB_PCAP_PREFIX              "pcap:" // pcap:<file>[@<speed>] replays a capture instead of opening an interface
+#define DB_PCAP_CAPTURE_SEPARATOR   '@'     // <interface>@<file> records all received frames of the interface
+#define DB_PCAP_SPEED_MAX           0.0     // replay as fast as the consumer reads
+
+#define LINKTYPE_IEEE802_11_RADIOTAP 127
+
+typedef struct {
+    uint32_t magic_number;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} __attribute__((packed)) pcap_file_header_t;
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_usec;   // nanoseconds in case of a nanosecond pcap file
+    uint32_t incl_len;
+    uint32_t orig_len;
+} __attribute__((packed)) pcap_record_header_t;
+
+FILE *db_pcap_create_file(const char *filepath);
+int db_pcap_write_record(FILE *file, const uint8_t *frame, uint32_t length);
+int db_pcap_open_replay(const char *spec, uint8_t comm_id, uint8_t recv_direction, uint8_t port);
+int db_pcap_open_capture(int raw_socket, struct sockaddr_ll *raw_socket_addr, const char *filepath);
+
+#endif //DRONEBRIDGE_DB_PCAP_H
@@ -42,12 +42,15 @@ typedef u32 __le32;
 #define RADIOTAP_LENGTH         13
 #define DB_RAW_V2_HEADER_LENGTH 10
 #define DB_MAX_ADAPTERS 4
+#define DB_MAX_IFNAME_LENGTH    256     // interface names may also be backend specs like pcap:<file>
 
 #define MSP_DATA_LENTH          34      // size of MSP v1
 #define MSP_V2_DATA_LENGTH      37      // size of MSP v2 frame
 #define DB_RC_DATA_LENGTH		16		// size of DB_RC frame
 #define DATA_UNI_LENGTH         2048	// max payload length for raw protocol
 #define DB_RAW_OFFSET			14      // when adhering the 802.11 header the payload is offset to not be overwritten by SQN
+#define DB_RAW_V2_EXT_FLAG		0x80	// set in payload_length[1]: header extension follows the DB raw v2 header
+#define DB_RAW_V2_EXT_LENGTH	4		// extension: 32 bit sequence number (little endian). Lies within DB_RAW_OFFSET
 #define MAX_DB_DATA_LENGTH		(RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH + DATA_UNI_LENGTH) // max length of a db raw packet
 #define ETHER_TYPE              0x88ab
 
@@ -73,6 +76,9 @@ typedef u32 __le32;
 #define DB_PORT_STATUS		0x05
 #define DB_PORT_PROXY		0x06
 #define DB_PORT_RC			0x07
+#define DB_PORT_NONE		0x00  // setBPF() only: no frame passes. For sockets that only send
+#define DB_PORT_ANY			0xFF  // setBPF() only: frames of all ports pass (link daemon)
+#define DB_PORT_CNT			8	  // size of arrays indexed by port
 
 #define DB_DIREC_DRONE      0x01 // packet to/for drone
 #define DB_DIREC_GROUND   	0x03 // packet to/for ground station
@@ -139,4 +145,15 @@ typedef struct {
 	uint16_t channels[NUM_CHANNELS];
 } __attribute__((packed)) db_rc_msg_t;
 
+// Two-way clock offset measurement between ground station and UAV. Sent via DB_PORT_STATUS in both directions.
+// Timestamps are CLOCK_MONOTONIC in microseconds of the respective side
+typedef struct {
+	uint8_t ident[2];
+	uint8_t message_id; // 4 for clock sync request (ground -> UAV); 5 for clock sync response (UAV -> ground)
+	uint8_t sync_id;    // echoed by the UAV. Identifies the request
+	uint64_t t1;        // ground: request sent
+	uint64_t t2;        // UAV: request received
+	uint64_t t3;        // UAV: response sent
+} __attribute__((packed)) db_clock_sync_msg_t;
+
 #endif // DB_PROTOCOL_H_INCLUDED
@@ -0,0 +1,117 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * Radiotap parsing with cached layouts. An adapter (driver) sends the same radiotap layout with every frame. Instead
+ * of walking the presence bitmaps and alignment rules with the radiotap iterator for every frame, the iterator runs
+ * once per layout and the offsets of all fields get stored. Following frames with identical presence bitmaps and
+ * header length are read with direct loads at the stored offsets. A different layout is parsed by the iterator again.
+ *
+ * Usage:
+ *  const db_radiotap_layout_t *layout = db_radiotap_get_layout(&cache, frame, radiotap_length);
+ *  for (int i = 0; layout != NULL && i < layout->num_fields; i++)
+ *      switch (layout->fields[i].index) { case IEEE80211_RADIOTAP_FLAGS: flags = frame[layout->fields[i].offset]; }
+ */
+
+#include <string.h>
+#include <errno.h>
+#include "db_radiotap.h"
+#include "db_common.h"
+#include "radiotap/radiotap_iter.h"
+
+/**
+ * @return Number of presence bitmap words or -1 if there are more than DB_RADIOTAP_MAX_PRESENT or the header is invalid
+ */
+static inline int count_present_words(const uint8_t *radiotap_header, int length) {
+    int num_present = 1;
+    // bit 31 (IEEE80211_RADIOTAP_EXT) of a bitmap word means another bitmap word follows
+    while (radiotap_header[4 + num_present * 4 - 1] & 0x80) {
+        if (++num_present > DB_RADIOTAP_MAX_PRESENT || 4 + num_present * 4 > length)
+            return -1;
+    }
+    return num_present;
+}
+
+/**
+ * Parse the header with the radiotap iterator and store the offsets of all fields
+ *
+ * @return 0 on success or -1 if the header is invalid or the layout does not fit into db_radiotap_layout_t
+ */
+static int compile_layout(db_radiotap_layout_t *layout, const uint8_t *radiotap_header, int length,
+                          int num_present) {
+    struct ieee80211_radiotap_iterator rti;
+    int ret;
+    if (ieee80211_radiotap_iterator_init(&rti, (struct ieee80211_radiotap_header *) radiotap_header, length,
+                                         NULL) != 0)
+        return -1;
+    layout->it_len = (uint16_t) (radiotap_header[2] | (radiotap_header[3] << 8));
+    layout->num_present = (uint8_t) num_present;
+    memcpy(layout->present, radiotap_header + 4, (size_t) num_present * 4);
+    layout->num_fields = 0;
+    while ((ret = ieee80211_radiotap_iterator_next(&rti)) == 0) {
+        if (layout->num_fields == DB_RADIOTAP_MAX_FIELDS)
+            return -1;
+        layout->fields[layout->num_fields].index = (uint8_t) rti.this_arg_index;
+        layout->fields[layout->num_fields].offset = (uint16_t) (rti.this_arg - radiotap_header);
+        layout->num_fields++;
+    }
+    return ret == -ENOENT ? 0 : -1;
+}
+
+/**
+ * Get the layout of a radiotap header. Compiles the layout using the radiotap iterator if it is not cached yet.
+ * Use one cache per adapter. A cache is not thread safe.
+ *
+ * @param cache Layout cache
+ * @param radiotap_header Start of the received frame
+ * @param length Length of the radiotap header (it_len)
+ * @return Layout describing all fields of the header or NULL if the header is invalid
+ */
+const db_radiotap_layout_t *db_radiotap_get_layout(db_radiotap_cache_t *cache, const uint8_t *radiotap_header,
+                                                   int length) {
+    if (length < 8 || radiotap_header[0] != 0)
+        return NULL;
+    uint16_t it_len = (uint16_t) (radiotap_header[2] | (radiotap_header[3] << 8));
+    for (int i = 0; i < cache->num_layouts; i++) {
+        db_radiotap_layout_t *layout = &cache->layouts[i];
+        if (layout->it_len == it_len && it_len <= length &&
+            memcmp(layout->present, radiotap_header + 4, (size_t) layout->num_present * 4) == 0) {
+            cache->hits++;
+            return layout;
+        }
+    }
+    cache->misses++;
+    int num_present = count_present_words(radiotap_header, length);
+    if (num_present < 0)
+        return NULL;
+    db_radiotap_layout_t *layout;
+    if (cache->num_layouts < DB_RADIOTAP_CACHE_SIZE) {
+        layout = &cache->layouts[cache->num_layouts];
+    } else {
+        layout = &cache->layouts[cache->next_replace];
+        cache->next_replace = (uint8_t) ((cache->next_replace + 1) % DB_RADIOTAP_CACHE_SIZE);
+    }
+    if (compile_layout(layout, radiotap_header, length, num_present) < 0) {
+        layout->it_len = 0; // slot holds no valid layout
+        return NULL;
+    }
+    if (cache->num_layouts < DB_RADIOTAP_CACHE_SIZE)
+        cache->num_layouts++;
+    return layout;
+}
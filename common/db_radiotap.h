@@ -0,0 +1,57 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#ifndef DRONEBRIDGE_DB_RADIOTAP_H
+#define DRONEBRIDGE_DB_RADIOTAP_H
+
+#include <stdint.h>
+#include "db_protocol.h"
+
+#define DB_RADIOTAP_MAX_PRESENT     8               // presence bitmap words (it_present + extended bitmaps)
+#define DB_RADIOTAP_MAX_FIELDS      48
+#define DB_RADIOTAP_CACHE_SIZE      DB_MAX_ADAPTERS // layouts kept per cache
+
+typedef struct {
+    uint8_t index;      // IEEE80211_RADIOTAP_* (same as this_arg_index of the iterator)
+    uint16_t offset;    // of the field data from the start of the radiotap header
+} db_radiotap_field_t;
+
+/**
+ * All fields of one radiotap layout in the order the iterator returns them. Identified by header length and the
+ * presence bitmaps.
+ */
+typedef struct {
+    uint16_t it_len;
+    uint8_t num_present;
+    uint8_t present[DB_RADIOTAP_MAX_PRESENT * 4];
+    uint8_t num_fields;
+    db_radiotap_field_t fields[DB_RADIOTAP_MAX_FIELDS];
+} db_radiotap_layout_t;
+
+typedef struct {
+    uint8_t num_layouts;
+    uint8_t next_replace;
+    uint32_t hits, misses;
+    db_radiotap_layout_t layouts[DB_RADIOTAP_CACHE_SIZE];
+} db_radiotap_cache_t;
+
+const db_radiotap_layout_t *db_radiotap_get_layout(db_radiotap_cache_t *cache, const uint8_t *radiotap_header,
+                                                   int length);
+
+#endif //DRONEBRIDGE_DB_RADIOTAP_H
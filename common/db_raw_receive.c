@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <sys/socket.h>
 #include <string.h>
 #include <linux/filter.h> // BPF
@@ -32,6 +33,7 @@
 #include <unistd.h>
 #include "db_protocol.h"
 #include "radiotap/radiotap_iter.h"
+#include "db_radiotap.h"
 
 #define ARRAY_SIZE(arr) (sizeof(arr)/sizeof((arr)[0]))
 int expected_seq_num;
@@ -42,7 +44,8 @@ int expected_seq_num;
  * @param newsocket The socket file descriptor on which the BPF filter should be set
  * @param new_comm_id The communication ID that we filter for
  * @param direction Packets with what kind of directions (DB_DIREC_DRONE or DB_V2_DIREC_GROUND) are allowed to pass the filter
- * @param port The port of the module using this function. See db_protocol.h (DB_PORT_CONTROLLER, DB_PORT_COMM, ...)
+ * @param port The port of the module using this function. See db_protocol.h (DB_PORT_CONTROLLER, DB_PORT_COMM, ...).
+ * DB_PORT_ANY lets frames of all ports pass
  * @return The socket with set BPF filter
  */
 int setBPF(int newsocket, const uint8_t new_comm_id, uint8_t direction, uint8_t port) {
@@ -69,6 +72,8 @@ int setBPF(int newsocket, const uint8_t new_comm_id, uint8_t direction, uint8_t
     // override some of the filter settings
     dest_filter[11].k = (uint32_t) ((0x00 << 24) | (0x00 << 16) | (direction << 8) | new_comm_id);
     dest_filter[13].k = (uint32_t) port;
+    if (port == DB_PORT_ANY)
+        dest_filter[12] = dest_filter[14]; // accept instead of loading the port
 
     struct sock_fprog bpf =
             {
@@ -172,11 +177,14 @@ uint16_t get_db_payload(uint8_t *receive_buffer, ssize_t receive_length, uint8_t
                         uint16_t *radiotap_length) {
     *radiotap_length = receive_buffer[2] | (receive_buffer[3] << 8);
     *seq_num = receive_buffer[*radiotap_length + 9];
+    uint8_t length_msb = receive_buffer[*radiotap_length + 8];
     uint16_t payload_length =
-            receive_buffer[*radiotap_length + 7] | (receive_buffer[*radiotap_length + 8] << 8); // DB_v2
+            receive_buffer[*radiotap_length + 7] | ((length_msb & ~DB_RAW_V2_EXT_FLAG) << 8); // DB_v2
+    int ext_length = (length_msb & DB_RAW_V2_EXT_FLAG) ? DB_RAW_V2_EXT_LENGTH : 0;
     // estimate if the packet was sent with offset payload. 4 FCS bytes may or may not be supplied at end of frame.
-    if ((receive_length - *radiotap_length - DB_RAW_V2_HEADER_LENGTH) <= (payload_length + 4))
-        memcpy(payload_buffer, &receive_buffer[*radiotap_length + DB_RAW_V2_HEADER_LENGTH], payload_length);
+    if ((receive_length - *radiotap_length - DB_RAW_V2_HEADER_LENGTH - ext_length) <= (payload_length + 4))
+        memcpy(payload_buffer, &receive_buffer[*radiotap_length + DB_RAW_V2_HEADER_LENGTH + ext_length],
+               payload_length);
     else if (payload_length <= DATA_UNI_LENGTH)
         memcpy(payload_buffer, &receive_buffer[*radiotap_length + DB_RAW_V2_HEADER_LENGTH + DB_RAW_OFFSET],
                payload_length);
@@ -184,24 +192,67 @@ uint16_t get_db_payload(uint8_t *receive_buffer, ssize_t receive_length, uint8_t
 }
 
 /**
- * Extract RSSI value from radiotap header
+ * Reads the 32 bit sequence number from the header extension of a received frame
+ *
+ * @param receive_buffer The buffer filled by the raw socket during recv()
+ * @param receive_length The length of the received raw packet
+ * @param ext_seq_num Set to the extended sequence number if the frame carries the header extension
+ * @return 1 if the frame has the header extension, 0 if not
+ */
+int get_db_ext_seq_num(const uint8_t *receive_buffer, ssize_t receive_length, uint32_t *ext_seq_num) {
+    uint16_t radiotap_length = (uint16_t) (receive_buffer[2] | (receive_buffer[3] << 8));
+    if (receive_length < radiotap_length + DB_RAW_V2_HEADER_LENGTH + DB_RAW_V2_EXT_LENGTH ||
+        !(receive_buffer[radiotap_length + 8] & DB_RAW_V2_EXT_FLAG))
+        return 0;
+    const uint8_t *ext = receive_buffer + radiotap_length + DB_RAW_V2_HEADER_LENGTH;
+    *ext_seq_num = ext[0] | (ext[1] << 8) | (ext[2] << 16) | ((uint32_t) ext[3] << 24);
+    return 1;
+}
+
+/**
+ * Extract RSSI value from radiotap header. Layouts are cached (see db_radiotap.c), so only call from one thread
  * 
  * @param payload_buffer Buffer containing the received packet data including radiotap header
  * @param radiotap_length Length of radiotap header
  * @return RSSI of received packet
  */
 int8_t get_rssi(uint8_t *payload_buffer, int radiotap_length) {
-    struct ieee80211_radiotap_iterator rti;
-    if (ieee80211_radiotap_iterator_init(&rti, (struct ieee80211_radiotap_header *) payload_buffer, radiotap_length,
-                                         NULL) < 0)
+    static db_radiotap_cache_t layout_cache;
+    const db_radiotap_layout_t *layout = db_radiotap_get_layout(&layout_cache, payload_buffer, radiotap_length);
+    if (layout == NULL)
         return 0;
-    while ((ieee80211_radiotap_iterator_next(&rti)) == 0) {
-        switch (rti.this_arg_index) {
-            case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
-                return (int8_t) (*rti.this_arg);
-            default:
-                break;
-        }
+    for (int i = 0; i < layout->num_fields; i++) {
+        if (layout->fields[i].index == IEEE80211_RADIOTAP_DBM_ANTSIGNAL)
+            return (int8_t) payload_buffer[layout->fields[i].offset];
     }
     return 0;
+}
+
+/**
+ * @param receive_buffer Received frame starting with the radiotap header
+ * @param receive_length Length of the received frame
+ * @param tsft_us Filled with the TSFT field (MAC timestamp in us) of the radiotap header
+ * @return true if the radiotap header contains the TSFT field
+ */
+bool get_tsft(const uint8_t *receive_buffer, ssize_t receive_length, uint64_t *tsft_us) {
+    static db_radiotap_cache_t layout_cache;
+    if (receive_length < 4)
+        return false;
+    int radiotap_length = receive_buffer[2] | (receive_buffer[3] << 8);
+    if (radiotap_length > receive_length)
+        return false;
+    const db_radiotap_layout_t *layout = db_radiotap_get_layout(&layout_cache, receive_buffer, radiotap_length);
+    if (layout == NULL)
+        return false;
+    for (int i = 0; i < layout->num_fields; i++) {
+        if (layout->fields[i].index == IEEE80211_RADIOTAP_TSFT) {
+            const uint8_t *field = receive_buffer + layout->fields[i].offset;
+            uint64_t tsft = 0;
+            for (int b = 7; b >= 0; b--)
+                tsft = (tsft << 8) | field[b];
+            *tsft_us = tsft;
+            return true;
+        }
+    }
+    return false;
 }
\ No newline at end of file
@@ -21,6 +21,8 @@
 #define STATUS_DB_RECEIVE_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
 #include <net/if.h>
 
 int setBPF(int newsocket, uint8_t new_comm_id, uint8_t direction, uint8_t port);
@@ -30,7 +32,9 @@ int set_socket_timeout(int the_socketfd, int time_out_s ,int time_out_us);
 uint16_t get_db_payload(uint8_t *receive_buffer, ssize_t receive_length, uint8_t *payload_buffer, uint8_t *seq_num,
         uint16_t *radiotap_length);
 
+int get_db_ext_seq_num(const uint8_t *receive_buffer, ssize_t receive_length, uint32_t *ext_seq_num);
 int8_t get_rssi(uint8_t *payload_buffer, int radiotap_length);
+bool get_tsft(const uint8_t *receive_buffer, ssize_t receive_length, uint64_t *tsft_us);
 uint8_t count_lost_packets(uint8_t last_seq_num, uint8_t received_seq_num);
 
 #endif //STATUS_DB_RECEIVE_H
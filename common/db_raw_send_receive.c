@@ -18,6 +18,7 @@
  */
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <stdint.h>
 #include <net/if.h>
 #include <netinet/in.h>
@@ -28,11 +29,16 @@
 #include <linux/if_packet.h>
 #include <errno.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include "db_protocol.h"
 #include "db_raw_send_receive.h"
 #include "db_raw_receive.h"
 #include "db_common.h"
 #include "db_utils.h"
+#include "db_pcap.h"
+#include "db_sim.h"
+#include "db_link.h"
+#include "db_clock_sync.h"
 
 uint8_t radiotap_header_pre[] = {
         0x00, 0x00, // <-- radiotap version
@@ -57,25 +63,26 @@ const uint8_t frame_control_pre_beacon[] =
                 0x80, 0x00, 0x00, 0x00
         };
 
-struct ifreq raw_if_idx;
-struct ifreq raw_if_mac;
-char interfaceName[IFNAMSIZ];
-struct sockaddr_ll socket_address;
-char mode = 'm';
-int db_raw_offset = 0; // offset between payload and DB raw header. Needed when drivers overwrite payload with 802.11 SQN
+// Every db_socket_t carries its own frame buffer (headers + payload). Sending on different sockets from different
+// threads is therefore safe. A single socket must not be used by multiple threads at the same time.
 
-// init packet structure
-uint8_t monitor_framebuffer[RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH + DATA_UNI_LENGTH] = {0};
-struct radiotap_header *rth = (struct radiotap_header *) monitor_framebuffer;
-struct db_raw_v2_header_t *db_raw_header = (struct db_raw_v2_header_t *) (monitor_framebuffer + RADIOTAP_LENGTH);
+static inline struct radiotap_header *get_radiotap_header(db_socket_t *a_db_socket) {
+    return (struct radiotap_header *) a_db_socket->tx_frame;
+}
+
+static inline struct db_raw_v2_header_t *get_db_raw_header(db_socket_t *a_db_socket) {
+    return (struct db_raw_v2_header_t *) (a_db_socket->tx_frame + RADIOTAP_LENGTH);
+}
 
 /**
- * Set the transmission bit rate in the radiotap header. Only works with ralink cards.
+ * Set the transmission bit rate in the radiotap header of the socket. Only works with ralink cards.
  * Can be used to change the bitrate before every transmission.
- * 
+ *
+ * @param a_db_socket The socket whose frames are affected
  * @param bitrate_option Bit rate in Mbps
  */
-void set_bitrate(int bitrate_option) {
+void set_bitrate(db_socket_t *a_db_socket, int bitrate_option) {
+    struct radiotap_header *rth = get_radiotap_header(a_db_socket);
     switch (bitrate_option) {
         case 1:
             rth->bytes[8] = 0x02;
@@ -121,20 +128,22 @@ void set_bitrate(int bitrate_option) {
 
 
 /**
- * Setup of the the DroneBridge raw protocol v2 header
- * 
+ * Setup of the radiotap header and the DroneBridge raw protocol v2 header inside the send buffer of the socket
+ *
+ * @param a_db_socket
  * @param comm_id
  * @param bitrate_option
- * @param frame_type
  * @param send_direction
  * @param frame_type The type of raw frame being sent: 1=RTS, 2=DATA
- * @return The socket file descriptor in case of a success or -1 if we screwed up
  */
-int conf_monitor(int sockfd, uint8_t comm_id, int bitrate_option, uint8_t send_direction, uint8_t new_port,
-                 uint8_t frame_type) {
-    memset(monitor_framebuffer, 0, (RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH + DATA_UNI_LENGTH));
-    memcpy(rth->bytes, radiotap_header_pre, RADIOTAP_LENGTH);
-    set_bitrate(bitrate_option);
+void conf_tx_buffer(db_socket_t *a_db_socket, uint8_t comm_id, int bitrate_option, uint8_t send_direction,
+                    uint8_t frame_type) {
+    struct db_raw_v2_header_t *db_raw_header = get_db_raw_header(a_db_socket);
+    memset(a_db_socket->tx_frame, 0, DB_TX_FRAME_LENGTH);
+    a_db_socket->db_raw_offset = 0;
+    a_db_socket->ext_seq_enabled = 0;
+    memcpy(get_radiotap_header(a_db_socket)->bytes, radiotap_header_pre, RADIOTAP_LENGTH);
+    set_bitrate(a_db_socket, bitrate_option);
     // build custom DroneBridge v2 header
     switch (frame_type) {
         case DB_FRAMETYPE_RTS:
@@ -151,14 +160,33 @@ int conf_monitor(int sockfd, uint8_t comm_id, int bitrate_option, uint8_t send_d
     }
     db_raw_header->direction = send_direction;
     db_raw_header->comm_id = comm_id;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_BINDTODEVICE, interfaceName, IFNAMSIZ) < 0) {
+}
+
+/**
+ * Setup of the the DroneBridge raw protocol v2 header and the monitor mode socket
+ * 
+ * @param a_db_socket The socket to configure. db_socket must be set to the opened socket
+ * @param if_name Name of the interface the socket gets bound to
+ * @param if_index Index of that interface
+ * @param comm_id
+ * @param bitrate_option
+ * @param send_direction
+ * @param frame_type The type of raw frame being sent: 1=RTS, 2=DATA
+ * @return The socket file descriptor in case of a success or -1 if we screwed up
+ */
+int conf_monitor(db_socket_t *a_db_socket, const char *if_name, int if_index, uint8_t comm_id, int bitrate_option,
+                 uint8_t send_direction, uint8_t new_port, uint8_t frame_type) {
+    int sockfd = a_db_socket->db_socket;
+    conf_tx_buffer(a_db_socket, comm_id, bitrate_option, send_direction, frame_type);
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BINDTODEVICE, if_name, IFNAMSIZ) < 0) {
         LOG_SYS_STD(LOG_ERR,
                     "DroneBridgeCommon: Error binding monitor socket to interface. Closing socket. Please restart.\n");
         close(sockfd);
         return -1;
     }
     /* Index of the network device */
-    socket_address.sll_ifindex = raw_if_idx.ifr_ifindex;
+    memset(&a_db_socket->db_socket_addr, 0, sizeof(struct sockaddr_ll));
+    a_db_socket->db_socket_addr.sll_ifindex = if_index;
     uint8_t recv_direction = (uint8_t) ((send_direction == DB_DIREC_DRONE) ? DB_DIREC_GROUND : DB_DIREC_DRONE);
     sockfd = setBPF(sockfd, comm_id, recv_direction, new_port);
     clear_socket_buffer(sockfd);
@@ -166,10 +194,93 @@ int conf_monitor(int sockfd, uint8_t comm_id, int bitrate_option, uint8_t send_d
 }
 
 
+/**
+ * Opens a socket that only sends. Received frames are never delivered to it: On a monitor mode interface this is an
+ * AF_PACKET socket with protocol 0, on virtual interfaces a socket with a filter that no frame passes.
+ */
+db_socket_t open_db_send_socket(char *ifName, uint8_t comm_id, int bitrate_option, uint8_t send_direction,
+                                uint8_t frame_type) {
+    db_socket_t new_socket = {.db_socket = -1};
+    struct ifreq raw_if_idx;
+    if (strncmp(ifName, DB_PCAP_PREFIX, strlen(DB_PCAP_PREFIX)) == 0 ||
+        strncmp(ifName, DB_SIM_PREFIX, strlen(DB_SIM_PREFIX)) == 0 || strchr(ifName, DB_PCAP_CAPTURE_SEPARATOR))
+        return open_db_socket(ifName, comm_id, 'm', bitrate_option, send_direction, DB_PORT_NONE, frame_type);
+    int socket_fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (socket_fd < 0) {
+        perror("DroneBridgeCommon: Error opening raw interface for sending ");
+        return new_socket;
+    }
+    memset(&raw_if_idx, 0, sizeof(struct ifreq));
+    strncpy(raw_if_idx.ifr_name, ifName, IFNAMSIZ - 1);
+    if (ioctl(socket_fd, SIOCGIFINDEX, &raw_if_idx) < 0) {
+        LOG_SYS_STD(LOG_ERR, "DroneBridgeCommon: Error with opening socket on '%s'\n", raw_if_idx.ifr_name);
+        close(socket_fd);
+        return new_socket;
+    }
+    conf_tx_buffer(&new_socket, comm_id, bitrate_option, send_direction, frame_type);
+    memset(&new_socket.db_socket_addr, 0, sizeof(struct sockaddr_ll));
+    new_socket.db_socket_addr.sll_ifindex = raw_if_idx.ifr_ifindex;
+    new_socket.db_socket = socket_fd;
+    new_socket.db_tx_socket = socket_fd;
+    return new_socket;
+}
+
+/**
+ * Opens a DroneBridge socket that is not backed by a monitor mode interface: A pcap replay ("pcap:<file>[@<speed>]"),
+ * a simulated link ("sim:<link>[@<options>]"), a live interface with capture ("<interface>@<file>") or a socket
+ * receiving via the link daemon ("link:<interface>").
+ *
+ * @return The socket or a socket with db_socket set to -1 if ifName does not describe such a socket or on error
+ */
+db_socket_t open_db_virtual_socket(char *ifName, uint8_t comm_id, char trans_mode, int bitrate_option,
+                                uint8_t send_direction, uint8_t receive_new_port, uint8_t frame_type) {
+    db_socket_t new_socket = {.db_socket = -1};
+    uint8_t recv_direction = (uint8_t) ((send_direction == DB_DIREC_DRONE) ? DB_DIREC_GROUND : DB_DIREC_DRONE);
+    if (strncmp(ifName, DB_LINK_PREFIX, strlen(DB_LINK_PREFIX)) == 0) {
+        // frames are sent directly, received frames come from the daemon owning the only receiving socket
+        char *link_if = ifName + strlen(DB_LINK_PREFIX);
+        new_socket = open_db_send_socket(link_if, comm_id, bitrate_option, send_direction, frame_type);
+        if (new_socket.db_socket < 0)
+            return new_socket;
+        new_socket.db_socket = db_link_open(link_if, comm_id, recv_direction, receive_new_port);
+        if (new_socket.db_socket < 0)
+            close(new_socket.db_tx_socket);
+        return new_socket;
+    } else if (strncmp(ifName, DB_PCAP_PREFIX, strlen(DB_PCAP_PREFIX)) == 0) {
+        conf_tx_buffer(&new_socket, comm_id, bitrate_option, send_direction, frame_type);
+        new_socket.db_socket = db_pcap_open_replay(ifName + strlen(DB_PCAP_PREFIX), comm_id, recv_direction,
+                                                   receive_new_port);
+    } else if (strncmp(ifName, DB_SIM_PREFIX, strlen(DB_SIM_PREFIX)) == 0) {
+        conf_tx_buffer(&new_socket, comm_id, bitrate_option, send_direction, frame_type);
+        new_socket.db_socket = db_sim_open(ifName + strlen(DB_SIM_PREFIX), comm_id, recv_direction,
+                                           receive_new_port);
+    } else {
+        char live_if[IFNAMSIZ] = {0};
+        char *capture_file = strchr(ifName, DB_PCAP_CAPTURE_SEPARATOR);
+        size_t if_len = (size_t) (capture_file - ifName);
+        strncpy(live_if, ifName, if_len < IFNAMSIZ ? if_len : IFNAMSIZ - 1);
+        db_socket_t live_socket = open_db_socket(live_if, comm_id, trans_mode, bitrate_option, send_direction,
+                                                 receive_new_port, frame_type);
+        if (live_socket.db_socket < 0)
+            return live_socket;
+        memcpy(new_socket.tx_frame, live_socket.tx_frame, DB_TX_FRAME_LENGTH);
+        new_socket.db_socket = db_pcap_open_capture(live_socket.db_socket, &live_socket.db_socket_addr,
+                                                    capture_file + 1);
+    }
+    // not an AF_PACKET socket. Frames get sent without destination address
+    memset(&new_socket.db_socket_addr, 0, sizeof(struct sockaddr_ll));
+    new_socket.db_socket_addr.sll_family = AF_UNIX;
+    new_socket.db_tx_socket = new_socket.db_socket;
+    return new_socket;
+}
+
 /**
  * Opens and configures a socket for sending and receiving DroneBridge raw protocol frames
  * 
- * @param ifName Name of the network interface the socket is bound to
+ * @param ifName Name of the network interface the socket is bound to. "pcap:<file>[@<speed>]" replays a pcap file
+ * instead (speed: factor or "max"). "<interface>@<file>" records all received frames of the interface to a pcap file.
+ * "sim:<link>[@<options>]" opens a socket on a simulated link (see db_sim.c). "link:<interface>" receives via the
+ * link daemon of the interface (see db_link.c) instead of opening another receiving socket on it
  * @param comm_id The communication ID
  * @param trans_mode The transmission mode (m|w) for monitor or wifi
  * @param bitrate_option Transmission bit rate. Only works with Ralink cards
@@ -180,10 +291,16 @@ int conf_monitor(int sockfd, uint8_t comm_id, int bitrate_option, uint8_t send_d
  */
 db_socket_t open_db_socket(char *ifName, uint8_t comm_id, char trans_mode, int bitrate_option,
                            uint8_t send_direction, uint8_t receive_new_port, uint8_t frame_type) {
-    mode = trans_mode;
     db_socket_t new_socket;
     int socket_fd;
-    if (mode == 'w') {
+    struct ifreq raw_if_idx;
+    struct ifreq raw_if_mac;
+    if (strncmp(ifName, DB_PCAP_PREFIX, strlen(DB_PCAP_PREFIX)) == 0 ||
+        strncmp(ifName, DB_SIM_PREFIX, strlen(DB_SIM_PREFIX)) == 0 ||
+        strncmp(ifName, DB_LINK_PREFIX, strlen(DB_LINK_PREFIX)) == 0 || strchr(ifName, DB_PCAP_CAPTURE_SEPARATOR))
+        return open_db_virtual_socket(ifName, comm_id, trans_mode, bitrate_option, send_direction, receive_new_port,
+                                   frame_type);
+    if (trans_mode == 'w') {
         // TODO: ignore for now. I will be UDP in future.
         if ((socket_fd = socket(AF_PACKET, SOCK_RAW, IPPROTO_RAW)) == -1) {
             perror("DroneBridgeCommon: Error opening raw interface for WiFi mode ");
@@ -222,9 +339,10 @@ db_socket_t open_db_socket(char *ifName, uint8_t comm_id, char trans_mode, int b
         return new_socket;
         //return conf_ethernet(dest_mac);
     } else {
-        new_socket.db_socket = conf_monitor(socket_fd, comm_id, bitrate_option, send_direction, receive_new_port,
-                                            frame_type);
-        new_socket.db_socket_addr = socket_address;
+        new_socket.db_socket = socket_fd;
+        new_socket.db_socket = conf_monitor(&new_socket, ifName, raw_if_idx.ifr_ifindex, comm_id, bitrate_option,
+                                            send_direction, receive_new_port, frame_type);
+        new_socket.db_tx_socket = new_socket.db_socket;
         return new_socket;
     }
 }
@@ -241,23 +359,190 @@ uint8_t update_seq_num(uint8_t *old_seq_num) {
 }
 
 /**
- * Returns a pointer to the buffer that gets sent when calling send_packet_hp(..) or send_packet_hp_div(...)
+ * Send the optional header extension carrying a 32 bit sequence number with every frame of this socket. Receivers use
+ * it for exact duplicate detection and loss/reorder statistics (see db_seq.c). Call right after opening the socket.
+ * The 8 bit sequence numbers passed to the send functions are extended per port: The extended number advances by the
+ * difference to the previous 8 bit number. Sending the same number on several sockets (diversity) therefore results in
+ * the same extended number on all of them.
+ *
+ * @param a_db_socket Socket to enable the extension for
+ */
+void db_enable_ext_seq_num(db_socket_t *a_db_socket) {
+    a_db_socket->ext_seq_enabled = 1;
+    memset(a_db_socket->ext_seq_num, 0, sizeof(a_db_socket->ext_seq_num));
+}
+
+/**
+ * Let the kernel timestamp every frame received by this socket. Read the timestamps using db_recv_ts(). Sockets
+ * receiving via the link daemon always carry the timestamp taken by the daemon.
+ *
+ * @param a_db_socket Socket to enable the timestamps for
+ * @return 0 on success, -1 on failure. db_recv_ts() still works but takes the time after the frame was read
+ */
+int db_enable_rx_timestamps(db_socket_t *a_db_socket) {
+    if (db_link_is_client(a_db_socket->db_socket))
+        return 0;
+    int enable = 1;
+    if (setsockopt(a_db_socket->db_socket, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_SEND: Could not enable receive timestamps: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Close a socket opened by open_db_socket(). Sockets receiving via the link daemon get unregistered from it and their
+ * separate send socket gets closed as well.
+ *
+ * @param a_db_socket Socket to close. Its file descriptors are set to -1
+ */
+void close_db_socket(db_socket_t *a_db_socket) {
+    if (a_db_socket->db_socket < 0)
+        return;
+    if (db_link_close(a_db_socket->db_socket) != 0)
+        close(a_db_socket->db_socket);
+    if (a_db_socket->db_tx_socket >= 0 && a_db_socket->db_tx_socket != a_db_socket->db_socket)
+        close(a_db_socket->db_tx_socket);
+    a_db_socket->db_socket = -1;
+    a_db_socket->db_tx_socket = -1;
+}
+
+/**
+ * @return Bytes between the DB raw header and the payload. The header extension lies within DB_RAW_OFFSET
+ */
+static inline int get_payload_offset(db_socket_t *a_db_socket, int adhere_to_80211_header) {
+    if (adhere_to_80211_header)
+        return DB_RAW_OFFSET;
+    return a_db_socket->ext_seq_enabled ? DB_RAW_V2_EXT_LENGTH : 0;
+}
+
+/**
+ * Returns a pointer to the payload area of the sockets send buffer. Fill it and call db_send_hp_div() on the same socket.
+ * @param a_db_socket The socket whose buffer is returned
  * @param adhere_to_80211_header: Set to 1 to enable. Offsets the payload by some bytes so that it sits outside the
  * 802.11 header. This is required since some drivers (Ubuntu Atheros drivers) write a sequence number to the 802.11
  * header on receive. Without offsetting the payload this sequence number would overwrite 2 bytes of the payload and
  * corrupt it. The receiver will be able to auto detect the offset. Set this to 1 if you are using a non DB-Rasp Kernel!
  * This will make the packet longer!
- * @return: A pointer to the buffer that gets sent when calling send_packet_hp(..) or send_packet_hp_div(...)
+ * @return: A pointer to the payload inside the buffer that gets sent when calling db_send_hp_div(...)
+ */
+struct data_uni *get_hp_raw_buffer(db_socket_t *a_db_socket, int adhere_to_80211_header) {
+    a_db_socket->db_raw_offset = get_payload_offset(a_db_socket, adhere_to_80211_header);
+    return (struct data_uni *) (a_db_socket->tx_frame + RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH +
+                                a_db_socket->db_raw_offset);
+}
+
+/**
+ * Send a complete frame via a DroneBridge socket. Sockets not backed by a monitor mode interface (pcap backend) do not
+ * take a link layer address.
  */
-struct data_uni *get_hp_raw_buffer(int adhere_to_80211_header) {
-    if (adhere_to_80211_header) {
-        db_raw_offset = DB_RAW_OFFSET;
-        return (struct data_uni *) (monitor_framebuffer + RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH + DB_RAW_OFFSET);
-    } else
-        return (struct data_uni *) (monitor_framebuffer + RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH);
+static inline ssize_t db_sendto(db_socket_t *a_db_socket, uint8_t *frame, size_t frame_length) {
+    if (a_db_socket->db_socket_addr.sll_family == AF_UNIX)
+        return send(a_db_socket->db_tx_socket, frame, frame_length, 0);
+    return sendto(a_db_socket->db_tx_socket, frame, frame_length, 0, (struct sockaddr *) &a_db_socket->db_socket_addr,
+                  sizeof(struct sockaddr_ll));
 }
 
-static inline void check_payload_length(const uint16_t *payload_length) {
+/**
+ * Receive a frame from a DroneBridge socket. Use it instead of recv() so that sockets receiving via the link daemon
+ * work as well.
+ *
+ * @param db_socket_fd db_socket of the DroneBridge socket
+ * @param buffer Filled with the complete frame (radiotap header, DB raw header, payload)
+ * @param buffer_length Size of the buffer
+ * @return Same as recv()
+ */
+ssize_t db_recv(int db_socket_fd, uint8_t *buffer, size_t buffer_length) {
+    if (db_link_is_client(db_socket_fd))
+        return db_link_recv(db_socket_fd, buffer, buffer_length);
+    return recv(db_socket_fd, buffer, buffer_length, 0);
+}
+
+/**
+ * Convert a CLOCK_REALTIME timestamp of the kernel to the db_clock_us() time base
+ */
+static uint64_t realtime_to_clock_us(const struct timespec *realtime) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t age_us = ((int64_t) now.tv_sec - realtime->tv_sec) * 1000000 + (now.tv_nsec - realtime->tv_nsec) / 1000;
+    uint64_t now_us = db_clock_us();
+    if (age_us < 0) age_us = 0; // wall clock was set back in between
+    return (uint64_t) age_us < now_us ? now_us - (uint64_t) age_us : now_us;
+}
+
+/**
+ * Receive a frame together with the time it arrived. The kernel timestamp (see db_enable_rx_timestamps()) excludes
+ * the scheduling and select() delay of the module that a time taken after recv() returns includes.
+ * The TSFT field of the radiotap header is passed on if the driver provides it. It is taken by the adapter and is
+ * suited to compare arrival times of frames received by the same adapter (jitter) without any host side delay.
+ *
+ * @param db_socket_fd db_socket of the DroneBridge socket
+ * @param buffer Filled with the complete frame (radiotap header, DB raw header, payload)
+ * @param buffer_length Size of the buffer
+ * @param timestamp Filled with the arrival time of the frame
+ * @return Same as recv()
+ */
+ssize_t db_recv_ts(int db_socket_fd, uint8_t *buffer, size_t buffer_length, db_rx_timestamp_t *timestamp) {
+    ssize_t length;
+    timestamp->flags = 0;
+    timestamp->rx_time_us = 0;
+    timestamp->tsft_us = 0;
+    if (db_link_is_client(db_socket_fd)) {
+        length = db_link_recv_ts(db_socket_fd, buffer, buffer_length, &timestamp->rx_time_us);
+        if (timestamp->rx_time_us != 0)
+            timestamp->flags |= DB_RX_TS_KERNEL;
+    } else {
+        union {
+            char buf[CMSG_SPACE(sizeof(struct timespec))];
+            struct cmsghdr align;
+        } control;
+        struct iovec iov = {.iov_base = buffer, .iov_len = buffer_length};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                             .msg_controllen = sizeof(control.buf)};
+        length = recvmsg(db_socket_fd, &msg, 0);
+        if (length > 0) {
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                    struct timespec kernel_time;
+                    memcpy(&kernel_time, CMSG_DATA(cmsg), sizeof(kernel_time));
+                    timestamp->rx_time_us = realtime_to_clock_us(&kernel_time);
+                    timestamp->flags |= DB_RX_TS_KERNEL;
+                }
+            }
+        }
+    }
+    if (length <= 0)
+        return length;
+    if (!(timestamp->flags & DB_RX_TS_KERNEL))
+        timestamp->rx_time_us = db_clock_us();
+    if (get_tsft(buffer, length, &timestamp->tsft_us))
+        timestamp->flags |= DB_RX_TS_TSFT;
+    return length;
+}
+
+/**
+ * Fill in the per frame fields of the DB raw v2 header (and the header extension) inside the sockets send buffer
+ */
+static inline void update_db_raw_header(db_socket_t *a_db_socket, uint8_t dest_port, uint16_t payload_length,
+                                        uint8_t new_seq_num) {
+    struct db_raw_v2_header_t *db_raw_header = get_db_raw_header(a_db_socket);
+    db_raw_header->payload_length[0] = (uint8_t) (payload_length & (uint8_t) 0xFF);
+    db_raw_header->payload_length[1] = (uint8_t) ((payload_length >> (uint8_t) 8) & (uint8_t) 0xFF);
+    db_raw_header->port = dest_port;
+    db_raw_header->seq_num = new_seq_num;
+    if (a_db_socket->ext_seq_enabled && dest_port < DB_PORT_CNT) {
+        uint32_t *ext_seq = &a_db_socket->ext_seq_num[dest_port];
+        *ext_seq += (uint8_t) (new_seq_num - (uint8_t) *ext_seq);
+        uint8_t *ext = (uint8_t *) db_raw_header + DB_RAW_V2_HEADER_LENGTH;
+        ext[0] = (uint8_t) *ext_seq;
+        ext[1] = (uint8_t) (*ext_seq >> 8);
+        ext[2] = (uint8_t) (*ext_seq >> 16);
+        ext[3] = (uint8_t) (*ext_seq >> 24);
+        db_raw_header->payload_length[1] |= DB_RAW_V2_EXT_FLAG;
+    }
+}
+
+static inline void check_payload_length(struct db_raw_v2_header_t *db_raw_header, const uint16_t *payload_length) {
     if (*payload_length < DB_MIN_PAYLOAD_LENGTH_RTS && db_raw_header->fcf_duration[0] == 0xb4)
         LOG_SYS_STD(LOG_ERR, "DroneBridgeCommon: Payload too short (<%i) for specified frame type\n",
                     DB_MIN_PAYLOAD_LENGTH_RTS);
@@ -270,8 +555,10 @@ static inline void check_payload_length(const uint16_t *payload_length) {
 /**
  * This function works the same as send_packet with the difference that it allows for soft. diversity transmission.
  * You can specify a socket (bound to an interface) that should be used to send the packet.
- * Overwrites payload set inside monitor_framebuffer with the provided payload.
- * @param payload: The payload bytes of the message to be sent. Does use memcpy to write payload into buffer.
+ * The payload is sent together with the headers of the socket via db_send_iov() without copying it. For diversity
+ * fill the buffer of the first socket (see get_hp_raw_buffer()) and pass that buffer to this function for all sockets.
+ * @param a_db_socket: The socket to send with
+ * @param payload: The payload bytes of the message to be sent. Not copied.
  * @param dest_port: The DroneBridge destination port of the message (see db_protocol.h)
  * @param payload_length: The length of the payload in bytes
  * @param new_seq_num: Specify the sequence number of the packet
@@ -281,16 +568,59 @@ static inline void check_payload_length(const uint16_t *payload_length) {
  */
 int db_send_div(db_socket_t *a_db_socket, uint8_t *payload, uint8_t dest_port, uint16_t payload_length,
                 uint8_t new_seq_num, int adhere_80211_header) {
-    check_payload_length(&payload_length);
-    db_raw_header->payload_length[0] = (uint8_t) (payload_length & (uint8_t) 0xFF);
-    db_raw_header->payload_length[1] = (uint8_t) ((payload_length >> (uint8_t) 8) & (uint8_t) 0xFF);
-    db_raw_header->port = dest_port;
-    db_raw_header->seq_num = new_seq_num;
-    struct data_uni *monitor_databuffer_internal = get_hp_raw_buffer(adhere_80211_header);
-    memcpy(monitor_databuffer_internal->bytes, payload, payload_length);
-    if (sendto(a_db_socket->db_socket, monitor_framebuffer, (size_t) (RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH +
-                                                                      payload_length + db_raw_offset), 0,
-               (struct sockaddr *) &a_db_socket->db_socket_addr, sizeof(struct sockaddr_ll)) <= 0) {
+    struct data_uni *payload_buffer = get_hp_raw_buffer(a_db_socket, adhere_80211_header);
+    if (payload == payload_buffer->bytes)
+        return db_send_hp_div(a_db_socket, dest_port, payload_length, new_seq_num);
+    struct iovec payload_iov = {.iov_base = payload, .iov_len = payload_length};
+    return db_send_iov(a_db_socket, dest_port, &payload_iov, 1, new_seq_num, adhere_80211_header);
+}
+
+/**
+ * Scatter-gather send. The radiotap and DB raw v2 headers are taken from the send buffer of the socket (template set
+ * up when opening the socket), the payload fragments are passed to the kernel by reference. No payload copy is made.
+ * The fragments are sent as one frame in the given order.
+ * @param a_db_socket The socket to send with
+ * @param dest_port The DroneBridge destination port of the message (see db_protocol.h)
+ * @param payload_iov Payload fragments
+ * @param payload_iov_cnt Number of fragments. Max DB_SEND_MAX_IOV
+ * @param new_seq_num Specify the sequence number of the packet
+ * @param adhere_80211_header Set to 1 to enable. Offsets the payload by some bytes so that it sits outside the
+ *                            802.11 header. Set this to 1 if you are using a non DB-Rasp Kernel!
+ * @return 0 on success or -1 on failure
+ */
+int db_send_iov(db_socket_t *a_db_socket, uint8_t dest_port, const struct iovec *payload_iov, int payload_iov_cnt,
+                uint8_t new_seq_num, int adhere_80211_header) {
+    struct iovec frame_iov[DB_SEND_MAX_IOV + 1];
+    struct msghdr msg = {0};
+    size_t payload_length = 0;
+    if (payload_iov_cnt > DB_SEND_MAX_IOV) {
+        LOG_SYS_STD(LOG_ERR, "DroneBridgeCommon: Too many payload fragments (%i > %i)\n", payload_iov_cnt,
+                    DB_SEND_MAX_IOV);
+        return -1;
+    }
+    for (int i = 0; i < payload_iov_cnt; i++) {
+        frame_iov[i + 1] = payload_iov[i];
+        payload_length += payload_iov[i].iov_len;
+    }
+    if (payload_length > DATA_UNI_LENGTH) {
+        LOG_SYS_STD(LOG_ERR, "DroneBridgeCommon: Payload too long (%zu > %i)\n", payload_length, DATA_UNI_LENGTH);
+        return -1;
+    }
+    uint16_t length = (uint16_t) payload_length;
+    struct db_raw_v2_header_t *db_raw_header = get_db_raw_header(a_db_socket);
+    check_payload_length(db_raw_header, &length);
+    update_db_raw_header(a_db_socket, dest_port, length, new_seq_num);
+    // headers (and the offset bytes) come from the sockets send buffer
+    frame_iov[0].iov_base = a_db_socket->tx_frame;
+    frame_iov[0].iov_len = (size_t) (RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH +
+                                     get_payload_offset(a_db_socket, adhere_80211_header));
+    msg.msg_iov = frame_iov;
+    msg.msg_iovlen = (size_t) payload_iov_cnt + 1;
+    if (a_db_socket->db_socket_addr.sll_family != AF_UNIX) {
+        msg.msg_name = &a_db_socket->db_socket_addr;
+        msg.msg_namelen = sizeof(struct sockaddr_ll);
+    }
+    if (sendmsg(a_db_socket->db_tx_socket, &msg, 0) <= 0) {
         LOG_SYS_STD(LOG_ERR, "DroneBridgeCommon: Send failed (monitor): %s\n", strerror(errno));
         return -1;
     }
@@ -300,32 +630,29 @@ int db_send_div(db_socket_t *a_db_socket, uint8_t *payload, uint8_t dest_port, u
 /**
  * This function works the same as send_packet_hp with the difference that it allows for soft. diversity transmission.
  * You can specify a socket (bound to an interface) that should be used to send the packet.
- * Use this function for maximum performance. No memcpy used. Create a pointer directly pointing inside the
- * monitor_framebuffer array in your script. Fill that with your payload and call this function.
- * This function only sends the monitor_framebuffer. You need to make sure you get the payload inside it.
+ * Use this function for maximum performance. No memcpy used. Get a pointer to the payload area inside the send buffer
+ * of the socket via get_hp_raw_buffer(), fill it with your payload and call this function.
+ * This function only sends the buffer of the socket. You need to make sure you get the payload inside it.
  * E.g. This will create such a pointer structure:
  *
- *     struct data_uni *data_uni_to_ground = (struct data_uni *)
- *           (monitor_framebuffer + RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH);
+ *     struct data_uni *data_uni_to_ground = get_hp_raw_buffer(&a_db_socket, 0);
  *     memset(data_uni_to_ground->bytes, 0xff, DATA_UNI_LENGTH); // set some payload
  *
  * Make sure you update your data every time before sending.
+ * @param a_db_socket The socket to send with. Its send buffer gets sent
  * @param dest_port The DroneBridge destination port of the message (see db_protocol.h)
  * @param payload_length The length of the payload in bytes
  * @param new_seq_num Specify the sequence number of the packet
  * @return 0 on success or -1 on failure
  */
 int db_send_hp_div(db_socket_t *a_db_socket, uint8_t dest_port, uint16_t payload_length, uint8_t new_seq_num) {
-    check_payload_length(&payload_length);
-    db_raw_header->payload_length[0] = (uint8_t) (payload_length & (uint8_t) 0xFF);
-    db_raw_header->payload_length[1] = (uint8_t) ((payload_length >> (uint8_t) 8) & (uint8_t) 0xFF);
-    db_raw_header->port = dest_port;
-    db_raw_header->seq_num = new_seq_num;
-    if (sendto(a_db_socket->db_socket, monitor_framebuffer,
-               (size_t) (RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH + payload_length + db_raw_offset), 0,
-               (struct sockaddr *) &a_db_socket->db_socket_addr, sizeof(struct sockaddr_ll)) <= 0) {
+    struct db_raw_v2_header_t *db_raw_header = get_db_raw_header(a_db_socket);
+    check_payload_length(db_raw_header, &payload_length);
+    update_db_raw_header(a_db_socket, dest_port, payload_length, new_seq_num);
+    if (db_sendto(a_db_socket, a_db_socket->tx_frame, (size_t) (RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH +
+                                                                payload_length + a_db_socket->db_raw_offset)) <= 0) {
         LOG_SYS_STD(LOG_ERR, "DroneBridgeCommon: Send failed (monitor): %s\n", strerror(errno));
         return -1;
     }
     return 0;
-}
\ No newline at end of file
+}
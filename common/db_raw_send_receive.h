@@ -23,29 +23,59 @@
 #include "db_protocol.h"
 #include <stdint.h>
 #include <linux/if_packet.h>
+#include <sys/uio.h>
 
-// That is the buffer that will be sent over the socket. Create a pointer to a part of this array and fill it with your
-// data, like e.g.:
-// struct uav_rc_status_update_message_t *rc_status_update_data = (struct uav_rc_status_update_message_t *) (monitor_framebuffer + RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH);
-extern uint8_t monitor_framebuffer[RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH + DATA_UNI_LENGTH];
+#define DB_TX_FRAME_LENGTH (RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH + DB_RAW_OFFSET + DATA_UNI_LENGTH)
+#define DB_SEND_MAX_IOV     8   // max payload fragments per db_send_iov() call
 
+#define DB_RX_TS_KERNEL     0x01    // rx_time_us was taken by the kernel when the frame arrived (SO_TIMESTAMPNS)
+#define DB_RX_TS_TSFT       0x02    // tsft_us is valid (radiotap TSFT field filled in by the driver)
+
+// Each socket has its own send buffer. Get a pointer to its payload area via get_hp_raw_buffer(), fill it with your
+// data and send it using db_send_hp_div(), like e.g.:
+// struct uav_rc_status_update_message_t *rc_status_update_data = (struct uav_rc_status_update_message_t *) get_hp_raw_buffer(&db_socket, 0);
+// Sending on different sockets from different threads is safe. A single socket must only be used by one thread.
 typedef struct {
-    int db_socket;  // socket file descriptor
+    int db_socket;  // file descriptor to select() on and to receive from using db_recv()
+    int db_tx_socket; // file descriptor frames are sent with. Differs from db_socket only for "link:" sockets
     struct sockaddr_ll db_socket_addr;
+    int db_raw_offset; // offset between DB raw header and payload. Needed when drivers overwrite payload with 802.11 SQN
+    uint8_t tx_frame[DB_TX_FRAME_LENGTH]; // radiotap header + DB raw v2 header + payload of the next frame to send
+    uint8_t ext_seq_enabled; // send the 32 bit sequence number header extension. See db_enable_ext_seq_num()
+    uint32_t ext_seq_num[DB_PORT_CNT]; // last sent extended sequence number per port
 } db_socket_t;
 
-void set_bitrate(int bitrate_option);
+// Arrival time of a received frame. See db_recv_ts()
+typedef struct {
+    uint8_t flags;          // DB_RX_TS_*
+    uint64_t rx_time_us;    // db_clock_us() time base. Taken after the frame was read if DB_RX_TS_KERNEL is not set
+    uint64_t tsft_us;       // MAC timestamp of the first bit of the frame. Time base of the adapters TSF timer
+} db_rx_timestamp_t;
+
+void set_bitrate(db_socket_t *a_db_socket, int bitrate_option);
 
 db_socket_t open_db_socket(char *ifName, uint8_t comm_id, char trans_mode, int bitrate_option,
                            uint8_t send_direction, uint8_t receive_new_port, uint8_t frame_type);
 
 uint8_t update_seq_num(uint8_t *old_seq_num);
 
-struct data_uni *get_hp_raw_buffer(int adhere_to_80211_header);
+void db_enable_ext_seq_num(db_socket_t *a_db_socket);
+
+int db_enable_rx_timestamps(db_socket_t *a_db_socket);
+void close_db_socket(db_socket_t *a_db_socket);
+
+struct data_uni *get_hp_raw_buffer(db_socket_t *a_db_socket, int adhere_to_80211_header);
 
 int db_send_div(db_socket_t *a_db_socket, uint8_t *payload, uint8_t dest_port, uint16_t payload_length,
                 uint8_t new_seq_num, int adhere_80211_header);
 
 int db_send_hp_div(db_socket_t *a_db_socket, uint8_t dest_port, uint16_t payload_length, uint8_t new_seq_num);
 
+ssize_t db_recv(int db_socket_fd, uint8_t *buffer, size_t buffer_length);
+
+ssize_t db_recv_ts(int db_socket_fd, uint8_t *buffer, size_t buffer_length, db_rx_timestamp_t *timestamp);
+
+int db_send_iov(db_socket_t *a_db_socket, uint8_t dest_port, const struct iovec *payload_iov, int payload_iov_cnt,
+                uint8_t new_seq_num, int adhere_80211_header);
+
 #endif //CONTROL_DB_RAW_SEND_H
\ No newline at end of file
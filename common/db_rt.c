@@ -0,0 +1,229 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+/**
+ * Real-time setup shared by the latency critical modules (control, video). Apart from the scheduling policy, RC and
+ * video jitter on a shared Pi comes from page faults in the main loop and from being moved between CPUs. A profile
+ * can therefore lock and prefault memory, pin the process and enable busy polling on the raw sockets.
+ *
+ * Spec: <option>[=<value>],... with options
+ *  fifo=<prio>  rr=<prio>  cpu=<n>[+<n>...]  mlock  prefault=<kB>  busypoll=<us>
+ * e.g. fifo=50,cpu=3,mlock,busypoll=50
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <alloca.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include "db_rt.h"
+#include "db_common.h"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+/**
+ * @param spec Profile spec. Empty string or NULL for none
+ * @param profile Filled with the profile. Defaults to no changes
+ * @return 0 on success, -1 on invalid spec
+ */
+int db_rt_parse_profile(const char *spec, db_rt_profile_t *profile) {
+    memset(profile, 0, sizeof(db_rt_profile_t));
+    profile->policy = SCHED_OTHER;
+    profile->prefault_kb = -1;
+    if (spec == NULL || spec[0] == '\0')
+        return 0;
+    char opts[DB_RT_SPEC_MAX_LENGTH];
+    strncpy(opts, spec, sizeof(opts) - 1);
+    opts[sizeof(opts) - 1] = '\0';
+    char *saveptr = NULL;
+    for (char *opt = strtok_r(opts, ",", &saveptr); opt != NULL; opt = strtok_r(NULL, ",", &saveptr)) {
+        char *value = strchr(opt, '=');
+        if (value != NULL) *value++ = '\0';
+        if (strcmp(opt, "mlock") == 0) {
+            profile->lock_memory = true;
+            continue;
+        }
+        if (value == NULL) {
+            LOG_SYS_STD(LOG_ERR, "DB_RT: Option '%s' has no value\n", opt);
+            return -1;
+        }
+        if (strcmp(opt, "fifo") == 0 || strcmp(opt, "rr") == 0) {
+            profile->policy = opt[0] == 'f' ? SCHED_FIFO : SCHED_RR;
+            profile->priority = (int) strtol(value, NULL, 10);
+            if (profile->priority < sched_get_priority_min(profile->policy) ||
+                profile->priority > sched_get_priority_max(profile->policy)) {
+                LOG_SYS_STD(LOG_ERR, "DB_RT: Invalid priority %i\n", profile->priority);
+                return -1;
+            }
+        } else if (strcmp(opt, "cpu") == 0) {
+            char *next = value;
+            do {
+                long cpu = strtol(next, &next, 10);
+                if (cpu < 0 || cpu >= 32) {
+                    LOG_SYS_STD(LOG_ERR, "DB_RT: Invalid CPU %li\n", cpu);
+                    return -1;
+                }
+                profile->cpu_mask |= (uint32_t) 1 << cpu;
+            } while (*next++ == '+');
+        } else if (strcmp(opt, "prefault") == 0) {
+            profile->prefault_kb = (int) strtol(value, NULL, 10);
+        } else if (strcmp(opt, "busypoll") == 0) {
+            profile->busy_poll_us = (int) strtol(value, NULL, 10);
+        } else {
+            LOG_SYS_STD(LOG_ERR, "DB_RT: Unknown option '%s'\n", opt);
+            return -1;
+        }
+    }
+    if (profile->prefault_kb < 0)
+        profile->prefault_kb = profile->lock_memory ? DB_RT_DEFAULT_PREFAULT_KB : 0;
+    return 0;
+}
+
+/**
+ * @return Largest stack area in kB that can be prefaulted without coming close to the stack size limit
+ */
+static int max_stack_prefault_kb() {
+    struct rlimit limit;
+    rlim_t stack_size = DB_RT_DEFAULT_STACK_SIZE;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        stack_size = limit.rlim_cur;
+    return (int) (stack_size / 1024 / 2); // the caller frames and signal handlers need the rest
+}
+
+/**
+ * Touch the stack so that its pages are mapped (and locked with mlock) before the main loop needs them
+ */
+static void __attribute__((noinline)) prefault_stack(int kb) {
+    volatile uint8_t *stack = alloca((size_t) kb * 1024);
+    for (size_t i = 0; i < (size_t) kb * 1024; i += 4096)
+        stack[i] = 0;
+}
+
+/**
+ * Map heap pages once and keep them: malloc() must neither give memory back to the OS nor use mmap() for large
+ * blocks. Otherwise the next allocation faults again
+ */
+static void prefault_heap(int kb) {
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    uint8_t *heap = malloc((size_t) kb * 1024);
+    if (heap == NULL)
+        return;
+    for (size_t i = 0; i < (size_t) kb * 1024; i += 4096)
+        heap[i] = 0;
+    free(heap);
+}
+
+/**
+ * Apply a profile to the calling process. Call once the module allocated its buffers, right before the main loop.
+ * Failing steps (e.g. missing CAP_SYS_NICE) are logged and skipped.
+ *
+ * @param profile Parsed profile (see db_rt_parse_profile())
+ * @param module_tag Prefix for log messages, e.g. "DB_CONTROL_AIR"
+ * @return 0 if all steps succeeded, -1 if at least one failed
+ */
+int db_rt_apply(const db_rt_profile_t *profile, const char *module_tag) {
+    int ret = 0;
+    if (profile->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        LOG_SYS_STD(LOG_ERR, "%s: mlockall failed: %s\n", module_tag, strerror(errno));
+        ret = -1;
+    }
+    if (profile->prefault_kb > 0) {
+        int stack_kb = max_stack_prefault_kb();
+        if (profile->prefault_kb <= stack_kb) {
+            stack_kb = profile->prefault_kb;
+        } else {
+            LOG_SYS_STD(LOG_WARNING, "%s: Prefaulting %ikB of stack only (half of the stack size limit)\n",
+                        module_tag, stack_kb);
+        }
+        prefault_stack(stack_kb);
+        prefault_heap(profile->prefault_kb);
+    }
+    if (profile->cpu_mask != 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int i = 0; i < 32; i++) {
+            if (profile->cpu_mask & ((uint32_t) 1 << i))
+                CPU_SET(i, &cpus);
+        }
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+            LOG_SYS_STD(LOG_ERR, "%s: Could not set CPU affinity: %s\n", module_tag, strerror(errno));
+            ret = -1;
+        }
+    }
+    if (profile->policy != SCHED_OTHER) {
+        struct sched_param param = {.sched_priority = profile->priority};
+        if (sched_setscheduler(0, profile->policy, &param) < 0) {
+            LOG_SYS_STD(LOG_ERR, "%s: Could not set real-time scheduling: %s\n", module_tag, strerror(errno));
+            ret = -1;
+        }
+    }
+    if (profile->lock_memory || profile->prefault_kb || profile->cpu_mask || profile->busy_poll_us ||
+        profile->policy != SCHED_OTHER)
+        LOG_SYS_STD(LOG_NOTICE, "%s: Real-time profile: %s %i, CPU mask 0x%x, mlock %s, prefault %ikB, "
+                                "busy poll %ius\n", module_tag,
+                    profile->policy == SCHED_FIFO ? "SCHED_FIFO" : profile->policy == SCHED_RR ? "SCHED_RR" : "other",
+                    profile->priority, profile->cpu_mask, profile->lock_memory ? "on" : "off",
+                    profile->prefault_kb, profile->busy_poll_us);
+    db_rt_report(NULL);  // reset the reference for the next report
+    return ret;
+}
+
+/**
+ * Enable busy polling on a raw socket if the profile asks for it. The kernel then polls the device queue for up to
+ * busy_poll_us instead of sleeping in recv(). Only has an effect with drivers that support it (NAPI).
+ *
+ * @param profile Parsed profile
+ * @param socket_fd Socket (db_socket of a DroneBridge socket)
+ */
+void db_rt_socket(const db_rt_profile_t *profile, int socket_fd) {
+    if (profile->busy_poll_us <= 0 || socket_fd < 0)
+        return;
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL, &profile->busy_poll_us, sizeof(profile->busy_poll_us)) < 0
+        && errno != ENOTSOCK)
+        LOG_SYS_STD(LOG_ERR, "DB_RT: Could not enable busy polling: %s\n", strerror(errno));
+}
+
+/**
+ * Log the number of context switches and page faults since the last report (or since db_rt_apply()). Involuntary
+ * context switches mean the module got preempted while it wanted to run.
+ *
+ * @param module_tag Prefix for the log message. NULL to only reset the reference
+ */
+void db_rt_report(const char *module_tag) {
+    static struct rusage last;
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0)
+        return;
+    if (module_tag != NULL)
+        LOG_SYS_STD(LOG_NOTICE, "%s: %li involuntary / %li voluntary context switches, %li page faults\n", module_tag,
+                    usage.ru_nivcsw - last.ru_nivcsw, usage.ru_nvcsw - last.ru_nvcsw,
+                    (usage.ru_minflt + usage.ru_majflt) - (last.ru_minflt + last.ru_majflt));
+    last = usage;
+}
@@ -0,0 +1,48 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#ifndef DRONEBRIDGE_DB_RT_H
+#define DRONEBRIDGE_DB_RT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DB_RT_SPEC_MAX_LENGTH   128
+#define DB_RT_DEFAULT_PREFAULT_KB   256 // stack & heap prefaulted with mlock if not specified otherwise
+#define DB_RT_DEFAULT_STACK_SIZE    (8 * 1024 * 1024) // assumed stack size if RLIMIT_STACK is unlimited
+
+/**
+ * Real-time execution profile of a module. Parsed from a spec like "fifo=50,cpu=3,mlock,busypoll=50"
+ */
+typedef struct {
+    int policy;             // SCHED_OTHER (unchanged), SCHED_FIFO or SCHED_RR
+    int priority;           // 1-99 with SCHED_FIFO/SCHED_RR
+    uint32_t cpu_mask;      // bit n = may run on CPU n. 0 = unchanged
+    bool lock_memory;       // mlockall() current and future pages
+    int prefault_kb;        // stack and heap to touch (and lock) up front
+    int busy_poll_us;       // SO_BUSY_POLL on the raw sockets. 0 = off
+} db_rt_profile_t;
+
+int db_rt_parse_profile(const char *spec, db_rt_profile_t *profile);
+int db_rt_apply(const db_rt_profile_t *profile, const char *module_tag);
+void db_rt_socket(const db_rt_profile_t *profile, int socket_fd);
+void db_rt_report(const char *module_tag);
+
+#endif //DRONEBRIDGE_DB_RT_H
@@ -0,0 +1,153 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * Sequence number tracking for DroneBridge ports. Tells apart loss, duplicates (diversity reception) and reordering
+ * (e.g. between adapters) using a sliding bitmap window behind the highest received sequence number.
+ * Frames carrying the header extension (see db_enable_ext_seq_num()) are tracked by their 32 bit sequence number. For
+ * all other frames the 8 bit sequence number gets unwrapped relative to the highest one received so far. Only numbers
+ * up to DB_SEQ_8BIT_SPAN behind the highest one count as duplicates or reordered frames, everything else as a step
+ * ahead. So frames after an outage of up to 255 - DB_SEQ_8BIT_SPAN lost frames are never taken for duplicates.
+ */
+
+#include <string.h>
+#include "db_seq.h"
+#include "db_raw_receive.h"
+
+/**
+ * @param tracker Tracker to init
+ * @param stats Statistics the tracker counts into. Usually located in the status shared memory
+ */
+void db_seq_tracker_init(db_seq_tracker_t *tracker, db_seq_stats_t *stats) {
+    memset(tracker, 0, sizeof(db_seq_tracker_t));
+    tracker->stats = stats;
+    memset(stats, 0, sizeof(db_seq_stats_t));
+}
+
+/**
+ * Move the window by n sequence numbers. Bit i becomes bit i + n.
+ */
+static void window_shift(uint64_t *window, uint32_t n) {
+    const int words = DB_SEQ_WINDOW / 64;
+    if (n >= DB_SEQ_WINDOW) {
+        memset(window, 0, sizeof(uint64_t) * words);
+        return;
+    }
+    int word_shift = (int) (n / 64), bit_shift = (int) (n % 64);
+    for (int i = words - 1; i >= 0; i--) {
+        uint64_t value = 0;
+        if (i - word_shift >= 0) {
+            value = window[i - word_shift] << bit_shift;
+            if (bit_shift && i - word_shift - 1 >= 0)
+                value |= window[i - word_shift - 1] >> (64 - bit_shift);
+        }
+        window[i] = value;
+    }
+}
+
+static void restart(db_seq_tracker_t *tracker, uint32_t seq_num) {
+    tracker->started = true;
+    tracker->highest = seq_num;
+    memset(tracker->window, 0, sizeof(tracker->window));
+    tracker->window[0] = 1;
+}
+
+/**
+ * Count a received frame
+ *
+ * @param tracker Tracker of the port (and adapter)
+ * @param seq_num Extended sequence number of the frame (see db_seq_unwrap() for 8 bit sequence numbers)
+ * @return true if the frame was received for the first time, false if it is a duplicate
+ */
+bool db_seq_track(db_seq_tracker_t *tracker, uint32_t seq_num) {
+    int32_t diff = (int32_t) (seq_num - tracker->highest);
+    if (!tracker->started || diff > DB_SEQ_RESET_GAP || diff <= -DB_SEQ_WINDOW) {
+        restart(tracker, seq_num);
+        tracker->stats->received++;
+        return true;
+    }
+    if (diff > 0) {
+        window_shift(tracker->window, (uint32_t) diff);
+        tracker->window[0] |= 1;
+        tracker->highest = seq_num;
+        tracker->stats->lost += (uint32_t) diff - 1;
+        tracker->stats->received++;
+        return true;
+    }
+    uint32_t age = (uint32_t) -diff;
+    uint64_t mask = (uint64_t) 1 << (age % 64);
+    if (tracker->window[age / 64] & mask) {
+        tracker->stats->duplicates++;
+        return false;
+    }
+    // arrived after a successor. Was counted as lost when the successor arrived
+    tracker->window[age / 64] |= mask;
+    tracker->stats->reordered++;
+    if (tracker->stats->lost > 0)
+        tracker->stats->lost--;
+    tracker->stats->received++;
+    return true;
+}
+
+/**
+ * @return Extended sequence number ending with the given 8 bits. Up to DB_SEQ_8BIT_SPAN behind the highest one
+ * received so far, otherwise ahead of it
+ */
+uint32_t db_seq_unwrap(const db_seq_tracker_t *tracker, uint8_t seq_num) {
+    if (!tracker->started)
+        return seq_num;
+    uint8_t behind = (uint8_t) ((uint8_t) tracker->highest - seq_num);
+    if (behind <= DB_SEQ_8BIT_SPAN)
+        return tracker->highest - behind;
+    return tracker->highest + (uint8_t) (seq_num - (uint8_t) tracker->highest);
+}
+
+/**
+ * @param port_seq Trackers of a port
+ * @param stats Statistics of the port in the status shared memory
+ */
+void db_port_seq_init(db_port_seq_t *port_seq, db_port_seq_stats_t *stats) {
+    db_seq_tracker_init(&port_seq->combined, &stats->combined);
+    for (int i = 0; i < DB_MAX_ADAPTERS; i++)
+        db_seq_tracker_init(&port_seq->adapter[i], &stats->adapter[i]);
+}
+
+/**
+ * Count a frame received on a port. Replaces the diversity duplicate check of the modules.
+ *
+ * @param port_seq Trackers of the port
+ * @param adapter_no Index of the adapter the frame was received on
+ * @param frame The received raw frame (as returned by db_recv())
+ * @param length Length of the frame
+ * @return true if the frame was received for the first time and should be processed, false if it is a duplicate
+ */
+bool db_port_seq_track(db_port_seq_t *port_seq, int adapter_no, const uint8_t *frame, ssize_t length) {
+    uint32_t ext_seq_num;
+    uint16_t radiotap_length = (uint16_t) (frame[2] | (frame[3] << 8));
+    if (length < radiotap_length + DB_RAW_V2_HEADER_LENGTH)
+        return false;
+    bool has_ext = get_db_ext_seq_num(frame, length, &ext_seq_num) == 1;
+    uint8_t seq_num = frame[radiotap_length + 9];
+    if (adapter_no >= 0 && adapter_no < DB_MAX_ADAPTERS) {
+        db_seq_tracker_t *adapter = &port_seq->adapter[adapter_no];
+        db_seq_track(adapter, has_ext ? ext_seq_num : db_seq_unwrap(adapter, seq_num));
+    }
+    return db_seq_track(&port_seq->combined,
+                        has_ext ? ext_seq_num : db_seq_unwrap(&port_seq->combined, seq_num));
+}
@@ -0,0 +1,52 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#ifndef DRONEBRIDGE_DB_SEQ_H
+#define DRONEBRIDGE_DB_SEQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "db_protocol.h"
+#include "shared_memory.h"
+
+#define DB_SEQ_WINDOW       256     // frames tracked behind the highest received sequence number. Multiple of 64
+#define DB_SEQ_RESET_GAP    65536   // larger jumps ahead (or any jump back beyond the window) mean the sender restarted
+#define DB_SEQ_8BIT_SPAN    16      // 8 bit sequence numbers further behind the highest one are taken as a step ahead
+
+typedef struct {
+    bool started;
+    uint32_t highest;                   // highest sequence number received so far
+    uint64_t window[DB_SEQ_WINDOW / 64]; // bit n set: highest - n was received
+    db_seq_stats_t *stats;
+} db_seq_tracker_t;
+
+// Trackers of a DroneBridge port: one per adapter for the per adapter statistics, one for all adapters for dedup
+typedef struct {
+    db_seq_tracker_t combined;
+    db_seq_tracker_t adapter[DB_MAX_ADAPTERS];
+} db_port_seq_t;
+
+void db_seq_tracker_init(db_seq_tracker_t *tracker, db_seq_stats_t *stats);
+bool db_seq_track(db_seq_tracker_t *tracker, uint32_t seq_num);
+uint32_t db_seq_unwrap(const db_seq_tracker_t *tracker, uint8_t seq_num);
+void db_port_seq_init(db_port_seq_t *port_seq, db_port_seq_stats_t *stats);
+bool db_port_seq_track(db_port_seq_t *port_seq, int adapter_no, const uint8_t *frame, ssize_t length);
+
+#endif //DRONEBRIDGE_DB_SEQ_H
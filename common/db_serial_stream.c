@@ -0,0 +1,218 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * Serial ingest for the telemetry link to the flight controller. Instead of one read() syscall per byte, all data
+ * available on the port is read into a buffer with one call and the MSP/MAVLink framing is checked on the buffered
+ * span. Frames are handed out as pointers into the buffer, so they can be passed on without being decoded/re-encoded.
+ * The buffer is compacted before every read so that frames are always contiguous.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include "db_serial_stream.h"
+#include "msp_serial.h"
+#include "db_crc.h"
+#include "mavlink/c_library_v2/common/mavlink.h"
+
+#define FRAME_OK            1
+#define FRAME_INCOMPLETE    0
+#define FRAME_INVALID       (-1)    // not the start of a frame
+#define FRAME_BAD_CHECKSUM  (-2)
+#define FRAME_UNKNOWN       (-3)    // MAVLink message ID not part of the dialect
+
+#define MAVLINK_V1_MAGIC            0xFE
+#define MAVLINK_V2_MAGIC            0xFD
+#define MAVLINK_V1_HEADER_LENGTH    6
+#define MAVLINK_V2_HEADER_LENGTH    10
+#define MAVLINK_V2_FLAG_SIGNED      0x01
+#define MAVLINK_V2_SIGNATURE_LENGTH 13
+
+/**
+ * @param stream Stream to init
+ * @param protocol DB_SERIAL_STREAM_MSP or DB_SERIAL_STREAM_MAVLINK
+ */
+void db_serial_stream_init(db_serial_stream_t *stream, uint8_t protocol) {
+    memset(stream, 0, sizeof(db_serial_stream_t));
+    stream->protocol = protocol;
+    stream->synced = true;
+}
+
+/**
+ * Read everything that is available on the serial port (up to the free space of the buffer) with one call.
+ * Invalidates all frames returned by db_serial_stream_next() so far.
+ *
+ * @param stream The stream
+ * @param fd Serial port
+ * @return Same as read()
+ */
+ssize_t db_serial_stream_fill(db_serial_stream_t *stream, int fd) {
+    if (stream->start > 0) {
+        memmove(stream->buf, stream->buf + stream->start, stream->end - stream->start);
+        stream->end -= stream->start;
+        stream->start = 0;
+    }
+    if (stream->end == DB_SERIAL_STREAM_BUF_SIZE) {
+        // can not happen with valid frames (all are smaller than the buffer). Do not get stuck on garbage
+        stream->stats.discarded_bytes += stream->end;
+        stream->end = 0;
+    }
+    ssize_t read_bytes = read(fd, stream->buf + stream->end, DB_SERIAL_STREAM_BUF_SIZE - stream->end);
+    if (read_bytes > 0) {
+        stream->end += read_bytes;
+        stream->stats.bytes += read_bytes;
+        stream->stats.reads++;
+    }
+    return read_bytes;
+}
+
+/**
+ * Append data that was received some other way (datagram, DroneBridge packet). Same as db_serial_stream_fill() but
+ * without the read() call. Data that does not fit into the buffer is dropped.
+ *
+ * @param stream The stream
+ * @param data Data to append
+ * @param length Length of data
+ * @return Number of bytes appended
+ */
+uint32_t db_serial_stream_feed(db_serial_stream_t *stream, const uint8_t *data, uint32_t length) {
+    if (stream->start > 0) {
+        memmove(stream->buf, stream->buf + stream->start, stream->end - stream->start);
+        stream->end -= stream->start;
+        stream->start = 0;
+    }
+    if (length > DB_SERIAL_STREAM_BUF_SIZE - stream->end) {
+        stream->stats.discarded_bytes += length - (DB_SERIAL_STREAM_BUF_SIZE - stream->end);
+        length = DB_SERIAL_STREAM_BUF_SIZE - stream->end;
+    }
+    memcpy(stream->buf + stream->end, data, length);
+    stream->end += length;
+    stream->stats.bytes += length;
+    stream->stats.reads++;
+    return length;
+}
+
+/**
+ * MSP v1 ($M>), MSP v2 over v1 ($M> with command 255) and MSP v2 native ($X>). Same set of frames as accepted by
+ * mspSerialProcessReceivedData()
+ */
+static int check_msp_frame(const uint8_t *b, uint32_t avail, uint32_t *length) {
+    if (b[0] != '$') return FRAME_INVALID;
+    if (avail < 3) return FRAME_INCOMPLETE;
+    if ((b[1] != 'M' && b[1] != 'X') || b[2] != '>') return FRAME_INVALID;
+    if (b[1] == 'M') {
+        if (avail < 5) return FRAME_INCOMPLETE;
+        uint8_t size = b[3];
+        if (size > MSP_PORT_INBUF_SIZE) return FRAME_INVALID;
+        *length = 6u + size;
+        if (avail < *length) return FRAME_INCOMPLETE;
+        uint8_t checksum = 0;
+        for (uint32_t i = 3; i < *length - 1; i++)
+            checksum ^= b[i];
+        return checksum == b[*length - 1] ? FRAME_OK : FRAME_BAD_CHECKSUM;
+    }
+    if (avail < 8) return FRAME_INCOMPLETE;
+    uint16_t size = (uint16_t) (b[6] | (b[7] << 8));
+    if (size > MSP_PORT_INBUF_SIZE) return FRAME_INVALID;
+    *length = 9u + size;
+    if (avail < *length) return FRAME_INCOMPLETE;
+    uint8_t crc = 0;
+    for (uint32_t i = 3; i < *length - 1; i++)
+        crc = crc8_dvb_s2_table(crc, b[i]);
+    return crc == b[*length - 1] ? FRAME_OK : FRAME_BAD_CHECKSUM;
+}
+
+/**
+ * MAVLink v1 & v2 (signed or unsigned). The checksum includes the CRC_EXTRA byte of the message definition
+ */
+static int check_mavlink_frame(const uint8_t *b, uint32_t avail, uint32_t *length) {
+    uint32_t header_length, msg_id;
+    if (b[0] == MAVLINK_V1_MAGIC) {
+        header_length = MAVLINK_V1_HEADER_LENGTH;
+        if (avail < header_length) return FRAME_INCOMPLETE;
+        *length = header_length + b[1] + 2;
+        msg_id = b[5];
+    } else if (b[0] == MAVLINK_V2_MAGIC) {
+        header_length = MAVLINK_V2_HEADER_LENGTH;
+        if (avail < header_length) return FRAME_INCOMPLETE;
+        if (b[2] & ~MAVLINK_V2_FLAG_SIGNED) return FRAME_INVALID; // incompatibility flag we do not understand
+        *length = header_length + b[1] + 2 + ((b[2] & MAVLINK_V2_FLAG_SIGNED) ? MAVLINK_V2_SIGNATURE_LENGTH : 0);
+        msg_id = b[7] | (b[8] << 8) | ((uint32_t) b[9] << 16);
+    } else {
+        return FRAME_INVALID;
+    }
+    if (avail < *length) return FRAME_INCOMPLETE;
+    const mavlink_msg_entry_t *msg_entry = mavlink_get_msg_entry(msg_id);
+    if (msg_entry == NULL) return FRAME_UNKNOWN;
+    uint16_t crc;
+    crc_init(&crc);
+    crc_accumulate_buffer(&crc, (const char *) b + 1, (uint16_t) (header_length - 1 + b[1]));
+    crc_accumulate(msg_entry->crc_extra, &crc);
+    uint32_t crc_pos = header_length + b[1];
+    return crc == (uint16_t) (b[crc_pos] | (b[crc_pos + 1] << 8)) ? FRAME_OK : FRAME_BAD_CHECKSUM;
+}
+
+static inline bool is_frame_start(const db_serial_stream_t *stream, uint8_t b) {
+    if (stream->protocol == DB_SERIAL_STREAM_MSP)
+        return b == '$';
+    return b == MAVLINK_V1_MAGIC || b == MAVLINK_V2_MAGIC;
+}
+
+/**
+ * Get the next complete frame from the buffered data. Call until it returns false, then wait for the port to become
+ * readable and call db_serial_stream_fill().
+ *
+ * @param stream The stream
+ * @param frame Set to the first byte of the frame inside the buffer. Valid until the next db_serial_stream_fill()
+ * @param frame_length Set to the length of the frame including header and checksum
+ * @return true if a complete frame with correct checksum was found. false if more data is needed
+ */
+bool db_serial_stream_next(db_serial_stream_t *stream, const uint8_t **frame, uint16_t *frame_length) {
+    while (stream->start < stream->end) {
+        uint8_t *b = stream->buf + stream->start;
+        uint32_t avail = stream->end - stream->start, length = 0;
+        int result = stream->protocol == DB_SERIAL_STREAM_MSP ? check_msp_frame(b, avail, &length)
+                                                               : check_mavlink_frame(b, avail, &length);
+        if (result == FRAME_OK) {
+            *frame = b;
+            *frame_length = (uint16_t) length;
+            stream->start += length;
+            stream->stats.frames++;
+            stream->synced = true;
+            return true;
+        } else if (result == FRAME_INCOMPLETE) {
+            return false;
+        } else if (result == FRAME_BAD_CHECKSUM) {
+            stream->stats.checksum_errors++;
+        } else if (result == FRAME_UNKNOWN) {
+            stream->stats.unknown_msgs++;
+        }
+        // search the next frame start. The dropped frame might have been garbage hiding the start of a real one
+        if (stream->synced) {
+            stream->synced = false;
+            stream->stats.resyncs++;
+        }
+        uint32_t skip = 1;
+        while (skip < avail && !is_frame_start(stream, b[skip]))
+            skip++;
+        stream->start += skip;
+        stream->stats.discarded_bytes += skip;
+    }
+    return false;
+}
@@ -0,0 +1,51 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#ifndef DRONEBRIDGE_DB_SERIAL_STREAM_H
+#define DRONEBRIDGE_DB_SERIAL_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "shared_memory.h"
+
+#define DB_SERIAL_STREAM_MSP        1
+#define DB_SERIAL_STREAM_MAVLINK    2
+#define DB_SERIAL_STREAM_BUF_SIZE   4096    // bytes read from the serial port with one read() at most
+
+/**
+ * Splits the byte stream of a flight controller serial port into MSP or MAVLink frames. Everything available on the
+ * port is read with one read() call. Complete frames are returned as spans pointing into the buffer - nothing gets
+ * decoded or re-encoded.
+ */
+typedef struct {
+    uint8_t protocol;           // DB_SERIAL_STREAM_MSP or DB_SERIAL_STREAM_MAVLINK
+    bool synced;                // false while hunting for the next frame start
+    uint32_t start;             // first unprocessed byte
+    uint32_t end;               // end of the valid data
+    uint8_t buf[DB_SERIAL_STREAM_BUF_SIZE];
+    db_serial_stats_t stats;
+} db_serial_stream_t;
+
+void db_serial_stream_init(db_serial_stream_t *stream, uint8_t protocol);
+ssize_t db_serial_stream_fill(db_serial_stream_t *stream, int fd);
+uint32_t db_serial_stream_feed(db_serial_stream_t *stream, const uint8_t *data, uint32_t length);
+bool db_serial_stream_next(db_serial_stream_t *stream, const uint8_t **frame, uint16_t *frame_length);
+
+#endif //DRONEBRIDGE_DB_SERIAL_STREAM_H
@@ -0,0 +1,194 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+/**
+ * Prioritized non-blocking writes to the flight controller. Frames are queued per traffic class and written as far as
+ * the UART driver accepts them, so the module never blocks on a slow serial port. Once the frame that is currently
+ * being written is complete, the queue of the highest priority class with data is served next.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "db_serial_writer.h"
+#include "db_clock_sync.h"
+
+#define BUF_MASK    (DB_SERIAL_WRITER_BUF_SIZE - 1)
+#define FRAME_MASK  (DB_SERIAL_WRITER_MAX_FRAMES - 1)
+
+/**
+ * Set up the writer for a newly opened serial port. Drops everything that is still queued. Sets the port to
+ * non-blocking mode.
+ *
+ * @param writer Writer to init
+ * @param fd Serial port. May be -1 if the port is not open (all queued frames get dropped)
+ * @param baud_rate Baud rate of the port. Used to limit the lower priority data inside the UART driver
+ */
+void db_serial_writer_init(db_serial_writer_t *writer, int fd, int baud_rate) {
+    db_serial_queue_stats_t stats[DB_SERIAL_CLASS_CNT];
+    memcpy(stats, writer->stats, sizeof(stats));
+    memset(writer, 0, sizeof(db_serial_writer_t));
+    memcpy(writer->stats, stats, sizeof(stats));   // keep counting across reconnects
+    for (int i = 0; i < DB_SERIAL_CLASS_CNT; i++)
+        writer->stats[i].queued_bytes = 0;
+    writer->fd = fd;
+    writer->active = -1;
+    if (baud_rate <= 0) baud_rate = 115200;
+    writer->byte_time_us = (uint32_t) (10000000L / baud_rate) + 1;
+    writer->outq_limit = (uint32_t) (baud_rate / 10 * DB_SERIAL_WRITER_OUTQ_MS / 1000);
+    if (writer->outq_limit < 16) writer->outq_limit = 16;
+    if (fd >= 0) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+/**
+ * Queue a frame. It is written right away if the port accepts it.
+ *
+ * @param writer The writer
+ * @param traffic_class DB_SERIAL_CLASS_RC, DB_SERIAL_CLASS_CMD or DB_SERIAL_CLASS_BULK. Only the newest RC frame is
+ * kept - older RC frames that were not started yet are replaced
+ * @param data Frame to write. Copied
+ * @param length Length of the frame
+ * @return 0 if the frame was queued, -1 if the frame was dropped (queue full or port not open). Write errors of the
+ * port are not reported here: the frame stays queued and the next db_serial_writer_flush() call returns the error
+ */
+int db_serial_writer_queue(db_serial_writer_t *writer, int traffic_class, const uint8_t *data, size_t length) {
+    db_serial_queue_t *queue = &writer->queues[traffic_class];
+    db_serial_queue_stats_t *stats = &writer->stats[traffic_class];
+    if (length == 0) return 0;
+    if (traffic_class == DB_SERIAL_CLASS_RC) {
+        // stale RC values are useless: drop every RC frame that is not being written already
+        uint32_t keep = (writer->active == DB_SERIAL_CLASS_RC) ? 1 : 0;
+        while (queue->frame_tail - queue->frame_head > keep) {
+            queue->frame_tail--;
+            uint16_t dropped_length = queue->frames[queue->frame_tail & FRAME_MASK].length;
+            queue->tail -= dropped_length;
+            stats->queued_bytes -= dropped_length;
+            stats->superseded_frames++;
+        }
+    }
+    if (writer->fd < 0 || length > UINT16_MAX || queue->frame_tail - queue->frame_head >= DB_SERIAL_WRITER_MAX_FRAMES
+        || DB_SERIAL_WRITER_BUF_SIZE - (queue->tail - queue->head) < length) {
+        stats->dropped_frames++;
+        return -1;
+    }
+    for (size_t i = 0; i < length;) {
+        uint32_t offset = (queue->tail + i) & BUF_MASK;
+        size_t chunk = DB_SERIAL_WRITER_BUF_SIZE - offset;
+        if (chunk > length - i) chunk = length - i;
+        memcpy(&queue->data[offset], data + i, chunk);
+        i += chunk;
+    }
+    queue->tail += (uint32_t) length;
+    db_serial_frame_t *frame = &queue->frames[queue->frame_tail++ & FRAME_MASK];
+    frame->length = (uint16_t) length;
+    frame->queued_us = db_clock_us();
+    stats->queued_bytes += (uint32_t) length;
+    if (stats->queued_bytes > stats->max_queued_bytes) stats->max_queued_bytes = stats->queued_bytes;
+    // the frame stays queued, so a port error shows up again in the next flush of the owner
+    (void) db_serial_writer_flush(writer);
+    return 0;
+}
+
+/**
+ * @return Class of the frame to write next or -1 if nothing may be written right now
+ */
+static int next_class(db_serial_writer_t *writer) {
+    if (writer->active >= 0) return writer->active;
+    writer->active_written = 0;
+    if (writer->queues[DB_SERIAL_CLASS_RC].frame_tail != writer->queues[DB_SERIAL_CLASS_RC].frame_head)
+        return DB_SERIAL_CLASS_RC;
+    int traffic_class = -1;
+    for (int i = DB_SERIAL_CLASS_RC + 1; i < DB_SERIAL_CLASS_CNT && traffic_class < 0; i++)
+        if (writer->queues[i].frame_tail != writer->queues[i].frame_head) traffic_class = i;
+    if (traffic_class < 0) return -1;
+    int outq = 0;
+    if (ioctl(writer->fd, TIOCOUTQ, &outq) == 0 && (uint32_t) outq >= writer->outq_limit) {
+        writer->throttle_us = (long) ((outq - writer->outq_limit + 1) * writer->byte_time_us);
+        return -1;
+    }
+    return traffic_class;
+}
+
+/**
+ * Write queued frames until the UART driver does not take more or lower priority data has to wait for the driver
+ * buffer to drain. Call whenever the port became writable (see want_write) or throttle_us elapsed.
+ *
+ * @param writer The writer
+ * @return 0 on success, -1 if the port reported an error. The caller must close and re-open it
+ */
+int db_serial_writer_flush(db_serial_writer_t *writer) {
+    writer->want_write = false;
+    writer->throttle_us = 0;
+    if (writer->fd < 0) return 0;
+    int traffic_class;
+    while ((traffic_class = next_class(writer)) >= 0) {
+        db_serial_queue_t *queue = &writer->queues[traffic_class];
+        db_serial_queue_stats_t *stats = &writer->stats[traffic_class];
+        db_serial_frame_t *frame = &queue->frames[queue->frame_head & FRAME_MASK];
+        writer->active = traffic_class;
+        uint32_t offset = queue->head & BUF_MASK;
+        size_t chunk = (size_t) (frame->length - writer->active_written);
+        if (chunk > DB_SERIAL_WRITER_BUF_SIZE - offset) chunk = DB_SERIAL_WRITER_BUF_SIZE - offset;
+        ssize_t written = write(writer->fd, &queue->data[offset], chunk);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                writer->want_write = true;
+                return 0;
+            }
+            return -1;
+        }
+        queue->head += (uint32_t) written;
+        stats->queued_bytes -= (uint32_t) written;
+        writer->active_written += (uint16_t) written;
+        if (writer->active_written == frame->length) {
+            uint32_t latency = (uint32_t) (db_clock_us() - frame->queued_us);
+            stats->latency_avg_us = stats->frames == 0 ? latency : (stats->latency_avg_us * 7 + latency) / 8;
+            if (latency > stats->latency_max_us) stats->latency_max_us = latency;
+            stats->frames++;
+            queue->frame_head++;
+            writer->active = -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return true if frames are waiting to be written
+ */
+bool db_serial_writer_pending(const db_serial_writer_t *writer) {
+    for (int i = 0; i < DB_SERIAL_CLASS_CNT; i++)
+        if (writer->queues[i].frame_tail != writer->queues[i].frame_head) return true;
+    return false;
+}
+
+/**
+ * @return Bytes a frame of the traffic class may have to be queued right now. 0 if the frame slots are used up
+ */
+size_t db_serial_writer_space(const db_serial_writer_t *writer, int traffic_class) {
+    const db_serial_queue_t *queue = &writer->queues[traffic_class];
+    if (queue->frame_tail - queue->frame_head >= DB_SERIAL_WRITER_MAX_FRAMES) return 0;
+    return DB_SERIAL_WRITER_BUF_SIZE - (queue->tail - queue->head);
+}
@@ -0,0 +1,69 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#ifndef DRONEBRIDGE_DB_SERIAL_WRITER_H
+#define DRONEBRIDGE_DB_SERIAL_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "shared_memory.h"
+
+#define DB_SERIAL_WRITER_BUF_SIZE   8192    // bytes per traffic class. Power of two
+#define DB_SERIAL_WRITER_MAX_FRAMES 64      // frames per traffic class. Power of two
+#define DB_SERIAL_WRITER_OUTQ_MS    2       // keep at most this much lower priority data in the UART driver
+
+typedef struct {
+    uint16_t length;
+    uint64_t queued_us;
+} db_serial_frame_t;
+
+typedef struct {
+    uint8_t data[DB_SERIAL_WRITER_BUF_SIZE];
+    uint32_t head, tail;            // byte ring. Free running, masked on access
+    db_serial_frame_t frames[DB_SERIAL_WRITER_MAX_FRAMES];
+    uint32_t frame_head, frame_tail;
+} db_serial_queue_t;
+
+/**
+ * Non-blocking writer for a serial port to the flight controller. Every traffic class has its own queue. Frames are
+ * never interleaved: a frame that was partly written is finished first. After that RC frames always go next.
+ * Frames of the other classes are only started while the UART driver holds less than DB_SERIAL_WRITER_OUTQ_MS of
+ * data, so an RC frame never waits behind a full driver buffer.
+ */
+typedef struct {
+    int fd;
+    uint32_t outq_limit;            // bytes. Derived from the baud rate
+    uint32_t byte_time_us;          // time to transmit one byte (8N1)
+    int active;                     // class of the partly written frame or -1
+    uint16_t active_written;        // bytes of the active frame already written
+    bool want_write;                // the driver buffer is full: wait for the fd to become writable
+    long throttle_us;               // lower priority data waits for the driver buffer to drain. 0 if not throttled
+    db_serial_queue_t queues[DB_SERIAL_CLASS_CNT];
+    db_serial_queue_stats_t stats[DB_SERIAL_CLASS_CNT];
+} db_serial_writer_t;
+
+void db_serial_writer_init(db_serial_writer_t *writer, int fd, int baud_rate);
+int db_serial_writer_queue(db_serial_writer_t *writer, int traffic_class, const uint8_t *data, size_t length);
+int db_serial_writer_flush(db_serial_writer_t *writer);
+bool db_serial_writer_pending(const db_serial_writer_t *writer);
+size_t db_serial_writer_space(const db_serial_writer_t *writer, int traffic_class);
+
+#endif //DRONEBRIDGE_DB_SERIAL_WRITER_H
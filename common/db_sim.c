@@ -0,0 +1,439 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * Simulated radio link backend for DroneBridge raw sockets. Allows to run air and ground modules on one Linux box
+ * without Wi-Fi hardware.
+ *
+ * A link is a directory (DB_SIM_DIR/<link name>) holding one AF_UNIX datagram socket per opened DroneBridge socket.
+ * Like on a real channel every sent frame is broadcast to all other sockets of the link. The regular BPF filter on
+ * every socket then only passes the frames that are meant for the module.
+ * The module gets one end of a socket pair, a worker thread handles the other end:
+ *  - TX: frames sent by the module are broadcast to all sockets of the link
+ *  - RX: received frames pass the channel model (loss, Gilbert-Elliott burst loss, corruption, delay, jitter,
+ *        reordering, bandwidth) and get a synthetic radiotap header (TSFT, RSSI, rate, FCS flag) instead of the TX header
+ *
+ * Spec: sim:<link name>[@<option>=<value>,...] with options (applied on the receiving side)
+ *  loss=<%>  ge=<p_gb %>/<p_bg %>[/<loss in bad state %>]  corrupt=<%>  reorder=<%>  delay=<ms>  jitter=<ms>
+ *  rate=<kbit/s>  rssi=<dBm>  rssivar=<dB>  seed=<n>
+ * e.g. sim:link0@loss=2,ge=1/30,delay=3,jitter=1,rate=8000
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "db_sim.h"
+#include "db_protocol.h"
+#include "db_raw_receive.h"
+#include "db_common.h"
+
+#define SIM_RX_RADIOTAP_LENGTH  20
+#define SIM_RX_RADIOTAP_FLAGS   16  // offset of the flags field
+#define SIM_RADIOTAP_F_FCS      0x10
+#define SIM_RADIOTAP_F_BADFCS   0x40
+#define SIM_MAX_PEERS           32
+#define SIM_PEER_REFRESH_US     500000
+#define SIM_MEDIUM_TIMEOUT_US   20000   // drop frame if a peer does not read its queue for that long
+#define SIM_MAX_FRAME_LENGTH    (SIM_RX_RADIOTAP_LENGTH + MAX_DB_DATA_LENGTH + DB_RAW_OFFSET + 4)
+
+typedef struct {
+    long long due_us;
+    uint32_t order;                 // keeps frames with the same due time in FIFO order
+    uint16_t length;
+    uint8_t frame[SIM_MAX_FRAME_LENGTH];
+} sim_pending_frame_t;
+
+typedef struct {
+    db_sim_channel_t channel;
+    char link_dir[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    struct sockaddr_un own_addr;
+    int medium;                     // bound to own_addr. Receives from & sends to other sockets of the link
+    int peer;                       // our end of the socket pair to the module
+    struct sockaddr_un peers[SIM_MAX_PEERS];
+    int num_peers;
+    long long last_peer_refresh_us;
+    int ge_bad_state;
+    long long link_free_us;         // time at which the link finished transmitting the last accepted frame
+    long long last_due_us;          // delivery time of the last frame that was not reordered
+    unsigned short rand_state[3];
+    sim_pending_frame_t *pool;
+    int heap[DB_SIM_MAX_PENDING];   // indices into pool. Min-heap on due_us
+    int heap_len;
+    int free_idx[DB_SIM_MAX_PENDING];
+    int free_len;
+    uint32_t next_order;
+    uint32_t lost, corrupted, delivered, queue_drops;
+} sim_link_t;
+
+static int socket_counter = 0;
+
+static long long monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Parse a simulated link spec
+ *
+ * @param spec <link name>[@<option>=<value>,...] (without "sim:" prefix)
+ * @param link_name Filled with the name of the link
+ * @param link_name_len Size of link_name
+ * @param channel Filled with the channel model. Defaults to a perfect channel
+ * @return 0 on success, -1 on invalid spec
+ */
+int db_sim_parse_spec(const char *spec, char *link_name, int link_name_len, db_sim_channel_t *channel) {
+    memset(channel, 0, sizeof(db_sim_channel_t));
+    channel->ge_loss_bad = 1;
+    channel->reorder_us = 5000;
+    channel->rssi_dbm = -50;
+    channel->seed = (unsigned short) getpid();
+
+    const char *options = strchr(spec, '@');
+    size_t name_len = options ? (size_t) (options - spec) : strlen(spec);
+    if (name_len == 0 || name_len >= (size_t) link_name_len || memchr(spec, '/', name_len)) {
+        LOG_SYS_STD(LOG_ERR, "DB_SIM: Invalid link name in '%s'\n", spec);
+        return -1;
+    }
+    memcpy(link_name, spec, name_len);
+    link_name[name_len] = '\0';
+    if (options == NULL)
+        return 0;
+
+    char opts[DB_MAX_IFNAME_LENGTH];
+    strncpy(opts, options + 1, sizeof(opts) - 1);
+    opts[sizeof(opts) - 1] = '\0';
+    char *saveptr = NULL;
+    for (char *opt = strtok_r(opts, ",", &saveptr); opt != NULL; opt = strtok_r(NULL, ",", &saveptr)) {
+        char *value = strchr(opt, '=');
+        if (value == NULL) {
+            LOG_SYS_STD(LOG_ERR, "DB_SIM: Option '%s' has no value\n", opt);
+            return -1;
+        }
+        *value++ = '\0';
+        if (strcmp(opt, "loss") == 0) {
+            channel->loss = strtod(value, NULL) / 100;
+        } else if (strcmp(opt, "ge") == 0) {
+            char *next;
+            channel->ge_p_gb = strtod(value, &next) / 100;
+            if (*next == '/') channel->ge_p_bg = strtod(next + 1, &next) / 100;
+            if (*next == '/') channel->ge_loss_bad = strtod(next + 1, &next) / 100;
+        } else if (strcmp(opt, "corrupt") == 0) {
+            channel->corrupt = strtod(value, NULL) / 100;
+        } else if (strcmp(opt, "reorder") == 0) {
+            channel->reorder = strtod(value, NULL) / 100;
+        } else if (strcmp(opt, "delay") == 0) {
+            channel->delay_us = (int) (strtod(value, NULL) * 1000);
+        } else if (strcmp(opt, "jitter") == 0) {
+            channel->jitter_us = (int) (strtod(value, NULL) * 1000);
+        } else if (strcmp(opt, "rate") == 0) {
+            channel->rate_kbit = (uint32_t) strtoul(value, NULL, 10);
+        } else if (strcmp(opt, "rssi") == 0) {
+            channel->rssi_dbm = (int8_t) strtol(value, NULL, 10);
+        } else if (strcmp(opt, "rssivar") == 0) {
+            channel->rssi_var_db = (int) strtol(value, NULL, 10);
+        } else if (strcmp(opt, "seed") == 0) {
+            channel->seed = (unsigned short) strtoul(value, NULL, 10);
+        } else {
+            LOG_SYS_STD(LOG_ERR, "DB_SIM: Unknown option '%s'\n", opt);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static double sim_random(sim_link_t *link) {
+    return erand48(link->rand_state);
+}
+
+/**
+ * Collect the addresses of all other sockets of the link
+ */
+static void refresh_peers(sim_link_t *link) {
+    DIR *dir = opendir(link->link_dir);
+    link->num_peers = 0;
+    link->last_peer_refresh_us = monotonic_us();
+    if (dir == NULL) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && link->num_peers < SIM_MAX_PEERS) {
+        if (entry->d_name[0] == '.') continue;
+        struct sockaddr_un *addr = &link->peers[link->num_peers];
+        memset(addr, 0, sizeof(struct sockaddr_un));
+        addr->sun_family = AF_UNIX;
+        if (snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s", link->link_dir, entry->d_name) >=
+            (int) sizeof(addr->sun_path))
+            continue;
+        if (strcmp(addr->sun_path, link->own_addr.sun_path) != 0)
+            link->num_peers++;
+    }
+    closedir(dir);
+}
+
+/**
+ * Broadcast a frame sent by the module to all other sockets of the link
+ */
+static void broadcast_frame(sim_link_t *link, uint8_t *frame, size_t length) {
+    if (monotonic_us() - link->last_peer_refresh_us > SIM_PEER_REFRESH_US)
+        refresh_peers(link);
+    for (int i = 0; i < link->num_peers; i++) {
+        if (sendto(link->medium, frame, length, 0, (struct sockaddr *) &link->peers[i],
+                   sizeof(struct sockaddr_un)) < 0 && errno == ECONNREFUSED) {
+            unlink(link->peers[i].sun_path); // left behind by a terminated module
+            link->peers[i] = link->peers[--link->num_peers];
+            i--;
+        }
+    }
+}
+
+static int due_before(sim_link_t *link, int a, int b) {
+    sim_pending_frame_t *fa = &link->pool[a], *fb = &link->pool[b];
+    return fa->due_us < fb->due_us || (fa->due_us == fb->due_us && (int32_t) (fa->order - fb->order) < 0);
+}
+
+static void heap_push(sim_link_t *link, int idx) {
+    int pos = link->heap_len++;
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (due_before(link, link->heap[parent], idx)) break;
+        link->heap[pos] = link->heap[parent];
+        pos = parent;
+    }
+    link->heap[pos] = idx;
+}
+
+static int heap_pop(sim_link_t *link) {
+    int top = link->heap[0];
+    int last = link->heap[--link->heap_len];
+    int pos = 0;
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (child >= link->heap_len) break;
+        if (child + 1 < link->heap_len && due_before(link, link->heap[child + 1], link->heap[child]))
+            child++;
+        if (due_before(link, last, link->heap[child])) break;
+        link->heap[pos] = link->heap[child];
+        pos = child;
+    }
+    if (link->heap_len > 0) link->heap[pos] = last;
+    return top;
+}
+
+/**
+ * Run a frame received from the medium through the channel model and queue it for delivery to the module
+ */
+static void receive_frame(sim_link_t *link, uint8_t *frame, size_t length) {
+    db_sim_channel_t *ch = &link->channel;
+    if (length < 4) return;
+    uint16_t tx_rt_length = (uint16_t) (frame[2] | (frame[3] << 8));
+    if (tx_rt_length >= length) return;
+
+    // Gilbert-Elliott state transition happens once per frame
+    if (ch->ge_p_gb > 0) {
+        if (link->ge_bad_state && sim_random(link) < ch->ge_p_bg) link->ge_bad_state = 0;
+        else if (!link->ge_bad_state && sim_random(link) < ch->ge_p_gb) link->ge_bad_state = 1;
+    }
+    if ((link->ge_bad_state && sim_random(link) < ch->ge_loss_bad) || sim_random(link) < ch->loss) {
+        link->lost++;
+        return;
+    }
+    if (link->free_len == 0) {
+        link->queue_drops++;
+        return;
+    }
+    long long now = monotonic_us();
+    uint16_t mpdu_length = (uint16_t) (length - tx_rt_length);
+    if (ch->rate_kbit > 0) {
+        // serialize frames on the link. Transmission time in us = bits / kbit/s * 1000
+        long long tx_time_us = (long long) mpdu_length * 8 * 1000 / ch->rate_kbit;
+        link->link_free_us = (link->link_free_us > now ? link->link_free_us : now) + tx_time_us;
+    } else {
+        link->link_free_us = now;
+    }
+    long long due = link->link_free_us + ch->delay_us;
+    if (ch->jitter_us > 0) due += (long long) (sim_random(link) * ch->jitter_us);
+    // a radio link does not reorder frames by itself. Jitter only delays the following frames too
+    if (due < link->last_due_us) due = link->last_due_us;
+    link->last_due_us = due;
+    if (ch->reorder > 0 && sim_random(link) < ch->reorder) due += ch->reorder_us;
+
+    int idx = link->free_idx[--link->free_len];
+    sim_pending_frame_t *p = &link->pool[idx];
+    uint8_t flags = SIM_RADIOTAP_F_FCS; // FCS is appended like with most monitor mode drivers
+    uint8_t rate = tx_rt_length > 8 ? frame[8] : 0x0c;
+    int rssi = ch->rssi_dbm;
+    if (ch->rssi_var_db > 0)
+        rssi += (int) (sim_random(link) * (2 * ch->rssi_var_db + 1)) - ch->rssi_var_db;
+    uint8_t rx_radiotap[SIM_RX_RADIOTAP_LENGTH] = {
+            0x00, 0x00, SIM_RX_RADIOTAP_LENGTH, 0x00,
+            0x27, 0x08, 0x00, 0x00,     // TSFT, FLAGS, RATE, DBM_ANTSIGNAL, ANTENNA
+            0, 0, 0, 0, 0, 0, 0, 0,     // TSFT: the arrival time is the MAC timestamp of the simulated adapter
+            flags, rate, (uint8_t) (int8_t) rssi, 0x00
+    };
+    for (int i = 0; i < 8; i++)
+        rx_radiotap[8 + i] = (uint8_t) ((uint64_t) due >> (8 * i));
+    memcpy(p->frame, rx_radiotap, SIM_RX_RADIOTAP_LENGTH);
+    memcpy(p->frame + SIM_RX_RADIOTAP_LENGTH, frame + tx_rt_length, mpdu_length);
+    memset(p->frame + SIM_RX_RADIOTAP_LENGTH + mpdu_length, 0, 4); // dummy FCS
+    p->length = (uint16_t) (SIM_RX_RADIOTAP_LENGTH + mpdu_length + 4);
+    if (ch->corrupt > 0 && sim_random(link) < ch->corrupt && mpdu_length > DB_RAW_V2_HEADER_LENGTH) {
+        p->frame[SIM_RX_RADIOTAP_FLAGS] |= SIM_RADIOTAP_F_BADFCS;
+        // flip a bit in the payload. Leave the DroneBridge header intact so that the frame passes the filter
+        int pos = SIM_RX_RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH +
+                  (int) (sim_random(link) * (mpdu_length - DB_RAW_V2_HEADER_LENGTH));
+        p->frame[pos] ^= (uint8_t) (1 << (int) (sim_random(link) * 8));
+        link->corrupted++;
+    }
+    p->due_us = due;
+    p->order = link->next_order++;
+    heap_push(link, idx);
+}
+
+static void *sim_thread(void *arg) {
+    sim_link_t *link = arg;
+    sigset_t all_signals;  // signals are for the main thread
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, NULL);
+    uint8_t buf[SIM_MAX_FRAME_LENGTH];
+    struct pollfd pfds[2] = {{.fd = link->medium, .events = POLLIN},
+                             {.fd = link->peer, .events = POLLIN}};
+    for (;;) {
+        int timeout_ms = -1;
+        if (link->heap_len > 0) {
+            long long wait_us = link->pool[link->heap[0]].due_us - monotonic_us();
+            timeout_ms = wait_us > 0 ? (int) ((wait_us + 999) / 1000) : 0;
+        }
+        if (poll(pfds, 2, timeout_ms) < 0 && errno != EINTR)
+            break;
+        if (pfds[0].revents & POLLIN) {
+            ssize_t l;
+            while ((l = recv(link->medium, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+                receive_frame(link, buf, (size_t) l);
+        }
+        if (pfds[1].revents & POLLIN) {
+            ssize_t l;
+            while ((l = recv(link->peer, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+                broadcast_frame(link, buf, (size_t) l);
+        }
+        if (pfds[1].revents & (POLLERR | POLLHUP))
+            break;
+        long long now = monotonic_us();
+        while (link->heap_len > 0 && link->pool[link->heap[0]].due_us <= now) {
+            int idx = heap_pop(link);
+            // behave like a raw socket with a full receive buffer if the module does not keep up
+            if (send(link->peer, link->pool[idx].frame, link->pool[idx].length, MSG_DONTWAIT) > 0)
+                link->delivered++;
+            else
+                link->queue_drops++;
+            link->free_idx[link->free_len++] = idx;
+        }
+    }
+    LOG_SYS_STD(LOG_NOTICE, "DB_SIM: Closed %s (delivered %u, lost %u, corrupted %u, queue drops %u)\n",
+                link->own_addr.sun_path, link->delivered, link->lost, link->corrupted, link->queue_drops);
+    close(link->medium);
+    unlink(link->own_addr.sun_path);
+    free(link->pool);
+    free(link);
+    return NULL;
+}
+
+/**
+ * Open a socket on a simulated link
+ *
+ * @param spec <link name>[@<option>=<value>,...] (without "sim:" prefix)
+ * @param comm_id The communication ID that we filter for
+ * @param recv_direction Direction of frames that pass the filter
+ * @param port DroneBridge port that passes the filter
+ * @return File descriptor to use as DroneBridge socket or -1 on error
+ */
+int db_sim_open(const char *spec, uint8_t comm_id, uint8_t recv_direction, uint8_t port) {
+    sim_link_t *link = calloc(1, sizeof(sim_link_t));
+    if (link == NULL) return -1;
+    char link_name[64];
+    if (db_sim_parse_spec(spec, link_name, sizeof(link_name), &link->channel) < 0)
+        goto error;
+    link->pool = malloc(sizeof(sim_pending_frame_t) * DB_SIM_MAX_PENDING);
+    if (link->pool == NULL) goto error;
+    for (int i = 0; i < DB_SIM_MAX_PENDING; i++)
+        link->free_idx[i] = DB_SIM_MAX_PENDING - 1 - i;
+    link->free_len = DB_SIM_MAX_PENDING;
+    link->rand_state[0] = 0x330e;
+    link->rand_state[1] = link->channel.seed;
+    link->rand_state[2] = (unsigned short) __sync_fetch_and_add(&socket_counter, 1);
+
+    mkdir(DB_SIM_DIR, 0777);
+    link->own_addr.sun_family = AF_UNIX;
+    // the socket of this end is created inside the link directory. Both paths must fit into sun_path
+    if (snprintf(link->link_dir, sizeof(link->link_dir), "%s/%s", DB_SIM_DIR, link_name) >=
+        (int) sizeof(link->link_dir) ||
+        snprintf(link->own_addr.sun_path, sizeof(link->own_addr.sun_path), "%s/%i-%i", link->link_dir, getpid(),
+                 link->rand_state[2]) >= (int) sizeof(link->own_addr.sun_path)) {
+        LOG_SYS_STD(LOG_ERR, "DB_SIM: Link name %s is too long\n", link_name);
+        goto error;
+    }
+    if (mkdir(link->link_dir, 0777) < 0 && errno != EEXIST) {
+        LOG_SYS_STD(LOG_ERR, "DB_SIM: Could not create %s: %s\n", link->link_dir, strerror(errno));
+        goto error;
+    }
+    unlink(link->own_addr.sun_path);
+    if ((link->medium = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 ||
+        bind(link->medium, (struct sockaddr *) &link->own_addr, sizeof(struct sockaddr_un)) < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_SIM: Could not bind %s: %s\n", link->own_addr.sun_path, strerror(errno));
+        goto error_medium;
+    }
+    struct timeval tv = {.tv_sec = 0, .tv_usec = SIM_MEDIUM_TIMEOUT_US};
+    setsockopt(link->medium, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+        goto error_medium;
+    link->peer = sv[1];
+    if (setBPF(sv[0], comm_id, recv_direction, port) < 0) {
+        close(sv[1]);
+        goto error_medium;
+    }
+    refresh_peers(link);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, sim_thread, link) != 0) {
+        close(sv[0]);
+        close(sv[1]);
+        goto error_medium;
+    }
+    pthread_detach(thread);
+    LOG_SYS_STD(LOG_NOTICE, "DB_SIM: Opened socket on simulated link %s (loss %.1f%%, delay %ims, rate %ukbit/s)\n",
+                link_name, link->channel.loss * 100, link->channel.delay_us / 1000, link->channel.rate_kbit);
+    return sv[0];
+
+    error_medium:
+    close(link->medium);
+    unlink(link->own_addr.sun_path);
+    error:
+    free(link->pool);
+    free(link);
+    return -1;
+}
@@ -0,0 +1,51 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#ifndef DRONEBRIDGE_DB_SIM_H
+#define DRONEBRIDGE_DB_SIM_H
+
+#include <stdint.h>
+
+#define DB_SIM_PREFIX           "sim:"          // sim:<link name>[@<option>=<value>,...]
+#define DB_SIM_DIR              "/tmp/db_sim"   // every link is a directory of unix sockets (one per opened socket)
+#define DB_SIM_MAX_PENDING      512             // max frames in flight per socket (delay/bandwidth queue)
+
+/**
+ * Channel model applied to all frames received by a simulated socket
+ */
+typedef struct {
+    double loss;            // probability of random loss (0..1)
+    double ge_p_gb;         // Gilbert-Elliott: probability of good -> bad state transition per frame
+    double ge_p_bg;         // Gilbert-Elliott: probability of bad -> good state transition per frame
+    double ge_loss_bad;     // Gilbert-Elliott: loss probability in bad state
+    double corrupt;         // probability of a frame being delivered with bad FCS and a flipped bit
+    double reorder;         // probability of a frame being held back by reorder_us
+    int delay_us;           // constant one-way delay
+    int jitter_us;          // uniformly distributed additional delay [0, jitter_us]
+    int reorder_us;
+    uint32_t rate_kbit;     // link capacity. 0 = unlimited
+    int8_t rssi_dbm;        // reported signal strength
+    int rssi_var_db;        // uniformly distributed +/- variation of the reported RSSI
+    unsigned short seed;
+} db_sim_channel_t;
+
+int db_sim_parse_spec(const char *spec, char *link_name, int link_name_len, db_sim_channel_t *channel);
+int db_sim_open(const char *spec, uint8_t comm_id, uint8_t recv_direction, uint8_t port);
+
+#endif //DRONEBRIDGE_DB_SIM_H
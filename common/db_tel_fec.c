@@ -0,0 +1,181 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#include <string.h>
+#include "db_tel_fec.h"
+
+static void xor_into(uint8_t *dst, const uint8_t *src, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++)
+        dst[i] ^= src[i];
+}
+
+/**
+ * @param enc Encoder to init
+ * @param k Data packets per parity packet (1..DB_TEL_FEC_MAX_K). 0 = FEC disabled, the encoder must not be used
+ * @param max_hold_us Max. time between the first data packet of a group and its parity packet. Bounds the latency of a
+ * rebuilt packet if telemetry is sparse
+ */
+void db_tel_fec_encoder_init(db_tel_fec_encoder_t *enc, uint8_t k, uint32_t max_hold_us) {
+    memset(enc, 0, sizeof(db_tel_fec_encoder_t));
+    enc->k = k > DB_TEL_FEC_MAX_K ? DB_TEL_FEC_MAX_K : k;
+    enc->max_hold_us = max_hold_us;
+}
+
+/**
+ * Wrap a telemetry packet into a FEC data packet and add it to the parity of the current group
+ *
+ * @param enc The encoder
+ * @param data Payload. Max. DB_TEL_FEC_MAX_PAYLOAD bytes
+ * @param length Length of the payload
+ * @param now_us db_clock_us()
+ * @return Length of the data packet in enc->packet. Send it before calling db_tel_fec_parity()
+ */
+uint16_t db_tel_fec_encode(db_tel_fec_encoder_t *enc, const uint8_t *data, uint16_t length, uint64_t now_us) {
+    if (length > DB_TEL_FEC_MAX_PAYLOAD) length = DB_TEL_FEC_MAX_PAYLOAD;
+    db_tel_fec_header_t *header = (db_tel_fec_header_t *) enc->packet;
+    header->index = enc->count;
+    header->group = enc->group;
+    header->length = length;
+    memcpy(enc->packet + DB_TEL_FEC_HEADER_LENGTH, data, length);
+
+    if (enc->count == 0) enc->group_start_us = now_us;
+    xor_into(enc->parity, data, length);
+    enc->length_xor ^= length;
+    if (length > enc->max_length) enc->max_length = length;
+    enc->count++;
+    enc->stats.data_packets++;
+    return (uint16_t) (length + DB_TEL_FEC_HEADER_LENGTH);
+}
+
+/**
+ * Finish the current group if it is complete or if its first packet was sent max_hold_us ago
+ *
+ * @param enc The encoder
+ * @param now_us db_clock_us()
+ * @return Length of the parity packet in enc->packet. 0 if no parity packet is due
+ */
+uint16_t db_tel_fec_parity(db_tel_fec_encoder_t *enc, uint64_t now_us) {
+    if (enc->count == 0 || (enc->count < enc->k && now_us - enc->group_start_us < enc->max_hold_us))
+        return 0;
+    db_tel_fec_header_t *header = (db_tel_fec_header_t *) enc->packet;
+    header->index = (uint8_t) (DB_TEL_FEC_PARITY_FLAG | enc->count);
+    header->group = enc->group;
+    header->length = enc->length_xor;
+    uint16_t length = enc->max_length;
+    memcpy(enc->packet + DB_TEL_FEC_HEADER_LENGTH, enc->parity, length);
+
+    memset(enc->parity, 0, length);
+    enc->group++;
+    enc->count = 0;
+    enc->length_xor = 0;
+    enc->max_length = 0;
+    enc->stats.parity_packets++;
+    return (uint16_t) (length + DB_TEL_FEC_HEADER_LENGTH);
+}
+
+/**
+ * @return Microseconds until the parity packet of a partial group is due. -1 if no group is open
+ */
+long db_tel_fec_timeout_us(const db_tel_fec_encoder_t *enc, uint64_t now_us) {
+    if (enc->count == 0) return -1;
+    uint64_t due_us = enc->group_start_us + enc->max_hold_us;
+    return due_us > now_us ? (long) (due_us - now_us) : 0;
+}
+
+void db_tel_fec_decoder_init(db_tel_fec_decoder_t *dec) {
+    memset(dec, 0, sizeof(db_tel_fec_decoder_t));
+}
+
+/**
+ * @return State of the group. NULL if the group is slightly older than the one currently tracked in its slot (late
+ * packet). Much older group numbers are taken as a restart of the UAV side or a wrap around after a long silence
+ */
+static db_tel_fec_group_t *get_group(db_tel_fec_decoder_t *dec, uint8_t group) {
+    db_tel_fec_group_t *slot = &dec->groups[group % DB_TEL_FEC_GROUPS];
+    if (slot->used && slot->group == group) return slot;
+    if (slot->used && (uint8_t) (slot->group - group) <= DB_TEL_FEC_LATE_GROUPS) return NULL;
+    slot->used = true;
+    slot->group = group;
+    slot->received = 0;
+    slot->mask = 0;
+    slot->length_xor = 0;
+    slot->max_length = 0;
+    memset(slot->acc, 0, DB_TEL_FEC_MAX_PAYLOAD);
+    return slot;
+}
+
+/**
+ * Process a received FEC packet. Data packets are passed on right away, a lost data packet is passed on as soon as the
+ * parity packet of its group arrived.
+ *
+ * @param dec The decoder
+ * @param packet Received DroneBridge payload incl. the FEC header
+ * @param length Length of the received payload
+ * @param payload Set to the telemetry payload to pass on. Points into packet or into the decoder
+ * @param payload_length Set to the length of the telemetry payload
+ * @return 1 if there is a payload to pass on, 0 if not (parity packet, duplicate), -1 if the packet is invalid
+ */
+int db_tel_fec_decode(db_tel_fec_decoder_t *dec, const uint8_t *packet, uint16_t length, const uint8_t **payload,
+                      uint16_t *payload_length) {
+    if (length < DB_TEL_FEC_HEADER_LENGTH) return -1;
+    db_tel_fec_header_t header;
+    memcpy(&header, packet, DB_TEL_FEC_HEADER_LENGTH);
+    const uint8_t *data = packet + DB_TEL_FEC_HEADER_LENGTH;
+    uint16_t data_length = (uint16_t) (length - DB_TEL_FEC_HEADER_LENGTH);
+    db_tel_fec_group_t *group = get_group(dec, header.group);
+
+    if (!(header.index & DB_TEL_FEC_PARITY_FLAG)) {
+        if (header.index >= DB_TEL_FEC_MAX_K || header.length != data_length) return -1;
+        dec->stats.data_packets++;
+        if (group != NULL) {
+            if (group->mask & (1u << header.index)) return 0;  // already rebuilt from parity
+            group->mask |= (uint16_t) (1u << header.index);
+            group->received++;
+            group->length_xor ^= data_length;
+            if (data_length > group->max_length) group->max_length = data_length;
+            xor_into(group->acc, data, data_length);
+        }
+        *payload = data;
+        *payload_length = data_length;
+        return 1;
+    }
+
+    uint8_t count = (uint8_t) (header.index & ~DB_TEL_FEC_PARITY_FLAG);
+    if (count == 0 || count > DB_TEL_FEC_MAX_K) return -1;
+    dec->stats.parity_packets++;
+    if (group == NULL || group->received >= count) return 0;
+    if (group->received + 1 < count) {
+        dec->stats.unrecoverable++;
+        group->received = count;    // count the group only once
+        return 0;
+    }
+    uint16_t lost_length = (uint16_t) (group->length_xor ^ header.length);
+    if (lost_length == 0 || lost_length > data_length || group->max_length > data_length) return -1;
+    uint8_t lost_index = 0;
+    while (group->mask & (1u << lost_index)) lost_index++;
+    memcpy(dec->packet, data, lost_length);
+    xor_into(dec->packet, group->acc, lost_length);
+    group->mask |= (uint16_t) (1u << lost_index);
+    group->received++;
+    dec->stats.recovered++;
+    *payload = dec->packet;
+    *payload_length = lost_length;
+    return 1;
+}
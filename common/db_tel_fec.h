@@ -0,0 +1,84 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+
+#ifndef DRONEBRIDGE_DB_TEL_FEC_H
+#define DRONEBRIDGE_DB_TEL_FEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "db_protocol.h"
+#include "shared_memory.h"
+
+#define DB_TEL_FEC_HEADER_LENGTH    4
+#define DB_TEL_FEC_MAX_PAYLOAD      (DATA_UNI_LENGTH - DB_TEL_FEC_HEADER_LENGTH)
+#define DB_TEL_FEC_MAX_K            16      // max. data packets per parity packet
+#define DB_TEL_FEC_PARITY_FLAG      0x80    // set in the index field of parity packets
+#define DB_TEL_FEC_GROUPS           4       // groups the decoder keeps track of at once (reordering, late parity)
+#define DB_TEL_FEC_LATE_GROUPS      32      // packets of groups up to this much older than the tracked one are late
+
+/**
+ * Prepended to every telemetry packet on DB_PORT_PROXY if FEC is enabled (-F). k data packets are followed by one
+ * parity packet that is the XOR of the k payloads (zero padded to the longest one). Any single lost packet of a group
+ * can be rebuilt once the parity packet arrived.
+ */
+typedef struct {
+    uint8_t index;      // data: position in the group. parity: DB_TEL_FEC_PARITY_FLAG | number of data packets
+    uint8_t group;
+    uint16_t length;    // data: payload length. parity: XOR of all data payload lengths of the group
+} __attribute__((packed)) db_tel_fec_header_t;
+
+typedef struct {
+    uint8_t k;
+    uint8_t group;
+    uint8_t count;              // data packets of the current group sent so far
+    uint16_t length_xor;
+    uint16_t max_length;        // longest payload of the current group = length of the parity payload
+    uint64_t group_start_us;    // time the first data packet of the current group was sent
+    uint32_t max_hold_us;       // a partial group gets its parity packet after this time
+    uint8_t parity[DB_TEL_FEC_MAX_PAYLOAD];
+    uint8_t packet[DATA_UNI_LENGTH];    // output of db_tel_fec_encode() & db_tel_fec_parity()
+    db_tel_fec_stats_t stats;
+} db_tel_fec_encoder_t;
+
+typedef struct {
+    bool used;
+    uint8_t group;
+    uint8_t received;
+    uint16_t mask;      // bit i = data packet i of the group was received or rebuilt
+    uint16_t length_xor;
+    uint16_t max_length;
+    uint8_t acc[DB_TEL_FEC_MAX_PAYLOAD];    // XOR of all received data payloads
+} db_tel_fec_group_t;
+
+typedef struct {
+    db_tel_fec_group_t groups[DB_TEL_FEC_GROUPS];
+    uint8_t packet[DB_TEL_FEC_MAX_PAYLOAD];    // rebuilt payload
+    db_tel_fec_stats_t stats;
+} db_tel_fec_decoder_t;
+
+void db_tel_fec_encoder_init(db_tel_fec_encoder_t *enc, uint8_t k, uint32_t max_hold_us);
+uint16_t db_tel_fec_encode(db_tel_fec_encoder_t *enc, const uint8_t *data, uint16_t length, uint64_t now_us);
+uint16_t db_tel_fec_parity(db_tel_fec_encoder_t *enc, uint64_t now_us);
+long db_tel_fec_timeout_us(const db_tel_fec_encoder_t *enc, uint64_t now_us);
+void db_tel_fec_decoder_init(db_tel_fec_decoder_t *dec);
+int db_tel_fec_decode(db_tel_fec_decoder_t *dec, const uint8_t *packet, uint16_t length, const uint8_t **payload,
+                      uint16_t *payload_length);
+
+#endif //DRONEBRIDGE_DB_TEL_FEC_H
@@ -55,25 +55,3 @@ void print_buffer(uint8_t buffer[], int num_bytes){
     }
     LOG_SYS_STD(LOG_INFO, "\n");
 }
-
-/**
- * Reads the current low-voltage value from RPi
- * @return 1 if currently not enough voltage supplied to Pi; 0 if all OK
- */
-uint8_t get_undervolt(void){
-    uint8_t uvolt = 10;
-    FILE *fp;
-    char path[1035];
-    fp = popen("vcgencmd get_throttled", "r");
-    if (fp == NULL) {
-        LOG_SYS_STD(LOG_WARNING, "Failed to get raspberry pi under-voltage notice\n" );
-        exit(1);
-    }
-    if (fgets(path, sizeof(path)-1, fp) != NULL) {
-        char *dummy;
-        uint32_t iuvolt = (uint32_t) strtoul(&path[10], &dummy, 16);
-        uvolt = (uint8_t) ((uint8_t) iuvolt & 1);  // get under volt bit - current voltage status
-    }
-    pclose(fp);
-    return uvolt;
-}
@@ -24,10 +24,327 @@
 #include <string.h>
 #include <zconf.h>
 #include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
 #include "db_protocol.h"
 #include "shared_memory.h"
 #include "db_common.h"
 
+#define DB_SHM_SPINS_BEFORE_YIELD   64
+
+static bool task_alive(int32_t tid) {
+    return !(kill(tid, 0) == -1 && errno == ESRCH);
+}
+
+static int32_t current_tid(void) {
+    return (int32_t) syscall(SYS_gettid);
+}
+
+/**
+ * Init the header of a freshly created segment or of a segment that was created with a different layout. The payload
+ * of those segments gets cleared. A writer lock left behind by a crashed process is released.
+ *
+ * @param header Header of the mapped segment
+ * @param size Size of the segment including the header
+ * @return true if the segment was (re)initialized
+ */
+static bool db_shm_init_header(db_shm_header_t *header, size_t size) {
+    if (header->magic == DB_SHM_MAGIC && header->version == DB_SHM_VERSION && header->size == size) {
+        int32_t owner = __atomic_load_n(&header->writer_tid, __ATOMIC_ACQUIRE);
+        if ((owner & FUTEX_TID_MASK) != 0 && !task_alive(owner & FUTEX_TID_MASK) &&
+            __atomic_compare_exchange_n(&header->writer_tid, &owner, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            // previous writer died inside a write. Make the segment readable again
+            uint32_t seq = __atomic_load_n(&header->seq, __ATOMIC_RELAXED);
+            if (seq & 1u) __atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELEASE);
+        }
+        return false;
+    }
+    memset((uint8_t *) header + sizeof(db_shm_header_t), 0, size - sizeof(db_shm_header_t));
+    header->version = DB_SHM_VERSION;
+    header->size = (uint32_t) size;
+    header->writer_tid = 0;
+    header->seq = 0;
+    __atomic_store_n(&header->magic, DB_SHM_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Start modifying the payload of a segment. Serializes concurrent writers (also across processes) and marks the
+ * payload as inconsistent for readers until db_shm_write_end() is called. Keep the section short and never nest it.
+ * The writer lock is a priority inheritance futex: a contended writer sleeps in the kernel and the current owner runs
+ * with the priority of the highest waiter, so a SCHED_FIFO writer can not starve a lower priority owner.
+ *
+ * @param header Header of the segment
+ */
+void db_shm_write_begin(db_shm_header_t *header) {
+    int32_t self = current_tid();
+    for (;;) {
+        int32_t owner = 0;
+        if (__atomic_compare_exchange_n(&header->writer_tid, &owner, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        if (syscall(SYS_futex, &header->writer_tid, FUTEX_LOCK_PI, 0, NULL, NULL, 0) == 0)
+            break;
+        if (errno == ESRCH) {
+            // writer crashed while holding the lock: take over. seq may still be odd from its unfinished write
+            owner = __atomic_load_n(&header->writer_tid, __ATOMIC_RELAXED);
+            if ((owner & FUTEX_TID_MASK) != 0 && !task_alive(owner & FUTEX_TID_MASK) &&
+                __atomic_compare_exchange_n(&header->writer_tid, &owner, self, false, __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (errno != EAGAIN && errno != EINTR) {
+            sched_yield();  // kernel without PI futex support
+        }
+    }
+    uint32_t seq = __atomic_load_n(&header->seq, __ATOMIC_RELAXED);
+    if (!(seq & 1u))
+        __atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Finish the modification of a segment started with db_shm_write_begin(). Readers see the new payload from now on.
+ *
+ * @param header Header of the segment
+ */
+void db_shm_write_end(db_shm_header_t *header) {
+    uint32_t seq = __atomic_load_n(&header->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->seq, seq + 1, __ATOMIC_SEQ_CST);
+    int32_t self = current_tid();
+    // kernel hands the lock to the highest priority waiter if there are any (FUTEX_WAITERS set)
+    if (!__atomic_compare_exchange_n(&header->writer_tid, &self, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        syscall(SYS_futex, &header->writer_tid, FUTEX_UNLOCK_PI, 0, NULL, NULL, 0);
+    // readers register before they check seq. Either they see the new seq or we see them waiting
+    if (__atomic_load_n(&header->waiters, __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, &header->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Copy locally accumulated fields into the segment in one consistent step. Writers with high update rates keep their
+ * counters in process memory and only publish every DB_SHM_PUBLISH_INTERVAL_MS to keep the shared cache lines quiet.
+ *
+ * @param header Header of the segment
+ * @param shm_dst Destination inside the mapped segment
+ * @param local_src Local copy of the fields
+ * @param length Number of bytes to publish
+ */
+void db_shm_publish(db_shm_header_t *header, void *shm_dst, const void *local_src, size_t length) {
+    db_shm_write_begin(header);
+    memcpy(shm_dst, local_src, length);
+    db_shm_write_end(header);
+}
+
+/**
+ * Take a consistent copy of a segment. Retries while a writer is active or if the segment was modified during the
+ * copy.
+ *
+ * @param header Header of the mapped segment
+ * @param copy Destination. Must be segment_size bytes long. Contains the header as well
+ * @param segment_size Size of the segment e.g. sizeof(db_gnd_status_t)
+ * @return true if the copy is consistent. false if no consistent copy could be taken after DB_SHM_SNAPSHOT_RETRIES
+ * attempts (e.g. writer crashed inside a write). The copy is filled anyway
+ */
+bool db_shm_snapshot(const db_shm_header_t *header, void *copy, size_t segment_size) {
+    for (int i = 0; i < DB_SHM_SNAPSHOT_RETRIES; i++) {
+        uint32_t seq_start = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+        if (!(seq_start & 1u)) {
+            memcpy(copy, header, segment_size);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&header->seq, __ATOMIC_RELAXED) == seq_start)
+                return true;
+        }
+        if ((i + 1) % DB_SHM_SPINS_BEFORE_YIELD == 0) sched_yield();
+    }
+    memcpy(copy, header, segment_size);
+    return false;
+}
+
+/**
+ * @param header Header of the segment
+ * @return Current update counter of the segment. Pass to db_shm_wait() to wait for the next update
+ */
+uint32_t db_shm_seq(const db_shm_header_t *header) {
+    return __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Block until a writer finished an update of the segment. Writers wake up the waiting readers in db_shm_write_end()
+ * via a futex on the sequence counter, so readers react to updates immediately instead of polling.
+ *
+ * @param header Header of the segment
+ * @param seq Update counter seen by the caller (db_shm_seq()). Set to the new counter if the segment was updated
+ * @param timeout_us Max time to wait [us]. -1 to wait forever
+ * @return 1 if the segment was updated, 0 on timeout
+ */
+int db_shm_wait(db_shm_header_t *header, uint32_t *seq, long timeout_us) {
+    struct timespec deadline, now, remaining;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_us / 1000000;
+    deadline.tv_nsec += (timeout_us % 1000000) * 1000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    for (;;) {
+        uint32_t current = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+        if (current != *seq && !(current & 1u)) {
+            *seq = current;
+            return 1;
+        }
+        if (timeout_us >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {
+                remaining.tv_sec--;
+                remaining.tv_nsec += 1000000000L;
+            }
+            if (remaining.tv_sec < 0)
+                return 0;
+        }
+        __atomic_add_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+        current = __atomic_load_n(&header->seq, __ATOMIC_SEQ_CST);
+        if (current == *seq || (current & 1u))  // returns right away if seq changed in the meantime
+            syscall(SYS_futex, &header->seq, FUTEX_WAIT, current, timeout_us >= 0 ? &remaining : NULL, NULL, 0);
+        __atomic_sub_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+typedef struct {
+    db_shm_header_t *header;
+    int event_fd;
+} db_shm_notifier_t;
+
+static void *notify_thread(void *arg) {
+    db_shm_notifier_t notifier = *(db_shm_notifier_t *) arg;
+    free(arg);
+    sigset_t all_signals;  // signals are for the main thread
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, NULL);
+    uint32_t seq = db_shm_seq(notifier.header);
+    uint64_t one = 1;
+    for (;;) {
+        db_shm_wait(notifier.header, &seq, -1);
+        if (write(notifier.event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            break;
+    }
+    return NULL;
+}
+
+/**
+ * Get a file descriptor that becomes readable every time a writer updated the segment. Use it with select()/poll()
+ * next to sockets. Call db_shm_notify_ack() once it was readable. A helper thread waits for the updates. Keep the
+ * descriptor open for the lifetime of the process.
+ *
+ * @param header Header of the segment
+ * @return Non-blocking eventfd or -1 on error
+ */
+int db_shm_notify_fd(db_shm_header_t *header) {
+    int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_SHM: Could not create eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+    db_shm_notifier_t *notifier = malloc(sizeof(db_shm_notifier_t));
+    notifier->header = header;
+    notifier->event_fd = event_fd;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, notify_thread, notifier) != 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_SHM: Could not start notification thread\n");
+        free(notifier);
+        close(event_fd);
+        return -1;
+    }
+    pthread_detach(thread);
+    return event_fd;
+}
+
+/**
+ * Reset a notification descriptor returned by db_shm_notify_fd() after it became readable
+ *
+ * @param notify_fd The descriptor
+ */
+void db_shm_notify_ack(int notify_fd) {
+    uint64_t cnt;
+    if (read(notify_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        LOG_SYS_STD(LOG_ERR, "DB_SHM: Could not read notification: %s\n", strerror(errno));
+}
+
+/**
+ * Set the name of an adapter shown in shared memory. Interface specs (e.g. pcap:<file>) may be longer than the field
+ * and get shortened.
+ *
+ * @param shm_name Name field of a db_adapter_status
+ * @param if_name Interface (spec) the module was started with
+ */
+void db_shm_set_adapter_name(char shm_name[IFNAMSIZ], const char *if_name) {
+    size_t length = strnlen(if_name, IFNAMSIZ);
+    if (length == IFNAMSIZ) {
+        length = IFNAMSIZ - 1;
+        LOG_SYS_STD(LOG_WARNING, "DB_SHM: Adapter %s is shown as %.*s\n", if_name, (int) length, if_name);
+    }
+    memcpy(shm_name, if_name, length);
+    shm_name[length] = '\0';
+}
+
+/**
+ * Append a sample to the history ring. Only one process may write to a ring.
+ *
+ * @param history The history ring
+ * @param sample Sample to append
+ */
+void db_history_append(db_link_history_t *history, const db_history_sample_t *sample) {
+    uint64_t head = history->head;
+    history->samples[head % DB_HISTORY_LENGTH] = *sample;
+    __atomic_store_n(&history->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Read all samples appended since the cursor (oldest first). Samples that were overwritten before they could be read
+ * are skipped and counted as missed.
+ *
+ * @param history The history ring
+ * @param cursor Number of samples consumed so far. Init with 0 to read the entire ring or with the head of the ring to
+ * only read new samples. Gets advanced by the number of samples consumed
+ * @param samples Destination for up to max_samples samples
+ * @param max_samples Size of samples
+ * @param missed Incremented by the number of samples that were overwritten before they were read. May be NULL
+ * @return Number of samples copied to samples
+ */
+uint32_t db_history_read(const db_link_history_t *history, uint64_t *cursor, db_history_sample_t *samples,
+                         uint32_t max_samples, uint64_t *missed) {
+    uint64_t head = __atomic_load_n(&history->head, __ATOMIC_ACQUIRE);
+    if (*cursor > head)
+        *cursor = 0;  // ring was re-created
+    // the writer might already be overwriting the slot of the oldest sample with the sample for index head
+    uint64_t oldest = head + 1 > DB_HISTORY_LENGTH ? head + 1 - DB_HISTORY_LENGTH : 0;
+    if (*cursor < oldest) {
+        if (missed) *missed += oldest - *cursor;
+        *cursor = oldest;
+    }
+    uint32_t cnt = (head - *cursor) < max_samples ? (uint32_t) (head - *cursor) : max_samples;
+    for (uint32_t i = 0; i < cnt; i++)
+        samples[i] = history->samples[(*cursor + i) % DB_HISTORY_LENGTH];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // drop samples the writer overwrote while we were copying
+    head = __atomic_load_n(&history->head, __ATOMIC_RELAXED);
+    oldest = head + 1 > DB_HISTORY_LENGTH ? head + 1 - DB_HISTORY_LENGTH : 0;
+    uint32_t overwritten = 0;
+    if (*cursor < oldest)
+        overwritten = (oldest - *cursor) < cnt ? (uint32_t) (oldest - *cursor) : cnt;
+    if (overwritten > 0) {
+        memmove(samples, samples + overwritten, (cnt - overwritten) * sizeof(db_history_sample_t));
+        if (missed) *missed += overwritten;
+    }
+    *cursor += cnt;
+    return cnt - overwritten;
+}
+
 db_gnd_status_t *db_gnd_status_memory_open(void) {
     int fd;
     for(;;) {
@@ -49,6 +366,7 @@ db_gnd_status_t *db_gnd_status_memory_open(void) {
         perror("db_gnd_status_t: mmap");
         exit(1);
     }
+    db_shm_init_header(retval, sizeof(db_gnd_status_t));
     return (db_gnd_status_t*)retval;
 }
 
@@ -73,6 +391,7 @@ db_rc_status_t *db_rc_status_memory_open(void) {
         perror("db_rc_status_memory_open: mmap");
         exit(1);
     }
+    db_shm_init_header(retval, sizeof(db_rc_status_t));
     return (db_rc_status_t*)retval;
 }
 
@@ -93,13 +412,43 @@ db_uav_status_t *db_uav_status_memory_open(void) {
 
     void *retval = mmap(NULL, sizeof(db_uav_status_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     if (retval == MAP_FAILED) { perror("mmap"); exit(1); }
+    db_shm_init_header(retval, sizeof(db_uav_status_t));
     return (db_uav_status_t*)retval;
 }
 
+db_link_history_t *db_gnd_history_memory_open(void) {
+    int fd;
+    for(;;) {
+        fd = shm_open("/db_gnd_history_t", O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+        if(fd > 0) {
+            break;
+        }
+        perror("db_gnd_history_t");
+        usleep((__useconds_t) 1e5);
+    }
+
+    if (ftruncate(fd, sizeof(db_link_history_t)) == -1) {
+        perror("db_gnd_history_t: ftruncate");
+        exit(1);
+    }
+
+    void *retval = mmap(NULL, sizeof(db_link_history_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (retval == MAP_FAILED) {
+        perror("db_gnd_history_t: mmap");
+        exit(1);
+    }
+    db_link_history_t *history = (db_link_history_t *) retval;
+    if (db_shm_init_header(&history->header, sizeof(db_link_history_t)))
+        history->capacity = DB_HISTORY_LENGTH;
+    return history;
+}
+
 void db_rc_values_memory_init(db_rc_values_t *rc_values) {
+    db_shm_write_begin(&rc_values->header);
     for(int i = 0; i < NUM_CHANNELS; i++) {
         rc_values->ch[i] = 1000;
     }
+    db_shm_write_end(&rc_values->header);
 }
 
 db_rc_values_t *db_rc_values_memory_open(void) {
@@ -124,14 +473,17 @@ db_rc_values_t *db_rc_values_memory_open(void) {
         exit(1);
     }
     db_rc_values_t *tretval = (db_rc_values_t*)retval;
+    db_shm_init_header(&tretval->header, sizeof(db_rc_values_t));
     db_rc_values_memory_init(tretval);
     return (db_rc_values_t*)retval;
 }
 
 void db_rc_overwrite_values_memory_init(db_rc_overwrite_values_t *rc_values) {
+    db_shm_write_begin(&rc_values->header);
     for(int i = 0; i < NUM_CHANNELS; i++) {
         rc_values->ch[i] = 0;
     }
+    db_shm_write_end(&rc_values->header);
 }
 
 db_rc_overwrite_values_t *db_rc_overwrite_values_memory_open(void) {
@@ -156,6 +508,7 @@ db_rc_overwrite_values_t *db_rc_overwrite_values_memory_open(void) {
         exit(1);
     }
     db_rc_overwrite_values_t *tretval = (db_rc_overwrite_values_t*)retval;
+    db_shm_init_header(&tretval->header, sizeof(db_rc_overwrite_values_t));
     db_rc_overwrite_values_memory_init(tretval);
     return tretval;
 }
\ No newline at end of file
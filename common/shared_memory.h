@@ -17,6 +17,8 @@
  *
  */
 
+#include <stdbool.h>
+#include <stddef.h>
 #include "db_protocol.h"
 
 #ifndef CONTROL_STATUS_SHARED_MEMORY_H
@@ -24,11 +26,37 @@
 
 #define MAX_ANTENNA_CNT 4
 
+#define DB_SHM_MAGIC                0x48534244  // "DBSH"
+#define DB_SHM_VERSION              11          // increase with every layout change of one of the segments
+#define DB_SHM_CACHE_LINE           64
+#define DB_SHM_PUBLISH_INTERVAL_MS  100         // writers publish their locally accumulated counters this often
+#define DB_SHM_SNAPSHOT_RETRIES     1000
+
+#define DB_HISTORY_LENGTH           4096        // samples kept in a history ring. 40 s at 10 ms resolution
+#define DB_HISTORY_NO_RSSI          (-128)      // no frame received by the adapter during the interval
+
+/**
+ * First cache line of every shared memory segment. Writers publish changes using db_shm_write_begin()/_end() or
+ * db_shm_publish(). Readers take consistent copies using db_shm_snapshot(). The payload starts on the next cache line.
+ */
 typedef struct {
+    uint32_t magic;         // DB_SHM_MAGIC once the segment was initialized
+    uint16_t version;       // DB_SHM_VERSION of the process that initialized the segment
+    uint16_t reserved;
+    uint32_t size;          // size of the segment including this header
+    uint32_t seq;           // seqlock: odd while a writer updates the payload
+    int32_t writer_tid;     // PI futex serializing the writers: thread id of the current writer. 0 = none
+    uint32_t waiters;       // readers blocked in db_shm_wait(). Writers only issue a wake up if there are any
+    uint8_t pad[DB_SHM_CACHE_LINE - 24];
+} __attribute__((packed)) db_shm_header_t;
+
+typedef struct {
+    db_shm_header_t header;
     uint16_t ch[NUM_CHANNELS];
 } __attribute__((packed)) db_rc_values_t;
 
 typedef struct {
+    db_shm_header_t header;
     struct timespec timestamp;
     uint16_t ch[NUM_CHANNELS];
 } __attribute__((packed)) db_rc_overwrite_values_t;
@@ -45,7 +73,136 @@ typedef struct {
     char name[IFNAMSIZ];
 } __attribute__((packed)) db_adapter_status;
 
+// stages of a video packet on its way from the air side pipe to the ground side outputs
+#define DB_LATENCY_STAGE_FILL_WAIT  0   // air: waiting for the rest of the FEC block to be read from the pipe
+#define DB_LATENCY_STAGE_INJECTION  1   // air: FEC encoding and injection of the preceding packets of the block
+#define DB_LATENCY_STAGE_AIR        2   // air -> ground. Only available once the clocks are synced
+#define DB_LATENCY_STAGE_DECODE     3   // ground: waiting for the block/predecessors & FEC decoding
+#define DB_LATENCY_STAGE_OUTPUT     4   // ground: handing the data to the outputs (UDP, stdout, unix socket)
+#define DB_LATENCY_STAGE_TOTAL      5   // sum of all stages. Only available once the clocks are synced
+#define DB_LATENCY_STAGE_CNT        6
+
+typedef struct {
+    uint32_t p50_us;
+    uint32_t p95_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+    uint32_t sample_cnt; // number of samples the percentiles were calculated from
+} __attribute__((packed)) db_latency_percentiles_t;
+
+// Filled by video_gnd if timestamped video headers are enabled (-T). Updated every second
+typedef struct {
+    uint8_t clock_synced; // 1 if the clock offset to the UAV is known
+    int64_t clock_offset_us; // UAV clock - ground station clock
+    uint32_t clock_sync_rtt_us; // RTT of the clock sync sample the offset was taken from
+    db_latency_percentiles_t stage[DB_LATENCY_STAGE_CNT];
+} __attribute__((packed)) db_video_latency_t;
+
+typedef struct {
+    uint32_t received;      // frames received for the first time
+    uint32_t lost;          // frames never received (sequence number gaps that were not filled later)
+    uint32_t duplicates;    // frames received more than once (diversity)
+    uint32_t reordered;     // frames received after a frame with a higher sequence number
+} __attribute__((packed)) db_seq_stats_t;
+
+// Serial link to the flight controller (see db_serial_stream.c)
+typedef struct {
+    uint32_t bytes;             // bytes read from the serial port
+    uint32_t reads;             // read() calls that returned data
+    uint32_t frames;            // complete frames with correct checksum
+    uint32_t checksum_errors;   // frames dropped because of a wrong checksum
+    uint32_t unknown_msgs;      // MAVLink frames with a message ID unknown to the dialect (checksum can not be verified)
+    uint32_t resyncs;           // times the parser lost track of the frame boundaries and had to search a frame start
+    uint32_t discarded_bytes;   // bytes skipped while searching for a frame start
+} __attribute__((packed)) db_serial_stats_t;
+
+// Traffic classes of the serial writer towards the flight controller (see db_serial_writer.c). Index of the stats array
+#define DB_SERIAL_CLASS_RC      0   // RC frames. Always written first
+#define DB_SERIAL_CLASS_CMD     1   // MSP/MAVLink from the ground station
+#define DB_SERIAL_CLASS_BULK    2   // data of local applications (unix socket clients)
+#define DB_SERIAL_CLASS_CNT     3
+
+typedef struct {
+    uint32_t queued_bytes;      // current queue depth
+    uint32_t max_queued_bytes;
+    uint32_t frames;            // frames completely handed to the UART driver
+    uint32_t dropped_frames;    // frames dropped because the queue was full or the port was closed
+    uint32_t superseded_frames; // RC only: frames replaced by a newer one before they were written
+    uint32_t latency_avg_us;    // queued -> written to the UART driver. Exponential moving average
+    uint32_t latency_max_us;
+} __attribute__((packed)) db_serial_queue_stats_t;
+
+// Packing of telemetry into DroneBridge packets (see db_aggregator.c)
+#define DB_AGG_HIST_BINS    8
+
+typedef struct {
+    uint32_t packets;
+    uint32_t bytes;                     // payload bytes
+    uint32_t fill[DB_AGG_HIST_BINS];    // packet length relative to the MTU in steps of 1/8
+    uint32_t delay[DB_AGG_HIST_BINS];   // time the oldest data waited: <1, <2, <5, <10, <20, <50, <100, >=100 ms
+} __attribute__((packed)) db_agg_stats_t;
+
+// Parity based FEC of the telemetry downlink (see db_tel_fec.c)
+typedef struct {
+    uint32_t data_packets;
+    uint32_t parity_packets;
+    uint32_t recovered;         // ground station only: lost data packets rebuilt from parity
+    uint32_t unrecoverable;     // ground station only: groups with more than one lost data packet
+} __attribute__((packed)) db_tel_fec_stats_t;
+
+// System metrics of the UAV or the ground station (see db_metrics.c)
+typedef struct {
+    uint8_t cpu_load;           // %
+    uint8_t temp;               // CPU temperature in °C
+    uint8_t undervolt;          // 1 = supply voltage too low right now
+    uint32_t throttled;         // Raspberry Pi firmware throttled flags (see vcgencmd get_throttled)
+    uint32_t sample_time_us;    // time it took to take the last sample
+} __attribute__((packed)) db_sys_metrics_t;
+
+// Selective repeat ARQ of the uplink from the proxy module (see db_arq.c)
 typedef struct {
+    uint32_t frames;                // sender: frames queued. receiver: frames passed on in order
+    uint32_t retransmissions;       // sender: frames sent again after the retransmission timeout
+    uint32_t fast_retransmissions;  // sender: frames sent again because a frame sent later was acknowledged
+    uint32_t given_up;              // sender: frames dropped after DB_ARQ_MAX_RETRIES. receiver: frames skipped
+    uint32_t duplicates;            // receiver only
+    uint32_t acks;                  // sender: acks received. receiver: acks sent
+    uint32_t srtt_us;               // sender only: smoothed round trip time
+} __attribute__((packed)) db_arq_stats_t;
+
+// MAVLink downlink scheduler of the control module (see db_mav_sched.c)
+typedef struct {
+    uint32_t packets;               // DroneBridge packets sent
+    uint32_t bytes;                 // MAVLink bytes sent
+    uint32_t sent[3];               // messages sent. Index is the class: command, state, bulk
+    uint32_t superseded;            // state messages replaced by a newer one before they were sent
+    uint32_t rate_limited;          // messages dropped because of a rate cap
+    uint32_t dropped;               // messages dropped because a queue was full
+    uint32_t budget_waits;          // times data was ready but the airtime budget was used up
+    uint32_t command_latency_max_us;
+} __attribute__((packed)) db_mav_sched_stats_t;
+
+// Endpoints of the air side MAVLink router of the control module (see db_mav_router.c)
+#define DB_MAV_ROUTER_MAX_ENDPOINTS 10
+
+typedef struct {
+    uint32_t frames_in;         // frames received from the endpoint
+    uint32_t frames_out;        // frames passed on to the endpoint
+    uint32_t bytes_out;
+    uint32_t filtered;          // not passed on because of the message filter of the endpoint
+    uint32_t rate_limited;      // not passed on because the endpoint used up its data rate
+    uint32_t errors;            // frames lost because of a full queue or a failed write/send
+    uint8_t systems;            // system/component IDs learned on the endpoint
+} __attribute__((packed)) db_mav_route_stats_t;
+
+// Link quality of a DroneBridge port based on sequence numbers (see db_seq.c). Index of the arrays is the DB port
+typedef struct {
+    db_seq_stats_t combined;    // after diversity combining: what the module forwarded
+    db_seq_stats_t adapter[DB_MAX_ADAPTERS];
+} __attribute__((packed)) db_port_seq_stats_t;
+
+typedef struct {
+    db_shm_header_t header;
     time_t last_update; // video stream
     uint32_t received_block_cnt; // video stream
     uint32_t damaged_block_cnt; // video stream
@@ -56,9 +213,15 @@ typedef struct {
     uint32_t kbitrate; // video stream
     uint32_t wifi_adapter_cnt; // video stream
     db_adapter_status adapter[8];
+    db_video_latency_t latency; // video stream
+    db_port_seq_stats_t port_stats[DB_PORT_CNT]; // frames received by the ground station modules
+    db_tel_fec_stats_t telem_fec; // telemetry downlink FEC (proxy module)
+    db_arq_stats_t uplink_arq; // reliable uplink to the UAV (proxy module)
+    db_sys_metrics_t sys; // ground station system metrics (status module)
 } __attribute__((packed)) db_gnd_status_t;
 
 typedef struct {
+    db_shm_header_t header;
     time_t last_update;
     uint32_t received_block_cnt;
     uint32_t damaged_block_cnt;
@@ -72,6 +235,7 @@ typedef struct {
 } __attribute__((packed)) db_rc_status_t;
 
 typedef struct {
+    db_shm_header_t header;
     int encoding_time; // in microseconds
     uint8_t cpuload;
     uint8_t temp;
@@ -86,12 +250,70 @@ typedef struct {
     uint8_t undervolt; // 1 = too low voltage
     uint32_t wifi_adapter_cnt; // video stream
     db_adapter_status adapter[8];
+    db_port_seq_stats_t port_stats[DB_PORT_CNT]; // frames received by the UAV modules
+    db_serial_stats_t telem_serial; // telemetry serial link to the flight controller (control module)
+    db_serial_queue_stats_t serial_writer[DB_SERIAL_CLASS_CNT]; // writes to the flight controller (control module)
+    db_mav_sched_stats_t mav_sched; // MAVLink downlink (control module)
+    db_agg_stats_t telem_agg; // packets of the telemetry downlink (control module)
+    db_tel_fec_stats_t telem_fec; // telemetry downlink FEC (control module)
+    db_arq_stats_t uplink_arq; // reliable uplink from the ground station proxy (control module)
+    db_sys_metrics_t sys; // UAV system metrics (control module)
+    uint8_t mav_router_cnt; // endpoints of the MAVLink router (control module). 0 = router not used
+    db_mav_route_stats_t mav_router[DB_MAV_ROUTER_MAX_ENDPOINTS]; // downlink, flight controller, then in order of -E
 } __attribute__((packed)) db_uav_status_t;
 
+typedef struct {
+    int8_t rssi_dbm;        // last RSSI seen in the interval. DB_HISTORY_NO_RSSI if no frame was received
+    uint8_t reserved;
+    uint16_t good_packets;  // frames with correct FCS received during the interval
+    uint16_t bad_packets;   // frames with wrong FCS received during the interval
+} __attribute__((packed)) db_history_adapter_t;
+
+/**
+ * Link statistics of one interval of the history resolution. 64 bytes
+ */
+typedef struct {
+    uint64_t timestamp_us;  // end of the interval. CLOCK_MONOTONIC
+    uint32_t kbitrate;      // received over the air during the interval (all adapters)
+    uint16_t lost_packets;  // packets that could not be recovered during the interval
+    uint8_t adapter_cnt;
+    uint8_t reserved;
+    db_history_adapter_t adapter[8];
+} __attribute__((packed)) db_history_sample_t;
+
+/**
+ * Fixed size time-series ring of link statistics. One writer appends a sample every resolution_ms. Readers keep a
+ * cursor (number of samples consumed) and fetch everything appended since using db_history_read().
+ */
+typedef struct {
+    db_shm_header_t header;
+    uint32_t resolution_ms;     // 0 if the writer is not sampling
+    uint32_t capacity;          // DB_HISTORY_LENGTH
+    uint64_t head;              // number of samples appended since the segment was created
+    uint8_t pad[DB_SHM_CACHE_LINE - 16];
+    db_history_sample_t samples[DB_HISTORY_LENGTH];
+} __attribute__((packed)) db_link_history_t;
+
+// Publish/copy a range of fields [first, end) of a segment, e.g. all fields written by one module
+#define DB_SHM_RANGE_LENGTH(type, first, end) (offsetof(type, end) - offsetof(type, first))
+
+void db_shm_write_begin(db_shm_header_t *header);
+void db_shm_write_end(db_shm_header_t *header);
+void db_shm_publish(db_shm_header_t *header, void *shm_dst, const void *local_src, size_t length);
+bool db_shm_snapshot(const db_shm_header_t *header, void *copy, size_t segment_size);
+uint32_t db_shm_seq(const db_shm_header_t *header);
+int db_shm_wait(db_shm_header_t *header, uint32_t *seq, long timeout_us);
+int db_shm_notify_fd(db_shm_header_t *header);
+void db_shm_notify_ack(int notify_fd);
+void db_shm_set_adapter_name(char shm_name[IFNAMSIZ], const char *if_name);
+void db_history_append(db_link_history_t *history, const db_history_sample_t *sample);
+uint32_t db_history_read(const db_link_history_t *history, uint64_t *cursor, db_history_sample_t *samples,
+                         uint32_t max_samples, uint64_t *missed);
 
 db_gnd_status_t *db_gnd_status_memory_open(void);
 db_rc_status_t *db_rc_status_memory_open(void);
 db_uav_status_t *db_uav_status_memory_open(void);
+db_link_history_t *db_gnd_history_memory_open(void);
 db_rc_values_t *db_rc_values_memory_open(void);
 db_rc_overwrite_values_t *db_rc_overwrite_values_memory_open(void);
 void db_rc_values_memory_init(db_rc_values_t *rc_values);
@@ -37,25 +37,75 @@
 #include "../common/radiotap/radiotap_iter.h"
 #include "../common/db_common.h"
 #include "../common/db_unix.h"
+#include "../common/db_clock_sync.h"
+#include "../common/db_seq.h"
+#include "../common/db_serial_stream.h"
+#include "../common/db_serial_writer.h"
+#include "../common/db_mav_sched.h"
+#include "../common/db_aggregator.h"
+#include "../common/db_tel_fec.h"
+#include "../common/db_arq.h"
+#include "../common/db_metrics.h"
+#include "../common/db_mav_router.h"
+#include "../common/shared_memory.h"
+#include "../common/db_rt.h"
+#include "../common/db_event.h"
 
 
 #define ETHER_TYPE        0x88ab
 #define UART_IF          "/dev/serial1"
 #define BUF_SIZ                      512    // should be enough?!
 #define COMMAND_BUF_SIZE            1024
-#define RETRANSMISSION_RATE            2    // send every MAVLink transparent packet twice for better reliability
-#define DB_TRANSPARENT_READBUF         8    // bytes to read at once from serial port
+#define TELEMETRY_MTU                1024   // default max. telemetry bytes per packet to the ground station (-v 1-4)
+#define TELEMETRY_FEC_K                0    // default data packets per telemetry parity packet. 0 = no FEC
+#define DB_TRANSPARENT_READBUF       256    // bytes to read at once from serial port
 #define STATUS_UPDATE_TIME    200    // send rc status to status module on groundstation every 200ms
 
-static volatile int keep_running = 1;
 uint8_t buf[BUF_SIZ];
-uint8_t mavlink_telemetry_buf[2048] = {0}, mavlink_message_buf[256] = {0};
-int mav_tel_message_counter = 0, mav_tel_buf_length = 0, cont_adhere_80211, num_inf = 0;
-long double cpu_u_new[4], cpu_u_old[4], loadavg;
-float systemp, millideg;
-
-void intHandler(int dummy) {
-    keep_running = 0;
+uint8_t mavlink_packet[DATA_UNI_LENGTH] = {0};
+db_serial_stream_t serial_stream;
+db_serial_writer_t telem_writer, sumd_writer;
+db_mav_sched_t mav_sched;
+db_aggregator_t telem_agg;
+db_tel_fec_encoder_t telem_fec;
+db_arq_receiver_t uplink_arq;
+int uplink_arq_enabled = 0;
+db_metrics_t sys_metrics;
+db_mav_router_t mav_router;
+db_serial_stream_t uplink_stream;   // MAVLink frames of the ground station for the router
+int mav_router_enabled = 0, router_link_ep = -1, router_fc_ep = -1;
+int cont_adhere_80211, num_inf = 0;
+int serial_protocol_control = 2, baud_rate = 115200;
+char telem_inf[IFNAMSIZ];
+uint32_t telemetry_deadline_us;
+db_event_loop_t event_loop;
+db_event_handler_t *serial_telem_handler = NULL, *sumd_handler = NULL, *wakeup_timer;
+db_event_handler_t *router_handlers[DB_MAV_ROUTER_MAX_ENDPOINTS] = {0};
+db_event_handler_t *unix_client_handlers[DB_MAX_UNIX_TCP_CLIENTS] = {0};
+db_socket_t raw_interfaces_rc[DB_MAX_ADAPTERS] = {0};
+db_socket_t raw_interfaces_telem[DB_MAX_ADAPTERS] = {0};
+db_socket_t raw_interfaces_status[DB_MAX_ADAPTERS] = {0};
+db_uav_status_t *db_uav_status;
+db_port_seq_t rc_seq, cont_seq, sync_seq;
+db_port_seq_stats_t port_stats[DB_PORT_CNT] = {0};  // published to db_uav_status every DB_SHM_PUBLISH_INTERVAL_MS
+int socket_control_serial = -1, rc_serial_socket = -1;
+db_serial_writer_t *rc_writer = &telem_writer;
+db_unix_tcp_socket unix_server;
+db_unix_tcp_client unix_server_clients[DB_MAX_UNIX_TCP_CLIENTS];
+uint8_t status_seq_number = 0, proxy_seq_number = 0, sync_seq_number = 0;
+uint8_t seq_num_rc = 0, seq_num_cont = 0, seq_num_sync = 0;
+uint8_t rc_packets_tmp = 0, rc_packets_cnt = 0;
+int8_t rssi = -128;
+uint64_t last_sync_t1 = 0;
+uint8_t commandBuf[COMMAND_BUF_SIZE];
+uint8_t serial_bytes[DB_TRANSPARENT_READBUF];
+struct data_uni *raw_buffer;
+struct uav_rc_status_update_message_t *rc_status_update_data;
+
+void service_links(db_event_loop_t *loop, void *arg);
+
+void on_signal(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t signo) {
+    db_event_stop(loop);
 }
 
 speed_t interpret_baud(int user_baud) {
@@ -79,106 +129,136 @@ speed_t interpret_baud(int user_baud) {
 
 
 /**
- * Buffer 5 MAVLink telemetry messages before sending packet to ground station
+ * Send a packet on the proxy port via all adapters using the same sequence number. With the reliable uplink enabled
+ * (-A) every packet starts with the current ack for the ground station proxy
+ */
+void send_proxy_packet(uint8_t *proxy_seq_number, db_socket_t *raw_interfaces_telem, uint8_t *data,
+                       uint16_t length) {
+    static uint8_t proxy_packet[DATA_UNI_LENGTH];
+    if (uplink_arq_enabled) {
+        db_arq_build_ack(&uplink_arq, (db_arq_ack_header_t *) proxy_packet);
+        if (length > 0) memcpy(proxy_packet + sizeof(db_arq_ack_header_t), data, length);
+        data = proxy_packet;
+        length += sizeof(db_arq_ack_header_t);
+    }
+    uint8_t seq_num = update_seq_num(proxy_seq_number);
+    for (int i = 0; i < num_inf; i++) {
+        db_send_div(&raw_interfaces_telem[i], data, DB_PORT_PROXY, length, seq_num, cont_adhere_80211);
+    }
+}
+
+/**
+ * Send the parity packet of the current FEC group if the group is complete or waited long enough
  *
- * @param length_message Length of new MAVLink message
- * @param mav_message The pointer to a new MAVLink message
  * @param proxy_seq_number
  * @param raw_interfaces_telem
  */
-void send_buffered_mavlink(int length_message, mavlink_message_t *mav_message, uint8_t *proxy_seq_number,
-                           db_socket_t *raw_interfaces_telem) {
-    mav_tel_message_counter++;  // Number of messages in buffer
-    mavlink_msg_to_send_buffer(mavlink_message_buf, mav_message);   // Get over the wire representation of message
-    // Copy message bytes into buffer
-    memcpy(&mavlink_telemetry_buf[mav_tel_buf_length], mavlink_message_buf, (size_t) length_message);
-    mav_tel_buf_length += length_message;   // Overall length of buffer
-    if (mav_tel_message_counter == 5) {
-        for (int i = 0; i < num_inf; i++) {
-            db_send_div(&raw_interfaces_telem[i], mavlink_telemetry_buf, DB_PORT_PROXY,
-                        (u_int16_t) mav_tel_buf_length, update_seq_num(proxy_seq_number),
-                        cont_adhere_80211);
-        }
-        mav_tel_message_counter = 0;
-        mav_tel_buf_length = 0;
-    }
+void send_telemetry_parity(uint8_t *proxy_seq_number, db_socket_t *raw_interfaces_telem) {
+    if (telem_fec.k == 0) return;
+    uint16_t length = db_tel_fec_parity(&telem_fec, db_clock_us());
+    if (length > 0)
+        send_proxy_packet(proxy_seq_number, raw_interfaces_telem, telem_fec.packet, length);
 }
 
 /**
- * Gets CPU usage on Linux systems. Needs to be called periodically. No one time calls!
+ * Send a telemetry packet to the ground station. With FEC enabled (-F) it is sent as data packet of the current FEC
+ * group followed by the parity packet once the group is complete
  *
- * @return CPU load in %
+ * @param proxy_seq_number
+ * @param raw_interfaces_telem
+ * @param data Telemetry packet
+ * @param length Length of the telemetry packet
  */
-uint8_t get_cpu_usage() {
-    FILE *fp;
-    fp = fopen("/proc/stat", "r");
-    if (fscanf(fp, "%*s %Lf %Lf %Lf %Lf", &cpu_u_new[0], &cpu_u_new[1], &cpu_u_new[2], &cpu_u_new[3]) < 4)
-        perror("DB_CONTROL_AIR: Could not read CPU usage");
-    fclose(fp);
-    loadavg = ((cpu_u_old[0] + cpu_u_old[1] + cpu_u_old[2]) - (cpu_u_new[0] + cpu_u_new[1] + cpu_u_new[2])) /
-              ((cpu_u_old[0] + cpu_u_old[1] + cpu_u_old[2] + cpu_u_old[3]) -
-               (cpu_u_new[0] + cpu_u_new[1] + cpu_u_new[2] + cpu_u_new[3])) * 100;
-    memcpy(cpu_u_old, cpu_u_new, sizeof(cpu_u_new));
-    return (uint8_t) loadavg;
+void send_telemetry(uint8_t *proxy_seq_number, db_socket_t *raw_interfaces_telem, uint8_t *data, uint16_t length) {
+    if (telem_fec.k == 0) {
+        send_proxy_packet(proxy_seq_number, raw_interfaces_telem, data, length);
+        return;
+    }
+    length = db_tel_fec_encode(&telem_fec, data, length, db_clock_us());
+    send_proxy_packet(proxy_seq_number, raw_interfaces_telem, telem_fec.packet, length);
+    send_telemetry_parity(proxy_seq_number, raw_interfaces_telem);
 }
 
 /**
- * Reads the CPU temperature from a Linux system
+ * Send all MAVLink packets the downlink scheduler releases right now to the ground station
  *
- * @return CPU temperature in °C
+ * @param proxy_seq_number
+ * @param raw_interfaces_telem
  */
-uint8_t get_cpu_temp() {
-    FILE *thermal;
-    thermal = fopen("/sys/class/thermal/thermal_zone0/temp", "r");
-    if (thermal == NULL || fscanf(thermal, "%f", &millideg) < 1)
-        perror("DB_CONTROL_AIR: Could not read CPU temperature");
-    else {
-        fclose(thermal);
-        systemp = millideg / 1000;
-        return (uint8_t) systemp;
-    }
-    return 0;
+void send_scheduled_mavlink(uint8_t *proxy_seq_number, db_socket_t *raw_interfaces_telem) {
+    uint16_t length;
+    while ((length = db_mav_sched_next_packet(&mav_sched, mavlink_packet, db_clock_us())) > 0)
+        send_telemetry(proxy_seq_number, raw_interfaces_telem, mavlink_packet, length);
 }
 
 /**
- * Send status update to status module
+ * Send the pending packet of the telemetry aggregator to the ground station
  *
- * @param status_seq_number
+ * @param proxy_seq_number
  * @param raw_interfaces_telem
- * @param rssi
- * @param start
- * @param start_rc
- * @param rc_packets_tmp
- * @param rc_packets_cnt
- * @param rc_status_update_data
- * @return
  */
-uint8_t send_status_update(uint8_t *status_seq_number, db_socket_t *raw_interfaces_telem, int8_t rssi, long *start,
-                           long *start_rc, uint8_t *rc_packets_tmp, uint8_t rc_packets_cnt,
-                           struct uav_rc_status_update_message_t *rc_status_update_data, const long *rightnow) {
-    struct timeval time_check;
-    if ((*rightnow - *start_rc) >= 1000) {
-        *rc_packets_tmp = rc_packets_cnt; // save received packets/seconds to temp variable
-        rc_packets_cnt = 0;
-        gettimeofday(&time_check, NULL);
-        *start_rc = (long) time_check.tv_sec * 1000 + (long) time_check.tv_usec / 1000;
+void send_aggregated_telemetry(uint8_t *proxy_seq_number, db_socket_t *raw_interfaces_telem) {
+    uint16_t length = db_agg_take(&telem_agg, db_clock_us());
+    if (length > 0)
+        send_telemetry(proxy_seq_number, raw_interfaces_telem, telem_agg.data, length);
+}
+
+/**
+ * MAVLink router: frame for the ground station or for the flight controller
+ *
+ * @param endpoint router_link_ep or router_fc_ep
+ * @param frame MAVLink frame
+ * @param length Length of the frame
+ * @param arg unused
+ */
+void deliver_routed_mavlink(int endpoint, const uint8_t *frame, uint16_t length, void *arg) {
+    if (endpoint == router_link_ep)
+        db_mav_sched_add(&mav_sched, frame, length, db_clock_us());
+    else if (endpoint == router_fc_ep)
+        db_serial_writer_queue(&telem_writer, DB_SERIAL_CLASS_CMD, frame, length);
+}
+
+/**
+ * Pass on data of the ground station. Goes to the flight controller or through the MAVLink router if it is enabled
+ *
+ * @param data MSP/MAVLink data of the ground station
+ * @param length Length of the data
+ */
+void forward_uplink(const uint8_t *data, uint16_t length) {
+    if (!mav_router_enabled) {
+        db_serial_writer_queue(&telem_writer, DB_SERIAL_CLASS_CMD, data, length);
+        return;
     }
-    if ((*rightnow - *start) >= STATUS_UPDATE_TIME) {
-        memset(rc_status_update_data, 0xff, 6);
-        rc_status_update_data->rssi_rc_uav = rssi;
-        rc_status_update_data->recv_pack_sec = *rc_packets_tmp;
-        rc_status_update_data->cpu_usage_uav = get_cpu_usage();
-        rc_status_update_data->cpu_temp_uav = get_cpu_temp();
-        rc_status_update_data->uav_is_low_V = get_undervolt();
-        for (int i = 0; i < num_inf; i++) {
-            db_send_hp_div(&raw_interfaces_telem[i], DB_PORT_STATUS,
-                           (u_int16_t) 14, update_seq_num(status_seq_number));
-        }
+    const uint8_t *frame;
+    uint16_t frame_length;
+    db_serial_stream_feed(&uplink_stream, data, length);
+    while (db_serial_stream_next(&uplink_stream, &frame, &frame_length))
+        db_mav_router_route(&mav_router, router_link_ep, frame, frame_length, db_clock_us());
+}
 
-        gettimeofday(&time_check, NULL);
-        *start = (long) time_check.tv_sec * 1000 + (long) time_check.tv_usec / 1000;
+/**
+ * Send status update to status module on ground station every STATUS_UPDATE_TIME
+ */
+void on_status_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    memset(rc_status_update_data, 0xff, 6);
+    memset(&rc_status_update_data->empty_unused[1], 0, sizeof(rc_status_update_data->empty_unused) - 1);
+    rc_status_update_data->rssi_rc_uav = rssi;
+    rc_status_update_data->recv_pack_sec = rc_packets_tmp;
+    rc_status_update_data->cpu_usage_uav = sys_metrics.metrics.cpu_load;
+    rc_status_update_data->cpu_temp_uav = sys_metrics.metrics.temp;
+    rc_status_update_data->uav_is_low_V = sys_metrics.metrics.undervolt;
+    for (int i = 0; i < num_inf; i++) {
+        db_send_div(&raw_interfaces_telem[i], (uint8_t *) rc_status_update_data, DB_PORT_STATUS,
+                    (u_int16_t) 14, update_seq_num(&status_seq_number), cont_adhere_80211);
     }
-    return rc_packets_cnt;
+}
+
+/**
+ * Received RC packets per second for the status update
+ */
+void on_rc_rate_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    rc_packets_tmp = rc_packets_cnt;
+    rc_packets_cnt = 0;
 }
 
 /**
@@ -238,7 +318,7 @@ int open_serial_telem(int baud_rate, const char *telem_inf) {
         cfsetispeed(&options, interpret_baud(baud_rate));
         cfsetospeed(&options, interpret_baud(baud_rate));
 
-        options.c_cc[VMIN] = 1;            // wait for min. 1 byte (select trigger)
+        options.c_cc[VMIN] = 1;            // wait for min. 1 byte (epoll trigger)
         options.c_cc[VTIME] = 0;           // timeout 0 second
         tcflush(socket_control_serial, TCIFLUSH);
         tcsetattr(socket_control_serial, TCSANOW, &options);
@@ -248,28 +328,15 @@ int open_serial_telem(int baud_rate, const char *telem_inf) {
 }
 
 /**
- *
- * @param serial_sock Socket to write to
- * @param data Buffer to write
- * @param data_len Data length
- * @param log_ident Name/Type of data so debugging gets easier
- * @return
+ * Close the telemetry serial port after an error. Queued frames are dropped. The port is re-opened by
+ * on_serial_reconnect_timer()
  */
-void write_to_serial(int serial_sock, uint8_t *data, size_t data_len, char *log_ident) {
-    if (data_len > 0 && serial_sock > 0) {
-        int sentbytes = (int) write(serial_sock, data, (size_t) data_len);
-        int errsv = errno;
-        tcdrain(serial_sock);
-        if (sentbytes <= 0) {
-            LOG_SYS_STD(LOG_WARNING, "DB_CONTROL_AIR: Could not write (%s) to serial interface %s\n", log_ident,
-                    strerror(errsv));
-        } else if (sentbytes != data_len){
-            LOG_SYS_STD(LOG_WARNING, "DB_CONTROL_AIR: Not all data (%s) written to serial interface %i/%zi\n", log_ident,
-                    sentbytes, data_len);
-        }
-        // TODO: check if necessary. It shouldn't as we use blocking UART socket
-        // tcflush(rc_serial_socket, TCOFLUSH);
-    }
+void close_serial_telem() {
+    db_event_remove(&event_loop, serial_telem_handler);
+    serial_telem_handler = NULL;
+    close(socket_control_serial);
+    socket_control_serial = -1;
+    db_serial_writer_init(&telem_writer, -1, baud_rate);
 }
 
 void write_to_unix(db_unix_tcp_client unix_server_clients[DB_MAX_UNIX_TCP_CLIENTS], uint8_t *data, ssize_t data_len) {
@@ -285,16 +352,339 @@ void write_to_unix(db_unix_tcp_client unix_server_clients[DB_MAX_UNIX_TCP_CLIENT
     }
 }
 
+/**
+ * DB_RC_PORT for DroneBridge RC packets
+ */
+void on_rc_packet(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
+    uint16_t radiotap_lenght;
+    ssize_t length = db_recv(raw_interfaces_rc[i].db_socket, buf, BUF_SIZ);
+    if (length > 0) {
+        rc_packets_cnt++;
+        get_db_payload(buf, length, commandBuf, &seq_num_rc, &radiotap_lenght);
+        rssi = get_rssi(buf, radiotap_lenght);
+        if (db_port_seq_track(&rc_seq, i, buf, length)) {  // diversity duplicate protection
+            int command_length = generate_rc_serial_message(commandBuf);
+            db_serial_writer_queue(rc_writer, DB_SERIAL_CLASS_RC, serial_data_buffer, (size_t) command_length);
+        }
+    }
+    db_event_defer(loop, service_links, NULL);
+}
+
+/**
+ * DB_CONTROL_PORT for incoming MSP/MAVLink
+ */
+void on_telem_packet(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
+    uint16_t radiotap_lenght;
+    db_event_defer(loop, service_links, NULL);
+    ssize_t length = db_recv(raw_interfaces_telem[i].db_socket, buf, BUF_SIZ);
+    if (length > 0) {
+        rssi = get_rssi(buf, buf[2]);
+        if (db_port_seq_track(&cont_seq, i, buf, length)) {  // diversity duplicate protection
+            int command_length = get_db_payload(buf, length, commandBuf, &seq_num_cont, &radiotap_lenght);
+            if (uplink_arq_enabled && db_arq_is_data(commandBuf, (uint16_t) command_length)) {
+                // Reliable data of the proxy. Not taken while the serial queue could overflow -
+                // the ground station will send it again
+                if (db_serial_writer_space(&telem_writer, DB_SERIAL_CLASS_CMD) < DB_ARQ_MAX_BUFFERED)
+                    return;
+                db_arq_receive(&uplink_arq, commandBuf, (uint16_t) command_length, db_clock_us());
+                const uint8_t *uplink_data;
+                uint16_t uplink_length;
+                while (db_arq_deliver(&uplink_arq, &uplink_data, &uplink_length))
+                    forward_uplink(uplink_data, uplink_length);
+            } else {
+                forward_uplink(commandBuf, (uint16_t) command_length);
+            }
+        }
+    }
+}
+
+/**
+ * DB_PORT_STATUS for clock sync requests. Answer as fast as possible
+ */
+void on_sync_request(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
+    uint16_t radiotap_lenght;
+    db_rx_timestamp_t rx_timestamp;
+    ssize_t length = db_recv_ts(raw_interfaces_status[i].db_socket, buf, BUF_SIZ, &rx_timestamp);
+    uint64_t t2 = rx_timestamp.rx_time_us;
+    if (length > 0 && db_port_seq_track(&sync_seq, i, buf, length)) {
+        int command_length = get_db_payload(buf, length, commandBuf, &seq_num_sync, &radiotap_lenght);
+        db_clock_sync_msg_t *sync_request = (db_clock_sync_msg_t *) commandBuf;
+        if (db_clock_sync_is_msg(commandBuf, (uint16_t) command_length, DB_CLOCK_SYNC_REQUEST_ID)
+            && sync_request->t1 != last_sync_t1) {  // diversity duplicate protection
+            last_sync_t1 = sync_request->t1;
+            uint16_t response_length = db_clock_sync_build_response(sync_request, t2, raw_buffer->bytes);
+            uint8_t response_seq_num = update_seq_num(&sync_seq_number);
+            for (int k = 0; k < num_inf; k++) {
+                db_send_div(&raw_interfaces_status[k], raw_buffer->bytes, DB_PORT_STATUS, response_length,
+                            response_seq_num, cont_adhere_80211);
+            }
+        }
+    }
+}
+
+/**
+ * The FC sent us a MSP/MAVLink message or the serial port can take more data - LTM telemetry will be ignored!
+ */
+void on_serial_telem(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    const uint8_t *serial_frame;
+    uint16_t serial_frame_length;
+    ssize_t read_bytes;
+    db_event_defer(loop, service_links, NULL);
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        return;     // writable only. Flushed by service_links()
+    switch (serial_protocol_control) {
+        default:
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+            // MSP/MAVLink: read everything available and pass on all complete frames as they are
+            read_bytes = db_serial_stream_fill(&serial_stream, socket_control_serial);
+            if (read_bytes <= 0 && !(read_bytes < 0 && (errno == EAGAIN || errno == EINTR))) {
+                LOG_SYS_STD(LOG_ERR, "DB_CONTROL_AIR: Telemetry serial port closed: %s\n",
+                            read_bytes == 0 ? "EOF" : strerror(errno));
+                close_serial_telem();  // reconnect by on_serial_reconnect_timer()
+                break;
+            }
+            while (db_serial_stream_next(&serial_stream, &serial_frame, &serial_frame_length)) {
+                if (mav_router_enabled) {
+                    db_mav_router_route(&mav_router, router_fc_ep, serial_frame, serial_frame_length,
+                                        db_clock_us());
+                } else if (serial_stream.protocol == DB_SERIAL_STREAM_MAVLINK) {
+                    db_mav_sched_add(&mav_sched, serial_frame, serial_frame_length, db_clock_us());
+                } else if (!db_agg_add(&telem_agg, serial_frame, serial_frame_length, telemetry_deadline_us,
+                                       db_clock_us())) {
+                    send_aggregated_telemetry(&proxy_seq_number, raw_interfaces_telem);
+                    db_agg_add(&telem_agg, serial_frame, serial_frame_length, telemetry_deadline_us,
+                               db_clock_us());
+                }
+                write_to_unix(unix_server_clients, (uint8_t *) serial_frame, serial_frame_length);
+            }
+            break;
+        case 5:
+            // MAVLink plain pass through - no parsing. Packets are filled up to the chunk size
+            read_bytes = read(socket_control_serial, serial_bytes, DB_TRANSPARENT_READBUF);
+            if (read_bytes == 0 || (read_bytes < 0 && errno != EAGAIN && errno != EINTR)) {
+                LOG_SYS_STD(LOG_ERR, "DB_CONTROL_AIR: Telemetry serial port closed: %s\n",
+                            read_bytes == 0 ? "EOF" : strerror(errno));
+                close_serial_telem();  // reconnect by on_serial_reconnect_timer()
+            } else if (read_bytes > 0) {
+                uint64_t now_us = db_clock_us();
+                for (ssize_t pos = 0; pos < read_bytes;) {
+                    uint16_t piece = (uint16_t) (telem_agg.mtu - telem_agg.length);
+                    if (piece > read_bytes - pos) piece = (uint16_t) (read_bytes - pos);
+                    db_agg_add(&telem_agg, &serial_bytes[pos], piece, telemetry_deadline_us, now_us);
+                    pos += piece;
+                    if (db_agg_due(&telem_agg, now_us))
+                        send_aggregated_telemetry(&proxy_seq_number, raw_interfaces_telem);
+                }
+                write_to_unix(unix_server_clients, serial_bytes, read_bytes);
+            }
+            break;
+    }
+}
+
+/**
+ * Watch the telemetry serial port if it is open
+ */
+void watch_serial_telem(db_event_loop_t *loop) {
+    if (socket_control_serial > 0)
+        serial_telem_handler = db_event_add_io(loop, socket_control_serial, EPOLLIN, on_serial_telem, NULL);
+}
+
+void on_serial_reconnect_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    if (socket_control_serial > 0)
+        return;
+    socket_control_serial = open_serial_telem(baud_rate, telem_inf);
+    db_serial_writer_init(&telem_writer, socket_control_serial, baud_rate);
+    watch_serial_telem(loop);
+}
+
+void on_sumd_writable(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    db_event_defer(loop, service_links, NULL);
+}
+
+/**
+ * Unix TCP clients - accept data to forward to serial connection
+ */
+void on_unix_client(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
+    uint8_t receive_buffer[4096];
+    ssize_t size = recv(unix_server_clients[i].client_sock, receive_buffer, 4096, 0);
+    if (size == 0) {
+        db_event_remove(loop, handler);
+        unix_client_handlers[i] = NULL;
+        close(unix_server_clients[i].client_sock);
+        unix_server_clients[i].client_sock = -1;
+        LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: Unix client disconnected\n");
+    } else if (size > 0) {
+        // forward to serial port
+        db_serial_writer_queue(&telem_writer, DB_SERIAL_CLASS_BULK, receive_buffer, (size_t) size);
+        db_event_defer(loop, service_links, NULL);
+    } else {
+        LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: Unix client receive error %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Unix TCP server - accept new clients
+ */
+void on_unix_connect(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    unsigned int addrlen = sizeof(struct sockaddr);
+    int new_client = accept(unix_server.socket, (struct sockaddr *) &unix_server.addr, &addrlen);
+    if (new_client <= 0)
+        return;
+    // find free slot for client
+    for (int t = 0; t < DB_MAX_UNIX_TCP_CLIENTS; t++) {
+        if (unix_server_clients[t].client_sock < 0 || t == (DB_MAX_UNIX_TCP_CLIENTS - 1)) {
+            if (unix_client_handlers[t] != NULL) {   // all taken: replace the last client
+                db_event_remove(loop, unix_client_handlers[t]);
+                close(unix_server_clients[t].client_sock);
+            }
+            unix_server_clients[t].client_sock = new_client;
+            unix_server_clients[t].addr = unix_server.addr;
+            unix_client_handlers[t] = db_event_add_io(loop, new_client, EPOLLIN, on_unix_client, (void *) (intptr_t) t);
+            LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: New unix client connected\n");
+            break;
+        }
+    }
+}
+
+/**
+ * MAVLink endpoint sent something or a serial endpoint can take more data
+ */
+void on_router_endpoint(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
+    db_event_defer(loop, service_links, NULL);
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        return;
+    db_mav_router_read(&mav_router, i, db_clock_us());
+    if (mav_router.endpoints[i].fd < 0) {   // serial endpoint got closed. Re-opened by db_mav_router_service()
+        db_event_remove(loop, handler);
+        router_handlers[i] = NULL;
+    }
+}
+
+/**
+ * Follow the MAVLink router endpoints: serial ports get closed & re-opened, serial ports with a full driver buffer
+ * need to be watched for writability
+ */
+void watch_router_endpoints(db_event_loop_t *loop) {
+    for (int i = 0; i < mav_router.endpoint_cnt; i++) {
+        db_mav_endpoint_t *ep = &mav_router.endpoints[i];
+        if (ep->type == DB_MAV_EP_EXTERNAL) continue;
+        if (router_handlers[i] != NULL && router_handlers[i]->fd != ep->fd) {
+            db_event_remove(loop, router_handlers[i]);
+            router_handlers[i] = NULL;
+        }
+        uint32_t events = EPOLLIN | (ep->type == DB_MAV_EP_SERIAL && ep->writer.want_write ? EPOLLOUT : 0);
+        if (router_handlers[i] != NULL)
+            db_event_modify_io(loop, router_handlers[i], events);
+        else if (ep->fd >= 0)
+            router_handlers[i] = db_event_add_io(loop, ep->fd, events, on_router_endpoint, (void *) (intptr_t) i);
+    }
+}
+
+/**
+ * @return Microseconds until the telemetry, the ack, the serial writers or the system metrics need attention again
+ */
+long next_deadline_us(uint64_t now_us) {
+    long deadline = db_metrics_timeout_us(&sys_metrics, now_us);
+    long timeouts[] = {
+            db_mav_sched_timeout_us(&mav_sched, now_us), db_agg_timeout_us(&telem_agg, now_us),
+            db_tel_fec_timeout_us(&telem_fec, now_us), db_arq_ack_timeout_us(&uplink_arq, now_us),
+            mav_router_enabled ? db_mav_router_timeout_us(&mav_router) : -1,
+            telem_writer.fd > 0 && telem_writer.throttle_us > 0 ? telem_writer.throttle_us : -1,
+            sumd_writer.fd > 0 && sumd_writer.throttle_us > 0 ? sumd_writer.throttle_us : -1
+    };
+    for (int i = 0; i < (int) (sizeof(timeouts) / sizeof(timeouts[0])); i++) {
+        if (timeouts[i] >= 0 && timeouts[i] < deadline)
+            deadline = timeouts[i];
+    }
+    return deadline;
+}
+
+/**
+ * Runs once after the events of a wake up were handled: continue writing queued frames to the flight controller &
+ * the MAVLink endpoints, send telemetry & acks that are due and arm the wake up timer for the next deadline
+ */
+void service_links(db_event_loop_t *loop, void *arg) {
+    if (mav_router_enabled) {
+        db_mav_router_service(&mav_router, db_clock_us());
+        watch_router_endpoints(loop);
+    }
+    send_scheduled_mavlink(&proxy_seq_number, raw_interfaces_telem);
+    if (db_agg_due(&telem_agg, db_clock_us()))
+        send_aggregated_telemetry(&proxy_seq_number, raw_interfaces_telem);
+    send_telemetry_parity(&proxy_seq_number, raw_interfaces_telem);
+    if (db_arq_ack_due(&uplink_arq, db_clock_us()))  // no telemetry to piggyback the ack on
+        send_proxy_packet(&proxy_seq_number, raw_interfaces_telem, NULL, 0);
+    if (socket_control_serial > 0 && db_serial_writer_pending(&telem_writer)
+        && db_serial_writer_flush(&telem_writer) < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_CONTROL_AIR: Could not write to telemetry serial port: %s\n", strerror(errno));
+        close_serial_telem();
+    }
+    if (rc_serial_socket > 0 && db_serial_writer_pending(&sumd_writer) && db_serial_writer_flush(&sumd_writer) < 0)
+        LOG_SYS_STD(LOG_ERR, "DB_CONTROL_AIR: Could not write to SUMD serial port: %s\n", strerror(errno));
+    db_metrics_sample(&sys_metrics, db_clock_us());
+
+    // Wait for the serial ports to take more data or for the UART driver buffer to drain
+    if (serial_telem_handler != NULL)
+        db_event_modify_io(loop, serial_telem_handler, EPOLLIN | (telem_writer.want_write ? EPOLLOUT : 0));
+    if (sumd_handler == NULL && rc_serial_socket > 0 && sumd_writer.want_write) {
+        sumd_handler = db_event_add_io(loop, rc_serial_socket, EPOLLOUT, on_sumd_writable, NULL);
+    } else if (sumd_handler != NULL && !sumd_writer.want_write) {
+        db_event_remove(loop, sumd_handler);
+        sumd_handler = NULL;
+    }
+    long deadline = next_deadline_us(db_clock_us());
+    db_event_timer_arm(wakeup_timer, deadline > 0 ? (uint64_t) deadline : 1, 0);
+}
+
+void on_wakeup_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    db_event_defer(loop, service_links, NULL);
+}
+
+void on_stats_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    db_shm_write_begin(&db_uav_status->header);
+    db_uav_status->port_stats[DB_PORT_RC] = port_stats[DB_PORT_RC];
+    db_uav_status->port_stats[DB_PORT_CONTROLLER] = port_stats[DB_PORT_CONTROLLER];
+    db_uav_status->port_stats[DB_PORT_STATUS] = port_stats[DB_PORT_STATUS];
+    db_uav_status->telem_serial = serial_stream.stats;
+    db_uav_status->serial_writer[DB_SERIAL_CLASS_RC] = rc_writer->stats[DB_SERIAL_CLASS_RC];
+    db_uav_status->serial_writer[DB_SERIAL_CLASS_CMD] = telem_writer.stats[DB_SERIAL_CLASS_CMD];
+    db_uav_status->serial_writer[DB_SERIAL_CLASS_BULK] = telem_writer.stats[DB_SERIAL_CLASS_BULK];
+    db_uav_status->mav_sched = mav_sched.stats;
+    db_uav_status->telem_fec = telem_fec.stats;
+    db_uav_status->uplink_arq = uplink_arq.stats;
+    db_uav_status->sys = sys_metrics.metrics;
+    db_uav_status->cpuload = sys_metrics.metrics.cpu_load;
+    db_uav_status->temp = sys_metrics.metrics.temp;
+    db_uav_status->undervolt = sys_metrics.metrics.undervolt;
+    db_uav_status->telem_agg = (serial_protocol_control == 3 || serial_protocol_control == 4) ?
+                               mav_sched.agg_stats : telem_agg.stats;
+    db_uav_status->mav_router_cnt = (uint8_t) (mav_router_enabled ? mav_router.endpoint_cnt : 0);
+    for (int i = 0; mav_router_enabled && i < mav_router.endpoint_cnt; i++)
+        db_uav_status->mav_router[i] = mav_router.endpoints[i].stats;
+    db_shm_write_end(&db_uav_status->header);
+}
+
 int main(int argc, char *argv[]) {
-    int c, bitrate_op = 1, chucksize = 64;
-    int serial_protocol_control = 2, baud_rate = 115200;
+    int c, bitrate_op = 1, chucksize = 64, ext_seq_num = 0;
+    uint32_t mavlink_budget_kbit = 0, telemetry_deadline_ms = DB_MAV_SCHED_DEADLINE_MS;
+    uint16_t telemetry_mtu = TELEMETRY_MTU;
+    uint8_t telemetry_fec_k = TELEMETRY_FEC_K;
+    char mavlink_rates[256] = "";
+    char router_endpoints[DB_MAV_ROUTER_MAX_ENDPOINTS - 2][128];
+    int router_endpoint_cnt = 0;
     char use_sumd = 'N';
     char sumd_interface[IFNAMSIZ];
-    char telem_inf[IFNAMSIZ];
     uint8_t comm_id = DEFAULT_V2_COMMID, frame_type = DB_FRAMETYPE_DEFAULT;
-    uint8_t status_seq_number = 0, proxy_seq_number = 0, serial_byte;
     char db_mode = 'm';
-    char adapters[DB_MAX_ADAPTERS][IFNAMSIZ];
+    char adapters[DB_MAX_ADAPTERS][DB_MAX_IFNAME_LENGTH];
 
 // -------------------------------
 // Processing command line arguments
@@ -302,12 +692,14 @@ int main(int argc, char *argv[]) {
     strcpy(telem_inf, UART_IF);
     strcpy(sumd_interface, UART_IF);
     cont_adhere_80211 = 0;
+    db_rt_profile_t rt_profile;
+    db_rt_parse_profile(NULL, &rt_profile);
     opterr = 0;
-    while ((c = getopt(argc, argv, "n:u:m:c:b:v:l:e:s:r:t:a:")) != -1) {
+    while ((c = getopt(argc, argv, "n:u:m:c:b:v:l:e:s:r:t:a:xP:B:R:M:D:F:AE:")) != -1) {
         switch (c) {
             case 'n':
                 if (num_inf < DB_MAX_ADAPTERS) {
-                    strncpy(adapters[num_inf], optarg, IFNAMSIZ);
+                    strncpy(adapters[num_inf], optarg, DB_MAX_IFNAME_LENGTH - 1);
                     num_inf++;
                 }
                 break;
@@ -343,6 +735,39 @@ int main(int argc, char *argv[]) {
                 break;
             case 'a':
                 cont_adhere_80211 = (int) strtol(optarg, NULL, 10);
+                break;
+            case 'x':
+                ext_seq_num = 1;
+                break;
+            case 'P':
+                if (db_rt_parse_profile(optarg, &rt_profile) < 0)
+                    exit(1);
+                break;
+            case 'B':
+                mavlink_budget_kbit = (uint32_t) strtol(optarg, NULL, 10);
+                break;
+            case 'R':
+                strncpy(mavlink_rates, optarg, sizeof(mavlink_rates) - 1);
+                break;
+            case 'M':
+                telemetry_mtu = (uint16_t) strtol(optarg, NULL, 10);
+                break;
+            case 'D':
+                telemetry_deadline_ms = (uint32_t) strtol(optarg, NULL, 10);
+                break;
+            case 'F':
+                telemetry_fec_k = (uint8_t) strtol(optarg, NULL, 10);
+                break;
+            case 'A':
+                uplink_arq_enabled = 1;
+                break;
+            case 'E':
+                if (router_endpoint_cnt < DB_MAV_ROUTER_MAX_ENDPOINTS - 2) {
+                    strncpy(router_endpoints[router_endpoint_cnt], optarg, sizeof(router_endpoints[0]) - 1);
+                    router_endpoints[router_endpoint_cnt][sizeof(router_endpoints[0]) - 1] = '\0';
+                    router_endpoint_cnt++;
+                }
+                break;
             case '?':
                 printf("Invalid commandline arguments. Use "
                        "\n\t-n <Network interface name - multiple <-n interface> possible> "
@@ -367,324 +792,211 @@ int main(int argc, char *argv[]) {
                        "\n\t-b bit rate:\tin Mbps (1|2|5|6|9|11|12|18|24|36|48|54)\n\t\t(bitrate option only "
                        "supported with Ralink chipsets)"
                        "\n\t-a [0|1] to disable/enable. Offsets the payload by some bytes so that it sits outside "
-                       "then 802.11 header. Set this to 1 if you are using a non DB-Rasp Kernel!",
-                       chucksize, baud_rate);
+                       "then 802.11 header. Set this to 1 if you are using a non DB-Rasp Kernel!"
+                       "\n\t-x Send 32 bit sequence numbers (header extension). Improves the link statistics of "
+                       "the ground station. All DroneBridge versions with sequence statistics can receive them"
+                       "\n\t-P Real-time profile <option>[=<value>],... with options fifo=<prio>|rr=<prio>, "
+                       "cpu=<n>[+<n>], mlock, prefault=<kB>, busypoll=<us>. e.g. fifo=50,cpu=3,mlock,busypoll=50"
+                       "\n\t-B only relevant with -v 3|4. Airtime budget of the MAVLink downlink in kbit/s incl. "
+                       "packet headers. Acks, commands & status texts are sent first. (default: 0 = unlimited)"
+                       "\n\t-R only relevant with -v 3|4. Rate caps <message ID>:<max. Hz>,... e.g. 30:10,33:5. "
+                       "Only the newest state message (attitude, position, ...) gets sent"
+                       "\n\t-M only relevant with -v 1-4. Max. telemetry bytes per packet to the ground station "
+                       "(default: %i). With -v 5 the packet size is set by -l"
+                       "\n\t-D Max. time telemetry waits for more data to fill a packet in ms (default: %i). "
+                       "MAVLink bulk data waits twice as long, acks & commands are sent right away"
+                       "\n\t-F FEC of the telemetry downlink: one parity packet per <n> packets (1-%i). Any single "
+                       "lost packet of a group is rebuilt on the ground. Must match the ground station proxy "
+                       "(default: %i = off)"
+                       "\n\t-A Reliable uplink: data of the ground station proxy is acknowledged and passed on in "
+                       "order. Must be enabled on the ground station proxy too"
+                       "\n\t-E only relevant with -v 3|4. Additional MAVLink endpoint (max. %i). Frames are routed "
+                       "between the FC, the ground station & all endpoints by the system/component IDs seen on "
+                       "them: <type>:<address>[@<option>=<value>,...] with serial:<device>, udp:<IP>:<port>, "
+                       "udpin:<port>, unix:<path> and the options baud=<n>, kbit=<max. rate>, "
+                       "allow=<msg ID>+..., deny=<msg ID>+... e.g. -E serial:/dev/ttyUSB0@baud=921600 "
+                       "-E udp:127.0.0.1:14550@kbit=64",
+                       chucksize, baud_rate, TELEMETRY_MTU, DB_MAV_SCHED_DEADLINE_MS, DB_TEL_FEC_MAX_K,
+                       TELEMETRY_FEC_K, DB_MAV_ROUTER_MAX_ENDPOINTS - 2);
                 break;
             default:
                 abort();
         }
     }
     conf_rc_serial_protocol_air(serial_protocol_control, use_sumd);
+    // leave room for the FEC & ARQ headers
+    uint16_t max_telemetry_payload = (uint16_t) (DATA_UNI_LENGTH - (telemetry_fec_k > 0 ? DB_TEL_FEC_HEADER_LENGTH : 0)
+                                                 - (uplink_arq_enabled ? sizeof(db_arq_ack_header_t) : 0));
+    if (telemetry_mtu > max_telemetry_payload) telemetry_mtu = max_telemetry_payload;
+    if (chucksize > max_telemetry_payload) chucksize = max_telemetry_payload;
+    db_arq_receiver_init(&uplink_arq);
+    db_metrics_open(&sys_metrics, DB_METRICS_INTERVAL_MS);
+    // only rebuilt packets wait for the parity. Allow a group to span k packet deadlines to keep the overhead at 1/k
+    db_tel_fec_encoder_init(&telem_fec, telemetry_fec_k, telemetry_fec_k * telemetry_deadline_ms * 1000);
+    db_mav_sched_init(&mav_sched, telemetry_mtu, mavlink_budget_kbit, telemetry_deadline_ms);
+    db_agg_init(&telem_agg, (uint16_t) (serial_protocol_control == 5 ? chucksize : telemetry_mtu));
+    telemetry_deadline_us = telemetry_deadline_ms * 1000;
+    if (db_mav_sched_parse_rates(&mav_sched, mavlink_rates) < 0)
+        exit(1);
+    if (router_endpoint_cnt > 0 && serial_protocol_control != 3 && serial_protocol_control != 4) {
+        LOG_SYS_STD(LOG_WARNING, "DB_CONTROL_AIR: MAVLink endpoints (-E) require -v 3|4 - ignoring them\n");
+    } else if (router_endpoint_cnt > 0) {
+        db_mav_router_init(&mav_router, deliver_routed_mavlink, NULL);
+        db_serial_stream_init(&uplink_stream, DB_SERIAL_STREAM_MAVLINK);
+        router_link_ep = db_mav_router_add_external(&mav_router, "downlink");
+        router_fc_ep = db_mav_router_add_external(&mav_router, "flight controller");
+        for (int i = 0; i < router_endpoint_cnt; i++) {
+            if (db_mav_router_add_endpoint(&mav_router, router_endpoints[i]) < 0)
+                exit(1);
+        }
+        mav_router_enabled = 1;
+    }
     open_rc_rx_shm(); // open/init shared memory to write RC values into it
+    const int signals[] = {SIGINT, SIGTERM};
+    if (db_event_loop_init(&event_loop) < 0 || db_event_add_signals(&event_loop, signals, 2, on_signal, NULL) == NULL)
+        exit(-1);
 
 // -------------------------------
 // Setting up network interface
 // -------------------------------
-    db_socket_t raw_interfaces_rc[DB_MAX_ADAPTERS] = {0};
-    db_socket_t raw_interfaces_telem[DB_MAX_ADAPTERS] = {0};
     for (int i = 0; i < num_inf; ++i) {
         raw_interfaces_rc[i] = open_db_socket(adapters[i], comm_id, db_mode, bitrate_op, DB_DIREC_GROUND, DB_PORT_RC,
                                               frame_type);
         raw_interfaces_telem[i] = open_db_socket(adapters[i], comm_id, db_mode, bitrate_op, DB_DIREC_GROUND,
                                                  DB_PORT_CONTROLLER, frame_type);
+        // clock sync requests of the ground station (video latency measurement)
+        raw_interfaces_status[i] = open_db_socket(adapters[i], comm_id, db_mode, bitrate_op, DB_DIREC_GROUND,
+                                                  DB_PORT_STATUS, frame_type);
+        db_enable_rx_timestamps(&raw_interfaces_status[i]); // clock sync: take t2 when the request arrived
+        db_rt_socket(&rt_profile, raw_interfaces_rc[i].db_socket);
+        db_rt_socket(&rt_profile, raw_interfaces_telem[i].db_socket);
+        db_rt_socket(&rt_profile, raw_interfaces_status[i].db_socket);
+        if (ext_seq_num) {
+            db_enable_ext_seq_num(&raw_interfaces_telem[i]);
+            db_enable_ext_seq_num(&raw_interfaces_status[i]);
+        }
+        if (db_event_add_io(&event_loop, raw_interfaces_rc[i].db_socket, EPOLLIN, on_rc_packet,
+                            (void *) (intptr_t) i) == NULL
+            || db_event_add_io(&event_loop, raw_interfaces_telem[i].db_socket, EPOLLIN, on_telem_packet,
+                               (void *) (intptr_t) i) == NULL
+            || db_event_add_io(&event_loop, raw_interfaces_status[i].db_socket, EPOLLIN, on_sync_request,
+                               (void *) (intptr_t) i) == NULL)
+            exit(-1);
     }
+    // loss/duplicate/reorder statistics of the uplink
+    db_uav_status = db_uav_status_memory_open();
+    db_port_seq_init(&rc_seq, &port_stats[DB_PORT_RC]);
+    db_port_seq_init(&cont_seq, &port_stats[DB_PORT_CONTROLLER]);
+    db_port_seq_init(&sync_seq, &port_stats[DB_PORT_STATUS]);
 
 // -------------------------------
 // Setting up UART interface for MSP/MAVLink stream
 // -------------------------------
-    uint8_t transparent_buffer[chucksize + 256];
-    int socket_control_serial = open_serial_telem(baud_rate, telem_inf);
-    int rc_serial_socket = socket_control_serial;
+    socket_control_serial = open_serial_telem(baud_rate, telem_inf);
+    db_serial_writer_init(&telem_writer, socket_control_serial, baud_rate);
+    db_serial_writer_init(&sumd_writer, -1, 115200);
+    watch_serial_telem(&event_loop);
 
 // -------------------------------
 // Setting up UART interface for RC commands over SUMD
 // -------------------------------
     if (use_sumd == 'Y') {
-        rc_serial_socket = open_serial_sumd(sumd_interface);  // overwrite serial socket used for RC
+        rc_serial_socket = open_serial_sumd(sumd_interface);  // overwrite serial port used for RC
+        db_serial_writer_init(&sumd_writer, rc_serial_socket, 115200);
+        rc_writer = &sumd_writer;
     }
 
 // -------------------------------
 // Setting up unix tcp server for local apps to access serial port data
 // -------------------------------
-    db_unix_tcp_socket unix_server = db_create_unix_tcpserver_sock(DB_UNIX_TCP_SERVER_CONTROL);
-    db_unix_tcp_client unix_server_clients[DB_MAX_UNIX_TCP_CLIENTS];
+    unix_server = db_create_unix_tcpserver_sock(DB_UNIX_TCP_SERVER_CONTROL);
     for (int i = 0; i<DB_MAX_UNIX_TCP_CLIENTS; i++) unix_server_clients[i].client_sock = -1;
+    if (unix_server.socket > 0)
+        db_event_add_io(&event_loop, unix_server.socket, EPOLLIN, on_unix_connect, NULL);
 
 // ----------------------------------
 // Loop
 // ----------------------------------
-    int sentbytes = 0, command_length = 0, errsv, select_return, continue_reading, serial_read_bytes = 0, max_sd = 0;
-    uint16_t radiotap_lenght;
-    uint8_t serial_bytes[DB_TRANSPARENT_READBUF];
-    int8_t rssi = -128, last_recv_rc_seq_num = 0, last_recv_cont_seq_num = 0;
-    unsigned int addrlen = sizeof(struct sockaddr);
-    long start; // start time for status report update
-    long start_rc; // start time for measuring the recv RC packets/second
-
-    uint8_t rc_packets_tmp = 0, rc_packets_cnt = 0, seq_num_rc = 0, seq_num_cont = 0;
-    mavlink_message_t mavlink_message;
-    mavlink_status_t mavlink_status;
-    mspPort_t db_msp_port;
-
-    fd_set fd_socket_set;
-    struct timeval socket_timeout;
-    // wait max STATUS_UPDATE_TIME for message on socket
-    socket_timeout.tv_sec = 0;
-    socket_timeout.tv_usec = STATUS_UPDATE_TIME * 1000;
-
-    ssize_t length;
-    signal(SIGINT, intHandler);
-    uint8_t commandBuf[COMMAND_BUF_SIZE];
-    struct timeval timecheck;
-
-    // create our data pointer directly inside the buffer (monitor_framebuffer) that is sent over the socket
-    struct data_uni *raw_buffer = get_hp_raw_buffer(cont_adhere_80211);
-    struct uav_rc_status_update_message_t *rc_status_update_data = (struct uav_rc_status_update_message_t *) raw_buffer;
+    db_serial_stream_init(&serial_stream, (serial_protocol_control == 3 || serial_protocol_control == 4) ?
+                                          DB_SERIAL_STREAM_MAVLINK : DB_SERIAL_STREAM_MSP);
+    // create our data pointer directly inside the send buffer of the first telemetry socket
+    raw_buffer = get_hp_raw_buffer(&raw_interfaces_telem[0], cont_adhere_80211);
+    rc_status_update_data = (struct uav_rc_status_update_message_t *) raw_buffer;
     memset(raw_buffer->bytes, 0, DATA_UNI_LENGTH);
 
+    wakeup_timer = db_event_add_timer(&event_loop, on_wakeup_timer, NULL);
+    db_event_handler_t *status_timer = db_event_add_timer(&event_loop, on_status_timer, NULL);
+    db_event_handler_t *rc_rate_timer = db_event_add_timer(&event_loop, on_rc_rate_timer, NULL);
+    db_event_handler_t *stats_timer = db_event_add_timer(&event_loop, on_stats_timer, NULL);
+    db_event_handler_t *reconnect_timer = db_event_add_timer(&event_loop, on_serial_reconnect_timer, NULL);
+    if (wakeup_timer == NULL || status_timer == NULL || rc_rate_timer == NULL || stats_timer == NULL
+        || reconnect_timer == NULL)
+        exit(-1);
+    db_event_timer_arm(status_timer, 0, STATUS_UPDATE_TIME * 1000);
+    db_event_timer_arm(rc_rate_timer, 0, 1000000);
+    db_event_timer_arm(stats_timer, 0, DB_SHM_PUBLISH_INTERVAL_MS * 1000);
+    db_event_timer_arm(reconnect_timer, 0, 2000000);   // try to open the telemetry serial port every two seconds
+    db_event_defer(&event_loop, service_links, NULL);
+
+    db_rt_apply(&rt_profile, "DB_CONTROL_AIR");
     LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: Ready for data! Enabled diversity on %i adapters\n", num_inf);
-    gettimeofday(&timecheck, NULL);
-    start = (long) timecheck.tv_sec * 1000 + (long) timecheck.tv_usec / 1000; // [ms]
-    long last_serial_telem_reconnect_try = start; // [ms]
-    start_rc = start;
-
-    while (keep_running) {
-        socket_timeout.tv_sec = 0;
-        socket_timeout.tv_usec = STATUS_UPDATE_TIME * 1000;
-        FD_ZERO (&fd_socket_set);
-
-        // add raw DroneBridge sockets
-        for (int i = 0; i < num_inf; i++) {
-            FD_SET(raw_interfaces_rc[i].db_socket, &fd_socket_set);
-            if (raw_interfaces_rc[i].db_socket > max_sd)
-                max_sd = raw_interfaces_rc[i].db_socket;
-            if (raw_interfaces_telem[i].db_socket > max_sd)
-                max_sd = raw_interfaces_telem[i].db_socket;
-        }
-        // Add or open serial interface for telemetry
-        if (socket_control_serial > 0) {
-            FD_SET(socket_control_serial, &fd_socket_set);
-            if (socket_control_serial > max_sd)
-                max_sd = socket_control_serial;
-        }
-        // Add unix tcp server
-        if (unix_server.socket > 0) {
-            FD_SET(unix_server.socket, &fd_socket_set);
-            if (unix_server.socket > max_sd)
-                max_sd = unix_server.socket;
-        }
-        // Add connected clients of unix socket
-        for (int i = 0; i < DB_MAX_UNIX_TCP_CLIENTS; i++) {
-            if (unix_server_clients[i].client_sock > 0) {
-                FD_SET (unix_server_clients[i].client_sock, &fd_socket_set);
-                if (unix_server_clients[i].client_sock > max_sd)
-                    max_sd = unix_server_clients[i].client_sock;
-            }
-        }
-
-        select_return = select(max_sd + 1, &fd_socket_set, NULL, NULL, &socket_timeout);
-        if (select_return == -1 && errno != EINTR) {
-            perror("DB_CONTROL_AIR: select returned error: ");
-        } else if (select_return > 0) {
-            // --------------------------------
-            // DroneBridge long range data
-            // --------------------------------
-            for (int i = 0; i < num_inf; i++) {
-                if (FD_ISSET(raw_interfaces_rc[i].db_socket, &fd_socket_set)) {
-                    // --------------------------------
-                    // DB_RC_PORT for DroneBridge RC packets
-                    // --------------------------------
-                    length = recv(raw_interfaces_rc[i].db_socket, buf, BUF_SIZ, 0);
-                    if (length > 0) {
-                        rc_packets_cnt++;
-                        get_db_payload(buf, length, commandBuf, &seq_num_rc, &radiotap_lenght);
-                        rssi = get_rssi(buf, radiotap_lenght);
-                        if (last_recv_rc_seq_num != seq_num_rc) {  // diversity duplicate protection
-                            last_recv_rc_seq_num = seq_num_rc;
-                            command_length = generate_rc_serial_message(commandBuf);
-                            write_to_serial(rc_serial_socket, serial_data_buffer, command_length, "RC");
-                        }
-                    }
-                }
-            }
-
-            for (int i = 0; i < num_inf; i++) {
-                if (FD_ISSET(raw_interfaces_telem[i].db_socket, &fd_socket_set)) {
-                    // --------------------------------
-                    // DB_CONTROL_PORT for incoming MSP/MAVLink
-                    // --------------------------------
-                    length = recv(raw_interfaces_telem[i].db_socket, buf, BUF_SIZ, 0);
-                    if (length > 0) {
-                        rssi = get_rssi(buf, buf[2]);
-                        if (last_recv_cont_seq_num != seq_num_cont) {  // diversity duplicate protection
-                            last_recv_cont_seq_num = seq_num_cont;
-                            command_length = get_db_payload(buf, length, commandBuf, &seq_num_cont, &radiotap_lenght);
-                            write_to_serial(socket_control_serial, commandBuf, command_length, "MSP/MAVLink");
-                        }
-                    }
-                }
-            }
-            // --------------------------------
-            // FC input to control module via serial
-            // --------------------------------
-            if (FD_ISSET(socket_control_serial, &fd_socket_set)) {
-                // --------------------------------
-                // The FC sent us a MSP/MAVLink message - LTM telemetry will be ignored!
-                // --------------------------------
-                ssize_t read_bytes;
-                switch (serial_protocol_control) {
-                    default:
-                    case 1:
-                    case 2:
-                        // Parse MSP message - just pass it to DB proxy module on ground station
-                        continue_reading = 1;
-                        serial_read_bytes = 0;
-                        while (continue_reading) {
-                            if (read(socket_control_serial, &serial_byte, 1) > 0) {
-                                serial_read_bytes++;
-                                // if MSP parser returns false stop reading from serial. We are reading shit or started
-                                // reading during the middle of a message
-                                if (mspSerialProcessReceivedData(&db_msp_port, serial_byte)) {
-                                    raw_buffer->bytes[(serial_read_bytes - 1)] = serial_byte;
-                                    if (db_msp_port.c_state == MSP_COMMAND_RECEIVED) {
-                                        continue_reading = 0; // stop reading from serial port --> got a complete message!
-                                        for (int i = 0; i < num_inf; i++) {
-                                            db_send_hp_div(&raw_interfaces_telem[i], DB_PORT_PROXY,
-                                                           (u_int16_t) serial_read_bytes,
-                                                           update_seq_num(&proxy_seq_number));
-                                        }
-                                        write_to_unix(unix_server_clients, raw_buffer->bytes, serial_read_bytes);
-                                    }
-                                } else {
-                                    continue_reading = 0;
-                                }
-                            }/* else {
-                                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                                    close(socket_control_serial);
-                                    socket_control_serial = -1;  // will try to reconnect in next loop iteration
-                                    continue_reading = 0;
-                                }
-                            }*/
-                        }
-                        break;
-                    case 3:
-                    case 4:
-                        // Parse complete MAVLink message
-                        continue_reading = 1;
-                        serial_read_bytes = 0;
-                        while (continue_reading) {
-                            if (read(socket_control_serial, &serial_byte, 1) > 0) {
-                                serial_read_bytes++;
-                                if (mavlink_parse_char(MAVLINK_COMM_0, (uint8_t) serial_byte, &mavlink_message,
-                                                       &mavlink_status)) {
-                                    continue_reading = 0; // stop reading from serial port --> got a complete message!
-                                    mavlink_msg_to_send_buffer(raw_buffer->bytes, &mavlink_message);
-                                    for (int i = 0; i < num_inf; i++) {
-                                        db_send_hp_div(&raw_interfaces_telem[i], DB_PORT_PROXY, serial_read_bytes,
-                                                update_seq_num(&proxy_seq_number));
-                                    }
-                                    write_to_unix(unix_server_clients, raw_buffer->bytes, serial_read_bytes);
-                                }
-                            }
-                        }
-                        break;
-                    case 5:
-                        // MAVLink plain pass through - no parsing. Send packets with length of chuck size
-                        read_bytes = read(socket_control_serial, &serial_bytes, DB_TRANSPARENT_READBUF);
-                        if (read_bytes > 0) {
-                            memcpy(&transparent_buffer[serial_read_bytes], &serial_bytes, read_bytes);
-                            serial_read_bytes += read_bytes;
-                            if (serial_read_bytes >= chucksize) {
-                                for (int i = 0; i < num_inf; i++) {
-                                    //LOG_SYS_STD(LOG_DEBUG, "DB_CONTROL_AIR: Sending transparent packet %i\n",
-                                    //            serial_read_bytes);
-                                    for (int r = 0; r < RETRANSMISSION_RATE; r++) {
-                                        db_send_div(&raw_interfaces_telem[i], transparent_buffer, DB_PORT_PROXY,
-                                                    serial_read_bytes, update_seq_num(&proxy_seq_number),
-                                                    cont_adhere_80211);
-                                    }
-                                    write_to_unix(unix_server_clients, raw_buffer->bytes, serial_read_bytes);
-                                }
-                                serial_read_bytes = 0;
-                            }
-                        }
-                        break;
-                }
-            }
-
-            // --------------------------------
-            // Unix TCP server - accept new clients
-            // --------------------------------
-            if (FD_ISSET(unix_server.socket, &fd_socket_set)) {
-                int new_client = accept(unix_server.socket, (struct sockaddr *) &unix_server.addr, &addrlen);
-                if (new_client > 0) {
-                    // find free slot for client
-                    for (int t = 0; t < DB_MAX_UNIX_TCP_CLIENTS; t++) {
-                        if (unix_server_clients[t].client_sock < 0 || t == (DB_MAX_UNIX_TCP_CLIENTS-1)) {
-                            unix_server_clients[t].client_sock = new_client;
-                            unix_server_clients[t].addr = unix_server.addr;
-                            LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: New unix client connected\n");
-                            break;
-                        }
-                    }
-                }
-            }
-            // --------------------------------
-            // Unix TCP clients - accept data to forward to serial connection
-            // --------------------------------
-            for (int i = 0; i < DB_MAX_UNIX_TCP_CLIENTS; i++) {
-                if (FD_ISSET(unix_server_clients[i].client_sock, &fd_socket_set)) {
-                    uint8_t receive_buffer[4096];
-                    ssize_t size = recv(unix_server_clients[i].client_sock, receive_buffer, 4096, 0);
-                    if (size == 0) {
-                        close(unix_server_clients[i].client_sock);
-                        unix_server_clients[i].client_sock = -1;
-                        LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: Unix client disconnected\n");
-                    } else if (size > 0) {
-                        // forward to serial port
-                        write_to_serial(socket_control_serial, receive_buffer, size, "client via unix sock");
-                    } else {
-                        LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: Unix client receive error %s\n", strerror(errno));
-                    }
-                }
-            }
-        }
-        struct timeval time_check;
-        gettimeofday(&time_check, NULL);
-        long rightnow = (long) time_check.tv_sec * 1000 + (long) time_check.tv_usec / 1000;
-
-        // --------------------------------
-        // Send a status update to status module on ground station
-        // --------------------------------
-        rc_packets_cnt = send_status_update(&status_seq_number, raw_interfaces_telem, rssi, &start, &start_rc,
-                                            &rc_packets_tmp, rc_packets_cnt, rc_status_update_data, &rightnow);
-        // --------------------------------
-        // Check for open telemetry serial socket
-        // --------------------------------
-        if (socket_control_serial < 0) {
-            if ((rightnow - last_serial_telem_reconnect_try) >= 2000) { // try to open it every two seconds
-                last_serial_telem_reconnect_try = rightnow;
-                socket_control_serial = open_serial_telem(baud_rate, telem_inf);
-                if (socket_control_serial > 0) {
-                    if (use_sumd == 'N')  // do not overwrite SUMD if set
-                        rc_serial_socket = socket_control_serial;
-                }
-            }
-        }
-    }
+    db_event_run(&event_loop);
 
+    db_event_report(&event_loop, "DB_CONTROL_AIR");
+    db_event_loop_close(&event_loop);
     for (int i = 0; i < DB_MAX_ADAPTERS; i++) {
         if (raw_interfaces_rc[i].db_socket > 0)
-            close(raw_interfaces_rc[i].db_socket);
+            close_db_socket(&raw_interfaces_rc[i]);
         if (raw_interfaces_telem[i].db_socket > 0)
-            close(raw_interfaces_telem[i].db_socket);
+            close_db_socket(&raw_interfaces_telem[i]);
+        if (raw_interfaces_status[i].db_socket > 0)
+            close_db_socket(&raw_interfaces_status[i]);
     }
     for (int i = 0; i < DB_MAX_UNIX_TCP_CLIENTS; i++) {
         if (unix_server_clients[i].client_sock > 0) close(unix_server_clients[i].client_sock);
     }
-    close(socket_control_serial);
-    close(rc_serial_socket);
+    if (socket_control_serial > 0) close(socket_control_serial);
+    if (rc_serial_socket > 0) close(rc_serial_socket);
     close(unix_server.socket);
+    if (serial_stream.stats.bytes > 0)
+        LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: Telemetry serial: %u bytes in %u reads, %u frames, %u checksum errors, "
+                              "%u unknown, %u resyncs, %u bytes discarded\n", serial_stream.stats.bytes,
+                    serial_stream.stats.reads, serial_stream.stats.frames, serial_stream.stats.checksum_errors,
+                    serial_stream.stats.unknown_msgs, serial_stream.stats.resyncs,
+                    serial_stream.stats.discarded_bytes);
+    const char *class_names[DB_SERIAL_CLASS_CNT] = {"RC", "command", "bulk"};
+    for (int i = 0; i < DB_SERIAL_CLASS_CNT; i++) {
+        db_serial_queue_stats_t *stats = (i == DB_SERIAL_CLASS_RC) ? &rc_writer->stats[i] : &telem_writer.stats[i];
+        if (stats->frames > 0 || stats->dropped_frames > 0)
+            LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: Serial writer %s: %u frames, %u dropped, %u superseded, max. queue "
+                                  "%u bytes, latency avg. %u us max. %u us\n", class_names[i], stats->frames,
+                        stats->dropped_frames, stats->superseded_frames, stats->max_queued_bytes,
+                        stats->latency_avg_us, stats->latency_max_us);
+    }
+    if (mav_sched.stats.packets > 0)
+        LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: MAVLink downlink: %u packets, %u bytes, sent %u command/%u state/%u "
+                              "bulk msgs, %u superseded, %u rate limited, %u dropped, %u budget waits, max. command "
+                              "latency %u us\n", mav_sched.stats.packets, mav_sched.stats.bytes,
+                    mav_sched.stats.sent[DB_MAV_CLASS_COMMAND], mav_sched.stats.sent[DB_MAV_CLASS_STATE],
+                    mav_sched.stats.sent[DB_MAV_CLASS_BULK], mav_sched.stats.superseded,
+                    mav_sched.stats.rate_limited, mav_sched.stats.dropped, mav_sched.stats.budget_waits,
+                    mav_sched.stats.command_latency_max_us);
+    db_agg_stats_t *agg_stats = (serial_protocol_control == 3 || serial_protocol_control == 4) ?
+                                &mav_sched.agg_stats : &telem_agg.stats;
+    if (agg_stats->packets > 0)
+        LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: Telemetry packets: %u, avg. %u bytes. Fill (1/8 MTU steps): "
+                              "%u %u %u %u %u %u %u %u. Delay (<1,2,5,10,20,50,100,>=100 ms): %u %u %u %u %u %u %u %u\n",
+                    agg_stats->packets, agg_stats->bytes / agg_stats->packets, agg_stats->fill[0], agg_stats->fill[1],
+                    agg_stats->fill[2], agg_stats->fill[3], agg_stats->fill[4], agg_stats->fill[5], agg_stats->fill[6],
+                    agg_stats->fill[7], agg_stats->delay[0], agg_stats->delay[1], agg_stats->delay[2],
+                    agg_stats->delay[3], agg_stats->delay[4], agg_stats->delay[5], agg_stats->delay[6],
+                    agg_stats->delay[7]);
+    if (mav_router_enabled) {
+        db_mav_router_report(&mav_router, "DB_CONTROL_AIR");
+        db_mav_router_close(&mav_router);
+    }
+    db_rt_report("DB_CONTROL_AIR");
+    db_metrics_close(&sys_metrics);
     LOG_SYS_STD(LOG_INFO, "DB_CONTROL_AIR: Terminated!\n");
     return 1;
 }
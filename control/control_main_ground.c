@@ -31,6 +31,7 @@
 #include "rc_ground.h"
 #include "opentx.h"
 #include "../common/db_common.h"
+#include "../common/db_rt.h"
 
 #define DB_DEFAULT_RC_FREQUENCY 60
 
@@ -52,11 +53,11 @@ int main(int argc, char *argv[]) {
     char RC_name[128];
     char calibrate_comm[CALI_COMM_SIZE] = {'\0'};
     uint8_t comm_id, frame_type;
-    int rc_int_indx, c, bitrate_op, rc_protocol, adhere_80211;
+    int rc_int_indx, c, bitrate_op, rc_protocol, adhere_80211, ext_seq_num = 0;
     char db_mode = 'm';
     char allow_rc_overwrite = 'N';
     int num_inf_rc = 0, rc_frequency = DB_DEFAULT_RC_FREQUENCY;
-    char adapters[DB_MAX_ADAPTERS][IFNAMSIZ];
+    char adapters[DB_MAX_ADAPTERS][DB_MAX_IFNAME_LENGTH];
 
     // Command Line processing
     rc_int_indx = JOY_INTERFACE;
@@ -65,12 +66,14 @@ int main(int argc, char *argv[]) {
     adhere_80211 = 0;
     comm_id = DEFAULT_V2_COMMID;
     frame_type = DB_FRAMETYPE_DEFAULT;
+    db_rt_profile_t rt_profile;
+    db_rt_parse_profile(NULL, &rt_profile);
     opterr = 0;
-    while ((c = getopt(argc, argv, "n:j:m:b:g:v:o:t:c:a:")) != -1) {
+    while ((c = getopt(argc, argv, "n:j:m:b:g:v:o:t:c:a:xP:")) != -1) {
         switch (c) {
             case 'n':
                 if (num_inf_rc < DB_MAX_ADAPTERS) {
-                    strncpy(adapters[num_inf_rc], optarg, IFNAMSIZ);
+                    strncpy(adapters[num_inf_rc], optarg, DB_MAX_IFNAME_LENGTH - 1);
                     num_inf_rc++;
                 }
                 break;
@@ -98,6 +101,13 @@ int main(int argc, char *argv[]) {
             case 'a':
                 adhere_80211 = (int) strtol(optarg, NULL, 10);
                 break;
+            case 'x':
+                ext_seq_num = 1;
+                break;
+            case 'P':
+                if (db_rt_parse_profile(optarg, &rt_profile) < 0)
+                    exit(1);
+                break;
             case 'r':
                 rc_frequency = (int) strtol(optarg, NULL, 10);
                 break;
@@ -117,7 +127,10 @@ int main(int argc, char *argv[]) {
                        "\n\t-b Bit rate in Mbps: (1|2|5|6|9|11|12|18|24|36|48|54)\n\t\t(bitrate option only "
                        "supported with Ralink chipsets), default is %i Mbps."
                        "\n\t-a <0|1> to enable/disable. Offsets the payload by some bytes so that it sits outside "
-                       "then 802.11 header.\n\t\t Set this to 1 if you are using a non DB-Rasp Kernel!\n",
+                       "then 802.11 header.\n\t\t Set this to 1 if you are using a non DB-Rasp Kernel!"
+                       "\n\t-x Send 32 bit sequence numbers (header extension) to the UAV"
+                       "\n\t-P Real-time profile <option>[=<value>],... with options fifo=<prio>|rr=<prio>, "
+                       "cpu=<n>[+<n>], mlock, prefault=<kB>, busypoll=<us>. e.g. fifo=50,cpu=3,mlock\n",
                        DB_DEFAULT_RC_FREQUENCY, bitrate_op);
                 exit(0);
             default:
@@ -125,7 +138,7 @@ int main(int argc, char *argv[]) {
         }
     }
     conf_rc(adapters, num_inf_rc, comm_id, db_mode, bitrate_op, frame_type, rc_protocol, allow_rc_overwrite,
-            adhere_80211);
+            adhere_80211, ext_seq_num);
 
     open_rc_shm();
 
@@ -139,6 +152,7 @@ int main(int argc, char *argv[]) {
     sleep_time.tv_sec = 0;
     sleep_time.tv_nsec = sleep_time_nano_sec;
 
+    db_rt_apply(&rt_profile, "DB_CONTROL_GND");
     LOG_SYS_STD(LOG_INFO, "DB_CONTROL_GND: started!\n");
     int sock_fd = detect_RC(rc_int_indx);
     if (ioctl(sock_fd, JSIOCGNAME(sizeof(RC_name)), RC_name) < 0)
@@ -155,5 +169,6 @@ int main(int argc, char *argv[]) {
         do_calibration(calibrate_comm, rc_int_indx);
         opentx(rc_int_indx, sleep_time);
     }
+    db_rt_report("DB_CONTROL_GND");
     exit(0);
 }
\ No newline at end of file
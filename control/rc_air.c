@@ -261,10 +261,12 @@ int generate_rc_serial_message(uint8_t *db_rc_protocol){
         rc_channels[4] += 1000; rc_channels[5] += 1000; rc_channels[6] += 1000; rc_channels[7] += 1000;
         rc_channels[8] += 1000; rc_channels[9] += 1000; rc_channels[10] += 1000; rc_channels[11] += 1000;
         // Update shared memory so that other modules/plugins can read from it
+        db_shm_write_begin(&shm_rc_values->header);
         shm_rc_values->ch[0] = rc_channels[0];shm_rc_values->ch[1] = rc_channels[1];shm_rc_values->ch[2] = rc_channels[2];
         shm_rc_values->ch[3] = rc_channels[3];shm_rc_values->ch[4] = rc_channels[4];shm_rc_values->ch[5] = rc_channels[5];
         shm_rc_values->ch[6] = rc_channels[6];shm_rc_values->ch[7] = rc_channels[7];shm_rc_values->ch[8] = rc_channels[8];
         shm_rc_values->ch[9] = rc_channels[9];shm_rc_values->ch[10] = rc_channels[10];shm_rc_values->ch[11] = rc_channels[11];
+        db_shm_write_end(&shm_rc_values->header);
 
         if (serial_rc_protocol == RC_SERIAL_PROT_MSPV1){
             generate_msp(rc_channels);
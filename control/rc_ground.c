@@ -17,26 +17,41 @@
  *
  */
 
+#include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
 #include "../common/db_raw_send_receive.h"
 #include "../common/db_crc.h"
 #include "../common/shared_memory.h"
 #include "../common/mavlink/c_library_v2/common/mavlink.h"
 #include "parameter.h"
 #include "../common/db_common.h"
+#include "../common/db_event.h"
+#include "rc_ground.h"
 
 
 int rc_protocol;
 uint8_t crc_mspv2, crc8, rc_seq_number = 0;
 crc_t crc_rc;
-int i_crc, i_rc, num_interfaces = 0;
+int i_crc, i_rc, num_interfaces = 0, rc_adhere_80211 = 0;
 unsigned int rc_crc_tbl_idx, mspv2_tbl_idx;
 db_rc_values_t *shm_rc_values = NULL;
 db_rc_overwrite_values_t *shm_rc_overwrite = NULL;
+db_rc_overwrite_values_t rc_overwrite;  // consistent copy of shm_rc_overwrite
 struct timespec timestamp;
 bool en_rc_overwrite = false;
 
+// RC loop: one frame per frame_time. Joystick events get read as they arrive
+db_event_loop_t rc_loop;
+db_event_handler_t *rc_frame_timer = NULL, *joystick_handler = NULL, *joystick_retry_timer = NULL;
+const rc_radio_t *rc_radio = NULL;
+int joystick_fd = -1, joystick_indx = 0;
+uint64_t rc_frame_us = 0;
+
 // pointing right into the sockets send buffer for max performance
 struct data_uni *monitor_databuffer;
 
@@ -244,17 +259,22 @@ void do_calibration(char *calibrate_comm, int joy_interface_indx) {
  * Sets the desired RC protocol. Opens DroneBridge raw protocol sockets for transmission
  * @param new_rc_protocol 1:MSPv1, 2:MSPv2, 3:MAVLink v1, 4:MAVLink v2, 5:DB-RC
  * @param allow_rc_overwrite Set to 'Y' if you want to allow the overwrite of RC channels via a shm/external app
+ * @param ext_seq_num Set to 1 to send 32 bit sequence numbers (header extension)
  * @return
  */
-void conf_rc(char adapters[DB_MAX_ADAPTERS][IFNAMSIZ], int num_inf_rc, int comm_id, char db_mode, int bitrate_op,
-            int frame_type, int new_rc_protocol, char allow_rc_overwrite, int adhere_80211) {
+void conf_rc(char adapters[DB_MAX_ADAPTERS][DB_MAX_IFNAME_LENGTH], int num_inf_rc, int comm_id, char db_mode, int bitrate_op,
+            int frame_type, int new_rc_protocol, char allow_rc_overwrite, int adhere_80211, int ext_seq_num) {
     rc_protocol = new_rc_protocol;
     en_rc_overwrite = allow_rc_overwrite == 'Y' ? true : false;
-    monitor_databuffer = get_hp_raw_buffer(adhere_80211);
     for (int i = 0; i < num_inf_rc; i++) {
         raw_interfaces_rc[i] = open_db_socket(adapters[i], comm_id, db_mode, bitrate_op, DB_DIREC_DRONE,
                                               DB_PORT_CONTROLLER, frame_type);
+        if (ext_seq_num)
+            db_enable_ext_seq_num(&raw_interfaces_rc[i]);
     }
+    // RC messages get generated into the send buffer of the first socket
+    monitor_databuffer = get_hp_raw_buffer(&raw_interfaces_rc[0], adhere_80211);
+    rc_adhere_80211 = adhere_80211;
     num_interfaces = num_inf_rc;
 }
 
@@ -275,42 +295,47 @@ void open_rc_shm() {
 int send_rc_packet(uint16_t channel_data[]) {
     if (en_rc_overwrite) {
         clock_gettime(CLOCK_MONOTONIC_COARSE, &timestamp);
+        db_shm_snapshot(&shm_rc_overwrite->header, &rc_overwrite, sizeof(db_rc_overwrite_values_t));
         // check if shm was updated min. 100ms ago
-        if (((timestamp.tv_sec - shm_rc_overwrite->timestamp.tv_sec) * (long) 1e9 + (timestamp.tv_nsec -
-                                                                                     shm_rc_overwrite->timestamp.tv_nsec))
+        if (((timestamp.tv_sec - rc_overwrite.timestamp.tv_sec) * (long) 1e9 + (timestamp.tv_nsec -
+                                                                                rc_overwrite.timestamp.tv_nsec))
             <= 100000000L) {
             for (i_rc = 0; i_rc < NUM_CHANNELS; i_rc++) {
-                if (shm_rc_overwrite->ch > 0)
-                    channel_data[i_rc] = shm_rc_overwrite->ch[i_rc];
+                if (rc_overwrite.ch[i_rc] > 0)
+                    channel_data[i_rc] = rc_overwrite.ch[i_rc];
             }
         }
     }
     // Update shared memory so status module or other apps can read RC channel values
+    db_shm_write_begin(&shm_rc_values->header);
     for (i_rc = 0; i_rc < NUM_CHANNELS; i_rc++) {
         shm_rc_values->ch[i_rc] = channel_data[i_rc];
     }
+    db_shm_write_end(&shm_rc_values->header);
 
     if (rc_protocol == 1) {
         generate_msp(channel_data);
         for (int i = 0; i < num_interfaces; i++) {
-            db_send_hp_div(&raw_interfaces_rc[i], DB_PORT_CONTROLLER, MSP_DATA_LENTH,
-                           update_seq_num(&rc_seq_number));
+            db_send_div(&raw_interfaces_rc[i], monitor_databuffer->bytes, DB_PORT_CONTROLLER, MSP_DATA_LENTH,
+                        update_seq_num(&rc_seq_number), rc_adhere_80211);
         }
     } else if (rc_protocol == 2) {
         generate_mspv2(channel_data);
         for (int i = 0; i < num_interfaces; i++) {
-            db_send_hp_div(&raw_interfaces_rc[i], DB_PORT_CONTROLLER, MSP_V2_DATA_LENGTH,
-                           update_seq_num(&rc_seq_number));
+            db_send_div(&raw_interfaces_rc[i], monitor_databuffer->bytes, DB_PORT_CONTROLLER, MSP_V2_DATA_LENGTH,
+                        update_seq_num(&rc_seq_number), rc_adhere_80211);
         }
     } else if (rc_protocol == 4) {
         for (int i = 0; i < num_interfaces; i++) {
-            db_send_hp_div(&raw_interfaces_rc[i], DB_PORT_CONTROLLER, generate_mavlinkv2_rc_overwrite(channel_data),
-                           update_seq_num(&rc_seq_number));
+            db_send_div(&raw_interfaces_rc[i], monitor_databuffer->bytes, DB_PORT_CONTROLLER,
+                        generate_mavlinkv2_rc_overwrite(channel_data), update_seq_num(&rc_seq_number),
+                        rc_adhere_80211);
         }
     } else if (rc_protocol == 5) {
         generate_db_rc_message(channel_data);
         for (int i = 0; i < num_interfaces; i++) {
-            db_send_hp_div(&raw_interfaces_rc[i], DB_PORT_RC, DB_RC_DATA_LENGTH, update_seq_num(&rc_seq_number));
+            db_send_div(&raw_interfaces_rc[i], monitor_databuffer->bytes, DB_PORT_RC, DB_RC_DATA_LENGTH,
+                        update_seq_num(&rc_seq_number), rc_adhere_80211);
         }
     }
     return 0;
@@ -319,6 +344,110 @@ int send_rc_packet(uint16_t channel_data[]) {
 void close_raw_interfaces() {
     for (int i = 0; i < DB_MAX_ADAPTERS; i++) {
         if (raw_interfaces_rc[i].db_socket != -1)
-            close(raw_interfaces_rc[i].db_socket);
+            close_db_socket(&raw_interfaces_rc[i]);
+    }
+}
+
+void on_rc_signal(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t signo) {
+    db_event_stop(loop);
+}
+
+/**
+ * Read all joystick events that occurred since the last call. Reopens the joystick once it was unplugged
+ */
+void on_joystick(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    struct js_event e;
+    while (read(joystick_fd, &e, sizeof(e)) > 0) {
+        e.type &= ~JS_EVENT_INIT; /* ignore synthetic events */
+        rc_radio->handle_event(&e);
+    }
+    int myerror = errno;
+    if (myerror == EAGAIN && !(events & (EPOLLHUP | EPOLLERR)))
+        return;
+    if (myerror == ENODEV || (events & (EPOLLHUP | EPOLLERR))) {
+        LOG_SYS_STD(LOG_WARNING, "DB_CONTROL_GND: Joystick was unplugged! Retrying...\n");
+        db_event_remove(loop, joystick_handler);
+        close(joystick_fd);
+        joystick_fd = -1;
+        db_event_timer_arm(joystick_retry_timer, 100000, 0);
+    } else {
+        LOG_SYS_STD(LOG_ERR, "DB_CONTROL_GND: Error: %s\n", strerror(myerror));
+    }
+}
+
+/**
+ * Try to open the joystick interface of the RC. Retries every 100ms until the RC is plugged in. No RC frames are sent
+ * in the meantime.
+ */
+void on_joystick_retry(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    char path_interface_joystick[CALI_COMM_SIZE];
+    get_joy_interface_path(path_interface_joystick, joystick_indx);
+    joystick_fd = open(path_interface_joystick, O_RDONLY | O_NONBLOCK);
+    if (joystick_fd < 0) {
+        db_event_timer_arm(joystick_retry_timer, 100000, 0);
+        return;
     }
+    LOG_SYS_STD(LOG_INFO, "DB_CONTROL_GND: Opened joystick interface!\n");
+    char calibrate_comm[CALI_COMM_SIZE];
+    strncpy(calibrate_comm, rc_radio->calibration, CALI_COMM_SIZE - 1);
+    calibrate_comm[CALI_COMM_SIZE - 1] = '\0';
+    do_calibration(calibrate_comm, joystick_indx);
+    joystick_handler = db_event_add_io(loop, joystick_fd, EPOLLIN, on_joystick, NULL);
+}
+
+void on_rc_frame(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    if (joystick_fd < 0)
+        return;
+    uint16_t joystick_data[NUM_CHANNELS];
+    rc_radio->get_channels(joystick_data);
+    send_rc_packet(joystick_data);
+}
+
+/**
+ * An external app updated the RC overwrite values. Send them right away instead of one frame later and start the next
+ * frame period from here.
+ */
+void on_rc_overwrite(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    db_shm_notify_ack(handler->fd);
+    on_rc_frame(loop, rc_frame_timer, 1);
+    db_event_timer_arm(rc_frame_timer, rc_frame_us, rc_frame_us);
+}
+
+/**
+ * Read the RC and send its channels until SIGINT/SIGTERM. With RC overwrite enabled a frame is also sent as soon as an
+ * external app updates the overwrite values.
+ *
+ * @param joy_interface_indx Joystick interface as specified by jscal interface index
+ * @param frame_time Time between two RC frames
+ * @param radio Radio specific event handling and channel mapping
+ */
+void run_rc(int joy_interface_indx, struct timespec frame_time, const rc_radio_t *radio) {
+    const int signals[] = {SIGINT, SIGTERM};
+    rc_radio = radio;
+    joystick_indx = joy_interface_indx;
+    rc_frame_us = (uint64_t) frame_time.tv_sec * 1000000 + (uint64_t) frame_time.tv_nsec / 1000;
+    if (db_event_loop_init(&rc_loop) < 0 || db_event_add_signals(&rc_loop, signals, 2, on_rc_signal, NULL) == NULL)
+        return;
+    rc_frame_timer = db_event_add_timer(&rc_loop, on_rc_frame, NULL);
+    joystick_retry_timer = db_event_add_timer(&rc_loop, on_joystick_retry, NULL);
+    if (rc_frame_timer == NULL || joystick_retry_timer == NULL)
+        return;
+    if (en_rc_overwrite) {
+        // after the signals got blocked: the notification thread must not receive them
+        int notify_fd = db_shm_notify_fd(&shm_rc_overwrite->header);
+        if (notify_fd >= 0)
+            db_event_add_io(&rc_loop, notify_fd, EPOLLIN, on_rc_overwrite, NULL);
+    }
+    LOG_SYS_STD(LOG_INFO, "DB_CONTROL_GND: Waiting for %s to be detected on joystick interface %i\n", radio->name,
+                joy_interface_indx);
+    on_joystick_retry(&rc_loop, joystick_retry_timer, 1);
+    db_event_timer_arm(rc_frame_timer, rc_frame_us, rc_frame_us);
+    LOG_SYS_STD(LOG_INFO, "DB_CONTROL_GND: Starting to send commands!\n");
+    db_event_run(&rc_loop);
+
+    db_event_report(&rc_loop, "DB_CONTROL_GND");
+    db_event_loop_close(&rc_loop);
+    if (joystick_fd >= 0)
+        close(joystick_fd);
+    close_raw_interfaces();
 }
@@ -20,19 +20,33 @@
 #ifndef CONTROL_TX_H
 #define CONTROL_TX_H
 
+#include <time.h>
+#include <linux/joystick.h>
 #include "../common/db_protocol.h"
 
+/**
+ * Radio specific part of the ground control module
+ */
+typedef struct {
+    const char *name;           // for log messages
+    const char *calibration;    // default jscal command. Used if no stored calibration can be restored
+    void (*handle_event)(struct js_event *e); // joystick event (JS_EVENT_INIT flag cleared)
+    void (*get_channels)(uint16_t channels[NUM_CHANNELS]); // channels of the next RC frame. Values 1000-2000
+} rc_radio_t;
+
 int send_rc_packet(uint16_t channel_data[]);
 
 void get_joy_interface_path(char *dst_joy_interface_path, int joy_interface_indx);
 
 void do_calibration(char *calibrate_comm, int joy_interface_indx);
 
-void conf_rc(char adapters[DB_MAX_ADAPTERS][IFNAMSIZ], int num_inf_rc, int comm_id, char db_mode, int bitrate_op,
-            int frame_type, int new_rc_protocol, char allow_rc_overwrite, int adhere_80211);
+void conf_rc(char adapters[DB_MAX_ADAPTERS][DB_MAX_IFNAME_LENGTH], int num_inf_rc, int comm_id, char db_mode, int bitrate_op,
+            int frame_type, int new_rc_protocol, char allow_rc_overwrite, int adhere_80211, int ext_seq_num);
 
 void open_rc_shm();
 
+void run_rc(int joy_interface_indx, struct timespec frame_time, const rc_radio_t *radio);
+
 void close_raw_interfaces();
 
 #endif //CONTROL_TX_H
@@ -0,0 +1,315 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * DroneBridge link daemon. Owns the only receiving raw socket per adapter and hands the received frames to the
+ * modules via shared memory rings (see common/db_link.c). Modules use it by opening "link:<interface>" instead of
+ * "<interface>". They still send directly on their own send-only sockets.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include "../common/db_protocol.h"
+#include "../common/db_raw_send_receive.h"
+#include "../common/db_raw_receive.h"
+#include "../common/db_link.h"
+#include "../common/db_common.h"
+#include "../common/db_event.h"
+
+#define LINK_RX_BATCH   64  // max frames read from one adapter before the clients get signaled
+
+typedef struct {
+    int control_fd;     // 0 = unused
+    db_event_handler_t *handler;
+    int event_fd;
+    bool pending;       // frames were pushed since the last signal
+    db_link_register_t reg;
+    db_link_ring_t *ring;
+} link_client_t;
+
+typedef struct {
+    char name[DB_MAX_IFNAME_LENGTH];
+    db_socket_t raw_socket;
+    int listen_fd;
+    struct sockaddr_un addr;
+    link_client_t clients[DB_LINK_MAX_CLIENTS];
+    uint64_t received, unrouted;
+} link_interface_t;
+
+db_event_loop_t event_loop;
+char adapters[DB_MAX_ADAPTERS][DB_MAX_IFNAME_LENGTH];
+int num_interfaces = 0;
+uint8_t comm_id = DEFAULT_V2_COMMID;
+uint8_t recv_direction = DB_DIREC_GROUND;
+link_interface_t interfaces[DB_MAX_ADAPTERS];
+
+void on_signal(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t signo) {
+    db_event_stop(loop);
+}
+
+void process_command_line_args(int argc, char *argv[]) {
+    int c;
+    opterr = 0;
+    while ((c = getopt(argc, argv, "n:c:a?")) != -1) {
+        switch (c) {
+            case 'n':
+                if (num_interfaces < DB_MAX_ADAPTERS) {
+                    strncpy(adapters[num_interfaces], optarg, DB_MAX_IFNAME_LENGTH - 1);
+                    num_interfaces++;
+                }
+                break;
+            case 'c':
+                comm_id = (uint8_t) strtol(optarg, NULL, 10);
+                break;
+            case 'a':
+                recv_direction = DB_DIREC_DRONE;
+                break;
+            case '?':
+                printf("DroneBridge link daemon. Owns one receiving raw socket per adapter and distributes the "
+                       "received frames to all modules that opened their sockets with \"link:<interface>\". Use"
+                       "\n\t-n <network_IF> Interface to receive on. Use multiple times for multiple adapters"
+                       "\n\t-c <communication id> Choose a number from 0-255. Same on ground station and drone!"
+                       "\n\t-a Run on the UAV (receive frames sent to the drone). Default: ground station\n");
+                exit(0);
+            default:
+                abort();
+        }
+    }
+}
+
+/**
+ * Create the ring and the eventfd for a new client and pass both to it
+ */
+void register_client(link_interface_t *interface, link_client_t *client) {
+    int8_t status = -1;
+    int fds[2] = {-1, -1};
+    if (recv(client->control_fd, &client->reg, sizeof(db_link_register_t), 0) != sizeof(db_link_register_t)) {
+        LOG_SYS_STD(LOG_WARNING, "DB_LINK: %s: Invalid registration\n", interface->name);
+        goto reply;
+    }
+    if (client->reg.comm_id != comm_id || client->reg.recv_direction != recv_direction) {
+        LOG_SYS_STD(LOG_WARNING, "DB_LINK: %s: Client wants comm id %i direction %i. Serving comm id %i direction "
+                                 "%i only\n", interface->name, client->reg.comm_id, client->reg.recv_direction,
+                    comm_id, recv_direction);
+        goto reply;
+    }
+    fds[0] = memfd_create("db_link_ring", MFD_CLOEXEC);
+    if (fds[0] < 0 || ftruncate(fds[0], sizeof(db_link_ring_t)) < 0)
+        goto reply;
+    client->ring = mmap(NULL, sizeof(db_link_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (client->ring == MAP_FAILED) {
+        client->ring = NULL;
+        goto reply;
+    }
+    if ((fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        goto reply;
+    client->event_fd = fds[1];
+    status = 0;
+    LOG_SYS_STD(LOG_INFO, "DB_LINK: %s: Client for port %i registered\n", interface->name, client->reg.port);
+
+    reply:;
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {.iov_base = &status, .iov_len = sizeof(status)};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    if (status == 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    }
+    if (sendmsg(client->control_fd, &msg, 0) < 0)
+        status = -1;
+    if (fds[0] >= 0) close(fds[0]);    // the ring stays mapped
+    if (status != 0) {
+        if (client->ring != NULL) munmap(client->ring, sizeof(db_link_ring_t));
+        if (fds[1] >= 0) close(fds[1]);
+        db_event_remove(&event_loop, client->handler);
+        close(client->control_fd);
+        memset(client, 0, sizeof(link_client_t));
+    }
+}
+
+void remove_client(link_interface_t *interface, link_client_t *client) {
+    LOG_SYS_STD(LOG_INFO, "DB_LINK: %s: Client for port %i left (%u frames dropped)\n", interface->name,
+                client->reg.port, client->ring ? client->ring->dropped : 0);
+    if (client->ring != NULL) munmap(client->ring, sizeof(db_link_ring_t));
+    if (client->event_fd > 0) close(client->event_fd);
+    db_event_remove(&event_loop, client->handler);
+    close(client->control_fd);
+    memset(client, 0, sizeof(link_client_t));
+}
+
+/**
+ * Registration message of a new client or a client that left. Clients send nothing after registering
+ */
+void on_client(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int index = (int) (intptr_t) handler->arg;
+    link_interface_t *interface = &interfaces[index / DB_LINK_MAX_CLIENTS];
+    link_client_t *client = &interface->clients[index % DB_LINK_MAX_CLIENTS];
+    if (client->ring == NULL)
+        register_client(interface, client);
+    else
+        remove_client(interface, client);
+}
+
+void on_accept(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int if_index = (int) (intptr_t) handler->arg;
+    link_interface_t *interface = &interfaces[if_index];
+    int new_fd = accept(interface->listen_fd, NULL, NULL);
+    if (new_fd < 0)
+        return;
+    for (int i = 0; i < DB_LINK_MAX_CLIENTS; i++) {
+        if (interface->clients[i].control_fd == 0) {
+            // registration message is read once the socket becomes readable
+            interface->clients[i].handler = db_event_add_io(loop, new_fd, EPOLLIN, on_client,
+                                                            (void *) (intptr_t) (if_index * DB_LINK_MAX_CLIENTS + i));
+            if (interface->clients[i].handler == NULL)
+                break;
+            interface->clients[i].control_fd = new_fd;
+            return;
+        }
+    }
+    LOG_SYS_STD(LOG_WARNING, "DB_LINK: %s: Too many clients\n", interface->name);
+    close(new_fd);
+}
+
+/**
+ * Read all pending frames of an adapter, sort them into the rings of the clients by port and signal the clients once
+ */
+void on_frames(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    link_interface_t *interface = &interfaces[(intptr_t) handler->arg];
+    uint8_t frame[DB_LINK_MAX_FRAME];
+    db_rx_timestamp_t timestamp;
+    for (int n = 0; n < LINK_RX_BATCH; n++) {
+        ssize_t length = db_recv_ts(interface->raw_socket.db_socket, frame, sizeof(frame), &timestamp);
+        if (length <= 0)
+            break;
+        interface->received++;
+        uint16_t radiotap_length = (uint16_t) (frame[2] | (frame[3] << 8));
+        if (length < radiotap_length + DB_RAW_V2_HEADER_LENGTH) {
+            interface->unrouted++;
+            continue;
+        }
+        struct db_raw_v2_header_t *db_header = (struct db_raw_v2_header_t *) (frame + radiotap_length);
+        bool routed = false;
+        for (int i = 0; i < DB_LINK_MAX_CLIENTS; i++) {
+            link_client_t *client = &interface->clients[i];
+            if (client->ring == NULL || client->reg.port != db_header->port)
+                continue;
+            routed = true;
+            if (db_link_ring_push(client->ring, frame, (uint16_t) length, timestamp.rx_time_us) == 0)
+                client->pending = true;
+        }
+        if (!routed) interface->unrouted++;
+    }
+    uint64_t one = 1;
+    for (int i = 0; i < DB_LINK_MAX_CLIENTS; i++) {
+        link_client_t *client = &interface->clients[i];
+        if (client->pending) {
+            client->pending = false;
+            if (write(client->event_fd, &one, sizeof(one)) < 0)
+                LOG_SYS_STD(LOG_ERR, "DB_LINK: %s: Could not signal client for port %i: %s\n", interface->name,
+                            client->reg.port, strerror(errno));
+        }
+    }
+}
+
+int open_interface(link_interface_t *interface, const char *if_name) {
+    memset(interface, 0, sizeof(link_interface_t));
+    strncpy(interface->name, if_name, DB_MAX_IFNAME_LENGTH - 1);
+    uint8_t send_direction = (uint8_t) ((recv_direction == DB_DIREC_DRONE) ? DB_DIREC_GROUND : DB_DIREC_DRONE);
+    interface->raw_socket = open_db_socket(interface->name, comm_id, 'm', 6, send_direction, DB_PORT_ANY,
+                                           DB_FRAMETYPE_DEFAULT);
+    if (interface->raw_socket.db_socket < 0)
+        return -1;
+    // clients get the arrival time at the daemon, not the time they got scheduled
+    db_enable_rx_timestamps(&interface->raw_socket);
+    set_socket_nonblocking(&interface->raw_socket.db_socket);
+    mkdir(DB_LINK_DIR, 0777);
+    interface->addr.sun_family = AF_UNIX;
+    db_link_socket_path(interface->name, interface->addr.sun_path, sizeof(interface->addr.sun_path));
+    unlink(interface->addr.sun_path);
+    if ((interface->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0 ||
+        bind(interface->listen_fd, (struct sockaddr *) &interface->addr, sizeof(struct sockaddr_un)) < 0 ||
+        listen(interface->listen_fd, DB_LINK_MAX_CLIENTS) < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_LINK: Could not create %s: %s\n", interface->addr.sun_path, strerror(errno));
+        return -1;
+    }
+    LOG_SYS_STD(LOG_NOTICE, "DB_LINK: Serving %s at %s\n", interface->name, interface->addr.sun_path);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const int signals[] = {SIGINT, SIGTERM};
+    signal(SIGPIPE, SIG_IGN);
+    process_command_line_args(argc, argv);
+    if (num_interfaces == 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_LINK: No interface specified (-n)\n");
+        exit(1);
+    }
+    if (db_event_loop_init(&event_loop) < 0 || db_event_add_signals(&event_loop, signals, 2, on_signal, NULL) == NULL)
+        exit(1);
+    for (int i = 0; i < num_interfaces; i++) {
+        if (open_interface(&interfaces[i], adapters[i]) < 0 ||
+            db_event_add_io(&event_loop, interfaces[i].raw_socket.db_socket, EPOLLIN, on_frames,
+                            (void *) (intptr_t) i) == NULL ||
+            db_event_add_io(&event_loop, interfaces[i].listen_fd, EPOLLIN, on_accept, (void *) (intptr_t) i) == NULL) {
+            LOG_SYS_STD(LOG_ERR, "DB_LINK: Could not open %s\n", adapters[i]);
+            exit(1);
+        }
+    }
+    LOG_SYS_STD(LOG_INFO, "DB_LINK: Started!\n");
+
+    db_event_run(&event_loop);
+
+    for (int i = 0; i < num_interfaces; i++) {
+        for (int j = 0; j < DB_LINK_MAX_CLIENTS; j++) {
+            if (interfaces[i].clients[j].control_fd > 0)
+                remove_client(&interfaces[i], &interfaces[i].clients[j]);
+        }
+        LOG_SYS_STD(LOG_INFO, "DB_LINK: %s: %llu frames received, %llu without client\n", interfaces[i].name,
+                    (unsigned long long) interfaces[i].received, (unsigned long long) interfaces[i].unrouted);
+        close(interfaces[i].listen_fd);
+        unlink(interfaces[i].addr.sun_path);
+        close(interfaces[i].raw_socket.db_socket);
+    }
+    db_event_report(&event_loop, "DB_LINK");
+    db_event_loop_close(&event_loop);
+    LOG_SYS_STD(LOG_INFO, "DB_LINK: Terminated!\n");
+    exit(0);
+}
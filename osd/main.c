@@ -119,40 +119,29 @@ int main(int argc, char *argv[]) {
     telemetry_data_t td;
     telemetry_init(&td);
     fprintf(stderr,"OSD: Sharedmem init done\n");
+    // becomes readable whenever the video module published new link statistics
+    int status_notify_fd = db_shm_notify_fd(&td.shm_rx_status->header);
 
     render_init();
 
     long long prev_time = current_timestamp();
     long long prev_time2 = current_timestamp();
 
-    long long prev_cpu_time = current_timestamp();
-    long long delta = 0;
-
-    int cpuload_gnd = 0;
-    int temp_gnd = 0;
-    int undervolt_gnd = 0;
-    FILE *fp;
-    FILE *fp2;
-    FILE *fp3;
-    long double a[4], b[4];
-
-    fp3 = fopen("/tmp/undervolt","r");
-    if(NULL == fp3) {
-        perror("OSD ERROR: Could not open /tmp/undervolt");
-        exit(EXIT_FAILURE);
-    }
-    fscanf(fp3,"%d",&undervolt_gnd);
-    fclose(fp3);
-
     while(1) {
 
         FD_ZERO(&set);
         FD_SET(readfd, &set);
+        if (status_notify_fd > 0) FD_SET(status_notify_fd, &set);
         timeout.tv_sec = 0;
         timeout.tv_usec = 50 * 1000;
         // look for data 50ms, then timeout
-        n = select(readfd + 1, &set, NULL, NULL, &timeout);
-        if(n > 0) { // if data there, read it and parse it
+        n = select((readfd > status_notify_fd ? readfd : status_notify_fd) + 1, &set, NULL, NULL, &timeout);
+        if (n > 0 && status_notify_fd > 0 && FD_ISSET(status_notify_fd, &set)) {
+            db_shm_notify_ack(status_notify_fd);
+            do_render = 1;  // show new link statistics right away
+            n--;
+        }
+        if(n > 0 && FD_ISSET(readfd, &set)) { // if data there, read it and parse it
             n = read(readfd, buf, sizeof(buf));
 //	        printf("OSD: %d bytes read\n",n);
             if(n == 0) { continue; } // EOF
@@ -176,31 +165,14 @@ int main(int argc, char *argv[]) {
         if ((do_render == 1) || (counter == 3)) {
             prev_time = current_timestamp();
             fpscount++;
-            render(&td, cpuload_gnd, temp_gnd/1000, undervolt_gnd,fps);
+            telemetry_update_status(&td);
+            // ground station metrics are sampled by the status module
+            render(&td, td.rx_status->sys.cpu_load, td.rx_status->sys.temp, td.rx_status->sys.undervolt, fps);
             long long took = current_timestamp() - prev_time;
             do_render = 0;
             counter = 0;
         }
 
-        delta = current_timestamp() - prev_cpu_time;
-        if (delta > 1000) {
-            prev_cpu_time = current_timestamp();
-
-            fp2 = fopen("/sys/class/thermal/thermal_zone0/temp","r");
-            fscanf(fp2,"%d",&temp_gnd);
-            fclose(fp2);
-
-            fp = fopen("/proc/stat","r");
-            fscanf(fp,"%*s %Lf %Lf %Lf %Lf",&a[0],&a[1],&a[2],&a[3]);
-            fclose(fp);
-
-            cpuload_gnd = (((b[0]+b[1]+b[2]) - (a[0]+a[1]+a[2])) / ((b[0]+b[1]+b[2]+b[3]) - (a[0]+a[1]+a[2]+a[3]))) * 100;
-
-            fp = fopen("/proc/stat","r");
-            fscanf(fp,"%*s %Lf %Lf %Lf %Lf",&b[0],&b[1],&b[2],&b[3]);
-            fclose(fp);
-        }
-
         long long fpscount_timer = current_timestamp() - fpscount_ts_last;
         if (fpscount_timer > 2000) {
             fpscount_ts_last = current_timestamp();
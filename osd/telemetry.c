@@ -66,11 +66,26 @@ void telemetry_init(telemetry_data_t *td) {
     td->ltm_home_latitude = 0;
 #endif
 
-    td->rx_status = db_gnd_status_memory_open();
+    td->shm_rx_status = db_gnd_status_memory_open();
+    td->rx_status = calloc(1, sizeof(db_gnd_status_t));
 
 #ifdef UPLINK_RSSI
-	td->rx_status_rc = db_rc_status_memory_open();
+	td->shm_rx_status_rc = db_rc_status_memory_open();
+	td->rx_status_rc = calloc(1, sizeof(db_rc_status_t));
 #endif
 
-	td->rx_status_sysair = db_uav_status_memory_open();
+	td->shm_rx_status_sysair = db_uav_status_memory_open();
+	td->rx_status_sysair = calloc(1, sizeof(db_uav_status_t));
+	telemetry_update_status(td);
+}
+
+/**
+ * Take consistent copies of the status segments so that one frame is rendered from one set of values
+ */
+void telemetry_update_status(telemetry_data_t *td) {
+    db_shm_snapshot(&td->shm_rx_status->header, td->rx_status, sizeof(db_gnd_status_t));
+#ifdef UPLINK_RSSI
+    db_shm_snapshot(&td->shm_rx_status_rc->header, td->rx_status_rc, sizeof(db_rc_status_t));
+#endif
+    db_shm_snapshot(&td->shm_rx_status_sysair->header, td->rx_status_sysair, sizeof(db_uav_status_t));
 }
@@ -71,11 +71,16 @@ typedef struct {
 #endif
 
 
+    // point to consistent copies of the shared memory segments. Refreshed by telemetry_update_status()
     db_gnd_status_t *rx_status;
     db_rc_status_t *rx_status_rc;
     db_uav_status_t *rx_status_sysair;
+    db_gnd_status_t *shm_rx_status;
+    db_rc_status_t *shm_rx_status_rc;
+    db_uav_status_t *shm_rx_status_sysair;
 } telemetry_data_t;
 
 void telemetry_init(telemetry_data_t *td);
+void telemetry_update_status(telemetry_data_t *td);
 
 
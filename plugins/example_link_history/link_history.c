@@ -0,0 +1,62 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <zconf.h>
+
+#ifdef USE_PI_INSTALL_PATH
+#include "/root/dronebridge/common/shared_memory.h"
+#else
+#include "../../common/shared_memory.h"
+#endif
+
+#define READ_CHUNK 256
+
+int main(int argc, char *argv[]) {
+    db_link_history_t *history = db_gnd_history_memory_open();
+    // start with the recorded history (-a) or only print what is recorded from now on
+    uint64_t cursor = (argc > 1 && strcmp(argv[1], "-a") == 0) ? 0 : history->head;
+    uint64_t missed = 0, missed_reported = 0;
+    db_history_sample_t samples[READ_CHUNK];
+
+    printf("timestamp_us,kbitrate,lost_packets");
+    for (int i = 0; i < 8; i++)
+        printf(",rssi_%i,good_%i,bad_%i", i, i, i);
+    printf("\n");
+    while (1) {
+        uint32_t cnt;
+        while ((cnt = db_history_read(history, &cursor, samples, READ_CHUNK, &missed)) > 0) {
+            for (uint32_t s = 0; s < cnt; s++) {
+                printf("%llu,%u,%u", (unsigned long long) samples[s].timestamp_us, samples[s].kbitrate,
+                       samples[s].lost_packets);
+                for (int i = 0; i < samples[s].adapter_cnt && i < 8; i++)
+                    printf(",%i,%u,%u", samples[s].adapter[i].rssi_dbm, samples[s].adapter[i].good_packets,
+                           samples[s].adapter[i].bad_packets);
+                printf("\n");
+            }
+        }
+        if (missed != missed_reported) {
+            fprintf(stderr, "Missed %llu samples\n", (unsigned long long) (missed - missed_reported));
+            missed_reported = missed;
+        }
+        fflush(stdout);
+        usleep(500000); // the ring holds 40 s at 10 ms resolution. No need to poll fast
+    }
+}
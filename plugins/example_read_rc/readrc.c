@@ -27,9 +27,19 @@
 #endif
 
 int main(int argc, char *argv[]) {
-    db_rc_values_t *rc_values = db_rc_values_memory_open();
+    db_rc_values_t *shm_rc_values = db_rc_values_memory_open();
+    db_rc_values_t rc_values;
+    uint32_t rc_values_seq = db_shm_seq(&shm_rc_values->header);
+    int last_ch1 = -1;
     while (1){
-        printf("CH1 %i\n", rc_values->ch[0]);
-        sleep(1);
+        // take a consistent copy. The control module might be updating the channels right now
+        db_shm_snapshot(&shm_rc_values->header, &rc_values, sizeof(db_rc_values_t));
+        if (rc_values.ch[0] != last_ch1) {
+            printf("CH1 %i\n", rc_values.ch[0]);
+            last_ch1 = rc_values.ch[0];
+        }
+        // wake up as soon as the control module wrote new values. Print at least once a second
+        if (db_shm_wait(&shm_rc_values->header, &rc_values_seq, 1000000) == 0)
+            last_ch1 = -1;
     }
 }
@@ -65,7 +65,10 @@ int main(int argc, char *argv[]) {
         return -1;
     }
     // open the shared memory where DB control module stores the channel values
-    db_rc_values_t *rc_values = db_rc_values_memory_open();
+    db_rc_values_t *shm_rc_values = db_rc_values_memory_open();
+    db_rc_values_t rc_values_copy;
+    db_rc_values_t *rc_values = &rc_values_copy;
+    uint32_t rc_values_seq = db_shm_seq(&shm_rc_values->header);
 
     // create a local storage array to keep a map of what the GPIOs currently are set (1=high, 0=low)
     int gpio_states[3] = {0, 0, 0};
@@ -74,6 +77,7 @@ int main(int argc, char *argv[]) {
     pinMode(GPIO_RC_CH_11, OUTPUT);
     pinMode(GPIO_RC_CH_12, OUTPUT);
     while (keep_running){
+        db_shm_snapshot(&shm_rc_values->header, rc_values, sizeof(db_rc_values_t));
         // check CH10 and set if it is not already set to HIGH
         if (rc_values->ch[9] >= 1500 && !gpio_states[0]){
             gpio_states[0] = 1;
@@ -101,6 +105,7 @@ int main(int argc, char *argv[]) {
             digitalWrite(GPIO_RC_CH_12, LOW);
         }
 
-        usleep(500000); // sleep for 0.5 seconds
+        // sleep until the control module wrote new channel values (or 0.5 seconds passed)
+        db_shm_wait(&shm_rc_values->header, &rc_values_seq, 500000);
     }
 }
\ No newline at end of file
@@ -37,6 +37,12 @@
 #include "../common/tcp_server.h"
 #include "../common/mavlink/c_library_v2/mavlink_types.h"
 #include "../common/db_common.h"
+#include "../common/db_seq.h"
+#include "../common/shared_memory.h"
+#include "../common/db_clock_sync.h"
+#include "../common/db_tel_fec.h"
+#include "../common/db_arq.h"
+#include "../common/db_event.h"
 
 #define TCP_BUFFER_SIZE (DATA_UNI_LENGTH-DB_RAW_V2_HEADER_LENGTH)
 #define MAX_TCP_CLIENTS 10
@@ -44,16 +50,34 @@
 #define DEFAULT_LOG_PATH "/DroneBridge/log/"
 #define MAX_PATH_LENGTH 1000
 
-bool volatile keeprunning = true;
 char db_mode, write_to_osdfifo;
 uint8_t comm_id = DEFAULT_V2_COMMID, frame_type;
-int bitrate_op, prox_adhere_80211, num_interfaces;
-char adapters[DB_MAX_ADAPTERS][IFNAMSIZ];
+int bitrate_op, prox_adhere_80211, num_interfaces, ext_seq_num, telem_fec_k, uplink_arq_enabled;
+char adapters[DB_MAX_ADAPTERS][DB_MAX_IFNAME_LENGTH];
 char log_path[MAX_PATH_LENGTH];
+db_arq_sender_t uplink_arq;
 uint8_t tel_msg_log_buff[MAVLINK_MAX_PACKET_LEN + sizeof(uint64_t)];
 
-void int_handler(int dummy) {
-    keeprunning = false;
+db_event_loop_t event_loop;
+db_event_handler_t *arq_timer, *stats_timer;
+db_socket_t raw_interfaces[DB_MAX_ADAPTERS] = {0};
+int tcp_clients[MAX_TCP_CLIENTS] = {0};
+db_event_handler_t *tcp_client_handlers[MAX_TCP_CLIENTS] = {0};
+bool tcp_clients_paused = false;
+struct tcp_server_info_t tcp_server_info;
+struct log_file_t log_file;
+int fifo_osd = -1;
+db_gnd_status_t *db_gnd_status;
+db_port_seq_t proxy_seq;
+db_port_seq_stats_t proxy_stats = {0};  // published to db_gnd_status DB_SHM_PUBLISH_INTERVAL_MS after a change
+bool proxy_stats_dirty = false;
+db_tel_fec_decoder_t telem_fec;
+uint8_t seq_num = 0;
+uint8_t lr_buffer[DATA_UNI_LENGTH];
+uint8_t tcp_buffer[TCP_BUFFER_SIZE];
+
+void on_signal(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t signo) {
+    db_event_stop(loop);
 }
 
 static inline uint64_t getSystemTimeUsecs()
@@ -70,14 +94,17 @@ void process_command_line_args(int argc, char *argv[]) {
     num_interfaces = 0;
     bitrate_op = 1;
     prox_adhere_80211 = 0;
+    ext_seq_num = 0;
+    telem_fec_k = 0;
+    uplink_arq_enabled = 0;
     frame_type = DB_FRAMETYPE_DEFAULT;
     strcpy(log_path, DEFAULT_LOG_PATH);
     int c;
-    while ((c = getopt(argc, argv, "n:m:c:b:o:f:a:l:?")) != -1) {
+    while ((c = getopt(argc, argv, "n:m:c:b:o:f:a:l:xF:A?")) != -1) {
         switch (c) {
             case 'n':
                 if (num_interfaces < DB_MAX_ADAPTERS) {
-                    strncpy(adapters[num_interfaces], optarg, IFNAMSIZ);
+                    strncpy(adapters[num_interfaces], optarg, DB_MAX_IFNAME_LENGTH - 1);
                     num_interfaces++;
                 }
                 break;
@@ -102,6 +129,15 @@ void process_command_line_args(int argc, char *argv[]) {
             case 'a':
                 prox_adhere_80211 = (int) strtol(optarg, NULL, 10);
                 break;
+            case 'x':
+                ext_seq_num = 1;
+                break;
+            case 'F':
+                telem_fec_k = (int) strtol(optarg, NULL, 10);
+                break;
+            case 'A':
+                uplink_arq_enabled = 1;
+                break;
             case '?':
                 LOG_SYS_STD(LOG_INFO,
                             "DroneBridge Proxy module is used to do any UDP <-> DB_CONTROL_AIR routing. UDP IP given by "
@@ -115,7 +151,12 @@ void process_command_line_args(int argc, char *argv[]) {
                             "\n\t-b bit rate:\tin Mbps (1|2|5|6|9|11|12|18|24|36|48|54)\n\t\t(bitrate option only "
                             "supported with Ralink chipsets)"
                             "\n\t-a [0|1] to disable/enable. Offsets the payload by some bytes so that it sits outside "
-                            "then 802.11 header. Set this to 1 if you are using a non DB-Rasp Kernel!");
+                            "then 802.11 header. Set this to 1 if you are using a non DB-Rasp Kernel!"
+                            "\n\t-x Send 32 bit sequence numbers (header extension) to the UAV"
+                            "\n\t-F <n> Telemetry downlink uses FEC with one parity packet per <n> packets. Same as "
+                            "on the UAV. 0 = off (default)"
+                            "\n\t-A Reliable uplink: data to the UAV gets acknowledged and is retransmitted if lost. "
+                            "Same as on the UAV");
                 break;
             default:
                 abort();
@@ -191,138 +232,190 @@ int open_osd_fifo() {
     return tempfifo_osd;
 }
 
+void on_stats_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    db_shm_publish(&db_gnd_status->header, &db_gnd_status->port_stats[DB_PORT_PROXY], &proxy_stats,
+                   sizeof(db_port_seq_stats_t));
+    if (telem_fec_k > 0)
+        db_shm_publish(&db_gnd_status->header, &db_gnd_status->telem_fec, &telem_fec.stats,
+                       sizeof(db_tel_fec_stats_t));
+    if (uplink_arq_enabled)
+        db_shm_publish(&db_gnd_status->header, &db_gnd_status->uplink_arq, &uplink_arq.stats,
+                       sizeof(db_arq_stats_t));
+    proxy_stats_dirty = false;
+}
+
+void mark_stats_dirty() {
+    if (proxy_stats_dirty) return;
+    proxy_stats_dirty = true;
+    db_event_timer_arm(stats_timer, DB_SHM_PUBLISH_INTERVAL_MS * 1000, 0);
+}
+
+/**
+ * Reliable uplink: send new frames & retransmissions, re-arm the retransmission timer and stop reading from the TCP
+ * clients while the window is full. Deferred until all events of the current wake up were processed
+ */
+void flush_uplink_arq(db_event_loop_t *loop, void *arg) {
+    const uint8_t *arq_frame;
+    uint16_t arq_frame_length;
+    uint64_t now = db_clock_us();
+    while (db_arq_next_frame(&uplink_arq, now, &arq_frame, &arq_frame_length)) {
+        uint8_t arq_seq_num = update_seq_num(&seq_num);
+        for (int j = 0; j < num_interfaces; j++)
+            db_send_div(&raw_interfaces[j], (uint8_t *) arq_frame, DB_PORT_CONTROLLER, arq_frame_length,
+                        arq_seq_num, prox_adhere_80211);
+    }
+    long arq_timeout = db_arq_timeout_us(&uplink_arq, db_clock_us());
+    db_event_timer_arm(arq_timer, arq_timeout < 0 ? 0 : (uint64_t) (arq_timeout > 0 ? arq_timeout : 1), 0);
+    bool window_full = db_arq_window_full(&uplink_arq);
+    if (window_full != tcp_clients_paused) {
+        tcp_clients_paused = window_full;
+        for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
+            if (tcp_clients[i] > 0)
+                db_event_modify_io(loop, tcp_client_handlers[i], window_full ? 0 : EPOLLIN);
+        }
+    }
+    mark_stats_dirty();
+}
+
+void on_arq_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    flush_uplink_arq(loop, NULL);
+}
+
+/**
+ * Incoming form long range proxy port - write data to OSD-FIFO and pass on to connected TCP clients
+ */
+void on_raw_proxy(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
+    uint8_t seq_num_proxy = 0;
+    uint16_t radiotap_length = 0;
+    ssize_t l = db_recv(raw_interfaces[i].db_socket, lr_buffer, DATA_UNI_LENGTH);
+    if (l <= 0) {
+        if (errno != EAGAIN)
+            LOG_SYS_STD(LOG_ERR, "DB_PROXY_GROUND: Long range socket received an error: %s\n", strerror(errno));
+        return;
+    }
+    size_t payload_length = get_db_payload(lr_buffer, l, tcp_buffer, &seq_num_proxy, &radiotap_length);
+    mark_stats_dirty();
+    if (!db_port_seq_track(&proxy_seq, i, lr_buffer, l))
+        return;     // diversity duplicate protection
+    const uint8_t *telem = tcp_buffer;
+    uint16_t telem_length = (uint16_t) payload_length;
+    if (uplink_arq_enabled && db_arq_process_ack(&uplink_arq, telem, telem_length, db_clock_us()) >= 0) {
+        db_event_defer(loop, flush_uplink_arq, NULL);
+        telem += sizeof(db_arq_ack_header_t);
+        telem_length -= sizeof(db_arq_ack_header_t);
+        if (telem_length == 0) return;    // ack only
+    }
+    if (telem_fec_k > 0 && db_tel_fec_decode(&telem_fec, telem, telem_length, &telem, &telem_length) != 1)
+        return;   // parity packet, already rebuilt or invalid
+    log_telem_to_file(log_file.file_pntr, (uint8_t *) telem, telem_length);
+    send_to_all_tcp_clients(tcp_clients, telem, telem_length);
+    if (fifo_osd != -1 && write_to_osdfifo == 'Y') {
+        ssize_t written = write(fifo_osd, telem, telem_length);
+        if (written < 1)
+            perror("DB_PROXY_GROUND: Could not write to OSD FIFO");
+    }
+}
+
+/**
+ * Message from a connected GCS. Goes to the UAV
+ */
+void on_tcp_client(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
+    int tcp_addrlen = sizeof(tcp_server_info.servaddr);
+    if (uplink_arq_enabled && db_arq_window_full(&uplink_arq))
+        return;   // read once acks freed up the window
+    ssize_t recv_length = read(tcp_clients[i], tcp_buffer, uplink_arq_enabled ? DB_ARQ_MAX_PAYLOAD : TCP_BUFFER_SIZE);
+    if (recv_length <= 0) {
+        //Somebody disconnected , get his details and print
+        getpeername(tcp_clients[i], (struct sockaddr *) &tcp_server_info.servaddr, (socklen_t *) &tcp_addrlen);
+        LOG_SYS_STD(LOG_INFO, "DB_PROXY_GROUND: Client disconnected (%s:%d)\n",
+                    inet_ntoa(tcp_server_info.servaddr.sin_addr), ntohs(tcp_server_info.servaddr.sin_port));
+        db_event_remove(loop, handler);
+        close(tcp_clients[i]);
+        tcp_clients[i] = 0;
+    } else if (uplink_arq_enabled) {
+        db_arq_queue(&uplink_arq, tcp_buffer, (uint16_t) recv_length);
+        db_event_defer(loop, flush_uplink_arq, NULL);
+    } else {
+        // client sent us some information. Process it...
+        uint8_t uplink_seq_num = update_seq_num(&seq_num);
+        for (int j = 0; j < num_interfaces; j++)
+            db_send_div(&raw_interfaces[j], tcp_buffer, DB_PORT_CONTROLLER, (u_int16_t) recv_length,
+                        uplink_seq_num, prox_adhere_80211);
+    }
+}
+
+/**
+ * Incoming tcp connection request on master TCP socket
+ */
+void on_tcp_connect(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int new_tcp_client;
+    int tcp_addrlen = sizeof(tcp_server_info.servaddr);
+    if ((new_tcp_client = accept(tcp_server_info.sock_fd, (struct sockaddr *) &tcp_server_info.servaddr,
+                                 (socklen_t *) &tcp_addrlen)) < 0) {
+        perror("DB_PROXY_GROUND: Accepting new tcp connection failed");
+        return;
+    }
+    LOG_SYS_STD(LOG_INFO, "DB_PROXY_GROUND: New connection (%s:%d)\n", inet_ntoa(tcp_server_info.servaddr.sin_addr),
+                ntohs(tcp_server_info.servaddr.sin_port));
+    //add new socket to array of sockets
+    for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
+        if (tcp_clients[i] == 0) {   // if position is empty
+            tcp_client_handlers[i] = db_event_add_io(loop, new_tcp_client, tcp_clients_paused ? 0 : EPOLLIN,
+                                                     on_tcp_client, (void *) (intptr_t) i);
+            if (tcp_client_handlers[i] == NULL)
+                break;
+            tcp_clients[i] = new_tcp_client;
+            return;
+        }
+    }
+    close(new_tcp_client);
+}
+
 int main(int argc, char *argv[]) {
-    signal(SIGINT, int_handler);
-    signal(SIGTERM, int_handler);
+    const int signals[] = {SIGINT, SIGTERM};
     signal(SIGPIPE, SIG_IGN);
     usleep((__useconds_t) 1e6);
     process_command_line_args(argc, argv);
+    if (db_event_loop_init(&event_loop) < 0 || db_event_add_signals(&event_loop, signals, 2, on_signal, NULL) == NULL)
+        exit(-1);
+    arq_timer = db_event_add_timer(&event_loop, on_arq_timer, NULL);
+    stats_timer = db_event_add_timer(&event_loop, on_stats_timer, NULL);
+    if (arq_timer == NULL || stats_timer == NULL)
+        exit(-1);
 
     // set up long range sockets
-    db_socket_t raw_interfaces[DB_MAX_ADAPTERS] = {0};
     for (int i = 0; i < num_interfaces; ++i) {
         raw_interfaces[i] = open_db_socket(adapters[i], comm_id, db_mode, bitrate_op, DB_DIREC_DRONE, DB_PORT_PROXY,
                                            frame_type);
+        if (ext_seq_num)
+            db_enable_ext_seq_num(&raw_interfaces[i]);
+        db_event_add_io(&event_loop, raw_interfaces[i].db_socket, EPOLLIN, on_raw_proxy, (void *) (intptr_t) i);
     }
-    int fifo_osd = -1, new_tcp_client;
-    int tcp_clients[MAX_TCP_CLIENTS] = {0};
+    db_gnd_status = db_gnd_status_memory_open();
+    db_port_seq_init(&proxy_seq, &proxy_stats);
+    db_tel_fec_decoder_init(&telem_fec);
+    db_arq_sender_init(&uplink_arq);
     if (write_to_osdfifo == 'Y') {
         fifo_osd = open_osd_fifo();
     }
 
-    // init variables
-    uint16_t radiotap_length = 0;
-    fd_set fd_socket_set;
-    struct timeval select_timeout;
-    size_t recv_length = 0;
-
     // Setup TCP server for GCS communication
-    struct tcp_server_info_t tcp_server_info = create_tcp_server_socket(APP_PORT_PROXY);
-    int tcp_addrlen = sizeof(tcp_server_info.servaddr);
+    tcp_server_info = create_tcp_server_socket(APP_PORT_PROXY);
+    db_event_add_io(&event_loop, tcp_server_info.sock_fd, EPOLLIN, on_tcp_connect, NULL);
 
     // open log file for messages incoming from long range link
-    struct log_file_t log_file = open_telemetry_log_file();
-
-    struct data_uni *data_uni_to_drone = get_hp_raw_buffer(prox_adhere_80211);
-    uint8_t seq_num = 0, seq_num_proxy = 0, last_recv_seq_num = 0;
-    uint8_t lr_buffer[DATA_UNI_LENGTH];
-    uint8_t tcp_buffer[TCP_BUFFER_SIZE];
-    size_t payload_length = 0;
+    log_file = open_telemetry_log_file();
 
     LOG_SYS_STD(LOG_INFO, "DB_PROXY_GROUND: started! Enabled diversity on %i adapters.\n", num_interfaces);
-    while (keeprunning) {
-        select_timeout.tv_sec = 5;
-        select_timeout.tv_usec = 0;
-        FD_ZERO (&fd_socket_set);
-        FD_SET (tcp_server_info.sock_fd, &fd_socket_set);
-        int max_sd = tcp_server_info.sock_fd;
-        // add raw DroneBridge sockets
-        for (int i = 0; i < num_interfaces; i++) {
-            FD_SET (raw_interfaces[i].db_socket, &fd_socket_set);
-            if (raw_interfaces[i].db_socket > max_sd)
-                max_sd = raw_interfaces[i].db_socket;
-        }
-        // add child sockets (tcp connection sockets) to set
-        for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-            int tcp_client_sd = tcp_clients[i];
-            if (tcp_client_sd > 0) {
-                FD_SET(tcp_client_sd, &fd_socket_set);
-                if (tcp_client_sd > max_sd)
-                    max_sd = tcp_client_sd;
-            }
-        }
+    db_event_run(&event_loop);
 
-        int select_return = select(max_sd + 1, &fd_socket_set, NULL, NULL, &select_timeout);
-        if (select_return == -1) {
-            perror("DB_PROXY_GROUND: select() returned error: ");
-        } else if (select_return > 0) {
-            for (int i = 0; i < num_interfaces; i++) {
-                if (FD_ISSET(raw_interfaces[i].db_socket, &fd_socket_set)) {
-                    // ---------------
-                    // incoming form long range proxy port - write data to OSD-FIFO and pass on to connected TCP clients
-                    // ---------------
-                    ssize_t l = recv(raw_interfaces[i].db_socket, lr_buffer, DATA_UNI_LENGTH, 0);
-                    int err = errno;
-                    if (l > 0) {
-                        payload_length = get_db_payload(lr_buffer, l, tcp_buffer, &seq_num_proxy, &radiotap_length);
-                        if (seq_num_proxy != last_recv_seq_num) {
-                            last_recv_seq_num = seq_num_proxy;
-                            log_telem_to_file(log_file.file_pntr, tcp_buffer, payload_length);
-                            send_to_all_tcp_clients(tcp_clients, tcp_buffer, payload_length);
-                            if (fifo_osd != -1 && write_to_osdfifo == 'Y') {
-                                ssize_t written = write(fifo_osd, tcp_buffer, payload_length);
-                                if (written < 1)
-                                    perror("DB_PROXY_GROUND: Could not write to OSD FIFO");
-                            }
-                        }
-                    } else
-                        LOG_SYS_STD(LOG_ERR, "DB_PROXY_GROUND: Long range socket received an error: %s\n", strerror(err));
-                }
-            }
-            // handle incoming tcp connection requests on master TCP socket
-            if (FD_ISSET(tcp_server_info.sock_fd, &fd_socket_set)) {
-                if ((new_tcp_client = accept(tcp_server_info.sock_fd,
-                                             (struct sockaddr *) &tcp_server_info.servaddr,
-                                             (socklen_t *) &tcp_addrlen)) < 0) {
-                    perror("DB_PROXY_GROUND: Accepting new tcp connection failed");
-                }
-                LOG_SYS_STD(LOG_INFO, "DB_PROXY_GROUND: New connection (%s:%d)\n", inet_ntoa(tcp_server_info.servaddr.sin_addr),
-                       ntohs(tcp_server_info.servaddr.sin_port));
-                //add new socket to array of sockets
-                for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-                    if (tcp_clients[i] == 0) {   // if position is empty
-                        tcp_clients[i] = new_tcp_client;
-                        break;
-                    }
-                }
-            }
-            // handle messages from connected TCP clients
-            for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-                int current_client_sock = tcp_clients[i];
-                if (FD_ISSET(current_client_sock, &fd_socket_set)) {
-                    if ((recv_length = read(current_client_sock, tcp_buffer, TCP_BUFFER_SIZE)) == 0) {
-                        //Somebody disconnected , get his details and print
-                        getpeername(current_client_sock, (struct sockaddr *) &tcp_server_info.servaddr,
-                                    (socklen_t *) &tcp_addrlen);
-                        LOG_SYS_STD(LOG_INFO, "DB_PROXY_GROUND: Client disconnected (%s:%d)\n",
-                               inet_ntoa(tcp_server_info.servaddr.sin_addr),
-                               ntohs(tcp_server_info.servaddr.sin_port));
-                        close(current_client_sock);
-                        tcp_clients[i] = 0;
-                    } else {
-                        // client sent us some information. Process it...
-                        memcpy(data_uni_to_drone->bytes, tcp_buffer, recv_length);
-                        for (int j = 0; j < num_interfaces; j++)
-                            db_send_hp_div(&raw_interfaces[j], DB_PORT_CONTROLLER, (u_int16_t) recv_length,
-                                           update_seq_num(&seq_num));
-                    }
-                }
-            }
-        }
-    }
+    db_event_report(&event_loop, "DB_PROXY_GROUND");
+    db_event_loop_close(&event_loop);
     for (int i = 0; i < DB_MAX_ADAPTERS; i++) {
         if (raw_interfaces[i].db_socket > 0)
-            close(raw_interfaces[i].db_socket);
+            close_db_socket(&raw_interfaces[i]);
     }
     for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
         if (tcp_clients[i] > 0)
@@ -342,4 +435,4 @@ int main(int argc, char *argv[]) {
     }
     LOG_SYS_STD(LOG_INFO, "DB_PROXY_GROUND: Terminated\n");
     exit(0);
-}
\ No newline at end of file
+}
@@ -18,6 +18,8 @@ UAV = 'AIR'
 GND_STRING_TAG = 'DroneBridge GND: '
 UAV_STRING_TAG = 'DroneBridge UAV: '
 DRONEBRIDGE_BIN_PATH = os.path.join(os.sep, "home", "pi", "DroneBridge")
+DB_LINK_DIR = os.path.join(os.sep, "tmp", "db_link")  # see DB_LINK_DIR in common/db_link.h
+DB_LINK_PREFIX = "link:"
 
 
 def parse_arguments():
@@ -42,6 +44,9 @@ def start_gnd_modules():
     video_fecs = config.getint(COMMON, 'video_fecs')
     video_blocklength = config.getint(COMMON, 'video_blocklength')
     compatibility_mode = config.getint(COMMON, 'compatibility_mode')
+    link_daemon = config.get(COMMON, 'link_daemon', fallback='N')
+    telemetry_fec = config.getint(COMMON, 'telemetry_fec', fallback=0)
+    uplink_arq = config.get(COMMON, 'uplink_arq', fallback='N')
     datarate = config.getint(GROUND, 'datarate')
     interface_selection = config.get(GROUND, 'interface_selection')
     interface_control = config.get(GROUND, 'interface_control')
@@ -57,6 +62,9 @@ def start_gnd_modules():
     joy_interface = config.getint(GROUND, 'joy_interface')
     fwd_stream = config.get(GROUND, 'fwd_stream')
     fwd_stream_port = config.getint(GROUND, 'fwd_stream_port')
+    rt_profile_control = config.get(GROUND, 'rt_profile_control', fallback='')
+    rt_profile_video = config.get(GROUND, 'rt_profile_video', fallback='')
+    link_history_ms = config.getint(GROUND, 'link_history_ms', fallback=0)
 
     # ---------- pre-init ------------------------
     print(GND_STRING_TAG + "Communication ID: " + str(communication_id))
@@ -68,6 +76,16 @@ def start_gnd_modules():
         interface_comm = interface_control
         interface_proxy = interface_control
     frametype = determine_frametype(cts_protection, get_interface())  # TODO: scan for WiFi traffic on all interfaces
+    if link_daemon == 'Y':
+        module_interfaces = [interface_proxy]
+        if en_control == 'Y':
+            module_interfaces.append(interface_control)
+        if en_video == 'Y':
+            module_interfaces.append(interface_video)
+        if start_link_daemon(module_interfaces, communication_id, False, GND_STRING_TAG):
+            interface_control = via_link_daemon(interface_control)
+            interface_video = via_link_daemon(interface_video)
+            interface_proxy = via_link_daemon(interface_proxy)
 
     # ----------- start modules ------------------------
     if en_comm == 'Y':
@@ -85,6 +103,10 @@ def start_gnd_modules():
     print(f"{GND_STRING_TAG} Starting proxy module...")
     comm_proxy = [os.path.join(DRONEBRIDGE_BIN_PATH, 'proxy', 'db_proxy'), "-m", "m", "-c", str(communication_id),
                   "-f", str(frametype), "-b", str(get_bit_rate(datarate)), "-a", str(compatibility_mode)]
+    if telemetry_fec > 0:
+        comm_proxy.extend(["-F", str(telemetry_fec)])
+    if uplink_arq == 'Y':
+        comm_proxy.append("-A")
     comm_proxy.extend(interface_proxy.split())
     proxy_module_process = Popen(comm_proxy, shell=False, stdin=None, stdout=None, stderr=None)
 
@@ -94,6 +116,8 @@ def start_gnd_modules():
                         str(joy_interface), "-m", "m", "-v", str(rc_proto), "-o", str(en_rc_overwrite), "-c",
                         str(communication_id), "-t", str(frametype), "-b", str(get_bit_rate(datarate)), "-a",
                         str(compatibility_mode)]
+        if rt_profile_control:
+            comm_control.extend(["-P", rt_profile_control])
         comm_control.extend(interface_control.split())
         control_module_process = Popen(comm_control, shell=False, stdin=None, stdout=None, stderr=None, close_fds=True)
 
@@ -111,6 +135,10 @@ def start_gnd_modules():
         receive_comm = [os.path.join(DRONEBRIDGE_BIN_PATH, 'video', 'video_gnd'), "-d", str(video_blocks),
                         "-r", str(video_fecs), "-f", str(video_blocklength), "-c", str(communication_id), "-p", "N",
                         "-v", str(fwd_stream_port), "-o"]
+        if rt_profile_video:
+            receive_comm.extend(["-P", rt_profile_video])
+        if link_history_ms > 0:
+            receive_comm.extend(["-H", str(link_history_ms)])
         receive_comm.extend(interface_video.split())
         db_video_receive_process = Popen(receive_comm, stdout=subprocess.PIPE, close_fds=True, shell=False, bufsize=0)
         print(f"{GND_STRING_TAG} Starting video player...")
@@ -127,6 +155,9 @@ def start_uav_modules():
     communication_id = config.getint(COMMON, 'communication_id')
     cts_protection = config.get(COMMON, 'cts_protection')
     compatibility_mode = config.getint(COMMON, 'compatibility_mode')
+    link_daemon = config.get(COMMON, 'link_daemon', fallback='N')
+    telemetry_fec = config.getint(COMMON, 'telemetry_fec', fallback=0)
+    uplink_arq = config.get(COMMON, 'uplink_arq', fallback='N')
     datarate = config.getint(UAV, 'datarate')
     interface_selection = config.get(UAV, 'interface_selection')
     interface_control = config.get(UAV, 'interface_control')
@@ -152,8 +183,15 @@ def start_uav_modules():
     baud_control = config.getint(UAV, 'baud_control')
     serial_prot = config.getint(UAV, 'serial_prot')
     pass_through_packet_size = config.getint(UAV, 'pass_through_packet_size')
+    telemetry_mtu = config.getint(UAV, 'telemetry_mtu', fallback=1024)
+    telemetry_deadline_ms = config.getint(UAV, 'telemetry_deadline_ms', fallback=20)
+    mavlink_budget_kbit = config.getint(UAV, 'mavlink_budget_kbit', fallback=0)
+    mavlink_rate_caps = config.get(UAV, 'mavlink_rate_caps', fallback='')
+    mavlink_endpoints = config.get(UAV, 'mavlink_endpoints', fallback='')
     enable_sumd_rc = config.get(UAV, 'enable_sumd_rc')
     serial_int_sumd = config.get(UAV, 'serial_int_sumd')
+    rt_profile_control = config.get(UAV, 'rt_profile_control', fallback='')
+    rt_profile_video = config.get(UAV, 'rt_profile_video', fallback='')
 
     # ---------- pre-init ------------------------
     if interface_selection == 'auto':
@@ -179,6 +217,15 @@ def start_uav_modules():
         enable_sumd_rc = 'N'
     print(f"{UAV_STRING_TAG} Communication ID: {communication_id}")
     print(f"{UAV_STRING_TAG} Trying to start individual modules...")
+    if link_daemon == 'Y':
+        module_interfaces = []
+        if en_control == 'Y':
+            module_interfaces.append(interface_control)
+        if en_video == 'Y':
+            module_interfaces.append(interface_video)
+        if start_link_daemon(module_interfaces, communication_id, True, UAV_STRING_TAG):
+            interface_control = via_link_daemon(interface_control)
+            interface_video = via_link_daemon(interface_video)
 
     # ----------- start modules ------------------------
     if en_comm == 'Y':
@@ -193,7 +240,20 @@ def start_uav_modules():
         comm = [os.path.join(DRONEBRIDGE_BIN_PATH, 'control', 'control_air'), "-u", str(serial_int_cont), "-m", "m",
                 "-c", str(communication_id), "-v", str(serial_prot), "-t", str(frametype), "-l",
                 str(pass_through_packet_size), "-r", str(baud_control), "-e", str(enable_sumd_rc), "-s",
-                str(serial_int_sumd), "-b", str(get_bit_rate(2))]
+                str(serial_int_sumd), "-b", str(get_bit_rate(2)), "-M", str(telemetry_mtu), "-D",
+                str(telemetry_deadline_ms)]
+        if telemetry_fec > 0:
+            comm.extend(["-F", str(telemetry_fec)])
+        if uplink_arq == 'Y':
+            comm.append("-A")
+        if rt_profile_control:
+            comm.extend(["-P", rt_profile_control])
+        if mavlink_budget_kbit > 0:
+            comm.extend(["-B", str(mavlink_budget_kbit)])
+        if mavlink_rate_caps:
+            comm.extend(["-R", mavlink_rate_caps])
+        for endpoint in mavlink_endpoints.split():
+            comm.extend(["-E", endpoint])
         comm.extend(interface_control.split())
         control_module_process = Popen(comm, shell=False, stdin=None, stdout=None, stderr=None)
 
@@ -217,6 +277,8 @@ def start_uav_modules():
         video_air_comm = [os.path.join(DRONEBRIDGE_BIN_PATH, 'video', 'video_air'), "-d", str(video_blocks), "-r",
                           str(video_fecs), "-f", str(video_blocklength), "-t", str(frametype),
                           "-b", str(get_bit_rate(datarate)), "-c", str(communication_id), "-a", str(compatibility_mode)]
+        if rt_profile_video:
+            video_air_comm.extend(["-P", rt_profile_video])
         video_air_comm.extend(interface_video.split())
         video_air_process = Popen(video_air_comm, stdin=raspivid_task.stdout, stdout=None, stderr=None, close_fds=True,
                                   shell=False)
@@ -291,6 +353,51 @@ def get_all_monitor_interfaces(formatted=False):
         return formated_str[1:]
 
 
+def start_link_daemon(module_interfaces: list, communication_id: int, on_uav: bool, tag: str):
+    """
+    Start the link daemon (db_link) on all interfaces used by the modules and wait until it serves them
+
+    :param module_interfaces: Interface arguments of the modules (e.g. "-n wlan1 -n wlan2")
+    :param communication_id: The communication ID
+    :param on_uav: Receive the frames sent to the UAV
+    :param tag: Prefix of the log messages
+    :return: True if the daemon serves all interfaces
+    """
+    link_interfaces = []
+    for interface_args in module_interfaces:
+        args = interface_args.split()
+        for i in range(len(args) - 1):
+            if args[i] == "-n" and args[i + 1] not in link_interfaces:
+                link_interfaces.append(args[i + 1])
+    if len(link_interfaces) == 0:
+        return False
+    print(f"{tag} Starting link daemon on {link_interfaces}...")
+    link_comm = [os.path.join(DRONEBRIDGE_BIN_PATH, 'link', 'db_link'), "-c", str(communication_id)]
+    if on_uav:
+        link_comm.append("-a")
+    for link_interface in link_interfaces:
+        link_comm.extend(["-n", link_interface])
+    Popen(link_comm, shell=False, stdin=None, stdout=None, stderr=None, close_fds=True)
+    for _ in range(50):
+        if all(os.path.exists(os.path.join(DB_LINK_DIR, name)) for name in link_interfaces):
+            return True
+        time.sleep(0.1)
+    print(f"{tag} Link daemon did not come up. Modules open their own sockets")
+    return False
+
+
+def via_link_daemon(interface_args: str) -> str:
+    """
+    :param interface_args: Interface arguments of a module (e.g. "-n wlan1 -n wlan2")
+    :return: Same arguments with every interface received via the link daemon (e.g. "-n link:wlan1 -n link:wlan2")
+    """
+    args = interface_args.split()
+    for i in range(1, len(args)):
+        if args[i - 1] == "-n":
+            args[i] = DB_LINK_PREFIX + args[i]
+    return " ".join(args)
+
+
 def measure_available_bandwidth(video_data_packets, video_fecs_packets, packet_size, video_frametype, datarate,
                                 interface_video, sleep_time=0.025) -> float:
     """
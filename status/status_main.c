@@ -27,9 +27,7 @@
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <signal.h>
-#include <stdbool.h>
 #include <memory.h>
-#include <sys/time.h>
 #include <errno.h>
 #include "../common/db_protocol.h"
 #include "../common/db_raw_receive.h"
@@ -37,18 +35,40 @@
 #include "../common/tcp_server.h"
 #include "../common/db_raw_send_receive.h"
 #include "../common/db_common.h"
+#include "../common/db_seq.h"
+#include "../common/db_clock_sync.h"
+#include "../common/db_metrics.h"
+#include "../common/db_event.h"
 
 #define NET_BUFF_SIZE 2048
 #define MAX_TCP_CLIENTS 10
 
-bool volatile keeprunning = true;
 int num_inf_status = 0;
 char db_mode;
 uint8_t comm_id = DEFAULT_V2_COMMID;
-char adapters[DB_MAX_ADAPTERS][IFNAMSIZ];
+char adapters[DB_MAX_ADAPTERS][DB_MAX_IFNAME_LENGTH];
 
-void int_handler(int dummy) {
-    keeprunning = false;
+db_event_loop_t event_loop;
+int restarts = 0;
+int tcp_clients[MAX_TCP_CLIENTS] = {0};
+struct tcp_server_info_t status_tcp_server_info;
+uint8_t lr_buffer[DATA_UNI_LENGTH];
+uint8_t message_buff[DATA_UNI_LENGTH - DB_RAW_V2_HEADER_LENGTH];
+uint8_t tcp_message_buff[NET_BUFF_SIZE];
+db_socket_t raw_interfaces_status[DB_MAX_ADAPTERS];
+db_rc_msg_t db_rc_status_message;
+db_system_status_msg_t db_sys_status_message;
+db_rc_status_t *rc_status;
+db_rc_values_t *rc_values;
+db_rc_overwrite_values_t *rc_overwrite_values;
+db_gnd_status_t *gnd_status_shm;
+db_uav_status_t *db_uav_status;
+db_port_seq_t status_seq;
+db_port_seq_stats_t status_stats = {0};  // published with every status message
+db_metrics_t sys_metrics;   // ground station CPU load, temperature & under-voltage for OSD and GCS
+
+void on_signal(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t signo) {
+    db_event_stop(loop);
 }
 
 int process_command_line_args(int argc, char *argv[]) {
@@ -59,7 +79,7 @@ int process_command_line_args(int argc, char *argv[]) {
         switch (c) {
             case 'n':
                 if (num_inf_status < DB_MAX_ADAPTERS) {
-                    strncpy(adapters[num_inf_status], optarg, IFNAMSIZ);
+                    strncpy(adapters[num_inf_status], optarg, DB_MAX_IFNAME_LENGTH - 1);
                     num_inf_status++;
                 }
                 break;
@@ -83,28 +103,146 @@ int process_command_line_args(int argc, char *argv[]) {
     return 0;
 }
 
-int main(int argc, char *argv[]) {
-    signal(SIGINT, int_handler);
-    signal(SIGTERM, int_handler);
-    struct timespec timestamp;
-    int restarts = 0, cardcounter = 0, select_return, max_sd, new_tcp_client, prev_seq_num_status = 0;
-    struct timeval timecheck;
-    long start, rightnow, status_message_update_rate = 100; // send status messages every 100ms (10Hz)
-    int8_t best_dbm = 0;
-    ssize_t l;
+/**
+ * Status message from long range link (UAV)
+ */
+void on_raw_status(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
     uint8_t seq_num_status = 0;
     uint16_t radiotap_length;
-    uint8_t lr_buffer[DATA_UNI_LENGTH];
+    ssize_t l = db_recv(raw_interfaces_status[i].db_socket, lr_buffer, DATA_UNI_LENGTH);
+    if (l <= 0)
+        return;
+    get_db_payload(lr_buffer, l, message_buff, &seq_num_status, &radiotap_length);
+    if (message_buff[0] == '$' && message_buff[1] == 'D')
+        return; // DroneBridge protocol message (e.g. clock sync response for video module)
+    if (db_port_seq_track(&status_seq, i, lr_buffer, l)) {  // diversity duplicate protection
+        // process payload (currently only one type of raw status frame is supported: RC_AIR --> STATUS_GROUND)
+        // must be a uav_rc_status_update_message_t
+        struct uav_rc_status_update_message_t *rc_status_message = (struct uav_rc_status_update_message_t *) message_buff;
+        db_sys_status_message.rssi_drone = rc_status_message->rssi_rc_uav;
+        db_sys_status_message.recv_pack_sec = rc_status_message->recv_pack_sec;
+        db_shm_write_begin(&rc_status->header);
+        rc_status->adapter[0].current_signal_dbm = db_sys_status_message.rssi_drone;
+        rc_status->received_packet_cnt = db_sys_status_message.recv_pack_sec;
+        db_shm_write_end(&rc_status->header);
+        db_shm_write_begin(&db_uav_status->header);
+        db_uav_status->cpuload = rc_status_message->cpu_usage_uav;
+        db_uav_status->temp = rc_status_message->cpu_temp_uav;
+        db_uav_status->undervolt = rc_status_message->uav_is_low_V;
+        db_shm_write_end(&db_uav_status->header);
+    }
+}
+
+/**
+ * Message from a connected GCS
+ */
+void on_tcp_client(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
+    int tcp_addrlen = sizeof(status_tcp_server_info.servaddr);
+    struct timespec timestamp;
+    if (read(tcp_clients[i], tcp_message_buff, NET_BUFF_SIZE) <= 0) {
+        //Somebody disconnected , get his details and print
+        getpeername(tcp_clients[i], (struct sockaddr *) &status_tcp_server_info.servaddr, (socklen_t *) &tcp_addrlen);
+        LOG_SYS_STD(LOG_INFO, "DB_STATUS_GND: Client disconnected (%s:%d)\n",
+                    inet_ntoa(status_tcp_server_info.servaddr.sin_addr),
+                    ntohs(status_tcp_server_info.servaddr.sin_port));
+        db_event_remove(loop, handler);
+        close(tcp_clients[i]);
+        tcp_clients[i] = 0;
+        return;
+    }
+    // client sent us some information. Process it...
+    switch (tcp_message_buff[2]) {
+        case 0x03:
+            // DB RC overwrite message. Set overwrite values in shared memory
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &timestamp);
+            db_shm_write_begin(&rc_overwrite_values->header);
+            memcpy(rc_overwrite_values->ch, &tcp_message_buff[3], (size_t) 2 * NUM_CHANNELS);
+            rc_overwrite_values->timestamp = timestamp;
+            db_shm_write_end(&rc_overwrite_values->header);
+            break;
+        default:
+            LOG_SYS_STD(LOG_WARNING, "DB_STATUS_GND: Unknown status message received from GCS\n");
+            break;
+    }
+}
+
+/**
+ * Incoming tcp connection request on master TCP socket
+ */
+void on_tcp_connect(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int new_tcp_client;
+    int tcp_addrlen = sizeof(status_tcp_server_info.servaddr);
+    if ((new_tcp_client = accept(status_tcp_server_info.sock_fd, (struct sockaddr *) &status_tcp_server_info.servaddr,
+                                 (socklen_t *) &tcp_addrlen)) < 0) {
+        perror("DB_STATUS_GND: Accepting new tcp connection failed");
+        return;
+    }
+    //add new socket to array of sockets
+    for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
+        if (tcp_clients[i] == 0) {   // if position is empty
+            if (db_event_add_io(loop, new_tcp_client, EPOLLIN, on_tcp_client, (void *) (intptr_t) i) == NULL)
+                break;
+            tcp_clients[i] = new_tcp_client;
+            LOG_SYS_STD(LOG_INFO, "DB_STATUS_GND: New connection (%s:%d)\n",
+                        inet_ntoa(status_tcp_server_info.servaddr.sin_addr),
+                        ntohs(status_tcp_server_info.servaddr.sin_port));
+            return;
+        }
+    }
+    close(new_tcp_client);
+}
+
+/**
+ * Status messages for the ground control station (app). Sent at 10Hz independently of whether data was received from
+ * UAV or not
+ */
+void on_status_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    db_gnd_status_t gnd_status;     // consistent copies taken before every status message
+    db_rc_values_t rc_values_copy;
+    db_shm_publish(&gnd_status_shm->header, &gnd_status_shm->port_stats[DB_PORT_STATUS], &status_stats,
+                   sizeof(db_port_seq_stats_t));
+    if (db_metrics_sample(&sys_metrics, db_clock_us()))
+        db_shm_publish(&gnd_status_shm->header, &gnd_status_shm->sys, &sys_metrics.metrics, sizeof(db_sys_metrics_t));
+    db_shm_snapshot(&gnd_status_shm->header, &gnd_status, sizeof(gnd_status));
+    db_shm_snapshot(&rc_values->header, &rc_values_copy, sizeof(rc_values_copy));
+    // ---------------
+    // DB system-status message
+    // ---------------
+    int8_t best_dbm = -128;
+    for (int cardcounter = 0; cardcounter < (int) gnd_status.wifi_adapter_cnt && cardcounter < 8; ++cardcounter) {
+        if (best_dbm < gnd_status.adapter[cardcounter].current_signal_dbm)
+            best_dbm = gnd_status.adapter[cardcounter].current_signal_dbm;
+    }
+    db_sys_status_message.rssi_ground = best_dbm;
+    db_sys_status_message.damaged_blocks_wbc = gnd_status.damaged_block_cnt;
+    db_sys_status_message.lost_packets_wbc = gnd_status.lost_packet_cnt;
+    db_sys_status_message.kbitrate_wbc = gnd_status.kbitrate;
+    db_sys_status_message.voltage_status = db_uav_status->undervolt;
+    if (gnd_status.tx_restart_cnt > restarts) {
+        restarts++;
+        usleep((__useconds_t) 1e7);
+    }
+    // ---------------
+    // send DB system status message
+    // ---------------
+    send_to_all_tcp_clients(tcp_clients, (uint8_t *) &db_sys_status_message, sizeof(db_system_status_msg_t));
+    // ---------------
+    // send DB RC-status message
+    // ---------------
+    memcpy(db_rc_status_message.channels, rc_values_copy.ch, 2 * NUM_CHANNELS);
+    send_to_all_tcp_clients(tcp_clients, (uint8_t *) &db_rc_status_message, sizeof(db_rc_msg_t));
+}
+
+int main(int argc, char *argv[]) {
+    const int signals[] = {SIGINT, SIGTERM};
+    long status_message_update_rate = 100; // send status messages every 100ms (10Hz)
     memset(lr_buffer, 0, DATA_UNI_LENGTH);
-    uint8_t message_buff[DATA_UNI_LENGTH - DB_RAW_V2_HEADER_LENGTH];
-    uint8_t tcp_message_buff[NET_BUFF_SIZE];
-    int tcp_clients[MAX_TCP_CLIENTS] = {0};
 
-    db_rc_msg_t db_rc_status_message;
     db_rc_status_message.ident[0] = '$';
     db_rc_status_message.ident[1] = 'D';
     db_rc_status_message.message_id = 2;
-    db_system_status_msg_t db_sys_status_message;
     db_sys_status_message.ident[0] = '$';
     db_sys_status_message.ident[1] = 'D';
     db_sys_status_message.message_id = 1;
@@ -114,182 +252,53 @@ int main(int argc, char *argv[]) {
     db_sys_status_message.voltage_status = 0;
 
     process_command_line_args(argc, argv);
+    if (db_event_loop_init(&event_loop) < 0 || db_event_add_signals(&event_loop, signals, 2, on_signal, NULL) == NULL)
+        exit(-1);
 
     // open wbc rc shared memory to push rc rssi etc. to wbc OSD
-    db_rc_status_t *db_rc_status_t = db_rc_status_memory_open();
+    rc_status = db_rc_status_memory_open();
     // open db rc shared memory
-    db_rc_values_t *rc_values = db_rc_values_memory_open();
+    rc_values = db_rc_values_memory_open();
     // open db rc overwrite shared memory
-    db_rc_overwrite_values_t *rc_overwrite_values = db_rc_overwrite_values_memory_open();
+    rc_overwrite_values = db_rc_overwrite_values_memory_open();
     // shm for video/gnd status
-    db_gnd_status_t *db_gnd_status_t = db_gnd_status_memory_open();
+    gnd_status_shm = db_gnd_status_memory_open();
     // all UAV status related data
-    db_uav_status_t *db_uav_status = db_uav_status_memory_open();
+    db_uav_status = db_uav_status_memory_open();
 
-    int number_cards = db_gnd_status_t->wifi_adapter_cnt;
+    db_port_seq_init(&status_seq, &status_stats);
+    db_metrics_open(&sys_metrics, DB_METRICS_INTERVAL_MS);
 
     // set up long range receiving socket
-    db_socket_t raw_interfaces_status[DB_MAX_ADAPTERS];
-    memset(raw_interfaces_status, 0, DB_MAX_ADAPTERS);
+    memset(raw_interfaces_status, 0, sizeof(raw_interfaces_status));
     for (int i = 0; i < num_inf_status; i++) {
         raw_interfaces_status[i] = open_db_socket(adapters[i], comm_id, db_mode, 6, DB_DIREC_DRONE,
                 DB_PORT_STATUS, DB_FRAMETYPE_DEFAULT);
+        db_event_add_io(&event_loop, raw_interfaces_status[i].db_socket, EPOLLIN, on_raw_status, (void *) (intptr_t) i);
     }
-
-    fd_set fd_socket_set;
-    struct timeval socket_timeout;
-    socket_timeout.tv_sec = 0;
-    socket_timeout.tv_usec = 100000; // 10Hz
     // Setup TCP server for GCS communication
-    struct tcp_server_info_t status_tcp_server_info = create_tcp_server_socket(APP_PORT_STATUS);
-    int tcp_addrlen = sizeof(status_tcp_server_info.servaddr);
+    status_tcp_server_info = create_tcp_server_socket(APP_PORT_STATUS);
+    db_event_add_io(&event_loop, status_tcp_server_info.sock_fd, EPOLLIN, on_tcp_connect, NULL);
+    db_event_handler_t *status_timer = db_event_add_timer(&event_loop, on_status_timer, NULL);
+    if (status_timer == NULL)
+        exit(-1);
+    db_event_timer_arm(status_timer, status_message_update_rate * 1000, status_message_update_rate * 1000);
 
     LOG_SYS_STD(LOG_INFO, "DB_STATUS_GND: Started!\n");
-    gettimeofday(&timecheck, NULL);
-    start = (long) timecheck.tv_sec * 1000 + (long) timecheck.tv_usec / 1000;
-    while (keeprunning) {
-        socket_timeout.tv_sec = 0;
-        socket_timeout.tv_usec = 100000; // 10Hz
-        FD_ZERO(&fd_socket_set);
-        FD_SET(status_tcp_server_info.sock_fd, &fd_socket_set);
-        max_sd = status_tcp_server_info.sock_fd;
-        for (int i = 0; i < num_inf_status; i++) {
-            FD_SET(raw_interfaces_status[i].db_socket, &fd_socket_set);
-            if (raw_interfaces_status[i].db_socket > max_sd)
-                max_sd = raw_interfaces_status[i].db_socket;
-        }
-        //add child sockets (tcp connection sockets) to set
-        for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-            if (tcp_clients[i] > 0) {
-                FD_SET(tcp_clients[i], &fd_socket_set);
-                if (tcp_clients[i] > max_sd)
-                    max_sd = tcp_clients[i];
-            }
-        }
-        select_return = select(max_sd + 1, &fd_socket_set, NULL, NULL, &socket_timeout);
-        if (select_return == -1 && errno != EINTR) {
-            perror("DB_STATUS_GROUND: select() returned error");
-        } else if (select_return > 0) {
-            for (int i = 0; i < num_inf_status; ++i) {
-                if (FD_ISSET(raw_interfaces_status[i].db_socket, &fd_socket_set)) {
-                    // ---------------
-                    // status message from long range link (UAV)
-                    // ---------------
-                    l = recv(raw_interfaces_status[i].db_socket, lr_buffer, DATA_UNI_LENGTH, 0);
-                    if (l > 0) {
-                        get_db_payload(lr_buffer, l, message_buff, &seq_num_status, &radiotap_length);
-                        if (prev_seq_num_status != seq_num_status) {
-                            prev_seq_num_status = seq_num_status;
-                            // process payload (currently only one type of raw status frame is supported: RC_AIR --> STATUS_GROUND)
-                            // must be a uav_rc_status_update_message_t
-                            struct uav_rc_status_update_message_t *rc_status_message = (struct uav_rc_status_update_message_t *) message_buff;
-                            db_sys_status_message.rssi_drone = rc_status_message->rssi_rc_uav;
-                            db_sys_status_message.recv_pack_sec = rc_status_message->recv_pack_sec;
-                            db_rc_status_t->adapter[0].current_signal_dbm = db_sys_status_message.rssi_drone;
-                            db_rc_status_t->received_packet_cnt = db_sys_status_message.recv_pack_sec;
-                            db_uav_status->cpuload = rc_status_message->cpu_usage_uav;
-                            db_uav_status->temp = rc_status_message->cpu_temp_uav;
-                            db_uav_status->undervolt = rc_status_message->uav_is_low_V;
-                        }
-                    }
-                }
-            }
-
-            // handle incoming tcp connection requests on master TCP socket
-            if (FD_ISSET(status_tcp_server_info.sock_fd, &fd_socket_set)) {
-                if ((new_tcp_client = accept(status_tcp_server_info.sock_fd,
-                                             (struct sockaddr *) &status_tcp_server_info.servaddr,
-                                             (socklen_t *) &tcp_addrlen)) < 0) {
-                    perror("DB_STATUS_GND: Accepting new tcp connection failed");
-                } else {
-                    //add new socket to array of sockets
-                    for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-                        if (tcp_clients[i] == 0) {   // if position is empty
-                            tcp_clients[i] = new_tcp_client;
-                            LOG_SYS_STD(LOG_INFO, "DB_STATUS_GND: New connection (%s:%d)\n",
-                                        inet_ntoa(status_tcp_server_info.servaddr.sin_addr),
-                                        ntohs(status_tcp_server_info.servaddr.sin_port));
-                            break;
-                        }
-                    }
-                }
-            }
-            // handle messages from connected TCP clients
-            for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-                if (FD_ISSET(tcp_clients[i], &fd_socket_set)) {
-                    if (read(tcp_clients[i], tcp_message_buff, NET_BUFF_SIZE) == 0) {
-                        //Somebody disconnected , get his details and print
-                        getpeername(tcp_clients[i], (struct sockaddr *) &status_tcp_server_info.servaddr,
-                                    (socklen_t *) &tcp_addrlen);
-                        LOG_SYS_STD(LOG_INFO, "DB_STATUS_GND: Client disconnected (%s:%d)\n",
-                               inet_ntoa(status_tcp_server_info.servaddr.sin_addr),
-                               ntohs(status_tcp_server_info.servaddr.sin_port));
-                        close(tcp_clients[i]);
-                        tcp_clients[i] = 0;
-                    } else {
-                        // client sent us some information. Process it...
-                        switch (tcp_message_buff[2]) {
-                            case 0x03:
-                                // DB RC overwrite message. Set overwrite values in shared memory
-                                memcpy(rc_overwrite_values->ch, &tcp_message_buff[3], (size_t) 2 * NUM_CHANNELS);
-                                clock_gettime(CLOCK_MONOTONIC_COARSE, &timestamp);
-                                rc_overwrite_values->timestamp = timestamp;
-                                break;
-                            default:
-                                LOG_SYS_STD(LOG_WARNING, "DB_STATUS_GND: Unknown status message received from GCS\n");
-                                break;
-                        }
-                    }
-                }
-            }
-        }
-
-        // status messages for the ground control station (app)
-        // sent at 10Hz independently of whether data was received from UAV or not
-        gettimeofday(&timecheck, NULL);
-        rightnow = (long) timecheck.tv_sec * 1000 + (long) timecheck.tv_usec / 1000;
-        if ((rightnow - start) >= status_message_update_rate) {
-            // ---------------
-            // DB system-status message
-            // ---------------
-            best_dbm = -128;
-            for (cardcounter = 0; cardcounter < number_cards; ++cardcounter) {
-                if (best_dbm < db_gnd_status_t->adapter[cardcounter].current_signal_dbm)
-                    best_dbm = db_gnd_status_t->adapter[cardcounter].current_signal_dbm;
-            }
-            // db_uav_status->undervolt = get_undervolt();
-            db_sys_status_message.rssi_ground = best_dbm;
-            db_sys_status_message.damaged_blocks_wbc = db_gnd_status_t->damaged_block_cnt;
-            db_sys_status_message.lost_packets_wbc = db_gnd_status_t->lost_packet_cnt;
-            db_sys_status_message.kbitrate_wbc = db_gnd_status_t->kbitrate;
-            db_sys_status_message.voltage_status = db_uav_status->undervolt;
-            if (db_gnd_status_t->tx_restart_cnt > restarts) {
-                restarts++;
-                usleep((__useconds_t) 1e7);
-            }
-            // ---------------
-            // send DB system status message
-            // ---------------
-            send_to_all_tcp_clients(tcp_clients, (uint8_t *) &db_sys_status_message, sizeof(db_system_status_msg_t));
-            // ---------------
-            // send DB RC-status message
-            // ---------------
-            memcpy(db_rc_status_message.channels, rc_values->ch, 2 * NUM_CHANNELS);
-            send_to_all_tcp_clients(tcp_clients, (uint8_t *) &db_rc_status_message, sizeof(db_rc_msg_t));
+    db_event_run(&event_loop);
 
-            gettimeofday(&timecheck, NULL);
-            start = (long) timecheck.tv_sec * 1000 + (long) timecheck.tv_usec / 1000;
-        }
-    }
     for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
         if (tcp_clients[i] > 0)
             close(tcp_clients[i]);
     }
+    db_event_report(&event_loop, "DB_STATUS_GND");
+    db_event_loop_close(&event_loop);
     close(status_tcp_server_info.sock_fd);
+    db_metrics_close(&sys_metrics);
     for (int i = 0; i < DB_MAX_ADAPTERS; i++) {
         if (raw_interfaces_status[i].db_socket > 0)
-            close(raw_interfaces_status[i].db_socket);
+            close_db_socket(&raw_interfaces_status[i]);
     }
     LOG_SYS_STD(LOG_INFO, "DB_STATUS_GND: Terminated!\n");
     exit(0);
-}
\ No newline at end of file
+}
@@ -30,19 +30,25 @@
 #include <zconf.h>
 #include <sys/socket.h>
 #include <stdint.h>
+#include <errno.h>
 #include "../common/db_common.h"
 #include "../common/tcp_server.h"
 #include "../common/db_protocol.h"
+#include "../common/db_event.h"
 
 #define NET_BUFF_SIZE 2048
 #define MAX_TCP_CLIENTS 10
 #define PORT_UDP_SYSLOG_SERVER 514
 
-int keep_running = 1;
+db_event_loop_t event_loop;
+int tcp_clients[MAX_TCP_CLIENTS] = {0};
+db_event_handler_t *tcp_client_handlers[MAX_TCP_CLIENTS] = {0};
+struct tcp_server_info_t tcp_server_syslog;
+uint8_t net_message_buff[NET_BUFF_SIZE];
 
 
-void signal_handler(int s) {
-    keep_running = 0;
+void on_signal(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t signo) {
+    db_event_stop(loop);
 }
 
 int open_udp_server() {
@@ -65,105 +71,88 @@ int open_udp_server() {
     return log_udp_socket;
 }
 
-int main(int argc, char *argv[]) {
-    struct sigaction action;
-    memset(&action, 0, sizeof(struct sigaction));
-    action.sa_handler = signal_handler;
-    sigaction(SIGTERM, &action, NULL);
-    sigaction(SIGINT, &action, NULL);
+/**
+ * Forward all queued log messages to the connected TCP clients. Edge triggered: read until the socket is empty
+ */
+void on_udp_log(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    struct sockaddr_in udp_client_addr;
+    socklen_t plen = sizeof(struct sockaddr_in);
+    ssize_t recv_bytes;
+    while ((recv_bytes = recvfrom(handler->fd, net_message_buff, NET_BUFF_SIZE, MSG_DONTWAIT,
+                                  (struct sockaddr *) &udp_client_addr, &plen)) > 0)
+        send_to_all_tcp_clients(tcp_clients, net_message_buff, recv_bytes);
+    if (recv_bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("DB_SYSLOG_SERVER: Error receiving");
+}
 
-    uint8_t net_message_buff[NET_BUFF_SIZE];
-    memset(net_message_buff, 0, NET_BUFF_SIZE);
+void on_tcp_client(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
+    int tcp_addrlen = sizeof(tcp_server_syslog.servaddr);
+    if (read(tcp_clients[i], net_message_buff, NET_BUFF_SIZE) <= 0) {
+        //Somebody disconnected
+        getpeername(tcp_clients[i], (struct sockaddr *) &tcp_server_syslog.servaddr, (socklen_t *) &tcp_addrlen);
+        LOG_SYS_STD(LOG_INFO, "DB_SYSLOG_SERVER: Client disconnected (%s:%d)\n",
+                    inet_ntoa(tcp_server_syslog.servaddr.sin_addr), ntohs(tcp_server_syslog.servaddr.sin_port));
+        db_event_remove(loop, handler);
+        close(tcp_clients[i]);
+        tcp_clients[i] = 0;
+    } else {
+        // tcp client sent us some information. Process it...
+        LOG_SYS_STD(LOG_WARNING, "DB_SYSLOG_SERVER: TCP server is not accepting any data\n");
+    }
+}
 
-    int tcp_clients[MAX_TCP_CLIENTS] = {0};
-    fd_set fd_read_set;
-    struct tcp_server_info_t tcp_server_syslog = create_tcp_server_socket(PORT_TCP_SYSLOG_SERVER);
+void on_tcp_connect(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int new_tcp_client;
     int tcp_addrlen = sizeof(tcp_server_syslog.servaddr);
+    if ((new_tcp_client = accept(tcp_server_syslog.sock_fd, (struct sockaddr *) &tcp_server_syslog.servaddr,
+                                 (socklen_t *) &tcp_addrlen)) < 0) {
+        perror("DB_SYSLOG_SERVER: Accepting new tcp connection failed");
+        return;
+    }
+    LOG_SYS_STD(LOG_INFO, "DB_SYSLOG_SERVER: New connection (%s:%d)\n", inet_ntoa(tcp_server_syslog.servaddr.sin_addr),
+                ntohs(tcp_server_syslog.servaddr.sin_port));
+    //add new socket to array of sockets
+    for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
+        if (tcp_clients[i] == 0) {   // if position is empty
+            tcp_client_handlers[i] = db_event_add_io(loop, new_tcp_client, EPOLLIN, on_tcp_client, (void *) (intptr_t) i);
+            if (tcp_client_handlers[i] != NULL)
+                tcp_clients[i] = new_tcp_client;
+            else
+                close(new_tcp_client);
+            return;
+        }
+    }
+    close(new_tcp_client);
+}
+
+int main(int argc, char *argv[]) {
+    const int signals[] = {SIGINT, SIGTERM};
+    if (db_event_loop_init(&event_loop) < 0 || db_event_add_signals(&event_loop, signals, 2, on_signal, NULL) == NULL)
+        exit(-1);
+    memset(net_message_buff, 0, NET_BUFF_SIZE);
+    tcp_server_syslog = create_tcp_server_socket(PORT_TCP_SYSLOG_SERVER);
 
-    struct sockaddr_in udp_client_addr;
-    socklen_t plen = sizeof(struct sockaddr_in);
     int udp_socket = open_udp_server();
     if (udp_socket < 0) {
         exit(-1);
     } else
         LOG_SYS_STD(LOG_INFO, "DB_SYSLOG_SERVER: Listening for TCP clients to forward logs on port %i\n",
                     PORT_TCP_SYSLOG_SERVER);
-    int max_sd = 0;
+    if (db_event_add_io(&event_loop, udp_socket, EPOLLIN | EPOLLET, on_udp_log, NULL) == NULL ||
+        db_event_add_io(&event_loop, tcp_server_syslog.sock_fd, EPOLLIN, on_tcp_connect, NULL) == NULL)
+        exit(-1);
 
     LOG_SYS_STD(LOG_INFO, "DB_SYSLOG_SERVER: Started\n");
-    while (keep_running) {
-        FD_ZERO(&fd_read_set);
-        FD_SET(udp_socket, &fd_read_set);
-        max_sd = udp_socket;
-        FD_SET(tcp_server_syslog.sock_fd, &fd_read_set);
-        //add child sockets (tcp connection sockets) to set
-        for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-            int tcp_client_sd = tcp_clients[i];
-            if (tcp_client_sd > 0)
-                FD_SET(tcp_client_sd, &fd_read_set);
-            if (tcp_client_sd > max_sd)
-                max_sd = tcp_client_sd;
-        }
-
-        int select_return = select(max_sd + 1, &fd_read_set, NULL, NULL, NULL);
-        if (select_return > 0) {
-            // handle incoming log messages & forward them to connected TCP clients
-            if (FD_ISSET(udp_socket, &fd_read_set)) {
-                ssize_t recv_bytes = recvfrom(udp_socket, net_message_buff, NET_BUFF_SIZE, 0,
-                                              (struct sockaddr *) &udp_client_addr, &plen);
-                if (recv_bytes > 0) {
-                    send_to_all_tcp_clients(tcp_clients, net_message_buff, recv_bytes);
-                } else
-                    perror("DB_SYSLOG_SERVER: Error receiving");
-            }
-            // handle incoming tcp connection requests on master TCP socket
-            if (FD_ISSET(tcp_server_syslog.sock_fd, &fd_read_set)) {
-                int new_tcp_client;
-                if ((new_tcp_client = accept(tcp_server_syslog.sock_fd,
-                                             (struct sockaddr *) &tcp_server_syslog.servaddr,
-                                             (socklen_t *) &tcp_addrlen)) < 0) {
-                    perror("DB_SYSLOG_SERVER: Accepting new tcp connection failed");
-                } else {
-                    LOG_SYS_STD(LOG_INFO, "DB_SYSLOG_SERVER: New connection (%s:%d)\n",
-                                inet_ntoa(tcp_server_syslog.servaddr.sin_addr),
-                                ntohs(tcp_server_syslog.servaddr.sin_port));
-                    //add new socket to array of sockets
-                    for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-                        if (tcp_clients[i] == 0) {   // if position is empty
-                            tcp_clients[i] = new_tcp_client;
-                            break;
-                        }
-                    }
-                }
-            }
-            // handle messages from connected TCP clients
-            for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
-                if (FD_ISSET(tcp_clients[i], &fd_read_set)) {
-                    if (read(tcp_clients[i], net_message_buff, NET_BUFF_SIZE) == 0) {
-                        //Somebody disconnected
-                        getpeername(tcp_clients[i], (struct sockaddr *) &tcp_server_syslog.servaddr,
-                                    (socklen_t *) &tcp_addrlen);
-                        LOG_SYS_STD(LOG_INFO, "DB_SYSLOG_SERVER: Client disconnected (%s:%d)\n",
-                                    inet_ntoa(tcp_server_syslog.servaddr.sin_addr),
-                                    ntohs(tcp_server_syslog.servaddr.sin_port));
-                        close(tcp_clients[i]);
-                        tcp_clients[i] = 0;
-                    } else {
-                        // tcp client sent us some information. Process it...
-                        LOG_SYS_STD(LOG_WARNING, "DB_SYSLOG_SERVER: TCP server is not accepting any data\n");
-                    }
-                }
-            }
-        } else if (select_return == -1) {
-            keep_running = 0;
-            perror("DB_SYSLOG_SERVER: select returned error");
-        }
-    }
+    db_event_run(&event_loop);
 
     for (int i = 0; i < MAX_TCP_CLIENTS; i++) {
         if (tcp_clients[i] > 0)
             close(tcp_clients[i]);
     }
+    db_event_report(&event_loop, "DB_SYSLOG_SERVER");
+    db_event_loop_close(&event_loop);
+    close(udp_socket);
     close(tcp_server_syslog.sock_fd);
     LOG_SYS_STD(LOG_INFO, "DB_SYSLOG_SERVER: Terminated\n");
     exit(0);
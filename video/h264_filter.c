@@ -0,0 +1,175 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * H.264 Annex-B output filter for the ground side. The decoded video stream is split into NAL units (start code
+ * 00 00 01 or 00 00 00 01). A NAL unit is only forwarded to the sink once it is complete (the next start code was
+ * seen) and none of its bytes were lost. NAL units overlapping an unrecoverable packet are dropped entirely, so that
+ * decoders never see broken slices. Optionally, after a lost reference NAL unit the output is held until the next
+ * IDR frame (SPS & PPS are still forwarded).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "h264_filter.h"
+
+static const uint8_t start_code[] = {0x00, 0x00, 0x00, 0x01};
+// Longest run of zeros that can belong to a start code. Any further zeros are trailing bytes of the current NAL unit
+#define H264_FILTER_MAX_START_ZEROS 3
+
+/**
+ * @param filter Filter to init
+ * @param hold_until_idr Drop all NAL units after a lost reference NAL unit until the next IDR. Also waits for the
+ * first IDR after start
+ * @param sink Called with every complete and undamaged NAL unit (including start code)
+ * @param gap Called before the next NAL unit is passed to the sink in case NAL units were dropped. May be NULL
+ * @return 0 on success, -1 if the buffer could not be allocated
+ */
+int h264_filter_init(h264_filter_t *filter, bool hold_until_idr, h264_sink_cb sink, h264_gap_cb gap) {
+    memset(filter, 0, sizeof(h264_filter_t));
+    filter->nal_buf = malloc(H264_FILTER_MAX_NAL_SIZE);
+    if (filter->nal_buf == NULL)
+        return -1;
+    filter->corrupt = true; // we did not see a start code yet
+    filter->hold_until_idr = hold_until_idr;
+    filter->wait_for_idr = hold_until_idr;
+    filter->sink = sink;
+    filter->gap = gap;
+    return 0;
+}
+
+void h264_filter_free(h264_filter_t *filter) {
+    free(filter->nal_buf);
+    filter->nal_buf = NULL;
+}
+
+static void emit(h264_filter_t *filter, uint8_t *data, uint32_t length) {
+    if (filter->gap_pending) {
+        filter->gap_pending = false;
+        filter->stats.gaps_signaled++;
+        if (filter->gap) filter->gap();
+    }
+    filter->sink(data, length);
+}
+
+/**
+ * The NAL unit in the buffer is complete. Decide if it gets forwarded.
+ *
+ * @param filter The filter
+ * @param length Length of the NAL unit in the buffer including the start code
+ */
+static void complete_nal(h264_filter_t *filter, uint32_t length) {
+    if (length <= sizeof(start_code)) {
+        if (filter->streaming && !filter->corrupt && length > 0)
+            filter->sink(filter->nal_buf, length); // tail of an oversized NAL unit
+        return;
+    }
+    if (filter->streaming) {
+        // beginning was already forwarded. Nothing to decide anymore
+        if (!filter->corrupt)
+            filter->sink(filter->nal_buf, length);
+        return;
+    }
+    // all complete NAL units in the buffer start with the normalized 4 byte start code. Only the bytes received
+    // before the first start code do not
+    bool has_header = memcmp(filter->nal_buf, start_code, sizeof(start_code)) == 0;
+    uint8_t nal_type = (uint8_t) (filter->nal_buf[sizeof(start_code)] & 0x1f);
+    uint8_t nal_ref_idc = (uint8_t) ((filter->nal_buf[sizeof(start_code)] >> 5) & 0x03);
+
+    if (filter->corrupt || !has_header) {
+        filter->stats.nals_dropped++;
+        filter->gap_pending = true;
+        if (filter->hold_until_idr && (nal_ref_idc != 0 || !has_header))
+            filter->wait_for_idr = true;
+        return;
+    }
+    if (filter->wait_for_idr) {
+        if (nal_type == H264_NAL_TYPE_IDR) {
+            filter->wait_for_idr = false;
+        } else if (nal_type != H264_NAL_TYPE_SPS && nal_type != H264_NAL_TYPE_PPS) {
+            filter->stats.nals_held++;
+            filter->gap_pending = true;
+            return;
+        }
+    }
+    filter->stats.nals_passed++;
+    emit(filter, filter->nal_buf, length);
+}
+
+/**
+ * Buffer is full. Forward everything but the trailing zeros (they might be part of the next start code) and continue
+ * in streaming mode for the rest of this NAL unit.
+ */
+static void handle_overflow(h264_filter_t *filter) {
+    uint32_t keep = (uint32_t) (filter->zero_cnt < H264_FILTER_MAX_START_ZEROS ? filter->zero_cnt :
+                                H264_FILTER_MAX_START_ZEROS);
+    uint32_t flush_len = filter->nal_len - keep;
+    if (!filter->streaming) {
+        filter->stats.oversized_nals++;
+        if (!filter->corrupt && !filter->wait_for_idr)
+            emit(filter, filter->nal_buf, flush_len);
+        else
+            filter->corrupt = true; // can not hold it back in full. Drop the rest as well
+        filter->streaming = true;
+    } else if (!filter->corrupt) {
+        filter->sink(filter->nal_buf, flush_len);
+    }
+    memmove(filter->nal_buf, filter->nal_buf + flush_len, keep);
+    filter->nal_len = keep;
+}
+
+/**
+ * Feed correctly received or recovered video data into the filter.
+ *
+ * @param filter The filter
+ * @param data Decoded video data (Annex-B byte stream)
+ * @param length Length of data
+ */
+void h264_filter_push(h264_filter_t *filter, const uint8_t *data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        uint8_t b = data[i];
+        if (b == 0x01 && filter->zero_cnt >= 2) {
+            // found start code. Everything before the zeros belongs to the previous NAL unit
+            complete_nal(filter, filter->nal_len - (uint32_t) filter->zero_cnt);
+            memcpy(filter->nal_buf, start_code, sizeof(start_code));
+            filter->nal_len = sizeof(start_code);
+            filter->zero_cnt = 0;
+            filter->corrupt = false;
+            filter->streaming = false;
+            continue;
+        }
+        if (filter->nal_len == H264_FILTER_MAX_NAL_SIZE)
+            handle_overflow(filter);
+        filter->nal_buf[filter->nal_len++] = b;
+        if (b != 0x00)
+            filter->zero_cnt = 0;
+        else if (filter->zero_cnt < H264_FILTER_MAX_START_ZEROS)
+            filter->zero_cnt++;
+    }
+}
+
+/**
+ * Signal that video data was lost at the current position of the stream. The current NAL unit gets dropped.
+ *
+ * @param filter The filter
+ */
+void h264_filter_mark_loss(h264_filter_t *filter) {
+    filter->corrupt = true;
+    filter->zero_cnt = 0;
+}
@@ -0,0 +1,62 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#ifndef DRONEBRIDGE_H264_FILTER_H
+#define DRONEBRIDGE_H264_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define H264_FILTER_MAX_NAL_SIZE    (512 * 1024)    // bigger NAL units get streamed through unfiltered
+
+#define H264_NAL_TYPE_IDR           5
+#define H264_NAL_TYPE_SPS           7
+#define H264_NAL_TYPE_PPS           8
+
+typedef void (*h264_sink_cb)(uint8_t *data, uint32_t length);
+typedef void (*h264_gap_cb)(void);
+
+typedef struct {
+    uint32_t nals_passed;
+    uint32_t nals_dropped;      // overlapped a lost packet
+    uint32_t nals_held;         // intact but dropped while waiting for the next IDR
+    uint32_t gaps_signaled;
+    uint32_t oversized_nals;    // too big for the buffer. Got streamed through unfiltered
+} h264_filter_stats_t;
+
+typedef struct {
+    uint8_t *nal_buf;           // current NAL unit including its start code
+    uint32_t nal_len;
+    int zero_cnt;               // number of consecutive 0x00 bytes at the end of nal_buf
+    bool corrupt;               // current NAL overlaps a lost packet
+    bool streaming;             // current NAL exceeded the buffer and is passed through directly
+    bool gap_pending;           // NAL units were dropped since the last output
+    bool wait_for_idr;
+    bool hold_until_idr;        // after losing a reference NAL hold the output until the next IDR
+    h264_sink_cb sink;
+    h264_gap_cb gap;
+    h264_filter_stats_t stats;
+} h264_filter_t;
+
+int h264_filter_init(h264_filter_t *filter, bool hold_until_idr, h264_sink_cb sink, h264_gap_cb gap);
+void h264_filter_push(h264_filter_t *filter, const uint8_t *data, uint32_t length);
+void h264_filter_mark_loss(h264_filter_t *filter);
+void h264_filter_free(h264_filter_t *filter);
+
+#endif //DRONEBRIDGE_H264_FILTER_H
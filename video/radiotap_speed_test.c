@@ -0,0 +1,165 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/DroneBridge/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * Micro benchmark: Radiotap parsing with the radiotap iterator (as done before for every received frame) vs. cached
+ * layouts (db_radiotap.c). Uses radiotap headers in the layout rtl8812au and ath9k_htc (mac80211) emit for received
+ * frames: combined signal + one extended bitmap per RX chain with signal and antenna index.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <string.h>
+
+#include "../common/radiotap/radiotap_iter.h"
+#include "../common/db_radiotap.h"
+
+#define ITERATIONS 2000000
+
+typedef struct {
+    uint8_t flags, rate, lock_quality, antenna;
+    int8_t signal, ant_signal[4];
+} rt_info_t;
+
+// rtl8812au: TSFT, FLAGS, RATE, CHANNEL, DBM_ANTSIGNAL, LOCK_QUALITY, RX_FLAGS + 2 chains (DBM_ANTSIGNAL, ANTENNA)
+static uint8_t rtl8812au_header[] = {
+        0x00, 0x00, 0x28, 0x00,             // version, pad, it_len = 40
+        0xaf, 0x40, 0x00, 0xa0,             // it_present: EXT | RADIOTAP_NS | RX_FLAGS | LOCK_Q | ANTSIG | CH | RATE..
+        0x20, 0x08, 0x00, 0xa0,             // chain 0: EXT | RADIOTAP_NS | ANTENNA | DBM_ANTSIGNAL
+        0x20, 0x08, 0x00, 0x00,             // chain 1: ANTENNA | DBM_ANTSIGNAL
+        0x1f, 0x3c, 0x5a, 0x01, 0x00, 0x00, 0x00, 0x00, // TSFT
+        0x10,                               // flags: FCS at end
+        0x0c,                               // rate: 6 Mbit/s
+        0x85, 0x16, 0x40, 0x01,             // channel: 5765 MHz, OFDM 5 GHz
+        0xc4,                               // combined signal: -60 dBm
+        0x00,                               // padding
+        0x64, 0x00,                         // lock quality
+        0x00, 0x00,                         // RX flags
+        0xc3, 0x00,                         // chain 0: -61 dBm, antenna 0
+        0xc6, 0x01,                         // chain 1: -58 dBm, antenna 1
+};
+
+// ath9k_htc: TSFT, FLAGS, RATE, CHANNEL, DBM_ANTSIGNAL, RX_FLAGS + 2 chains (DBM_ANTSIGNAL, ANTENNA)
+static uint8_t ath9k_htc_header[] = {
+        0x00, 0x00, 0x26, 0x00,             // version, pad, it_len = 38
+        0x2f, 0x40, 0x00, 0xa0,             // it_present: EXT | RADIOTAP_NS | RX_FLAGS | ANTSIG | CH | RATE | FLAGS..
+        0x20, 0x08, 0x00, 0xa0,             // chain 0
+        0x20, 0x08, 0x00, 0x00,             // chain 1
+        0x6d, 0x8e, 0x03, 0x17, 0x00, 0x00, 0x00, 0x00, // TSFT
+        0x10,                               // flags: FCS at end
+        0x0c,                               // rate: 6 Mbit/s
+        0x6c, 0x09, 0xa0, 0x00,             // channel: 2412 MHz, OFDM 2.4 GHz
+        0xbf,                               // combined signal: -65 dBm
+        0x00,                               // padding
+        0x00, 0x00,                         // RX flags
+        0xbd, 0x00,                         // chain 0: -67 dBm, antenna 0
+        0xc2, 0x01,                         // chain 1: -62 dBm, antenna 1
+};
+
+static inline void apply_field(rt_info_t *info, int index, const uint8_t *arg) {
+    switch (index) {
+        case IEEE80211_RADIOTAP_FLAGS:
+            info->flags = *arg;
+            break;
+        case IEEE80211_RADIOTAP_RATE:
+            info->rate = *arg;
+            break;
+        case IEEE80211_RADIOTAP_LOCK_QUALITY:
+            info->lock_quality = *arg;
+            break;
+        case IEEE80211_RADIOTAP_ANTENNA:
+            info->antenna = *arg;
+            break;
+        case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
+            if (info->antenna == 0) info->signal = (int8_t) *arg;
+            if (info->antenna < 4) info->ant_signal[info->antenna] = (int8_t) *arg;
+            break;
+        default:
+            break;
+    }
+}
+
+static int parse_iterator(uint8_t *header, rt_info_t *info) {
+    struct ieee80211_radiotap_iterator rti;
+    if (ieee80211_radiotap_iterator_init(&rti, (struct ieee80211_radiotap_header *) header, header[2], NULL) != 0)
+        return -1;
+    while (ieee80211_radiotap_iterator_next(&rti) == 0)
+        apply_field(info, rti.this_arg_index, rti.this_arg);
+    return 0;
+}
+
+static int parse_cached(db_radiotap_cache_t *cache, uint8_t *header, rt_info_t *info) {
+    const db_radiotap_layout_t *layout = db_radiotap_get_layout(cache, header, header[2]);
+    if (layout == NULL)
+        return -1;
+    for (int i = 0; i < layout->num_fields; i++)
+        apply_field(info, layout->fields[i].index, header + layout->fields[i].offset);
+    return 0;
+}
+
+static double elapsed_ns(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static int run(const char *name, uint8_t *header) {
+    struct timespec start_time, end_time;
+    db_radiotap_cache_t cache;
+    rt_info_t info_iter, info_cached;
+    volatile int8_t sink = 0;
+    memset(&cache, 0, sizeof(cache));
+    memset(&info_iter, 0, sizeof(info_iter));
+    memset(&info_cached, 0, sizeof(info_cached));
+
+    if (parse_iterator(header, &info_iter) < 0 || parse_cached(&cache, header, &info_cached) < 0 ||
+        memcmp(&info_iter, &info_cached, sizeof(rt_info_t)) != 0) {
+        printf("%s: results of iterator and cached layout differ!\n", name);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (int i = 0; i < ITERATIONS; i++) {
+        memset(&info_iter, 0, sizeof(info_iter));
+        parse_iterator(header, &info_iter);
+        sink += info_iter.signal;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double iter_ns = elapsed_ns(&start_time, &end_time) / ITERATIONS;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (int i = 0; i < ITERATIONS; i++) {
+        memset(&info_cached, 0, sizeof(info_cached));
+        parse_cached(&cache, header, &info_cached);
+        sink += info_cached.signal;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double cached_ns = elapsed_ns(&start_time, &end_time) / ITERATIONS;
+    printf("%-10s (%2i bytes, %i fields): iterator %6.1f ns/frame   cached layout %6.1f ns/frame   speedup %.1fx\n",
+           name, header[2], cache.layouts[0].num_fields, iter_ns, cached_ns, iter_ns / cached_ns);
+    printf("%-10s signal %i dBm, rate %i, layout cache hits %u misses %u\n", "", info_cached.signal,
+           info_cached.rate, cache.hits, cache.misses);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    printf("Radiotap parsing, %i iterations\n", ITERATIONS);
+    if (run("rtl8812au", rtl8812au_header) < 0 || run("ath9k_htc", ath9k_htc_header) < 0)
+        return 1;
+    return 0;
+}
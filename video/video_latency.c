@@ -0,0 +1,70 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * Collects per stage latency samples of the video stream and calculates percentiles for the shared memory status.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "video_latency.h"
+
+static latency_stage_t stages[DB_LATENCY_STAGE_CNT];
+
+/**
+ * @param stage One of DB_LATENCY_STAGE_*
+ * @param latency_us Latency of a single packet in that stage
+ */
+void latency_add(int stage, uint32_t latency_us) {
+    latency_stage_t *s = &stages[stage];
+    s->samples[s->cnt % LATENCY_MAX_SAMPLES] = latency_us;
+    s->cnt++;
+    if (latency_us > s->max_us) s->max_us = latency_us;
+}
+
+static int compare_uint32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Calculate the percentiles of all samples added since the last call and write them to the status. Stages without
+ * samples report zeros.
+ *
+ * @param latency_status Latency part of the ground station status (shared memory)
+ */
+void latency_update(db_video_latency_t *latency_status) {
+    for (int i = 0; i < DB_LATENCY_STAGE_CNT; i++) {
+        latency_stage_t *s = &stages[i];
+        db_latency_percentiles_t *p = &latency_status->stage[i];
+        uint32_t n = s->cnt < LATENCY_MAX_SAMPLES ? s->cnt : LATENCY_MAX_SAMPLES;
+        if (n == 0) {
+            memset(p, 0, sizeof(db_latency_percentiles_t));
+            continue;
+        }
+        qsort(s->samples, n, sizeof(uint32_t), compare_uint32);
+        p->p50_us = s->samples[(n - 1) * 50 / 100];
+        p->p95_us = s->samples[(n - 1) * 95 / 100];
+        p->p99_us = s->samples[(n - 1) * 99 / 100];
+        p->max_us = s->max_us;
+        p->sample_cnt = s->cnt;
+        s->cnt = 0;
+        s->max_us = 0;
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#ifndef DRONEBRIDGE_VIDEO_LATENCY_H
+#define DRONEBRIDGE_VIDEO_LATENCY_H
+
+#include <stdint.h>
+#include "../common/shared_memory.h"
+
+#define LATENCY_MAX_SAMPLES 1024    // per stage and update interval. Older samples get overwritten
+
+typedef struct {
+    uint32_t samples[LATENCY_MAX_SAMPLES];
+    uint32_t cnt;   // total samples added since the last update
+    uint32_t max_us;
+} latency_stage_t;
+
+void latency_add(int stage, uint32_t latency_us);
+void latency_update(db_video_latency_t *latency_status);
+
+#endif //DRONEBRIDGE_VIDEO_LATENCY_H
@@ -10,6 +10,8 @@ void lib_init_packet_buffer(packet_buffer_t *p) {
 	p->crc_correct = 0;
 	p->len = 0;
 	p->data = NULL;
+	p->rx_time_us = 0;
+	p->tx_latency_us = 0;
 }
 
 void lib_alloc_packet_buffer(packet_buffer_t *p, size_t len) {
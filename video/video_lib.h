@@ -10,11 +10,14 @@ typedef struct {
 	int crc_correct;
 	uint len; // this is the actual length of the packet stored in data
 	uint8_t *data; // this is video_packet_data_t
+	uint64_t rx_time_us; // ground: reception time (CLOCK_MONOTONIC) in timestamp mode. 0 if not received/recovered
+	uint32_t tx_latency_us; // ground: time spent on air side and in the air in timestamp mode (0 if clock not synced)
 } packet_buffer_t;
 
 typedef struct {
 	int block_num;
 	int packet_buffer_len;  // number of packets stored in packet buffer
+	int published_data_cnt; // number of data packets (in order, from the start of the block) already published early
 	packet_buffer_t *packet_buffer_list;
 } block_buffer_t;
 
@@ -23,6 +26,14 @@ typedef struct {
     uint32_t sequence_number;
 } __attribute__((packed)) video_packet_header_t;
 
+// outside of FEC. Replaces video_packet_header_t if timestamps are enabled (-T on air and ground)
+typedef struct {
+    uint32_t sequence_number;
+    uint32_t inject_time_us; // air: CLOCK_MONOTONIC (lower 32 bits) when the packet was handed to the adapters
+    uint32_t fill_wait_us; // air: time the packet waited for its block to be filled. 0 for FEC packets
+    uint32_t injection_us; // air: time between block completion and injection of this packet
+} __attribute__((packed)) video_packet_header_ts_t;
+
 // protected by FEC
 typedef struct {
 	uint32_t data_length; // length of H264 video data
@@ -38,19 +38,26 @@
 #include "../common/shared_memory.h"
 #include "../common/db_common.h"
 #include "../common/db_unix.h"
+#include "../common/db_rt.h"
 #include "../common/db_raw_receive.h"
+#include "../common/db_clock_sync.h"
+#include "../common/db_event.h"
 
 #define MAX_PACKET_LENGTH (DATA_UNI_LENGTH + RADIOTAP_LENGTH + DB_RAW_V2_HEADER_LENGTH)
 #define MAX_DATA_OR_FEC_PACKETS_PER_BLOCK 32
 #define MAX_USER_PACKET_LENGTH 1450
 
-bool keeprunning = true;
 uint8_t comm_id, frame_type, db_vid_seqnum = 0;
 unsigned int num_interfaces = 0, num_data_per_block = 8, num_fec_per_block = 4, pack_size = 1024, bitrate_op = 11, vid_adhere_80211;
 db_uav_status_t *db_uav_status;
-char adapters[DB_MAX_ADAPTERS][IFNAMSIZ];
+char adapters[DB_MAX_ADAPTERS][DB_MAX_IFNAME_LENGTH];
 db_socket_t raw_sockets[DB_MAX_ADAPTERS];
 struct timespec start_time, end_time;
+bool timestamps_enabled = false;
+db_rt_profile_t rt_profile;
+size_t video_header_length = sizeof(video_packet_header_t);
+uint64_t packet_complete_us[MAX_DATA_OR_FEC_PACKETS_PER_BLOCK]; // time a DATA packet of the current block was filled
+int param_min_packet_length = 24;
 
 volatile int recorder_running = 1;
 volatile uint32_t receive_count = 0;
@@ -62,12 +69,20 @@ typedef struct {
     packet_buffer_t *pb_list;
 } input_t;
 
+db_event_loop_t event_loop;
+input_t input;
+bool input_pollable = true;  // regular files are always readable and can not be added to epoll
+db_event_handler_t *input_handler = NULL, *input_retry_timer;
+db_unix_tcp_socket unix_server;
+db_unix_tcp_client unix_server_clients[DB_MAX_UNIX_TCP_CLIENTS];
+db_event_handler_t *unix_client_handlers[DB_MAX_UNIX_TCP_CLIENTS] = {0};
+
 static inline int TimeSpecToUSeconds(struct timespec *ts) {
     return (int) (ts->tv_sec + ts->tv_nsec / 1000.0);
 }
 
-void int_handler(int dummy) {
-    keeprunning = false;
+void on_signal(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t signo) {
+    db_event_stop(loop);
 }
 
 void write_to_unix(db_unix_tcp_client unix_server_clients[DB_MAX_UNIX_TCP_CLIENTS], uint8_t *data, ssize_t data_len) {
@@ -92,24 +107,31 @@ void write_to_unix(db_unix_tcp_client unix_server_clients[DB_MAX_UNIX_TCP_CLIENT
  * Sends a DATA or FEC block or any other data using all available adapters
  *
  * @param seq_nr Video header sequence number
- * @param data_uni_to_ground Pointer to transmission buffer
  * @param packet_data Packet payload (FEC block or DATA block + length field)
  * @param data_length payload length
+ * @param fill_wait_us Timestamp mode: Time the packet waited for the block to be filled
+ * @param block_complete_us Timestamp mode: Time the block was completed (db_clock_us())
  */
-void transmit_packet(uint32_t seq_nr, uint8_t *packet_data, uint data_length) {
-    // create pointer directly to sockets send buffer (use of DB high performance send function)
-    struct data_uni *data_to_ground = get_hp_raw_buffer(vid_adhere_80211);
-    // set video packet to payload field of raw protocol buffer
-    db_video_packet_t *db_video_p = (db_video_packet_t *) (data_to_ground->bytes);
-    db_video_p->video_packet_header.sequence_number = seq_nr;
+void transmit_packet(uint32_t seq_nr, uint8_t *packet_data, uint data_length, uint32_t fill_wait_us,
+                     uint64_t block_complete_us) {
+    // video header lives on the stack, the payload is passed by reference. Radiotap & DB headers come from the sockets
+    video_packet_header_ts_t video_header;
+    struct iovec payload_iov[2] = {
+            {.iov_base = &video_header, .iov_len = video_header_length},
+            {.iov_base = packet_data, .iov_len = data_length}
+    };
+    video_header.sequence_number = seq_nr;
     db_uav_status->injected_packet_cnt++;
-
-    //copy data to raw packet payload buffer (into video packet struct)
-    memcpy(&db_video_p->video_packet_data, packet_data, (size_t) data_length);
+    if (timestamps_enabled) {
+        uint64_t now_us = db_clock_us();
+        video_header.inject_time_us = (uint32_t) now_us;
+        video_header.fill_wait_us = fill_wait_us;
+        video_header.injection_us = (uint32_t) (now_us - block_complete_us);
+    }
     clock_gettime(CLOCK_MONOTONIC, &start_time);
     for (int i = 0; i < num_interfaces; i++) {
-        db_send_hp_div(&raw_sockets[i], DB_PORT_VIDEO, sizeof(video_packet_header_t) + data_length,
-                       update_seq_num(&db_vid_seqnum));
+        db_send_iov(&raw_sockets[i], DB_PORT_VIDEO, payload_iov, 2, update_seq_num(&db_vid_seqnum),
+                    vid_adhere_80211);
     }
     clock_gettime(CLOCK_MONOTONIC, &end_time);
     db_uav_status->injection_time_packet = TimeSpecToUSeconds(&end_time) - TimeSpecToUSeconds(&start_time);
@@ -147,15 +169,17 @@ void transmit_block(packet_buffer_t *pbl, uint32_t *seq_nr, uint packet_size) {
     int di = 0;
     int fi = 0;
     uint32_t seq_nr_tmp = *seq_nr;
+    uint64_t block_complete_us = packet_complete_us[num_data_per_block - 1];
     while (di < num_data_per_block || fi < num_fec_per_block) {
         if (di < num_data_per_block) {
-            transmit_packet(seq_nr_tmp, data_blocks[di], packet_size);
+            transmit_packet(seq_nr_tmp, data_blocks[di], packet_size,
+                            (uint32_t) (block_complete_us - packet_complete_us[di]), block_complete_us);
             seq_nr_tmp++; // every packet gets a sequence number
             di++;
         }
 
         if (fi < num_fec_per_block) {
-            transmit_packet(seq_nr_tmp, fec_pool[fi], packet_size);
+            transmit_packet(seq_nr_tmp, fec_pool[fi], packet_size, 0, block_complete_us);
             seq_nr_tmp++; // every packet gets a sequence number
             fi++;
         }
@@ -173,10 +197,11 @@ void process_command_line_args(int argc, char *argv[]) {
     num_interfaces = 0, comm_id = DEFAULT_V2_COMMID, bitrate_op = 11;
     num_data_per_block = 8, num_fec_per_block = 4, pack_size = 1024, frame_type = 1, vid_adhere_80211 = 0;
     int c;
-    while ((c = getopt(argc, argv, "n:c:d:r:f:b:t:a:")) != -1) {
+    db_rt_parse_profile(NULL, &rt_profile);
+    while ((c = getopt(argc, argv, "n:c:d:r:f:b:t:a:TP:")) != -1) {
         switch (c) {
             case 'n':
-                strncpy(adapters[num_interfaces], optarg, IFNAMSIZ);
+                strncpy(adapters[num_interfaces], optarg, DB_MAX_IFNAME_LENGTH - 1);
                 num_interfaces++;
                 break;
             case 'c':
@@ -199,6 +224,14 @@ void process_command_line_args(int argc, char *argv[]) {
             case 'a':
                 vid_adhere_80211 = (uint) strtol(optarg, NULL, 10);
                 break;
+            case 'T':
+                timestamps_enabled = true;
+                video_header_length = sizeof(video_packet_header_ts_t);
+                break;
+            case 'P':
+                if (db_rt_parse_profile(optarg, &rt_profile) < 0)
+                    abort();
+                break;
             default:
                 printf("Based of Wifibroadcast by befinitiv, based on packetspammer by Andy Green.  Licensed under GPL2\n"
                        "This tool takes a data stream via the DroneBridge long range video port and outputs it via stdout, "
@@ -215,23 +248,158 @@ void process_command_line_args(int argc, char *argv[]) {
                        "supported with Ralink chipsets)"
                        "\n\t-t [1|2] DroneBridge v2 raw protocol packet/frame type: 1=RTS, 2=DATA (CTS protection)"
                        "\n\t-a [0|1] disable/enable. Offsets the payload by some bytes so that it sits outside the "
-                       "802.11 header. Set this to 1 if you are using a non DB-Rasp Kernel!\n", 1024, DATA_UNI_LENGTH);
+                       "802.11 header. Set this to 1 if you are using a non DB-Rasp Kernel!"
+                       "\n\t-T Timestamped video headers for latency measurement on the ground. Needs to match with rx."
+                       "\n\t-P Real-time profile <option>[=<value>],... with options fifo=<prio>|rr=<prio>, "
+                       "cpu=<n>[+<n>], mlock, prefault=<kB>, busypoll=<us>. e.g. fifo=40,cpu=2,mlock\n",
+                       1024, DATA_UNI_LENGTH);
                 abort();
         }
     }
 }
 
+/**
+ * Read from stdin into the current packet buffer. Sends the block once it is complete
+ *
+ * @return Number of bytes read. 0 on EOF
+ */
+ssize_t read_input() {
+    // get a packet buffer from list
+    packet_buffer_t *pb = input.pb_list + input.curr_pb;
+    // if the buffer is fresh we add a payload header
+    if (pb->len == 0) {
+        pb->len += sizeof(uint32_t); //make space for a length field (will be filled later)
+    }
+    //read the data into packet buffer (inside block)
+    ssize_t inl = read(input.fd, pb->data + pb->len, pack_size - pb->len);
+    if (inl < 0 || inl > pack_size - pb->len) {
+        perror("DB_VIDEO_AIR: reading stdin\n");
+        abort();
+    }
+    if (inl == 0) // EOF
+        return 0;
+    write_to_unix(unix_server_clients, &pb->data[pb->len], inl);    // write received data to UNIX clients
+    pb->len += inl;
+    // check if this packet is finished
+    if (pb->len >= param_min_packet_length) {
+        // fill packet buffer length field
+        video_packet_data_t *video_p_data = (video_packet_data_t *) (pb->data);
+        video_p_data->data_length = pb->len;
+        if (timestamps_enabled) packet_complete_us[input.curr_pb] = db_clock_us();
+        // check if this block is finished
+        if (input.curr_pb == num_data_per_block - 1) {
+            // transmit entire block - consisting of packets that get sent interleaved
+            // always transmit/FEC encode packets of length pack_size, even if payload (data_length) is less
+            transmit_block(input.pb_list, &(input.seq_nr), pack_size); // input.pb_list is video_packet_data_t[num_fec + num_data]
+            if (db_uav_status->injected_block_cnt % 500 == 1) {
+                LOG_SYS_STD(LOG_INFO,
+                            "DB_VIDEO_AIR: \ttried to inject %i packets, maybe failed %i, injection time/packet %ius, "
+                            "FEC encoding time %ius         \n",
+                            db_uav_status->injected_packet_cnt, db_uav_status->injection_fail_cnt,
+                            db_uav_status->injection_time_packet, db_uav_status->encoding_time);
+            }
+
+            input.curr_pb = 0;
+        } else {
+            input.curr_pb++;
+        }
+    }
+    return inl;
+}
+
+/**
+ * Nothing left to read. Stop watching stdin and check again in 500ms whether a data source got connected
+ */
+void pause_input(db_event_loop_t *loop) {
+    LOG_SYS_STD(LOG_ERR,
+                "\nDB_VIDEO_AIR: Warning: Lost connection to stdin. Please make sure that a data source is connected");
+    if (input_handler != NULL) {
+        db_event_remove(loop, input_handler);
+        input_handler = NULL;
+    }
+    db_event_timer_arm(input_retry_timer, 500000, 0);
+}
+
+void on_input(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    if (read_input() == 0)
+        pause_input(loop);
+}
+
+/**
+ * stdin is a regular file. It never blocks, so keep reading it as deferred work to still serve the other events
+ */
+void on_input_file(db_event_loop_t *loop, void *arg) {
+    if (read_input() == 0)
+        pause_input(loop);
+    else
+        db_event_defer(loop, on_input_file, NULL);
+}
+
+void resume_input(db_event_loop_t *loop) {
+    if (!input_pollable) {
+        db_event_defer(loop, on_input_file, NULL);
+        return;
+    }
+    input_handler = db_event_add_io(loop, input.fd, EPOLLIN, on_input, NULL);
+    if (input_handler == NULL)
+        db_event_stop(loop);
+}
+
+void on_input_retry(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    resume_input(loop);
+}
+
+/**
+ * Unix clients only receive. Readable means they disconnected
+ */
+void on_unix_client(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int t = (int) (intptr_t) handler->arg;
+    uint8_t some_buff[1];
+    ssize_t received = recv(unix_server_clients[t].client_sock, some_buff, 1, 0);  // dummy buffer
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        LOG_SYS_STD(LOG_INFO, "DB_VIDEO_AIR: Unix client disconnected\n");
+        db_event_remove(loop, handler);
+        unix_client_handlers[t] = NULL;
+        close(unix_server_clients[t].client_sock);
+        unix_server_clients[t].client_sock = -1;
+    }
+}
+
+void on_unix_connect(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    unsigned int addrlen = sizeof(unix_server.addr);
+    int new_client = accept(unix_server.socket, (struct sockaddr *) &unix_server.addr, &addrlen);
+    if (new_client < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            LOG_SYS_STD(LOG_ERR, "DB_VIDEO_AIR: Error (%s) accepting new unix client on %s!\n", strerror(errno),
+                        DB_UNIX_DOMAIN_VIDEO_PATH);
+        return;
+    }
+    for (int t = 0; t < DB_MAX_UNIX_TCP_CLIENTS; t++) {
+        if (unix_server_clients[t].client_sock < 0 || t == (DB_MAX_UNIX_TCP_CLIENTS - 1)) {
+            if (unix_client_handlers[t] != NULL) {   // all taken: replace the last client
+                db_event_remove(loop, unix_client_handlers[t]);
+                close(unix_server_clients[t].client_sock);
+            }
+            unix_server_clients[t].client_sock = new_client;
+            set_socket_nonblocking(&unix_server_clients[t].client_sock);
+            unix_server_clients[t].addr = unix_server.addr;
+            unix_client_handlers[t] = db_event_add_io(loop, new_client, EPOLLIN, on_unix_client, (void *) (intptr_t) t);
+            LOG_SYS_STD(LOG_INFO, "DB_VIDEO_AIR: New unix client connected\n");
+            break;
+        }
+    }
+}
+
 // Transmission scheme: 4 Data, 2 FEC packet per block
 // |-------------- Block -----------------|
 // |Data - FEC - Data - FEC - Data - Data |
 //  1024   1024  1024   1024  1024   1024
 
 int main(int argc, char *argv[]) {
-    signal(SIGINT, int_handler);
+    const int signals[] = {SIGINT, SIGTERM};
     setpriority(PRIO_PROCESS, 0, -10);
     process_command_line_args(argc, argv);
 
-    input_t input;
     // DEBUG
     db_uav_status = &(db_uav_status_t) {};
     // db_uav_status = db_uav_status_memory_open();
@@ -240,17 +408,15 @@ int main(int argc, char *argv[]) {
     db_uav_status->injection_time_packet = 0, db_uav_status->wifi_adapter_cnt = num_interfaces;
     db_uav_status->injected_packet_cnt = 0;
     db_uav_status->encoding_time = 0;
-    int param_min_packet_length = 24;
-    uint8_t some_buff[1];
 
     if (num_interfaces == 0) {
         LOG_SYS_STD(LOG_ERR, "DB_VIDEO_AIR: No interface specified. Aborting\n");
         abort();
     }
 
-    if (pack_size > DATA_UNI_LENGTH) {
-        LOG_SYS_STD(LOG_ERR, "DB_VIDEO_AIR; Packet length is limited to %d bytes (you requested %d bytes)\n",
-                    DATA_UNI_LENGTH, pack_size);
+    if (pack_size > DATA_UNI_LENGTH - video_header_length) {
+        LOG_SYS_STD(LOG_ERR, "DB_VIDEO_AIR; Packet length is limited to %zu bytes (you requested %d bytes)\n",
+                    DATA_UNI_LENGTH - video_header_length, pack_size);
         abort();
     }
 
@@ -268,7 +434,16 @@ int main(int argc, char *argv[]) {
         abort();
     }
 
+    if (db_event_loop_init(&event_loop) < 0 || db_event_add_signals(&event_loop, signals, 2, on_signal, NULL) == NULL)
+        exit(-1);
+    input_retry_timer = db_event_add_timer(&event_loop, on_input_retry, NULL);
+    if (input_retry_timer == NULL)
+        exit(-1);
+
     input.fd = STDIN_FILENO;
+    struct stat input_stat;
+    if (fstat(input.fd, &input_stat) == 0 && S_ISREG(input_stat.st_mode))
+        input_pollable = false;
     input.seq_nr = 0;
     input.curr_pb = 0;
     input.pb_list = lib_alloc_packet_buffer_list(num_data_per_block, MAX_PACKET_LENGTH);
@@ -286,102 +461,34 @@ int main(int argc, char *argv[]) {
     for (int k = 0; k < num_interfaces; ++k) {
         raw_sockets[k] = open_db_socket(adapters[k], comm_id, 'm', bitrate_op, DB_DIREC_GROUND, DB_PORT_VIDEO,
                                         frame_type);
-        strncpy(db_uav_status->adapter[k].name, adapters[k], IFNAMSIZ);
+        db_shm_set_adapter_name(db_uav_status->adapter[k].name, adapters[k]);
     }
 // -------------------------------
 // Setting up unix tcp server for local apps to access data received via pipe
 // -------------------------------
-    db_unix_tcp_socket unix_server = db_create_unix_tcpserver_sock(DB_UNIX_DOMAIN_VIDEO_PATH);
+    unix_server = db_create_unix_tcpserver_sock(DB_UNIX_DOMAIN_VIDEO_PATH);
     set_socket_nonblocking(&unix_server.socket);
-    db_unix_tcp_client unix_server_clients[DB_MAX_UNIX_TCP_CLIENTS];
-    struct sockaddr_un new_addr;
-    unsigned int addrlen = sizeof(unix_server.addr);
     for (int i = 0; i < DB_MAX_UNIX_TCP_CLIENTS; i++) unix_server_clients[i].client_sock = -1;
+    if (db_event_add_io(&event_loop, unix_server.socket, EPOLLIN, on_unix_connect, NULL) == NULL)
+        exit(-1);
+    resume_input(&event_loop);
 
+    db_rt_apply(&rt_profile, "DB_VIDEO_AIR");
     LOG_SYS_STD(LOG_INFO, "DB_VIDEO_AIR: started!\n");
-    while (keeprunning) {
-        // do some unix server stuff - accept new clients
-        int new_client = accept(unix_server.socket, (struct sockaddr *) &unix_server.addr, &addrlen);
-        if (new_client > 0) {
-            for (int t = 0; t < DB_MAX_UNIX_TCP_CLIENTS; t++) {
-                if (unix_server_clients[t].client_sock < 0 || t == (DB_MAX_UNIX_TCP_CLIENTS - 1)) {
-                    unix_server_clients[t].client_sock = new_client;
-                    set_socket_nonblocking(&unix_server_clients[t].client_sock);
-                    unix_server_clients[t].addr = unix_server.addr;
-                    LOG_SYS_STD(LOG_INFO, "DB_VIDEO_AIR: New unix client connected\n");
-                    break;
-                }
-            }
-        } else if (errno != EAGAIN || errno != EWOULDBLOCK) {
-            LOG_SYS_STD(LOG_ERR, "DB_VIDEO_AIR: Error (%s) accepting new unix client on %s!\n", strerror(errno),
-                    DB_UNIX_DOMAIN_VIDEO_PATH);
-        }
-
-        // get a packet buffer from list
-        packet_buffer_t *pb = input.pb_list + input.curr_pb;
-        // if the buffer is fresh we add a payload header
-        if (pb->len == 0) {
-            pb->len += sizeof(uint32_t); //make space for a length field (will be filled later)
-        }
-        //read the data into packet buffer (inside block)
-        ssize_t inl = read(input.fd, pb->data + pb->len, pack_size - pb->len);
-        if (inl < 0 || inl > pack_size - pb->len) {
-            perror("DB_VIDEO_AIR: reading stdin\n");
-            abort();
-        }
-        if (inl == 0) { // EOF
-            LOG_SYS_STD(LOG_ERR,
-                        "\nDB_VIDEO_AIR: Warning: Lost connection to stdin. Please make sure that a data source is connected");
-            usleep((__useconds_t) 5e5);
-            continue;
-        }
-        write_to_unix(unix_server_clients, &pb->data[pb->len], inl);    // write received data to UNIX clients
-        pb->len += inl;
-        // check if this packet is finished
-        if (pb->len >= param_min_packet_length) {
-            // fill packet buffer length field
-            video_packet_data_t *video_p_data = (video_packet_data_t *) (pb->data);
-            video_p_data->data_length = pb->len;
-            // check if this block is finished
-            if (input.curr_pb == num_data_per_block - 1) {
-                // transmit entire block - consisting of packets that get sent interleaved
-                // always transmit/FEC encode packets of length pack_size, even if payload (data_length) is less
-                transmit_block(input.pb_list, &(input.seq_nr), pack_size); // input.pb_list is video_packet_data_t[num_fec + num_data]
-                if (db_uav_status->injected_block_cnt % 500 == 1) {
-                    LOG_SYS_STD(LOG_INFO,
-                                "DB_VIDEO_AIR: \ttried to inject %i packets, maybe failed %i, injection time/packet %ius, "
-                                "FEC encoding time %ius         \n",
-                                db_uav_status->injected_packet_cnt, db_uav_status->injection_fail_cnt,
-                                db_uav_status->injection_time_packet, db_uav_status->encoding_time);
-                }
+    db_event_run(&event_loop);
 
-                input.curr_pb = 0;
-                // send to unix socket clients
-            } else {
-                input.curr_pb++;
-            }
-            // detect disconnections of unix clients
-            for (int t = 0; t < DB_MAX_UNIX_TCP_CLIENTS; t++) {
-                if (unix_server_clients[t].client_sock > 0) {
-                    ssize_t received = recv(unix_server_clients[t].client_sock, some_buff, 1, 0);  // dummy buffer
-                    if (received == 0) {
-                        LOG_SYS_STD(LOG_INFO, "DB_VIDEO_AIR: Unix client disconnected\n");
-                        close(unix_server_clients[t].client_sock);
-                        unix_server_clients[t].client_sock = -1;
-                    }
-                }
-            }
-        }
-    }
+    db_event_report(&event_loop, "DB_VIDEO_AIR");
+    db_event_loop_close(&event_loop);
     for (int i = 0; i < DB_MAX_ADAPTERS; i++) {
         if (raw_sockets[i].db_socket > 0)
-            close(raw_sockets[i].db_socket);
+            close_db_socket(&raw_sockets[i]);
     }
     for (int i = 0; i < DB_MAX_UNIX_TCP_CLIENTS; i++) {
         if (unix_server_clients[i].client_sock > 0)
             close(unix_server_clients[i].client_sock);
     }
     close(unix_server.socket);
+    db_rt_report("DB_VIDEO_AIR");
     LOG_SYS_STD(LOG_INFO, "DB_VIDEO_AIR: Terminated!\n");
     return (0);
 }
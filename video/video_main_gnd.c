@@ -18,9 +18,10 @@
 /**
  * Program to receive a continuous stream of data from the UAV unit. Stream is protected by FEC. This program decodes
  * the FEC data and outputs the payload to various end-points. Endpoints are UDP (192.192.2.1) and a UNIX domain socket
- * on /tmp/db_video_out (see db_protocol.h). The UDP destination address can be changed by sending a UDP packet of any
- * content to this application on port 5000. The source address of that packet will be the new destination address.
- * It is called a video destination hint packet.
+ * on /tmp/db_video_out (see db_protocol.h). A client subscribes to the UDP stream by sending a UDP packet of any
+ * content to this application on port 5000. It is called a video destination hint packet. The source IP of that packet
+ * is added to the list of subscribers. Clients must repeat the hint periodically or they time out (-t). Fixed IPs (-i)
+ * and a multicast group (-m) never time out. Every subscriber receives the same decoded stream.
  */
 
 #include <stdbool.h>
@@ -36,12 +37,19 @@
 #include <sys/un.h>
 #include "fec.h"
 #include "video_lib.h"
+#include "video_udp_out.h"
+#include "h264_filter.h"
+#include "video_latency.h"
 #include "../common/shared_memory.h"
 #include "../common/db_raw_receive.h"
 #include "../common/radiotap/radiotap_iter.h"
+#include "../common/db_radiotap.h"
 #include "../common/db_raw_send_receive.h"
 #include "../common/db_common.h"
 #include "../common/db_unix.h"
+#include "../common/db_clock_sync.h"
+#include "../common/db_rt.h"
+#include "../common/db_event.h"
 
 #define MAX_PACKET_LENGTH 4192
 #define MAX_USER_PACKET_LENGTH 1450
@@ -54,30 +62,60 @@ int dest_port_video, unix_sock;
 uint8_t comm_id, num_data_per_block, num_fec_per_block;
 uint8_t lr_buffer[MAX_DB_DATA_LENGTH] = {0};
 bool pass_through, udp_enabled = true, output_to_usb_bridge = false, send_to_std_out = true;
-volatile bool keeprunning = true;
 int param_block_buffers = 1;
 int pack_size = MAX_USER_PACKET_LENGTH;
-db_gnd_status_t *db_gnd_status = NULL;
+db_gnd_status_t gnd_status_local = {0};
+db_gnd_status_t *db_gnd_status = &gnd_status_local;   // counters are accumulated locally and published periodically
+db_gnd_status_t *db_gnd_status_shm = NULL;
+db_link_history_t *link_history = NULL;
+int history_resolution_ms = 0;  // 0 = link history disabled
+uint64_t next_history_sample_us = 0;
+uint64_t history_received_bytes = 0;
+db_gnd_status_t history_prev;   // counters at the end of the previous interval
 int max_block_num = -1, udp_socket;
-struct sockaddr_in client_video_addr;
 struct sockaddr_un unix_socket_addr;
 long long prev_time = 0;
 long long now = 0;
 int bytes_written = 0;
 socklen_t server_length = sizeof(struct sockaddr_un);
 
-char adapters[DB_MAX_ADAPTERS][IFNAMSIZ];
+char adapters[DB_MAX_ADAPTERS][DB_MAX_IFNAME_LENGTH];
 char overwrite_ip[INET6_ADDRSTRLEN];
-bool fixed_ip = false;
+char multicast_ip[INET6_ADDRSTRLEN];
+bool fixed_ip = false, multicast_enabled = false, early_release = false;
+uint8_t data_packet_pos[MAX_DATA_OR_FEC_PACKETS_PER_BLOCK]; // position of the n-th data packet inside a block
+int h264_filter_mode = 0; // 0 = off, 1 = drop damaged NAL units, 2 = additionally hold output until next IDR
+h264_filter_t h264_filter;
+int last_retired_block_num = -1;
+long long subscriber_timeout = DEFAULT_SUBSCRIBER_TIMEOUT_MS;
+bool timestamps_enabled = false;
+db_rt_profile_t rt_profile;
+size_t video_header_length = sizeof(video_packet_header_t);
+bool is_data_packet[2 * MAX_DATA_OR_FEC_PACKETS_PER_BLOCK]; // DATA/FEC flag of every packet position inside a block
+db_clock_sync_t clock_sync;
+db_socket_t status_sockets[DB_MAX_ADAPTERS];
+uint8_t status_seq_num = 0;
+
+typedef struct {
+    uint64_t start_us; // time the packet was handed to the outputs
+    uint32_t tx_latency_us; // air side + air + decode latency. 0 if clocks are not synced
+} output_latency_t;
+output_latency_t pending_output[MAX_DATA_OR_FEC_PACKETS_PER_BLOCK]; // packets handed to outputs but not flushed yet
+int pending_output_cnt = 0;
 
 typedef struct {
     int selectable_fd;
+    db_socket_t db_sock;
     int n80211HeaderLength;
+    db_radiotap_cache_t radiotap_cache;
 } monitor_interface_t;
 
+db_event_loop_t event_loop;
+monitor_interface_t interfaces[MAX_PENUMBRA_INTERFACES];
+block_buffer_t *block_buffer_list;
 
-void int_handler(int dummy) {
-    keeprunning = false;
+void on_signal(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t signo) {
+    db_event_stop(loop);
 }
 
 long long current_timestamp() {
@@ -95,9 +133,6 @@ void init_outputs() {
     if (pass_through) dest_port_video = APP_PORT_VIDEO_FEC;
     if (udp_enabled) {
         udp_socket = socket(AF_INET, SOCK_DGRAM, 0);
-        client_video_addr.sin_family = AF_INET;
-        client_video_addr.sin_addr.s_addr = inet_addr(DB_AP_CLIENT_IP);
-        client_video_addr.sin_port = htons(dest_port_video);
         int optval = 1;
         setsockopt(udp_socket, SOL_SOCKET, SO_REUSEADDR, (const void *) &optval, sizeof(int));
 
@@ -109,11 +144,15 @@ void init_outputs() {
         if ((bind(udp_socket, (struct sockaddr *) &udp_server_addr, sizeof(udp_server_addr))) != 0) {
             perror("DB_VIDEO_GND: UDP socket bind failed ");
         }
+        udp_out_init(udp_socket, dest_port_video, subscriber_timeout);
+        if (fixed_ip) udp_out_add_permanent(overwrite_ip);
+        if (multicast_enabled) udp_out_add_permanent(multicast_ip);
     }
 }
 
 /**
- * Write final data to various outputs (UDP, (TCP) etc.)
+ * Write final data to various outputs (UDP, (TCP) etc.). UDP data is only queued. Call flush_outputs() once all
+ * packets of a block are published and before the buffers get reused.
  *
  * @param data Data to publish
  * @param message_length Lenght of data
@@ -133,12 +172,8 @@ void publish_data(uint8_t *data, uint32_t message_length, bool fec_decoded) {
 //                LOG_SYS_STD(LOG_ERR, "DB_VIDEO_GND: Error sending to unix domain - might lost a packet\n");
         }
     }
-    if (udp_enabled) {
-        if (sendto(udp_socket, data, message_length, 0, (struct sockaddr *) &client_video_addr,
-                   sizeof(client_video_addr)) < message_length)
-            LOG_SYS_STD(LOG_ERR, "DB_VIDEO_GND: Not all data sent via UDP (msg size %ui) > %s\n", message_length,
-                        strerror(errno));
-    }
+    if (udp_enabled)
+        udp_out_queue(data, message_length);
     if (send_to_std_out && fec_decoded) {
         // only output decoded fec packets to stdout so that video player can read data stream directly
         if (write(STDOUT_FILENO, data, message_length) < 0)
@@ -154,6 +189,106 @@ void publish_data(uint8_t *data, uint32_t message_length, bool fec_decoded) {
     }
 }
 
+/**
+ * Send all queued UDP packets to all subscribers
+ */
+void flush_outputs() {
+    if (udp_enabled) udp_out_flush();
+    if (pending_output_cnt > 0) {
+        uint64_t now_us = db_clock_us();
+        for (int i = 0; i < pending_output_cnt; i++) {
+            uint32_t output_us = (uint32_t) (now_us - pending_output[i].start_us);
+            latency_add(DB_LATENCY_STAGE_OUTPUT, output_us);
+            if (pending_output[i].tx_latency_us > 0)
+                latency_add(DB_LATENCY_STAGE_TOTAL, pending_output[i].tx_latency_us + output_us);
+        }
+        pending_output_cnt = 0;
+    }
+}
+
+/**
+ * Timestamp mode: Record the latency of the air side stages and the air stage of a received DATA packet
+ *
+ * @param pb Packet buffer the packet was stored in
+ * @param ts_header Timestamped video header of the packet
+ * @param rx_time_us Time the packet was received (db_clock_us())
+ */
+void latency_packet_received(packet_buffer_t *pb, video_packet_header_ts_t *ts_header, uint64_t rx_time_us) {
+    pb->rx_time_us = rx_time_us;
+    pb->tx_latency_us = 0;
+    latency_add(DB_LATENCY_STAGE_FILL_WAIT, ts_header->fill_wait_us);
+    latency_add(DB_LATENCY_STAGE_INJECTION, ts_header->injection_us);
+    if (clock_sync.synced) {
+        // convert injection time to ground clock. Only use differences since the 32 bit timestamps wrap every 71 min
+        uint32_t inject_time_gnd = ts_header->inject_time_us - (uint32_t) clock_sync.offset_us;
+        int32_t air_us = (int32_t) ((uint32_t) rx_time_us - inject_time_gnd);
+        if (air_us < 0) air_us = 0; // offset has an error of up to RTT/2
+        latency_add(DB_LATENCY_STAGE_AIR, (uint32_t) air_us);
+        pb->tx_latency_us = ts_header->fill_wait_us + ts_header->injection_us + (uint32_t) air_us;
+    }
+}
+
+/**
+ * Timestamp mode: A DATA packet gets handed to the outputs. Recovered packets carry no timestamp and are ignored.
+ */
+void latency_packet_output(packet_buffer_t *pb) {
+    if (!timestamps_enabled || pb->rx_time_us == 0)
+        return;
+    uint64_t now_us = db_clock_us();
+    uint32_t decode_us = (uint32_t) (now_us - pb->rx_time_us);
+    latency_add(DB_LATENCY_STAGE_DECODE, decode_us);
+    if (pending_output_cnt < MAX_DATA_OR_FEC_PACKETS_PER_BLOCK) {
+        pending_output[pending_output_cnt].start_us = now_us;
+        pending_output[pending_output_cnt].tx_latency_us = pb->tx_latency_us > 0 ? pb->tx_latency_us + decode_us : 0;
+        pending_output_cnt++;
+    }
+}
+
+/**
+ * Sink of the H.264 filter. Splits complete NAL units into packets of max. pack_size for UDP
+ */
+void publish_filtered_nal(uint8_t *data, uint32_t length) {
+    uint32_t offset = 0;
+    while (offset < length) {
+        uint32_t chunk = (length - offset) > pack_size ? (uint32_t) pack_size : (length - offset);
+        publish_data(data + offset, chunk, true);
+        offset += chunk;
+    }
+    flush_outputs(); // the filter reuses the buffer
+}
+
+/**
+ * NAL units were dropped by the H.264 filter. Signal the gap to UDP subscribers via an empty datagram
+ */
+void signal_video_gap() {
+    if (udp_enabled) {
+        udp_out_queue(NULL, 0);
+        udp_out_flush();
+    }
+}
+
+/**
+ * Output a decoded DATA packet. Passes it through the H.264 filter if enabled.
+ *
+ * @param data Video data without the data_length field
+ * @param length Length of the video data
+ */
+void output_data_packet(uint8_t *data, uint32_t length) {
+    if (h264_filter_mode)
+        h264_filter_push(&h264_filter, data, length);
+    else
+        publish_data(data, length, true);
+}
+
+/**
+ * A DATA packet could not be recovered. Only the H.264 filter cares, otherwise the packet is simply missing (or
+ * published damaged).
+ */
+void output_data_lost() {
+    if (h264_filter_mode)
+        h264_filter_mark_loss(&h264_filter);
+}
+
 void block_buffer_list_reset(block_buffer_t *block_buffer_list, int block_buffer_list_len) {
     int i;
     block_buffer_t *rb = block_buffer_list;
@@ -161,6 +296,7 @@ void block_buffer_list_reset(block_buffer_t *block_buffer_list, int block_buffer
     for (i = 0; i < block_buffer_list_len; ++i) {
         rb->block_num = -1;
         rb->packet_buffer_len = 0;
+        rb->published_data_cnt = 0;
 
         int j;
         packet_buffer_t *p = rb->packet_buffer_list;
@@ -168,6 +304,7 @@ void block_buffer_list_reset(block_buffer_t *block_buffer_list, int block_buffer
             p->valid = 0;
             p->crc_correct = 0;
             p->len = 0;
+            p->rx_time_us = 0;
             p++;
         }
 
@@ -176,19 +313,68 @@ void block_buffer_list_reset(block_buffer_t *block_buffer_list, int block_buffer
 }
 
 /**
- * Takes a stream of payload (FEC & DATA) and does error correction publishing the corrected data in the end
+ * The air unit interleaves DATA and FEC packets inside a block (D F D F ... D D). Calculate the position of each DATA
+ * packet inside the block so that we can check for received DATA packets without splitting the whole block.
+ */
+void init_data_packet_positions() {
+    uint di = 0, fi = 0, i = 0;
+    while (di < num_data_per_block || fi < num_fec_per_block) {
+        if (di < num_data_per_block) {
+            is_data_packet[i] = true;
+            data_packet_pos[di++] = (uint8_t) i++;
+        }
+        if (fi < num_fec_per_block) {
+            is_data_packet[i] = false;
+            fi++;
+            i++;
+        }
+    }
+}
+
+/**
+ * Early release: Publish all DATA packets of the block that were received correctly and whose predecessors inside the
+ * block were published already. Keeps the output in order. Packets after a gap wait for the block to be retired and
+ * get recovered by FEC.
+ *
+ * @param rbb Block buffer that just received a new packet
+ */
+void publish_in_order_packets(block_buffer_t *rbb) {
+    bool published = false;
+    while (rbb->published_data_cnt < num_data_per_block) {
+        packet_buffer_t *pb = &rbb->packet_buffer_list[data_packet_pos[rbb->published_data_cnt]];
+        if (!pb->valid || !pb->crc_correct)
+            break;
+        video_packet_data_t *data_packet = (video_packet_data_t *) pb->data;
+        if (data_packet->data_length > pack_size)
+            break; // let the block decoding handle it
+        latency_packet_output(pb);
+        output_data_packet(pb->data + 4, data_packet->data_length - 4);
+        rbb->published_data_cnt++;
+        published = true;
+    }
+    if (published) flush_outputs();
+}
+
+/**
+ * Takes a stream of payload (FEC & DATA) and does error correction publishing the corrected data in the end.
+ * With early release enabled, DATA packets are published as soon as all preceding DATA packets of the block are
+ * available. FEC is then only used to fill the gaps.
  *
  * @param data: The payload of raw protocol (a db_video_packet_t)
  * @param data_len: Length of the payload
  * @param crc_correct: Was the FCF of the raw packet OK
  * @param block_buffer_list: An array of block_buffer_t structs
+ * @param rx_time_us: Reception time of the packet (db_clock_us()). Only used in timestamp mode
  */
-void process_video_payload(uint8_t *data, uint16_t data_len, int crc_correct, block_buffer_t *block_buffer_list) {
+void process_video_payload(uint8_t *data, uint16_t data_len, int crc_correct, block_buffer_t *block_buffer_list,
+                           uint64_t rx_time_us) {
     uint block_num;
     uint packet_num;
     bool all_data_avail = false;    // indicator for second iteration inited by GOTO jump when full block was received
     int i;
     db_video_packet_t *db_video_packet = (db_video_packet_t *) data;
+    if (data_len <= video_header_length)
+        return;
 
     //if aram_data_packets_per_block+num_fec_per_block would be limited to powers of two, this could be replaced by a logical AND operation
     block_num = db_video_packet->video_packet_header.sequence_number / (num_data_per_block + num_fec_per_block);
@@ -209,6 +395,8 @@ void process_video_payload(uint8_t *data, uint16_t data_len, int crc_correct, bl
                         "(max_block_num = %x) (if there was no tx restart, increase window size via -d)\n",
                         block_num, max_block_num);
             block_buffer_list_reset(block_buffer_list, param_block_buffers);
+            last_retired_block_num = -1;
+            output_data_lost();
         }
         //first, find the minimum block num in the buffers list. this will be the block that we replace
         int min_block_num = INT_MAX;
@@ -224,9 +412,13 @@ void process_video_payload(uint8_t *data, uint16_t data_len, int crc_correct, bl
 
         packet_buffer_t *packet_buffer_list = block_buffer_list[min_block_num_idx].packet_buffer_list;
         int last_block_num = block_buffer_list[min_block_num_idx].block_num;
+        int already_published = block_buffer_list[min_block_num_idx].published_data_cnt;
 
         if (last_block_num != -1) {
             db_gnd_status->received_block_cnt++;
+            if (last_retired_block_num != -1 && last_block_num > last_retired_block_num + 1)
+                output_data_lost(); // entire blocks are missing in between
+            last_retired_block_num = last_block_num;
 
             //we have both pointers to the packet buffers (to get information about crc and vadility) and raw data pointers for fec_decode
             packet_buffer_t *data_pkgs[MAX_DATA_OR_FEC_PACKETS_PER_BLOCK];
@@ -338,24 +530,31 @@ void process_video_payload(uint8_t *data, uint16_t data_len, int crc_correct, bl
                 //decode data and publish it
                 fec_decode(pack_size, data_blocks, num_data_per_block, fec_blocks, fec_block_nos, erased_blocks,
                            nr_fec_blocks);
-                for (i = 0; i < num_data_per_block; ++i) {
+                for (i = already_published; i < num_data_per_block; ++i) {
                     video_packet_data_t *vpd_corrected = (video_packet_data_t *) data_blocks[i];
-                    if (!reconstruction_failed || data_pkgs[i]->valid) {
+                    if (h264_filter_mode && reconstruction_failed &&
+                        !(data_pkgs[i]->valid && data_pkgs[i]->crc_correct)) {
+                        // do not feed damaged or zero filled data into the H.264 filter
+                        output_data_lost();
+                    } else if (!reconstruction_failed || data_pkgs[i]->valid) {
                         //if reconstruction did fail, the data_length value is undefined. better limit it to some sensible value
                         if (vpd_corrected->data_length > pack_size) {
                             vpd_corrected->data_length = (uint32_t) pack_size;
                         }
                         // do not publish the data_length field of video_packet_data_t struct
-                        publish_data(data_blocks[i] + 4, vpd_corrected->data_length - 4, true);
+                        latency_packet_output(data_pkgs[i]);
+                        output_data_packet(data_blocks[i] + 4, vpd_corrected->data_length - 4);
                     }
                 }
             } else {
                 // All data packets received correctly - no need for FEC
-                for (int w = 0; w < num_data_per_block; ++w) {
+                for (int w = already_published; w < num_data_per_block; ++w) {
                     video_packet_data_t *data_packet = (video_packet_data_t *) data_blocks[w];
-                    publish_data(data_blocks[w] + 4, data_packet->data_length - 4, true);
+                    latency_packet_output(data_pkgs[w]);
+                    output_data_packet(data_blocks[w] + 4, data_packet->data_length - 4);
                 }
             }
+            flush_outputs();
 
 
             //reset buffers
@@ -364,10 +563,12 @@ void process_video_payload(uint8_t *data, uint16_t data_len, int crc_correct, bl
                 p->valid = 0;
                 p->crc_correct = 0;
                 p->len = 0;
+                p->rx_time_us = 0;
             }
         }
 
         block_buffer_list[min_block_num_idx].packet_buffer_len = 0;
+        block_buffer_list[min_block_num_idx].published_data_cnt = 0;
         block_buffer_list[min_block_num_idx].block_num = block_num;
         max_block_num = block_num;
     }
@@ -391,12 +592,15 @@ void process_video_payload(uint8_t *data, uint16_t data_len, int crc_correct, bl
 
         //only overwrite packets where the checksum is not yet correct. otherwise the packets are already received correctly
         if (packet_buffer_list[packet_num].crc_correct == 0) {
-            memcpy(packet_buffer_list[packet_num].data, data + sizeof(video_packet_header_t),
-                   data_len - sizeof(video_packet_header_t));
-            packet_buffer_list[packet_num].len = (uint) (data_len - sizeof(video_packet_header_t));
+            memcpy(packet_buffer_list[packet_num].data, data + video_header_length, data_len - video_header_length);
+            packet_buffer_list[packet_num].len = (uint) (data_len - video_header_length);
             packet_buffer_list[packet_num].valid = 1;
             packet_buffer_list[packet_num].crc_correct = crc_correct;
+            if (timestamps_enabled && crc_correct && is_data_packet[packet_num])
+                latency_packet_received(&packet_buffer_list[packet_num], (video_packet_header_ts_t *) data, rx_time_us);
             rbb->packet_buffer_len++;
+            if (early_release)
+                publish_in_order_packets(rbb);
         }
     }
     // Check if we got all possible packets of a block already and decode, no need to wait for a packet of the next block to indicate
@@ -415,48 +619,57 @@ void process_video_payload(uint8_t *data, uint16_t data_len, int crc_correct, bl
  * @param adapter_no
  */
 void process_packet(monitor_interface_t *interface, block_buffer_t *block_buffer_list, int adapter_no) {
-    struct ieee80211_radiotap_iterator rti;
-
     uint8_t payload_buffer[DATA_UNI_LENGTH]; // contains payload of raw protocol (video header + data = db_video_packet)
     uint16_t radiotap_length = 0;
     int checksum_correct = 1;
     uint8_t current_antenna_indx = 0, seq_num_video = 0;
     uint16_t message_length;
 
-    // receive
-    ssize_t l = recv(interface->selectable_fd, lr_buffer, MAX_DB_DATA_LENGTH, 0);
+    // receive. In timestamp mode use the time the frame arrived at the kernel, not the time we got to read it
+    db_rx_timestamp_t rx_timestamp = {0};
+    ssize_t l;
+    if (timestamps_enabled)
+        l = db_recv_ts(interface->selectable_fd, lr_buffer, MAX_DB_DATA_LENGTH, &rx_timestamp);
+    else
+        l = db_recv(interface->selectable_fd, lr_buffer, MAX_DB_DATA_LENGTH);
     int err = errno;
+    uint64_t rx_time_us = rx_timestamp.rx_time_us;
     if (l > 0) {
         db_gnd_status->received_packet_cnt++;
+        history_received_bytes += l;
         message_length = get_db_payload(lr_buffer, l, payload_buffer, &seq_num_video, &radiotap_length);
         if (pass_through) {
             // Do not decode using FEC - pure UDP pass through, decoding of FEC must happen on following applications
             // TODO: Implement custom protocol in case of pass_through that tells the receiver about the adapter that it was received on
             publish_data(payload_buffer, message_length, false);
+            flush_outputs();
         }
-        if (ieee80211_radiotap_iterator_init(&rti, (struct ieee80211_radiotap_header *) lr_buffer, radiotap_length,
-                                             NULL) != 0) {
+        // layout of the radiotap header is the same for all frames of an adapter. Only parsed once (see db_radiotap.c)
+        const db_radiotap_layout_t *layout = db_radiotap_get_layout(&interface->radiotap_cache, lr_buffer,
+                                                                    radiotap_length);
+        if (layout == NULL) {
             LOG_SYS_STD(LOG_ERR, "DB_VIDEO_GND: Could not init radiotap header\n");
             return;
         }
-        while ((ieee80211_radiotap_iterator_next(&rti)) == 0) {
-            switch (rti.this_arg_index) {
+        for (int i = 0; i < layout->num_fields; i++) {
+            uint8_t *this_arg = lr_buffer + layout->fields[i].offset;
+            switch (layout->fields[i].index) {
                 case IEEE80211_RADIOTAP_RATE:
-                    db_gnd_status->adapter[adapter_no].rate = (*rti.this_arg);
+                    db_gnd_status->adapter[adapter_no].rate = (*this_arg);
                     break;
                 case IEEE80211_RADIOTAP_ANTENNA:
-                    current_antenna_indx = (*rti.this_arg);
+                    current_antenna_indx = (*this_arg);
                     break;
                 case IEEE80211_RADIOTAP_FLAGS:
-                    checksum_correct = (*rti.this_arg & IEEE80211_RADIOTAP_F_BADFCS) == 0;
+                    checksum_correct = (*this_arg & IEEE80211_RADIOTAP_F_BADFCS) == 0;
                     break;
                 case IEEE80211_RADIOTAP_LOCK_QUALITY:
-                    db_gnd_status->adapter[adapter_no].lock_quality = (*rti.this_arg);
+                    db_gnd_status->adapter[adapter_no].lock_quality = (*this_arg);
                 case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
                     if (current_antenna_indx == 0) // first occurrence in header will be general RSSI
-                        db_gnd_status->adapter[adapter_no].current_signal_dbm = (int8_t) (*rti.this_arg);
+                        db_gnd_status->adapter[adapter_no].current_signal_dbm = (int8_t) (*this_arg);
                     if (current_antenna_indx <= MAX_ANTENNA_CNT)
-                        db_gnd_status->adapter[adapter_no].ant_signal_dbm[current_antenna_indx] = (int8_t) (*rti.this_arg);
+                        db_gnd_status->adapter[adapter_no].ant_signal_dbm[current_antenna_indx] = (int8_t) (*this_arg);
                     break;
                 default:
                     break;
@@ -468,20 +681,119 @@ void process_packet(monitor_interface_t *interface, block_buffer_t *block_buffer
         db_gnd_status->adapter[adapter_no].received_packet_cnt++;
 
         db_gnd_status->last_update = time(NULL);
-        process_video_payload(payload_buffer, message_length, checksum_correct, block_buffer_list);
-    } else {
+        process_video_payload(payload_buffer, message_length, checksum_correct, block_buffer_list, rx_time_us);
+    } else if (err != EAGAIN) {
         LOG_SYS_STD(LOG_ERR, "DB_VIDEO_GND: Received an error: %s\n", strerror(err));
     }
 }
 
+/**
+ * Timestamp mode: Receive clock sync responses of the UAV via the status port. All other status messages are ignored.
+ *
+ * @param status_socket Raw socket bound to DB_PORT_STATUS
+ */
+void process_status_packet(int status_socket) {
+    uint8_t payload_buffer[DATA_UNI_LENGTH];
+    uint16_t radiotap_length = 0;
+    uint8_t seq_num = 0;
+    db_rx_timestamp_t rx_timestamp;
+    ssize_t l = db_recv_ts(status_socket, lr_buffer, MAX_DB_DATA_LENGTH, &rx_timestamp);
+    uint64_t t4 = rx_timestamp.rx_time_us;
+    if (l > 0) {
+        uint16_t message_length = get_db_payload(lr_buffer, l, payload_buffer, &seq_num, &radiotap_length);
+        if (db_clock_sync_is_msg(payload_buffer, message_length, DB_CLOCK_SYNC_RESPONSE_ID) &&
+            db_clock_sync_process_response(&clock_sync, (db_clock_sync_msg_t *) payload_buffer, t4) &&
+            clock_sync.sample_cnt == 1) {
+            LOG_SYS_STD(LOG_NOTICE, "DB_VIDEO_GND: Clock synced with UAV (offset %llius, RTT %uus)\n",
+                        (long long) clock_sync.offset_us, clock_sync.rtt_us);
+        }
+    }
+}
+
+/**
+ * Timestamp mode: Send a clock sync request to the UAV via all adapters if one is due
+ */
+void send_clock_sync_request() {
+    if (!db_clock_sync_request_due(&clock_sync, db_clock_us()))
+        return;
+    struct data_uni *raw_buffer = get_hp_raw_buffer(&status_sockets[0], 0);
+    uint16_t length = db_clock_sync_build_request(&clock_sync, raw_buffer->bytes);
+    uint8_t seq_num = update_seq_num(&status_seq_num);
+    for (int i = 0; i < num_interfaces; i++) {
+        db_send_div(&status_sockets[i], raw_buffer->bytes, DB_PORT_STATUS, length, seq_num, 0);
+    }
+}
+
+/**
+ * Timestamp mode: Publish clock sync state and latency percentiles to shared memory
+ */
+void update_latency_status() {
+    db_gnd_status->latency.clock_synced = clock_sync.synced;
+    db_gnd_status->latency.clock_offset_us = clock_sync.offset_us;
+    db_gnd_status->latency.clock_sync_rtt_us = clock_sync.rtt_us;
+    latency_update(&db_gnd_status->latency);
+}
+
+/**
+ * Copy the locally accumulated video statistics to shared memory. port_stats are owned by other modules
+ */
+void publish_gnd_status() {
+    db_shm_publish(&db_gnd_status_shm->header, &db_gnd_status_shm->last_update, &db_gnd_status->last_update,
+                   DB_SHM_RANGE_LENGTH(db_gnd_status_t, last_update, port_stats));
+}
+
+/**
+ * Append one sample to the link history for every history interval that passed. Intervals without any received frame
+ * are recorded as well - those are the dropouts we want to see.
+ *
+ * @param now_us db_clock_us()
+ */
+void sample_link_history(uint64_t now_us) {
+    uint64_t resolution_us = (uint64_t) history_resolution_ms * 1000;
+    if (now_us < next_history_sample_us)
+        return;
+    if (now_us - next_history_sample_us > DB_HISTORY_LENGTH * resolution_us)
+        next_history_sample_us = now_us - (now_us - next_history_sample_us) % resolution_us; // long stall. Resync
+    db_history_sample_t sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.timestamp_us = next_history_sample_us;
+    sample.kbitrate = (uint32_t) ((history_received_bytes * 8) / history_resolution_ms);
+    uint32_t lost = db_gnd_status->lost_packet_cnt - history_prev.lost_packet_cnt;
+    sample.lost_packets = (uint16_t) (lost > UINT16_MAX ? UINT16_MAX : lost);
+    sample.adapter_cnt = (uint8_t) num_interfaces;
+    for (int i = 0; i < num_interfaces; i++) {
+        db_adapter_status *adapter = &db_gnd_status->adapter[i];
+        uint32_t received = adapter->received_packet_cnt - history_prev.adapter[i].received_packet_cnt;
+        uint32_t bad = adapter->wrong_crc_cnt - history_prev.adapter[i].wrong_crc_cnt;
+        sample.adapter[i].good_packets = (uint16_t) (received - bad > UINT16_MAX ? UINT16_MAX : received - bad);
+        sample.adapter[i].bad_packets = (uint16_t) (bad > UINT16_MAX ? UINT16_MAX : bad);
+        sample.adapter[i].rssi_dbm = received > 0 ? adapter->current_signal_dbm : (int8_t) DB_HISTORY_NO_RSSI;
+    }
+    db_history_append(link_history, &sample);
+    history_prev = *db_gnd_status;
+    history_received_bytes = 0;
+    next_history_sample_us += resolution_us;
+    // remaining intervals passed without us getting to sample: nothing was received during those
+    memset(&sample.adapter, 0, sizeof(sample.adapter));
+    for (int i = 0; i < num_interfaces; i++)
+        sample.adapter[i].rssi_dbm = DB_HISTORY_NO_RSSI;
+    sample.kbitrate = 0, sample.lost_packets = 0;
+    while (now_us >= next_history_sample_us) {
+        sample.timestamp_us = next_history_sample_us;
+        db_history_append(link_history, &sample);
+        next_history_sample_us += resolution_us;
+    }
+}
+
 void process_command_line_args(int argc, char *argv[]) {
     num_interfaces = 0, comm_id = DEFAULT_V2_COMMID, pass_through = false, udp_enabled = true, send_to_std_out = true;
     num_data_per_block = 8, num_fec_per_block = 4, pack_size = 1024, dest_port_video = APP_PORT_VIDEO;
     int c;
-    while ((c = getopt(argc, argv, "n:c:r:f:p:d:u:v:i:os")) != -1) {
+    db_rt_parse_profile(NULL, &rt_profile);
+    while ((c = getopt(argc, argv, "n:c:r:f:p:d:u:v:i:m:t:x:eosTP:H:")) != -1) {
         switch (c) {
             case 'n':
-                strncpy(adapters[num_interfaces], optarg, IFNAMSIZ);
+                strncpy(adapters[num_interfaces], optarg, DB_MAX_IFNAME_LENGTH - 1);
                 num_interfaces++;
                 break;
             case 'c':
@@ -513,12 +825,36 @@ void process_command_line_args(int argc, char *argv[]) {
                 fixed_ip = true;
                 strncpy(overwrite_ip, optarg, INET6_ADDRSTRLEN);
                 break;
+            case 'm':
+                multicast_enabled = true;
+                strncpy(multicast_ip, optarg, INET6_ADDRSTRLEN);
+                break;
+            case 't':
+                subscriber_timeout = strtol(optarg, NULL, 10) * 1000;
+                break;
+            case 'e':
+                early_release = true;
+                break;
+            case 'x':
+                h264_filter_mode = (int) strtol(optarg, NULL, 10);
+                break;
             case 'o':
                 output_to_usb_bridge = true;
                 break;
             case 's':
                 send_to_std_out = false;
                 break;
+            case 'T':
+                timestamps_enabled = true;
+                video_header_length = sizeof(video_packet_header_ts_t);
+                break;
+            case 'P':
+                if (db_rt_parse_profile(optarg, &rt_profile) < 0)
+                    abort();
+                break;
+            case 'H':
+                history_resolution_ms = (int) strtol(optarg, NULL, 10);
+                break;
             default:
                 printf("Based of Wifibroadcast by befinitiv, based on packet spammer by Andy Green.  Licensed under GPL2\n"
                        "This tool takes a data stream via the DroneBridge long range video port and outputs it via stdout, "
@@ -532,27 +868,94 @@ void process_command_line_args(int argc, char *argv[]) {
                        "\n\t-f Bytes per packet (default %d. max %d). This is also the FEC "
                        "block size. Needs to match with tx."
                        "\n\t-u <Y|N> to enable or disable UDP forwarding of decoded data"
-                       "\n\t-i UDP DST IP overwrite: Ignore DroneBridge default dst-IP & send data to this IP via UDP"
+                       "\n\t-i UDP DST IP overwrite: Ignore DroneBridge default dst-IP & always send data to this IP via UDP"
+                       "\n\t-m Multicast group (e.g. 239.0.0.1) to which the UDP stream is always sent"
+                       "\n\t-t Seconds after which a client that sent a video destination hint gets removed if it does "
+                       "not repeat the hint (default %i)"
                        "\n\t-v Destination port of video stream when set via UDP"
+                       "\n\t-e Early release: Publish DATA packets as soon as all their predecessors in the block are "
+                       "received. FEC is only used to fill gaps. Lowers latency on good links"
+                       "\n\t-x <0|1|2> H.264 output filter. 1: Only output complete NAL units that do not overlap lost "
+                       "packets. Gaps are signaled to UDP clients by an empty datagram. 2: Additionally hold the output "
+                       "until the next IDR frame after a reference frame was lost. Default 0 (off)"
                        "\n\t-p <Y|N> to enable/disable pass through of encoded FEC packets via UDP to port: %i"
                        "\n\t-o Send to output to unix domain socket at %s so that DroneBridge USBBridge can forward it"
-                       "\n\t-s Disable decoded output to stdout",
-                       1024, MAX_USER_PACKET_LENGTH, APP_PORT_VIDEO_FEC, DB_UNIX_DOMAIN_VIDEO_PATH);
+                       "\n\t-s Disable decoded output to stdout"
+                       "\n\t-T Timestamped video headers. Needs to match with tx. Syncs the clock with the UAV "
+                       "(control module) via the status port and reports per stage latency percentiles to shared memory"
+                       "\n\t-P Real-time profile <option>[=<value>],... with options fifo=<prio>|rr=<prio>, "
+                       "cpu=<n>[+<n>], mlock, prefault=<kB>, busypoll=<us>. e.g. fifo=40,cpu=2,mlock,busypoll=50"
+                       "\n\t-H <ms> Record per adapter RSSI, good/bad frames, lost packets and bitrate with this "
+                       "resolution into the link history ring in shared memory (e.g. 10). Default 0 (off)",
+                       1024, MAX_USER_PACKET_LENGTH, DEFAULT_SUBSCRIBER_TIMEOUT_MS / 1000, APP_PORT_VIDEO_FEC, DB_UNIX_DOMAIN_VIDEO_PATH);
                 abort();
         }
     }
 }
 
+void on_video_packet(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    int i = (int) (intptr_t) handler->arg;
+    process_packet(&interfaces[i], block_buffer_list, i);
+}
+
+void on_status_packet(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    process_status_packet(handler->fd);
+}
+
+/**
+ * Received a video destination hint. Register or refresh the subscriber
+ */
+void on_udp_hint(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t events) {
+    struct sockaddr_in udp_video_hint_src;
+    socklen_t client_address_size = sizeof(udp_video_hint_src);
+    uint8_t udp_buff[UDP_BUFF_SIZE];
+    if (recvfrom(udp_socket, udp_buff, UDP_BUFF_SIZE, 0, (struct sockaddr *) &udp_video_hint_src,
+                 &client_address_size) != -1) {
+        udp_out_hint(&udp_video_hint_src, current_timestamp());
+    } else
+        perror("DB_VIDEO_GND: Error receiving on UDP socket: ");
+}
+
+void on_expiry_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    udp_out_expire(current_timestamp());
+}
+
+void on_status_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    publish_gnd_status();
+}
+
+void on_clock_sync_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    send_clock_sync_request();
+}
+
+void on_latency_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    update_latency_status();
+}
+
+void on_history_timer(db_event_loop_t *loop, db_event_handler_t *handler, uint32_t expirations) {
+    sample_link_history(db_clock_us());
+}
+
+/**
+ * Register a periodic timer with the event loop. Aborts if the loop is out of handlers
+ *
+ * @param callback Called every interval_ms
+ * @param interval_ms Period of the timer
+ */
+void add_periodic_timer(db_event_cb callback, int interval_ms) {
+    db_event_handler_t *timer = db_event_add_timer(&event_loop, callback, NULL);
+    if (timer == NULL || db_event_timer_arm(timer, (uint64_t) interval_ms * 1000, (uint64_t) interval_ms * 1000) < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_VIDEO_GND: Could not add timer to event loop\n");
+        exit(-1);
+    }
+}
+
 // Log to LOG_NOTICE since it is directed to stderr via LOG_SYS_STD.
 // Do not log to stdout! It is for video data only!
 int main(int argc, char *argv[]) {
-    signal(SIGINT, int_handler);
+    const int signals[] = {SIGINT, SIGTERM};
     setpriority(PRIO_PROCESS, 0, -10);
-    monitor_interface_t interfaces[MAX_PENUMBRA_INTERFACES];
     int i;
-    struct sockaddr_in udp_video_hint_src;
-    uint8_t udp_buff[UDP_BUFF_SIZE];
-    block_buffer_t *block_buffer_list;
 
     process_command_line_args(argc, argv);
     if (num_interfaces == 0) {
@@ -566,14 +969,29 @@ int main(int argc, char *argv[]) {
         abort();
     }
 
+    if (num_data_per_block == 0 || num_data_per_block > MAX_DATA_OR_FEC_PACKETS_PER_BLOCK ||
+        num_fec_per_block > MAX_DATA_OR_FEC_PACKETS_PER_BLOCK) {
+        LOG_SYS_STD(LOG_ERR, "DB_VIDEO_GND: Data (-d) and FEC (-r) packets per block must be within 1-%i and 0-%i "
+                             "(you requested %i and %i)\n", MAX_DATA_OR_FEC_PACKETS_PER_BLOCK,
+                    MAX_DATA_OR_FEC_PACKETS_PER_BLOCK, num_data_per_block, num_fec_per_block);
+        abort();
+    }
+
+    if (db_event_loop_init(&event_loop) < 0 || db_event_add_signals(&event_loop, signals, 2, on_signal, NULL) == NULL)
+        exit(-1);
+
     fec_init();
-    init_outputs();
-    if (fixed_ip && udp_enabled) {
-        LOG_SYS_STD(LOG_NOTICE, "DB_VIDEO_GND: Sending to %s\n", overwrite_ip);
-        client_video_addr.sin_addr.s_addr = inet_addr(overwrite_ip);
+    init_data_packet_positions();
+    if (h264_filter_mode && h264_filter_init(&h264_filter, h264_filter_mode == 2, publish_filtered_nal,
+                                             signal_video_gap) != 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_VIDEO_GND: Could not allocate H.264 filter buffer\n");
+        abort();
     }
+    init_outputs();
+    if (udp_enabled && db_event_add_io(&event_loop, udp_socket, EPOLLIN, on_udp_hint, NULL) == NULL)
+        exit(-1);
 
-    db_gnd_status = db_gnd_status_memory_open();
+    db_gnd_status_shm = db_gnd_status_memory_open();
     db_gnd_status->wifi_adapter_cnt = (uint32_t) num_interfaces;
     db_gnd_status->received_packet_cnt = 0;
     db_gnd_status->lost_packet_cnt = 0;
@@ -586,12 +1004,35 @@ int main(int argc, char *argv[]) {
     for (int j = 0; j < num_interfaces; ++j) {
         db_socket_t db_sock = open_db_socket(adapters[j], comm_id, 'm', 11, DB_DIREC_DRONE, DB_PORT_VIDEO,
                                              DB_FRAMETYPE_DATA);
+        if (timestamps_enabled)
+            db_enable_rx_timestamps(&db_sock);
         interfaces[j].selectable_fd = db_sock.db_socket;
-        strcpy(db_gnd_status->adapter[j].name, adapters[j]);
-        LOG_SYS_STD(LOG_NOTICE, "\t%s\n", db_gnd_status->adapter[j].name);
+        interfaces[j].db_sock = db_sock;
+        if (db_event_add_io(&event_loop, db_sock.db_socket, EPOLLIN, on_video_packet, (void *) (intptr_t) j) == NULL)
+            exit(-1);
+        db_rt_socket(&rt_profile, db_sock.db_socket);
+        memset(&interfaces[j].radiotap_cache, 0, sizeof(db_radiotap_cache_t));
+        db_shm_set_adapter_name(db_gnd_status->adapter[j].name, adapters[j]);
+        LOG_SYS_STD(LOG_NOTICE, "\t%s\n", adapters[j]);
         db_gnd_status->adapter[j].received_packet_cnt = 0;
         db_gnd_status->adapter[j].wrong_crc_cnt = 0;
         db_gnd_status->adapter[j].current_signal_dbm = -100;
+        if (timestamps_enabled) {
+            status_sockets[j] = open_db_socket(adapters[j], comm_id, 'm', 11, DB_DIREC_DRONE, DB_PORT_STATUS,
+                                               DB_FRAMETYPE_DATA);
+            db_enable_rx_timestamps(&status_sockets[j]);
+            if (db_event_add_io(&event_loop, status_sockets[j].db_socket, EPOLLIN, on_status_packet, NULL) == NULL)
+                exit(-1);
+        }
+    }
+    db_clock_sync_init(&clock_sync);
+    memset(&db_gnd_status->latency, 0, sizeof(db_video_latency_t));
+    publish_gnd_status();
+    if (history_resolution_ms > 0) {
+        link_history = db_gnd_history_memory_open();
+        link_history->resolution_ms = (uint32_t) history_resolution_ms;
+        history_prev = *db_gnd_status;
+        next_history_sample_us = db_clock_us() + history_resolution_ms * 1000;
     }
     // init UNIX domain master socket to which local clients can connect & get video data in an UDP like fashion
     unix_sock = socket(AF_UNIX, SOCK_DGRAM, 0);
@@ -610,53 +1051,41 @@ int main(int argc, char *argv[]) {
     for (i = 0; i < param_block_buffers; ++i) {
         block_buffer_list[i].block_num = -1;
         block_buffer_list[i].packet_buffer_len = 0;
+        block_buffer_list[i].published_data_cnt = 0;
         block_buffer_list[i].packet_buffer_list = lib_alloc_packet_buffer_list(num_data_per_block + num_fec_per_block,
                                                                                MAX_PACKET_LENGTH);
     }
 
+    db_rt_apply(&rt_profile, "DB_VIDEO_GND");
     LOG_SYS_STD(LOG_NOTICE, "DB_VIDEO_GND: started on %i interfaces\n", num_interfaces);
-    fd_set readset;
-    unsigned int client_address_size = sizeof(udp_video_hint_src);
-    while (keeprunning) {
-        FD_ZERO(&readset);
-
-        int max_sd = udp_socket;
-        FD_SET(udp_socket, &readset);
-        for (i = 0; i < num_interfaces; i++) {
-            FD_SET(interfaces[i].selectable_fd, &readset);
-            if (interfaces[i].selectable_fd > max_sd)
-                max_sd = interfaces[i].selectable_fd;
-        }
-
-        int select_return = select(max_sd + 1, &readset, NULL, NULL, NULL);
-        if (select_return == -1 && errno != EINTR) {
-            perror("DB_VIDEO_GND: select() returned error: ");
-        } else if (select_return > 0) {
-            if (FD_ISSET(udp_socket, &readset)) {
-                // received a video destination hint. Update video destination udp address
-                if (recvfrom(udp_socket, udp_buff, UDP_BUFF_SIZE, 0, (struct sockaddr *) &udp_video_hint_src,
-                             &client_address_size) != -1) {
-                    client_video_addr.sin_addr.s_addr = udp_video_hint_src.sin_addr.s_addr;
-                    char ip_str[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &(client_video_addr.sin_addr), ip_str, INET_ADDRSTRLEN);
-                    LOG_SYS_STD(LOG_NOTICE, "Changed destination IP to %s\n", ip_str);
-                } else
-                    perror("DB_VIDEO_GND: Error receiving on UDP socket: ");
-            }
-            for (i = 0; i < num_interfaces; i++) {
-                if (FD_ISSET(interfaces[i].selectable_fd, &readset)) {
-                    process_packet(&interfaces[i], block_buffer_list, i);
-                }
-            }
-        }
+    add_periodic_timer(on_status_timer, DB_SHM_PUBLISH_INTERVAL_MS);
+    if (udp_enabled)
+        add_periodic_timer(on_expiry_timer, 1000);
+    if (timestamps_enabled) {
+        add_periodic_timer(on_clock_sync_timer, DB_CLOCK_SYNC_FAST_INTERVAL_MS);
+        add_periodic_timer(on_latency_timer, 1000);
     }
-
-    for (int g = 0; i < num_interfaces; ++i) {
-        close(interfaces[g].selectable_fd);
+    if (history_resolution_ms > 0)
+        add_periodic_timer(on_history_timer, history_resolution_ms);
+    db_event_run(&event_loop);
+
+    db_event_report(&event_loop, "DB_VIDEO_GND");
+    db_event_loop_close(&event_loop);
+    for (int g = 0; g < num_interfaces; ++g) {
+        close_db_socket(&interfaces[g].db_sock);
+        if (timestamps_enabled) close_db_socket(&status_sockets[g]);
     }
     unlink(DB_UNIX_DOMAIN_VIDEO_PATH);
     close(unix_sock);
+    if (h264_filter_mode) {
+        LOG_SYS_STD(LOG_NOTICE, "DB_VIDEO_GND: H.264 filter passed %u NAL units, dropped %u damaged, held %u, "
+                                "signaled %u gaps\n", h264_filter.stats.nals_passed, h264_filter.stats.nals_dropped,
+                    h264_filter.stats.nals_held, h264_filter.stats.gaps_signaled);
+        h264_filter_free(&h264_filter);
+    }
     if (udp_enabled) close(udp_socket);
+    if (link_history != NULL) link_history->resolution_ms = 0;
+    db_rt_report("DB_VIDEO_GND");
     LOG_SYS_STD(LOG_NOTICE, "DB_VIDEO_GND: Terminated\n");
     return (0);
 }
@@ -0,0 +1,231 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * UDP output of video_gnd. Keeps a table of subscribers (clients that sent a video destination hint, a fixed IP or a
+ * multicast group) and sends every queued video packet to all of them. Packets are collected per block and sent with
+ * a single sendmmsg() call so that the number of syscalls does not grow with every additional viewer.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "video_udp_out.h"
+#include "../common/db_protocol.h"
+#include "../common/db_common.h"
+
+#define UDP_OUT_MAX_MSGS    (UDP_OUT_MAX_QUEUED * MAX_VIDEO_SUBSCRIBERS)
+
+static int out_sock = -1;
+static in_port_t out_port;
+static long long subscriber_timeout_ms = DEFAULT_SUBSCRIBER_TIMEOUT_MS;
+static video_subscriber_t subscribers[MAX_VIDEO_SUBSCRIBERS];
+static struct sockaddr_in default_dst; // used as long as there is no other subscriber
+
+static struct iovec queued_packets[UDP_OUT_MAX_QUEUED];
+static int num_queued = 0;
+static struct mmsghdr out_msgs[UDP_OUT_MAX_MSGS];
+
+/**
+ * Init the subscriber table. Until the first hint arrives data is sent to the default AP client (DB_AP_CLIENT_IP).
+ *
+ * @param udp_sock Socket used for sending. Must be the socket receiving the hints
+ * @param dst_port Destination port of the video stream on the subscribers side
+ * @param timeout_ms Time after which a subscriber is removed if it did not send a hint
+ */
+void udp_out_init(int udp_sock, int dst_port, long long timeout_ms) {
+    out_sock = udp_sock;
+    out_port = htons((uint16_t) dst_port);
+    subscriber_timeout_ms = timeout_ms;
+    memset(subscribers, 0, sizeof(subscribers));
+    memset(&default_dst, 0, sizeof(default_dst));
+    default_dst.sin_family = AF_INET;
+    default_dst.sin_addr.s_addr = inet_addr(DB_AP_CLIENT_IP);
+    default_dst.sin_port = out_port;
+    num_queued = 0;
+}
+
+static int find_subscriber(in_addr_t ip) {
+    for (int i = 0; i < MAX_VIDEO_SUBSCRIBERS; i++) {
+        if (subscribers[i].in_use && subscribers[i].addr.sin_addr.s_addr == ip)
+            return i;
+    }
+    return -1;
+}
+
+static int find_free_slot() {
+    for (int i = 0; i < MAX_VIDEO_SUBSCRIBERS; i++) {
+        if (!subscribers[i].in_use)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Add a subscriber that never expires. If the IP is a multicast group the multicast TTL of the socket is limited to
+ * the local network.
+ *
+ * @param ip IPv4 address as string. Unicast or multicast
+ * @return Index in subscriber table or -1 on error
+ */
+int udp_out_add_permanent(const char *ip) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, ip, &addr) != 1) {
+        LOG_SYS_STD(LOG_ERR, "DB_VIDEO_GND: Invalid destination IP %s\n", ip);
+        return -1;
+    }
+    int idx = find_subscriber(addr.s_addr);
+    if (idx < 0) idx = find_free_slot();
+    if (idx < 0) {
+        LOG_SYS_STD(LOG_ERR, "DB_VIDEO_GND: Subscriber table full. Can not add %s\n", ip);
+        return -1;
+    }
+    if (IN_MULTICAST(ntohl(addr.s_addr))) {
+        unsigned char ttl = 1;
+        if (setsockopt(out_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)
+            LOG_SYS_STD(LOG_WARNING, "DB_VIDEO_GND: Could not set multicast TTL %s\n", strerror(errno));
+    }
+    subscribers[idx].addr.sin_family = AF_INET;
+    subscribers[idx].addr.sin_addr = addr;
+    subscribers[idx].addr.sin_port = out_port;
+    subscribers[idx].permanent = true;
+    subscribers[idx].in_use = true;
+    LOG_SYS_STD(LOG_NOTICE, "DB_VIDEO_GND: Sending to %s\n", ip);
+    return idx;
+}
+
+/**
+ * Register or refresh a subscriber based on the source address of a received video destination hint packet.
+ * The video is sent to the IP of the hint source and the configured video port.
+ *
+ * @param hint_src Source address of the hint packet
+ * @param now Current timestamp in ms
+ * @return true if a new subscriber was added
+ */
+bool udp_out_hint(struct sockaddr_in *hint_src, long long now) {
+    int idx = find_subscriber(hint_src->sin_addr.s_addr);
+    if (idx >= 0) {
+        subscribers[idx].last_seen = now;
+        return false;
+    }
+    if ((idx = find_free_slot()) < 0) {
+        LOG_SYS_STD(LOG_WARNING, "DB_VIDEO_GND: Subscriber table full. Ignoring video destination hint\n");
+        return false;
+    }
+    subscribers[idx].addr.sin_family = AF_INET;
+    subscribers[idx].addr.sin_addr = hint_src->sin_addr;
+    subscribers[idx].addr.sin_port = out_port;
+    subscribers[idx].last_seen = now;
+    subscribers[idx].permanent = false;
+    subscribers[idx].in_use = true;
+    char ip_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &hint_src->sin_addr, ip_str, INET_ADDRSTRLEN);
+    LOG_SYS_STD(LOG_NOTICE, "DB_VIDEO_GND: Added video subscriber %s (%i total)\n", ip_str, udp_out_subscriber_cnt());
+    return true;
+}
+
+/**
+ * Remove all non-permanent subscribers that did not send a hint within the timeout.
+ *
+ * @param now Current timestamp in ms
+ */
+void udp_out_expire(long long now) {
+    for (int i = 0; i < MAX_VIDEO_SUBSCRIBERS; i++) {
+        if (subscribers[i].in_use && !subscribers[i].permanent &&
+            (now - subscribers[i].last_seen) > subscriber_timeout_ms) {
+            subscribers[i].in_use = false;
+            char ip_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &subscribers[i].addr.sin_addr, ip_str, INET_ADDRSTRLEN);
+            LOG_SYS_STD(LOG_NOTICE, "DB_VIDEO_GND: Video subscriber %s timed out\n", ip_str);
+        }
+    }
+}
+
+int udp_out_subscriber_cnt() {
+    int cnt = 0;
+    for (int i = 0; i < MAX_VIDEO_SUBSCRIBERS; i++) {
+        if (subscribers[i].in_use) cnt++;
+    }
+    return cnt;
+}
+
+/**
+ * Queue a packet for sending. Data is not copied. The buffer must stay valid until udp_out_flush() was called.
+ * The queue is flushed automatically if it is full.
+ *
+ * @param data Pointer to the packet
+ * @param data_length Length of the packet
+ */
+void udp_out_queue(uint8_t *data, uint32_t data_length) {
+    if (num_queued == UDP_OUT_MAX_QUEUED)
+        udp_out_flush();
+    queued_packets[num_queued].iov_base = data;
+    queued_packets[num_queued].iov_len = data_length;
+    num_queued++;
+}
+
+/**
+ * Send all queued packets to all subscribers using as few sendmmsg() calls as possible.
+ * Packets are sent in order to every subscriber.
+ *
+ * @return Number of datagrams sent
+ */
+int udp_out_flush() {
+    if (num_queued == 0) return 0;
+    struct sockaddr_in *dsts[MAX_VIDEO_SUBSCRIBERS];
+    int num_dsts = 0;
+    for (int i = 0; i < MAX_VIDEO_SUBSCRIBERS; i++) {
+        if (subscribers[i].in_use)
+            dsts[num_dsts++] = &subscribers[i].addr;
+    }
+    if (num_dsts == 0)
+        dsts[num_dsts++] = &default_dst;
+
+    int num_msgs = 0;
+    for (int p = 0; p < num_queued; p++) {
+        for (int d = 0; d < num_dsts; d++) {
+            struct msghdr *hdr = &out_msgs[num_msgs].msg_hdr;
+            memset(hdr, 0, sizeof(struct msghdr));
+            hdr->msg_name = dsts[d];
+            hdr->msg_namelen = sizeof(struct sockaddr_in);
+            hdr->msg_iov = &queued_packets[p];
+            hdr->msg_iovlen = 1;
+            num_msgs++;
+        }
+    }
+    num_queued = 0;
+
+    int sent_total = 0;
+    while (sent_total < num_msgs) {
+        int sent = sendmmsg(out_sock, &out_msgs[sent_total], (unsigned int) (num_msgs - sent_total), 0);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            // skip the failing datagram (e.g. unreachable subscriber) and continue with the rest
+            LOG_SYS_STD(LOG_ERR, "DB_VIDEO_GND: Not all data sent via UDP > %s\n", strerror(errno));
+            sent_total++;
+        } else {
+            sent_total += sent;
+        }
+    }
+    return num_msgs;
+}
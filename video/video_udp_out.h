@@ -0,0 +1,46 @@
+/*
+ *   This file is part of DroneBridge: https://github.com/seeul8er/DroneBridge
+ *
+ *   Copyright 2020 Wolfgang Christl
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+#ifndef DRONEBRIDGE_VIDEO_UDP_OUT_H
+#define DRONEBRIDGE_VIDEO_UDP_OUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#define MAX_VIDEO_SUBSCRIBERS           16
+#define DEFAULT_SUBSCRIBER_TIMEOUT_MS   10000   // hinted clients get dropped after this time without a new hint
+#define UDP_OUT_MAX_QUEUED              64      // max packets buffered before the batch gets flushed
+
+typedef struct {
+    struct sockaddr_in addr;
+    long long last_seen;    // ms timestamp of the last received hint
+    bool permanent;         // set via command line (fixed IP or multicast group). Never expires
+    bool in_use;
+} video_subscriber_t;
+
+void udp_out_init(int udp_sock, int dst_port, long long timeout_ms);
+int udp_out_add_permanent(const char *ip);
+bool udp_out_hint(struct sockaddr_in *hint_src, long long now);
+void udp_out_expire(long long now);
+void udp_out_queue(uint8_t *data, uint32_t data_length);
+int udp_out_flush();
+int udp_out_subscriber_cnt();
+
+#endif //DRONEBRIDGE_VIDEO_UDP_OUT_H